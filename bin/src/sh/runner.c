@@ -33,6 +33,7 @@
  */
 
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,6 +51,8 @@ enum runner_state {
     CMD_LAST,
 };
 
+extern char ** environ;
+
 static int fork_count; /*!< number of forks. */
 static char * args[256]; /*!< Args for exec. */
 
@@ -65,6 +68,60 @@ static const struct tish_builtin * get_builtin(char * name)
     return NULL;
 }
 
+/**
+ * Connect stdin and stdout of a forked child to the pipeline.
+ */
+static void redirect(int input_fd, int pipettes[2], enum runner_state state)
+{
+    if (state == CMD_FIRST && input_fd == STDIN_FILENO) {
+        /* First command */
+        dup2(pipettes[WRITE], STDOUT_FILENO);
+    } else if (state == CMD_MIDDLE && input_fd != STDIN_FILENO) {
+        /* Middle command */
+        dup2(input_fd, STDIN_FILENO);
+        dup2(pipettes[WRITE], STDOUT_FILENO);
+    } else {
+        /* Last command */
+        dup2(input_fd, STDIN_FILENO);
+    }
+}
+
+/**
+ * Spawn an external command connected to the pipeline.
+ * The same redirections as in redirect() are done with file actions, and the
+ * pipe descriptors that aren't used by the command are closed.
+ * @return 0 if the command was spawned; Otherwise -1.
+ */
+static int spawn(int input_fd, int pipettes[2], enum runner_state state)
+{
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int err;
+
+    posix_spawn_file_actions_init(&fa);
+    if (state == CMD_FIRST && input_fd == STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&fa, pipettes[WRITE], STDOUT_FILENO);
+    } else if (state == CMD_MIDDLE && input_fd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&fa, input_fd, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&fa, pipettes[WRITE], STDOUT_FILENO);
+    } else {
+        posix_spawn_file_actions_adddup2(&fa, input_fd, STDIN_FILENO);
+    }
+    if (input_fd != STDIN_FILENO)
+        posix_spawn_file_actions_addclose(&fa, input_fd);
+    posix_spawn_file_actions_addclose(&fa, pipettes[READ]);
+    posix_spawn_file_actions_addclose(&fa, pipettes[WRITE]);
+
+    err = posix_spawnp(&pid, args[0], &fa, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Handle commands separately.
  * @param input_fd is the return value from the previous call.
@@ -84,33 +141,19 @@ static int command(int input_fd, enum runner_state state)
      *  STDIN --> O --> O --> O --> STDOUT
      */
 
-    fork_count++;
     pipe(pipettes);
-    pid = fork();
-    if (pid == -1) {
-        perror("Fork failed");
-    } else if (pid == 0) {
-        if (state == CMD_FIRST && input_fd == STDIN_FILENO) {
-            /* First command */
-            dup2(pipettes[WRITE], STDOUT_FILENO);
-        } else if (state == CMD_MIDDLE && input_fd != STDIN_FILENO) {
-            /* Middle command */
-            dup2(input_fd, STDIN_FILENO);
-            dup2(pipettes[WRITE], STDOUT_FILENO);
-        } else {
-            /* Last command */
-            dup2(input_fd, STDIN_FILENO);
-        }
 
-        /* Run builtin command */
-        if (builtin) {
+    if (builtin) {
+        fork_count++;
+        pid = fork();
+        if (pid == -1) {
+            perror("Fork failed");
+        } else if (pid == 0) {
+            redirect(input_fd, pipettes, state);
             _exit(builtin->fn(args));
         }
-
-        /* Try exec */
-        if (execvp(args[0], args)) {
-            _exit(EXIT_FAILURE);
-        }
+    } else if (spawn(input_fd, pipettes, state) == 0) {
+        fork_count++;
     }
 
     if (input_fd != STDIN_FILENO)
@@ -43,6 +43,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types/_ssize_t.h>
 
 #ifndef _MODE_T_DECLARED
 typedef int mode_t; /*!< Used for some file attributes. */
@@ -82,6 +83,8 @@ typedef int pid_t; /*!< Process ID. */
                               SIGURG signals. */
 #define F_SETOWN        11  /*!< Set process or process group ID to receive
                              *   SIGURG signals. */
+#define F_GETPIPE_SZ    12  /*!< Get the capacity of a pipe. */
+#define F_SETPIPE_SZ    13  /*!< Set the capacity of a pipe. */
 
 /* fcntl() fdflags */
 #define FD_CLOEXEC      0x1 /*!< Close the file descriptor upon execution of
@@ -92,6 +95,11 @@ typedef int pid_t; /*!< Process ID. */
 #define F_UNLCK         1   /*!< Unlock. */
 #define F_WRLCK         2   /*!< Exclusive or write lock. */
 
+/* splice() and tee() flags */
+#define SPLICE_F_MOVE       0x1 /*!< Move instead of copying; a hint. */
+#define SPLICE_F_NONBLOCK   0x2 /*!< Don't block on the pipe. */
+#define SPLICE_F_MORE       0x4 /*!< More data will follow; a hint. */
+
 /**
  * @}
  */
@@ -188,6 +196,28 @@ struct _fs_open_args {
     mode_t mode;
 };
 
+/**
+ * Arguments struct for SYSCALL_FS_SPLICE
+ */
+struct _fs_splice_args {
+    int fd_in;
+    off_t off_in;       /*!< Offset in fd_in or -1 to use the file offset. */
+    int fd_out;
+    off_t off_out;      /*!< Offset in fd_out or -1 to use the file offset. */
+    size_t len;
+    unsigned flags;
+};
+
+/**
+ * Arguments struct for SYSCALL_FS_TEE
+ */
+struct _fs_tee_args {
+    int fd_in;
+    int fd_out;
+    size_t len;
+    unsigned flags;
+};
+
 #endif
 
 #ifndef KERNEL_INTERNAL
@@ -213,6 +243,34 @@ int fcntl(int fd, int cmd, ... /* arg */);
  * @}
  */
 
+/**
+ * Move data between a pipe and another file descriptor.
+ * One of the file descriptors must refer to a pipe.
+ * @param fd_in is the file descriptor to read from.
+ * @param off_in is a pointer to the offset in fd_in or NULL to use and
+ *               update the file offset. Must be NULL for a pipe.
+ * @param fd_out is the file descriptor to write to.
+ * @param off_out is a pointer to the offset in fd_out or NULL to use and
+ *                update the file offset. Must be NULL for a pipe.
+ * @param len is the maximum number of bytes to move.
+ * @param flags is a bitwise or of SPLICE_F flags.
+ * @return Returns the number of bytes moved; 0 on EOF;
+ *         Otherwise -1 and errno is set.
+ */
+ssize_t splice(int fd_in, off_t * off_in, int fd_out, off_t * off_out,
+               size_t len, unsigned int flags);
+
+/**
+ * Duplicate data from a pipe to another pipe without consuming it.
+ * @param fd_in is the read end of the source pipe.
+ * @param fd_out is the write end of the destination pipe.
+ * @param len is the maximum number of bytes to copy.
+ * @param flags is a bitwise or of SPLICE_F flags.
+ * @return Returns the number of bytes copied; 0 on EOF;
+ *         Otherwise -1 and errno is set.
+ */
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags);
+
 __END_DECLS
 #endif /* !KERNEL_INTERNAL */
 
@@ -47,6 +47,7 @@
 
 /* Runtime Invariant Values */
 #define HOST_NAME_MAX   255
+#define IOV_MAX         64          /*!< Max number of iovec structures. */
 
 /* Pathname Variable Values */
 #define FILESIZEBITS    32
@@ -57,7 +58,7 @@
 #define PATH_MAX        4096        /*!< Maximum path length. */
 #define NGROUPS_MAX     16
 
-/* TODO PIPE_BUF */
+#define PIPE_BUF        512         /*!< Max size of an atomic pipe write. */
 
 
 /* Runtime Increasable Values */
@@ -66,6 +67,7 @@
 #define _POSIX2_LINE_MAX    LINE_MAX
 #define _POSIX_ARG_MAX      ARG_MAX
 #define _POSIX_LINK_MAX     LINK_MAX
+#define _POSIX_PIPE_BUF     512
 #define _XOPEN_PATH_MAX     PATH_MAX
 
 /* Other Invariant Values */
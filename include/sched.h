@@ -77,6 +77,7 @@ struct sched_param {
 struct _setpolicy_args {
     id_t id;
     int policy;
+    unsigned cpu_affinity; /*!< Mask of allowed CPUs, 0 = don't change. */
 };
 #endif
 
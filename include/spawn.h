@@ -0,0 +1,184 @@
+/**
+ *******************************************************************************
+ * @file    spawn.h
+ * @author  Olli Vanhoja
+ * @brief   Process spawning.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+/**
+ * @addtogroup LIBC
+ * @{
+ */
+
+/**
+ * @addtogroup spawn
+ * @{
+ */
+
+#ifndef _SPAWN_H
+#define _SPAWN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/_sigset.h>
+#include <sys/types/_mode_t.h>
+#include <sys/types/_pid_t.h>
+
+#ifndef _SIGSET_T_DECLARED
+#define _SIGSET_T_DECLARED
+typedef __sigset_t sigset_t;
+#endif
+
+/*
+ * posix_spawnattr_t flags.
+ */
+#define POSIX_SPAWN_RESETIDS        0x01 /*!< Reset the effective ids. */
+#define POSIX_SPAWN_SETPGROUP       0x02 /*!< Set the process group. */
+#define POSIX_SPAWN_SETSIGDEF       0x04 /*!< Reset signal actions. */
+#define POSIX_SPAWN_SETSIGMASK      0x08 /*!< Set the signal mask. */
+#define POSIX_SPAWN_SETSCHEDPARAM   0x10 /*!< Not supported. */
+#define POSIX_SPAWN_SETSCHEDULER    0x20 /*!< Not supported. */
+
+/**
+ * Spawn attributes.
+ */
+typedef struct {
+    short sa_flags;             /*!< POSIX_SPAWN flags. */
+    pid_t sa_pgroup;            /*!< Process group of the new process. */
+    sigset_t sa_sigmask;        /*!< Signal mask of the new process. */
+    sigset_t sa_sigdefault;     /*!< Signals reset to the default action. */
+} posix_spawnattr_t;
+
+/**
+ * A spawn file action.
+ */
+struct _spawn_file_action {
+    int fa_type;                /*!< Type of the action. */
+    int fa_fd;                  /*!< Target file descriptor. */
+    int fa_newfd;               /*!< New file descriptor for dup2. */
+    int fa_oflag;               /*!< open() flags. */
+    mode_t fa_mode;             /*!< open() mode. */
+    char * fa_path;             /*!< open() path. */
+};
+
+#define _SPAWN_FA_CLOSE     1 /*!< close(fa_fd) */
+#define _SPAWN_FA_DUP2      2 /*!< dup2(fa_fd, fa_newfd) */
+#define _SPAWN_FA_OPEN      3 /*!< open(fa_path, fa_oflag, fa_mode) */
+
+/**
+ * Max number of file actions accepted by SYSCALL_EXEC_SPAWN.
+ */
+#define _SPAWN_FA_MAX       32
+
+/**
+ * Spawn file actions.
+ */
+typedef struct {
+    size_t fa_count;
+    size_t fa_size;
+    struct _spawn_file_action * fa_actions;
+} posix_spawn_file_actions_t;
+
+#if defined(__SYSCALL_DEFS__) || defined(KERNEL_INTERNAL)
+/** Arguments for SYSCALL_EXEC_SPAWN */
+struct _exec_spawn_args {
+    int fd;                     /*!< Executable opened with O_EXEC. */
+    char * const * argv;
+    size_t nargv;
+    char * const * env;
+    size_t nenv;
+    const struct _spawn_file_action * fa; /*!< File actions. */
+    size_t nfa;
+    posix_spawnattr_t attr;
+};
+#endif
+
+#ifndef KERNEL_INTERNAL
+__BEGIN_DECLS
+/**
+ * Create a new process executing the file pointed by path.
+ * @param pid[out]      is set to the PID of the new process; Can be NULL.
+ * @param path          is the path to the executable.
+ * @param file_actions  is a list of file actions performed in the new
+ *                      process; Can be NULL.
+ * @param attrp         are the attributes of the new process; Can be NULL.
+ * @return  Returns 0 if succeed; Otherwise an error number is returned.
+ */
+int posix_spawn(pid_t * restrict pid, const char * restrict path,
+                const posix_spawn_file_actions_t * file_actions,
+                const posix_spawnattr_t * restrict attrp,
+                char * const argv[restrict], char * const envp[restrict]);
+
+/**
+ * Same as posix_spawn() but the file is searched from PATH.
+ */
+int posix_spawnp(pid_t * restrict pid, const char * restrict file,
+                 const posix_spawn_file_actions_t * file_actions,
+                 const posix_spawnattr_t * restrict attrp,
+                 char * const argv[restrict], char * const envp[restrict]);
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t * file_actions);
+int posix_spawn_file_actions_destroy(
+        posix_spawn_file_actions_t * file_actions);
+int posix_spawn_file_actions_addclose(
+        posix_spawn_file_actions_t * file_actions, int fildes);
+int posix_spawn_file_actions_adddup2(
+        posix_spawn_file_actions_t * file_actions, int fildes, int newfildes);
+int posix_spawn_file_actions_addopen(
+        posix_spawn_file_actions_t * restrict file_actions, int fildes,
+        const char * restrict path, int oflag, mode_t mode);
+
+int posix_spawnattr_init(posix_spawnattr_t * attr);
+int posix_spawnattr_destroy(posix_spawnattr_t * attr);
+int posix_spawnattr_getflags(const posix_spawnattr_t * restrict attr,
+                             short * restrict flags);
+int posix_spawnattr_setflags(posix_spawnattr_t * attr, short flags);
+int posix_spawnattr_getpgroup(const posix_spawnattr_t * restrict attr,
+                              pid_t * restrict pgroup);
+int posix_spawnattr_setpgroup(posix_spawnattr_t * attr, pid_t pgroup);
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t * restrict attr,
+                                  sigset_t * restrict sigdefault);
+int posix_spawnattr_setsigdefault(posix_spawnattr_t * restrict attr,
+                                  const sigset_t * restrict sigdefault);
+int posix_spawnattr_getsigmask(const posix_spawnattr_t * restrict attr,
+                               sigset_t * restrict sigmask);
+int posix_spawnattr_setsigmask(posix_spawnattr_t * restrict attr,
+                               const sigset_t * restrict sigmask);
+__END_DECLS
+#endif /* !KERNEL_INTERNAL */
+
+#endif /* _SPAWN_H */
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
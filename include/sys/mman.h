@@ -85,6 +85,7 @@
 #define MAP_EXCL    0x00004000 /* for MAP_FIXED, fail if address is used */
 #define MAP_NOCORE  0x00020000 /* dont include these pages in a coredump */
 #define MAP_PREFAULT_READ 0x00040000 /* prefault mapping for reading */
+#define MAP_HUGE    0x00100000 /* prefer large pages for the mapping */
 #ifdef __LP64__
 #define MAP_32BIT   0x00080000 /* map in the low 2GB of address space */
 #endif
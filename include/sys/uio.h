@@ -0,0 +1,99 @@
+/**
+ *******************************************************************************
+ * @file    sys/uio.h
+ * @author  Olli Vanhoja
+ * @brief   Vectored IO.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup LIBC
+ * @{
+ */
+
+#ifndef SYS_UIO_H
+#define SYS_UIO_H
+
+#include <stddef.h>
+#include <sys/types/_ssize_t.h>
+
+/**
+ * IO vector element.
+ */
+struct iovec {
+    void * iov_base;    /*!< Base address of a memory region for IO. */
+    size_t iov_len;     /*!< Size of the memory region. */
+};
+
+#if defined(__SYSCALL_DEFS__) || defined(KERNEL_INTERNAL)
+
+/**
+ * Arguments struct for SYSCALL_FS_READV and SYSCALL_FS_WRITEV
+ */
+struct _fs_readwritev_args {
+    int fildes;
+    const struct iovec * iov;
+    int iovcnt;
+};
+
+#endif
+
+#ifndef KERNEL_INTERNAL
+__BEGIN_DECLS
+
+/**
+ * Read from a file descriptor into multiple buffers.
+ * The buffers are filled in order and the function returns after a short
+ * read.
+ * @param fildes is the file descriptor.
+ * @param iov is an array of buffers.
+ * @param iovcnt is the number of buffers in iov; At most IOV_MAX.
+ * @return Returns the number of bytes read;
+ *         Otherwise -1 and errno is set.
+ */
+ssize_t readv(int fildes, const struct iovec * iov, int iovcnt);
+
+/**
+ * Write to a file descriptor from multiple buffers.
+ * If the total size is at most PIPE_BUF bytes the data is written with a
+ * single write, so it's not interleaved with other writes to a pipe.
+ * @param fildes is the file descriptor.
+ * @param iov is an array of buffers.
+ * @param iovcnt is the number of buffers in iov; At most IOV_MAX.
+ * @return Returns the number of bytes written;
+ *         Otherwise -1 and errno is set.
+ */
+ssize_t writev(int fildes, const struct iovec * iov, int iovcnt);
+
+__END_DECLS
+#endif /* !KERNEL_INTERNAL */
+
+#endif /* SYS_UIO_H */
+
+/**
+ * @}
+ */
@@ -110,6 +110,7 @@
 #define SYSCALL_SIGNAL_SETRETURN    SYSCALL_MMTOTYPE(SYSCALL_GROUP_SIGNAL, 0x09)
 #define SYSCALL_SIGNAL_RETURN       SYSCALL_MMTOTYPE(SYSCALL_GROUP_SIGNAL, 0x0A)
 #define SYSCALL_EXEC_EXEC           SYSCALL_MMTOTYPE(SYSCALL_GROUP_EXEC, 0x00)
+#define SYSCALL_EXEC_SPAWN          SYSCALL_MMTOTYPE(SYSCALL_GROUP_EXEC, 0x01)
 #define SYSCALL_PROC_FORK           SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x00)
 #define SYSCALL_PROC_WAIT           SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x01)
 #define SYSCALL_PROC_EXIT           SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x02)
@@ -134,6 +135,7 @@
 #define SYSCALL_PROC_SETRLIM        SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x15)
 #define SYSCALL_PROC_TIMES          SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x16)
 #define SYSCALL_PROC_GETBREAK       SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x17)
+#define SYSCALL_PROC_VFORK          SYSCALL_MMTOTYPE(SYSCALL_GROUP_PROC, 0x18)
 #define SYSCALL_IPC_PIPE            SYSCALL_MMTOTYPE(SYSCALL_GROUP_IPC, 0x00)
 #define SYSCALL_FS_OPEN             SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x00)
 #define SYSCALL_FS_CLOSE            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x01)
@@ -158,11 +160,18 @@
 #define SYSCALL_FS_UMASK            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x14)
 #define SYSCALL_FS_MOUNT            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x15)
 #define SYSCALL_FS_UMOUNT           SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x16)
+#define SYSCALL_FS_SPLICE           SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x17)
+#define SYSCALL_FS_TEE              SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x18)
+#define SYSCALL_FS_PREAD            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x19)
+#define SYSCALL_FS_PWRITE           SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x1A)
+#define SYSCALL_FS_READV            SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x1B)
+#define SYSCALL_FS_WRITEV           SYSCALL_MMTOTYPE(SYSCALL_GROUP_FS, 0x1C)
 #define SYSCALL_IOCTL_GETSET        SYSCALL_MMTOTYPE(SYSCALL_GROUP_IOCTL, 0x00)
 #define SYSCALL_SHMEM_MMAP          SYSCALL_MMTOTYPE(SYSCALL_GROUP_SHMEM, 0x00)
 #define SYSCALL_SHMEM_MUNMAP        SYSCALL_MMTOTYPE(SYSCALL_GROUP_SHMEM, 0x01)
 #define SYSCALL_TIME_GETTIME        SYSCALL_MMTOTYPE(SYSCALL_GROUP_TIME, 0x00)
 #define SYSCALL_TIME_SETTIME        SYSCALL_MMTOTYPE(SYSCALL_GROUP_TIME, 0x01)
+#define SYSCALL_TIME_NANOSLEEP      SYSCALL_MMTOTYPE(SYSCALL_GROUP_TIME, 0x02)
 #define SYSCALL_PRIV_PCAP           SYSCALL_MMTOTYPE(SYSCALL_GROUP_PRIV, 0x00)
 #define SYSCALL_PRIV_PCAP_GETALL    SYSCALL_MMTOTYPE(SYSCALL_GROUP_PRIV, 0x01)
 
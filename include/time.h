@@ -72,6 +72,11 @@ struct itimerspec {
 
 #define CLOCKS_PER_SEC              1000000
 
+/**
+ * The time given to clock_nanosleep() is an absolute time.
+ */
+#define TIMER_ABSTIME               0x1
+
 #if defined(__SYSCALL_DEFS__) || defined(KERNEL_INTERNAL)
 
 /**
@@ -90,12 +95,45 @@ struct _time_settime_args {
     struct timespec ts;
 };
 
+/**
+ * Argument struct for SYSCALL_TIME_NANOSLEEP
+ */
+struct _time_nanosleep_args {
+    clockid_t clk_id;
+    int flags;
+    struct timespec rqtp;
+    struct timespec * rmtp;
+};
+
 #endif
 
 #ifndef KERNEL_INTERNAL
 __BEGIN_DECLS
 
 int clock_gettime(clockid_t clk_id, struct timespec * tp);
+
+/**
+ * High resolution sleep with a specifiable clock.
+ * Sleeps until the time specified by rqtp has elapsed or, if TIMER_ABSTIME
+ * is set in flags, until the clock reaches the time specified by rqtp.
+ * @param clk_id is the clock.
+ * @param flags is 0 or TIMER_ABSTIME.
+ * @param rqtp is the sleep time.
+ * @param[out] rmtp is set to the remaining time if interrupted by a signal;
+ *                  Not used for an absolute time. Can be NULL.
+ * @return  Returns 0 if the requested time has elapsed;
+ *          Otherwise an error number is returned.
+ */
+int clock_nanosleep(clockid_t clk_id, int flags, const struct timespec * rqtp,
+                    struct timespec * rmtp);
+
+/**
+ * High resolution sleep.
+ * @return  Returns 0 if the requested time has elapsed;
+ *          Otherwise -1 is returned and errno is set.
+ */
+int nanosleep(const struct timespec * rqtp, struct timespec * rmtp);
+
 time_t time(time_t * t);
 
 /**
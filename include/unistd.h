@@ -57,6 +57,7 @@
 #define _POSIX_MAPPED_FILES             200809L
 #define _POSIX_PRIORITY_SCHEDULING      200809L
 #define _POSIX_SHELL                    1
+#define _POSIX_SPAWN                    200809L
 #define _POSIX_THREAD_SAFE_FUNCTIONS    200809L
 #define _POSIX_SPORADIC_SERVER          -1
 #define _POSIX_THREAD_ATTR_STACKADDR    200809L
@@ -182,6 +183,16 @@ struct _fs_readwrite_args {
     size_t nbytes;
 };
 
+/**
+ * Arguments struct for SYSCALL_FS_PREAD and SYSCALL_FS_PWRITE
+ */
+struct _fs_preadwrite_args {
+    int fildes;
+    void * buf;
+    size_t nbytes;
+    off_t offset;
+};
+
 /** Arguments struct for SYSCALL_FS_LSEEK */
 struct _fs_lseek_args {
     int fd;
@@ -327,6 +338,15 @@ int chdir(const char * path);
 
 pid_t fork(void);
 
+/**
+ * Create a new process sharing the memory of the calling process.
+ * The calling thread is suspended until the child calls one of the exec
+ * functions or _exit(). The child shall not modify any data other than
+ * the variable storing the return value, nor return from the function that
+ * called vfork().
+ */
+pid_t vfork(void);
+
 /*
  * Note only exevp() and axeclp() can properly handle scripts with and without
  * shebang. This is also a requirement set by POSIX.
@@ -450,6 +470,10 @@ int fchown(int fildes, uid_t owner, gid_t group);
 
 int lchown(const char *path, uid_t owner, gid_t group);
 
+/**
+ * Read from a file descriptor at a given offset.
+ * The file offset is neither used nor changed.
+ */
 ssize_t pread(int fildes, void * buf, size_t nbytes, off_t offset);
 
 /**
@@ -457,7 +481,11 @@ ssize_t pread(int fildes, void * buf, size_t nbytes, off_t offset);
  */
 ssize_t read(int fildes, void * buf, size_t nbytes);
 
-ssize_t pwrite(int fildes, const void *buf, size_t nbytes, off_t offset);
+/**
+ * Write to a file descriptor at a given offset.
+ * The file offset is neither used nor changed.
+ */
+ssize_t pwrite(int fildes, const void * buf, size_t nbytes, off_t offset);
 
 /**
  * Write to a file descriptor.
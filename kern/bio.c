@@ -35,73 +35,462 @@
 #include <idle.h>
 #include <kstring.h>
 #include <sys/linker_set.h>
-#include <sys/tree.h>
+#include <sys/sysctl.h>
 #include <sys/types.h>
 #include <buf.h>
 #include <fs/devfs.h>
 #include <kerror.h>
+#include <kinit.h>
 #include <kmalloc.h>
+#include <libkern.h>
+#include <thread.h>
+#include <waitq.h>
 
 /*
- * Used to protect access caching data structures and synchronizing access
- * to some functions.
+ * The buffer cache is a global hash table of buffers keyed by (vnode, blkno).
+ * Each hash bucket has its own lock, so lookups of different blocks don't
+ * contend with each other.
  *
- * TODO We'd like to use MTX_TYPE_TICKET here but bio_clean() makes it
- * impossible right now.
+ * Buffers that are not busy are kept in 2Q queues. A buffer that was found
+ * from the cache only once is kept in the A1 FIFO and a buffer that has been
+ * reused is kept in the Am LRU queue. Released buffers with a delayed write
+ * pending are kept in a separate dirty queue until bio_clean() has written
+ * them out. Buffers are evicted from the head of A1 while it holds more than
+ * a quarter of the cache, otherwise from the head of Am, whenever the cache
+ * grows over bio_max_size.
+ *
+ * Read-ahead buffers are kept busy in the read queue until the bio thread
+ * reads them in and releases them to A1. If a reader gets to a queued
+ * read-ahead buffer first it takes the buffer over and reads it in itself.
+ *
+ * Lock order: bucket lock -> buffer lock -> bio_qlock. Eviction starts from
+ * the queue side and thus only uses trylock on the other locks.
+ */
+
+#define BIO_HASH_SHIFT  8
+#define BIO_HASH_SIZE   (1 << BIO_HASH_SHIFT)
+
+/**
+ * Max number of delayed writes done by a single bio_clean() call.
+ */
+#define BIO_CLEAN_BATCH 8
+
+/**
+ * Max number of buffers tried when looking for an eviction victim.
+ */
+#define BIO_EVICT_TRIES 8
+
+/**
+ * Number of wait queues for threads waiting on buffers.
+ */
+#define BIO_WAITQ_SIZE  16
+
+/**
+ * Upper limit for the read-ahead window in blocks.
+ */
+#define BIO_RA_LIMIT    32
+
+enum bio_qindex {
+    BIO_Q_NONE = 0, /*!< Not in any queue, i.e. busy or not cached. */
+    BIO_Q_A1,       /*!< Buffers referenced once. */
+    BIO_Q_AM,       /*!< Buffers referenced multiple times. */
+    BIO_Q_DIRTY,    /*!< Buffers waiting for a delayed write. */
+    BIO_Q_READ,     /*!< Busy buffers waiting for a read-ahead. */
+    BIO_Q_COUNT
+};
+
+struct bio_bucket {
+    mtx_t lock;
+    LIST_HEAD(bio_hash_head, buf) head;
+};
+
+static struct bio_bucket bio_hash[BIO_HASH_SIZE];
+
+/*
+ * Threads waiting for a buffer to become unbusy or its I/O to complete
+ * sleep in one of these wait queues, selected by the buffer address. The
+ * condition is protected by the buffer lock.
+ */
+static struct waitq bio_waitqs[BIO_WAITQ_SIZE];
+
+/*
+ * Protects the queues and the size counters.
+ */
+MTX_LOCK_CLASS(bio_qlock, "IO buffer cache queue lock");
+static mtx_t bio_qlock = MTX_INITIALIZER_CLASS(MTX_TYPE_SPIN, MTX_OPT_DEFAULT,
+                                               bio_qlock);
+static TAILQ_HEAD(bio_queue, buf) bio_queues[BIO_Q_COUNT];
+static size_t bio_qsize[BIO_Q_COUNT];
+
+SYSCTL_DECL(_vm_bio);
+SYSCTL_NODE(_vm, OID_AUTO, bio, CTLFLAG_RW, 0,
+            "IO buffer cache");
+
+static size_t bio_max_size = configBIO_MAX_SIZE;
+SYSCTL_UINT(_vm_bio, OID_AUTO, max_size, CTLFLAG_RW, &bio_max_size, 0,
+            "Max size of the buffer cache in bytes");
+
+static size_t bio_size;
+SYSCTL_UINT(_vm_bio, OID_AUTO, size, CTLFLAG_RD, &bio_size, 0,
+            "Current size of the buffer cache in bytes");
+
+static atomic_t bio_hits = ATOMIC_INIT(0);
+SYSCTL_INT(_vm_bio, OID_AUTO, hits, CTLFLAG_RD, &bio_hits, 0,
+           "Number of getblk() calls that found the block in the cache");
+
+static atomic_t bio_misses = ATOMIC_INIT(0);
+SYSCTL_INT(_vm_bio, OID_AUTO, misses, CTLFLAG_RD, &bio_misses, 0,
+           "Number of getblk() calls that created a new buffer");
+
+static atomic_t bio_evictions = ATOMIC_INIT(0);
+SYSCTL_INT(_vm_bio, OID_AUTO, evictions, CTLFLAG_RD, &bio_evictions, 0,
+           "Number of buffers evicted from the cache");
+
+static atomic_t bio_ra_issued = ATOMIC_INIT(0);
+SYSCTL_INT(_vm_bio, OID_AUTO, ra_issued, CTLFLAG_RD, &bio_ra_issued, 0,
+           "Number of blocks queued for read-ahead");
+
+static atomic_t bio_ra_hits = ATOMIC_INIT(0);
+SYSCTL_INT(_vm_bio, OID_AUTO, ra_hits, CTLFLAG_RD, &bio_ra_hits, 0,
+           "Number of read-ahead blocks that were used");
+
+static atomic_t bio_ra_wasted = ATOMIC_INIT(0);
+SYSCTL_INT(_vm_bio, OID_AUTO, ra_wasted, CTLFLAG_RD, &bio_ra_wasted, 0,
+           "Number of read-ahead blocks evicted before they were used");
+
+static int bio_ra_max = 8;
+SYSCTL_INT(_vm_bio, OID_AUTO, ra_max, CTLFLAG_RW, &bio_ra_max, 0,
+           "Max read-ahead window in blocks, 0 disables read-ahead");
+
+static pthread_t bio_ra_tid;
+
+/*
+ * Protects the read-ahead state of open files, struct file_ra. The same
+ * open file can be read by several threads at once, e.g. the device file
+ * of a mounted file system.
  */
-static mtx_t cache_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_SLEEP |
-                                                         MTX_OPT_PRICEIL);
-static TAILQ_HEAD(bio_relse_list_head, buf) relse_list =
-     TAILQ_HEAD_INITIALIZER(relse_list);
+MTX_LOCK_CLASS(bio_ra_lock, "IO buffer cache read-ahead lock");
+static mtx_t bio_ra_lock = MTX_INITIALIZER_CLASS(MTX_TYPE_SPIN, MTX_OPT_DEFAULT,
+                                                 bio_ra_lock);
 
 static void _bio_readin(struct buf * bp);
 static void _bio_writeout(struct buf * bp);
 static void bl_brelse(struct buf * bp);
 static int biowait_timo(struct buf * bp, long timeout);
-static void bio_clean(uintptr_t freebufs);
-
-SPLAY_GENERATE(bufhd_splay, buf, sentry_, biobuf_compar);
+static void bio_clean(uintptr_t arg);
 
 /* Init bio, called by vralloc_init() */
 void _bio_init(void)
 {
-    cache_lock.pri.p_lock = NICE_MIN;
+    for (size_t i = 0; i < BIO_HASH_SIZE; i++) {
+        mtx_init(&bio_hash[i].lock, MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+        LIST_INIT(&bio_hash[i].head);
+    }
+
+    for (size_t i = 0; i < BIO_Q_COUNT; i++) {
+        TAILQ_INIT(&bio_queues[i]);
+    }
+
+    for (size_t i = 0; i < BIO_WAITQ_SIZE; i++) {
+        waitq_init(&bio_waitqs[i]);
+    }
 }
 
-/*
- * Comparator for buffer splay trees.
+static struct waitq * bio_waitq(struct buf * bp)
+{
+    return &bio_waitqs[((uintptr_t)bp / sizeof(struct buf)) %
+                       BIO_WAITQ_SIZE];
+}
+
+static struct bio_bucket * bio_bucket(vnode_t * vnode, size_t blkno)
+{
+    const uint32_t h = ((uint32_t)(uintptr_t)vnode >> 4) ^ (uint32_t)blkno;
+
+    return &bio_hash[(h * 0x9E3779B1u) >> (32 - BIO_HASH_SHIFT)];
+}
+
+static struct buf * bucket_find(struct bio_bucket * bucket, vnode_t * vnode,
+                                size_t blkno)
+{
+    struct buf * bp;
+
+    KASSERT(mtx_test(&bucket->lock), "bucket should be locked");
+
+    LIST_FOREACH(bp, &bucket->head, b_hashentry_) {
+        if (bp->b_file.vnode == vnode && bp->b_blkno == blkno)
+            return bp;
+    }
+
+    return NULL;
+}
+
+/**
+ * Insert a released buffer to the queue it belongs to.
+ * bio_qlock must be held.
+ */
+static void bioq_insert(struct buf * bp)
+{
+    enum bio_qindex qi;
+
+    if (bp->b_flags & B_DELWRI)
+        qi = BIO_Q_DIRTY;
+    else if (bp->b_flags & B_REUSED)
+        qi = BIO_Q_AM;
+    else
+        qi = BIO_Q_A1;
+
+    TAILQ_INSERT_TAIL(&bio_queues[qi], bp, b_qentry_);
+    bp->b_qindex = qi;
+    bio_qsize[qi] += bp->b_bufsize;
+}
+
+/**
+ * Remove a buffer from its queue if it's in one.
+ * bio_qlock must be held.
+ */
+static void bioq_remove(struct buf * bp)
+{
+    const enum bio_qindex qi = bp->b_qindex;
+
+    if (qi == BIO_Q_NONE)
+        return;
+
+    TAILQ_REMOVE(&bio_queues[qi], bp, b_qentry_);
+    bp->b_qindex = BIO_Q_NONE;
+    bio_qsize[qi] -= bp->b_bufsize;
+}
+
+/**
+ * Select the queue to evict from.
+ * bio_qlock must be held.
+ */
+static struct bio_queue * bioq_victim_queue(void)
+{
+    struct bio_queue * a1 = &bio_queues[BIO_Q_A1];
+    struct bio_queue * am = &bio_queues[BIO_Q_AM];
+
+    if (!TAILQ_EMPTY(a1) && (bio_qsize[BIO_Q_A1] > bio_size / 4 ||
+                             TAILQ_EMPTY(am)))
+        return a1;
+    if (!TAILQ_EMPTY(am))
+        return am;
+
+    return NULL;
+}
+
+/**
+ * Write out the oldest delayed write buffer.
+ * @return Returns 1 if a buffer was written; Otherwise 0.
+ */
+static int bio_flush_one(void)
+{
+    struct buf * bp;
+
+    mtx_lock(&bio_qlock);
+    TAILQ_FOREACH(bp, &bio_queues[BIO_Q_DIRTY], b_qentry_) {
+        if (!mtx_trylock(&bp->lock))
+            break;
+    }
+    if (!bp) {
+        mtx_unlock(&bio_qlock);
+        return 0;
+    }
+    bioq_remove(bp);
+    bp->b_flags |= B_BUSY;
+    mtx_unlock(&bio_qlock);
+
+    bp->b_flags &= ~B_ASYNC;
+    _bio_writeout(bp);
+    bp->b_flags &= ~B_DELWRI;
+    bl_brelse(bp);
+    BUF_UNLOCK(bp);
+
+    return 1;
+}
+
+/**
+ * Evict a single clean buffer from the cache.
+ * @return Returns 1 if a buffer was evicted; Otherwise 0.
  */
-int biobuf_compar(struct buf * a, struct buf * b)
+static int bio_evict_one(void)
 {
-    KASSERT(a->b_file.vnode == b->b_file.vnode,
-            "vnodes differ in the same tree");
+    struct bio_queue * q;
+    struct bio_bucket * bucket = NULL;
+    struct buf * bp;
+    int tries = BIO_EVICT_TRIES;
+
+    mtx_lock(&bio_qlock);
+    q = bioq_victim_queue();
+    if (!q) {
+        mtx_unlock(&bio_qlock);
+        return 0;
+    }
+
+    TAILQ_FOREACH(bp, q, b_qentry_) {
+        if (tries-- == 0) {
+            bp = NULL;
+            break;
+        }
+
+        bucket = bio_bucket(bp->b_file.vnode, bp->b_blkno);
+        if (mtx_trylock(&bucket->lock))
+            continue;
+        if (mtx_trylock(&bp->lock)) {
+            mtx_unlock(&bucket->lock);
+            continue;
+        }
+        break;
+    }
+    if (!bp) {
+        mtx_unlock(&bio_qlock);
+        return 0;
+    }
+
+    bioq_remove(bp);
+    bio_size -= bp->b_bufsize;
+    mtx_unlock(&bio_qlock);
 
-    return (a->b_blkno - b->b_blkno);
+    LIST_REMOVE(bp, b_hashentry_);
+    bp->b_flags &= ~B_CACHE;
+    bp->b_flags |= B_BUSY;
+    mtx_unlock(&bucket->lock);
+    BUF_UNLOCK(bp);
+
+    atomic_dec(&bp->b_file.vnode->vn_bpo.bh_count);
+    atomic_inc(&bio_evictions);
+    if (bp->b_flags & B_RAHEAD)
+        atomic_inc(&bio_ra_wasted);
+    vrfree(bp);
+
+    return 1;
+}
+
+/**
+ * Evict buffers until the size of the cache is at most target bytes.
+ * This is a best effort operation and may leave the cache larger than
+ * requested if all buffers are busy or dirty.
+ */
+static void bio_evict(size_t target)
+{
+    while (bio_size > target) {
+        if (!bio_evict_one() && !bio_flush_one())
+            break;
+    }
 }
 
 int bread(vnode_t * vnode, size_t blkno, int size, struct buf ** bpp)
 {
     struct buf * bp;
+    int err = 0;
 
     bp = getblk(vnode, blkno, size, 0);
     if (!bp)
         return -ENOMEM;
 
     BUF_LOCK(bp);
-    _bio_readin(bp);
+    bp->b_bcount = size;
+    if (!(bp->b_flags & B_VALID))
+        _bio_readin(bp);
+    if (bp->b_flags & B_ERROR)
+        err = bp->b_error;
     BUF_UNLOCK(bp);
 
-    bp->b_bcount = size;
+    if (err) {
+        brelse(bp);
+        return err;
+    }
+
     *bpp = bp;
 
     return 0;
 }
 
+/**
+ * Queue a block for an asynchronous read-ahead.
+ */
+static void bio_readahead(vnode_t * vnode, size_t blkno, int size)
+{
+    struct buf * bp;
+
+    if (bio_ra_tid <= 0 || incore(vnode, blkno))
+        return;
+
+    bp = getblk(vnode, blkno, size, 0);
+    if (!bp)
+        return;
+
+    BUF_LOCK(bp);
+    if (bp->b_flags & B_VALID) {
+        /* Someone else read it in already. */
+        bl_brelse(bp);
+        BUF_UNLOCK(bp);
+        return;
+    }
+    bp->b_bcount = size;
+    bp->b_flags &= ~B_DONE;
+    bp->b_flags |= B_ASYNC | B_RAHEAD;
+
+    mtx_lock(&bio_qlock);
+    TAILQ_INSERT_TAIL(&bio_queues[BIO_Q_READ], bp, b_qentry_);
+    bp->b_qindex = BIO_Q_READ;
+    bio_qsize[BIO_Q_READ] += bp->b_bufsize;
+    mtx_unlock(&bio_qlock);
+    BUF_UNLOCK(bp);
+
+    atomic_inc(&bio_ra_issued);
+    thread_release(bio_ra_tid);
+}
+
 int  breadn(vnode_t * vnode, size_t blkno, int size, size_t rablks[],
             int rasizes[], int nrablks, struct buf ** bpp)
 {
-    /* TODO */
-    return -ENOTSUP;
+    int err;
+
+    err = bread(vnode, blkno, size, bpp);
+    if (err)
+        return err;
+
+    for (int i = 0; i < nrablks; i++) {
+        bio_readahead(vnode, rablks[i], rasizes[i]);
+    }
+
+    return 0;
+}
+
+int bread_ra(file_t * file, size_t blkno, int size, struct buf ** bpp)
+{
+    vnode_t * vnode = file->vnode;
+    struct file_ra * ra = &file->f_ra;
+    const size_t step = S_ISBLK(vnode->vn_mode) ? 1 : size;
+    const unsigned ra_max = imin(imax(bio_ra_max, 0), BIO_RA_LIMIT);
+    size_t rablks[BIO_RA_LIMIT];
+    int rasizes[BIO_RA_LIMIT];
+    size_t ra_blkno;
+    int nrablks = 0;
+
+    mtx_lock(&bio_ra_lock);
+    if (blkno == ra->ra_next) {
+        /* Sequential access, grow the window. */
+        ra->ra_window = min(max(ra->ra_window * 2, 2u), ra_max);
+    } else {
+        ra->ra_window = 0;
+        ra->ra_end = 0;
+    }
+    ra->ra_next = blkno + step;
+
+    /* Skip the blocks that were already read ahead. */
+    ra_blkno = ulmax(ra->ra_next, ra->ra_end);
+    while (ra_blkno < ra->ra_next + ra->ra_window * step) {
+        rablks[nrablks] = ra_blkno;
+        rasizes[nrablks] = size;
+        nrablks++;
+        ra_blkno += step;
+    }
+    if (nrablks > 0)
+        ra->ra_end = ra_blkno;
+    mtx_unlock(&bio_ra_lock);
+
+    return breadn(vnode, blkno, size, rablks, rasizes, nrablks, bpp);
 }
 
 void bio_readin(struct buf * bp)
@@ -116,6 +505,7 @@ static void _bio_readin(struct buf * bp)
     file_t * file;
     vnode_t * vnode;
     struct uio uio;
+    ssize_t retval;
 
     KASSERT(mtx_test(&bp->lock), "bp should be locked\n");
 
@@ -130,15 +520,21 @@ static void _bio_readin(struct buf * bp)
     }
     vnode = file->vnode;
 
-    bp->b_flags &= ~B_DONE;
+    bp->b_flags &= ~(B_DONE | B_VALID);
 
     if (uio_buf2kuio(bp, &uio)) {
-        /* TODO Error handling */
-        return;
+        retval = -EINVAL;
+    } else {
+        vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
+        retval = vnode->vnode_ops->read(file, &uio, bp->b_bcount);
     }
-    vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
-    vnode->vnode_ops->read(file, &uio, bp->b_bcount);
 
+    if (retval < 0) {
+        bp->b_flags |= B_ERROR;
+        bp->b_error = (int)retval;
+    } else {
+        bp->b_flags |= B_VALID;
+    }
     bp->b_flags |= B_DONE;
 }
 
@@ -157,6 +553,7 @@ static void _bio_writeout(struct buf * bp)
     file_t * file;
     vnode_t * vnode;
     struct uio uio;
+    ssize_t retval;
 
     KASSERT(mtx_test(&bp->lock), "bp should be locked\n");
 
@@ -175,11 +572,18 @@ static void _bio_writeout(struct buf * bp)
     vnode = file->vnode;
 
     if (uio_buf2kuio(bp, &uio)) {
-        /* TODO Error handling */
-        return;
+        retval = -EINVAL;
+    } else {
+        vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
+        retval = vnode->vnode_ops->write(file, &uio, bp->b_bcount);
+    }
+
+    if (retval < 0) {
+        bp->b_flags |= B_ERROR;
+        bp->b_error = (int)retval;
+    } else {
+        bp->b_flags |= B_VALID;
     }
-    vnode->vnode_ops->lseek(file, bp->b_blkno, SEEK_SET);
-    vnode->vnode_ops->write(file, &uio, bp->b_bcount);
 
 out:
     bp->b_flags |= B_DONE;
@@ -217,13 +621,18 @@ int bwrite(struct buf * bp)
 
         return 0;
     } else {
+        int err = 0;
+
         BUF_LOCK(bp);
         _bio_writeout(bp);
+        if (bp->b_flags & B_ERROR)
+            err = bp->b_error;
         bp->b_flags &= ~B_BUSY;
+        waitq_wakeup_all(bio_waitq(bp));
         BUF_UNLOCK(bp);
-    }
 
-    return 0;
+        return err;
+    }
 }
 
 void bawrite(struct buf * bp)
@@ -243,18 +652,16 @@ void bdwrite(struct buf * bp)
 
 void bio_clrbuf(struct buf * bp)
 {
-    unsigned flags;
-
     KASSERT(bp, "bp != NULL\n");
 
     BUF_LOCK(bp);
 
-    flags = bp->b_flags;
-
-    if (flags & B_DELWRI) {
+    if (bp->b_flags & B_DELWRI) {
         _bio_writeout(bp);
-    } else if (flags & B_ASYNC) {
+    } else if (bp->b_flags & B_ASYNC) {
+        BUF_UNLOCK(bp);
         biowait(bp);
+        BUF_LOCK(bp);
     }
     bp->b_flags &= ~(B_DELWRI | B_ERROR);
     bp->b_flags |= B_BUSY;
@@ -263,7 +670,9 @@ void bio_clrbuf(struct buf * bp)
     memset((void *)bp->b_data, 0, bp->b_bufsize);
 
     BUF_LOCK(bp);
+    bp->b_flags |= B_VALID;
     bp->b_flags &= ~B_BUSY;
+    waitq_wakeup_all(bio_waitq(bp));
     BUF_UNLOCK(bp);
 }
 
@@ -294,90 +703,189 @@ static struct buf * create_blk(vnode_t * vnode, size_t blkno, size_t size,
         bp->b_devfile.vnode = NULL;
     }
 
-    bp->b_flags |= B_DONE;
-    bp->b_flags &= ~B_BUSY; /* Unbusy for now */
-
-    VN_LOCK(vnode);
-
-    /* Put to the buffer splay tree of the vnode. */
-    if (SPLAY_INSERT(bufhd_splay, &vnode->vn_bpo.sroot, bp))
-        panic("Double insert");
-
-    VN_UNLOCK(vnode);
+    bp->b_flags |= B_DONE | B_BUSY;
 
     return bp;
 }
 
 struct buf * getblk(vnode_t * vnode, size_t blkno, size_t size, int slptimeo)
 {
+    struct bio_bucket * bucket;
     struct buf * bp;
+    struct buf * nbp = NULL;
+    size_t old_size;
 
     if (!vnode)
         return NULL;
 
-    /* For now we want to synchronize access to this function. */
-    mtx_lock(&cache_lock);
+    bucket = bio_bucket(vnode, blkno);
 
-    bp = incore(vnode, blkno);
-    if (!bp) { /* Not found, create a new buffer. */
-        bp = create_blk(vnode, blkno, size, slptimeo);
-        if (!bp)
-            goto fail;
-    }
-
-    /* Found */
 retry:
-    biowait(bp); /* Wait until I/O has completed. */
-
-    /*
-     * Wait until the buffer is released. It is possible that we don't get it
-     * locked for us on first try, so we just keep trying until it's not set
-     * busy by some other thread.
-     */
-    while (bp->b_flags & B_BUSY)
-        thread_yield(THREAD_YIELD_LAZY);
-    BUF_LOCK(bp);
-    if (bp->b_flags & B_BUSY) {
+    mtx_lock(&bucket->lock);
+    bp = bucket_find(bucket, vnode, blkno);
+    if (bp) { /* Found */
+        /*
+         * Wait until the buffer is released. We can't sleep while holding
+         * the bucket lock, so just keep trying until it's not set busy by
+         * some other thread.
+         */
+        BUF_LOCK(bp);
+        mtx_lock(&bio_qlock);
+        if ((bp->b_flags & B_BUSY) && bp->b_qindex != BIO_Q_READ) {
+            int err;
+
+            /*
+             * Wait until the buffer is released. The buffer may be freed
+             * while we sleep, so it must be looked up again after waking up.
+             */
+            mtx_unlock(&bio_qlock);
+            mtx_unlock(&bucket->lock);
+            err = waitq_wait(bio_waitq(bp), &bp->lock, slptimeo);
+            if (err == -ETIMEDOUT) {
+                if (nbp)
+                    vrfree(nbp);
+                return NULL;
+            }
+            goto retry;
+        }
+        if (bp->b_qindex == BIO_Q_READ) {
+            /*
+             * Take over a read-ahead that hasn't been started yet, the
+             * caller will read the block in.
+             */
+            bp->b_flags &= ~B_ASYNC;
+            bp->b_flags |= B_DONE;
+        }
+        bioq_remove(bp);
+        mtx_unlock(&bio_qlock);
+        if (bp->b_flags & B_RAHEAD) {
+            /* The first actual reference to a read-ahead block. */
+            bp->b_flags &= ~B_RAHEAD;
+            atomic_inc(&bio_ra_hits);
+        } else {
+            bp->b_flags |= B_REUSED;
+        }
+        bp->b_flags |= B_BUSY;
         BUF_UNLOCK(bp);
+        mtx_unlock(&bucket->lock);
+
+        atomic_inc(&bio_hits);
+
+        /* Someone else inserted the block while we were creating it. */
+        if (nbp)
+            vrfree(nbp);
+    } else if (!nbp) { /* Not found, create a new buffer. */
+        mtx_unlock(&bucket->lock);
+
+        bio_evict((bio_max_size > size) ? bio_max_size - size : 0);
+        nbp = create_blk(vnode, blkno, size, slptimeo);
+        if (!nbp)
+            return NULL;
         goto retry;
+    } else {
+        bp = nbp;
+        bp->b_flags |= B_CACHE;
+        LIST_INSERT_HEAD(&bucket->head, bp, b_hashentry_);
+        mtx_unlock(&bucket->lock);
+
+        atomic_inc(&vnode->vn_bpo.bh_count);
+        atomic_inc(&bio_misses);
+        mtx_lock(&bio_qlock);
+        bio_size += bp->b_bufsize;
+        mtx_unlock(&bio_qlock);
     }
-    bp->b_flags |= B_BUSY;
-    /* Remove from the released list. */
-    TAILQ_REMOVE(&relse_list, bp, relse_entry_);
-    BUF_UNLOCK(bp);
 
+    biowait(bp); /* Wait until I/O has completed. */
+
+    old_size = bp->b_bufsize;
     allocbuf(bp, size); /* Resize if necessary */
 
     BUF_LOCK(bp);
+    if ((bp->b_flags & B_CACHE) && bp->b_bufsize != old_size) {
+        mtx_lock(&bio_qlock);
+        bio_size += bp->b_bufsize - old_size;
+        mtx_unlock(&bio_qlock);
+    }
     bp->b_flags &= ~B_ERROR;
     bp->b_error = 0;
     BUF_UNLOCK(bp);
 
-fail:
-    mtx_unlock(&cache_lock);
-
     return bp;
 }
 
 struct buf * incore(vnode_t * vnode, size_t blkno)
 {
-    struct bufhd * bf;
+    struct bio_bucket * bucket;
     struct buf * bp;
-    struct buf find;
 
     if (!vnode)
         return NULL;
 
-    bf = &vnode->vn_bpo;
+    bucket = bio_bucket(vnode, blkno);
+    mtx_lock(&bucket->lock);
+    bp = bucket_find(bucket, vnode, blkno);
+    mtx_unlock(&bucket->lock);
 
-    if (SPLAY_EMPTY(&bf->sroot))
-        return NULL;
+    return bp;
+}
 
-    find.b_file.vnode = vnode;
-    find.b_blkno = blkno;
-    bp = SPLAY_FIND(bufhd_splay, &bf->sroot, &find);
+void bio_vnode_purge(vnode_t * vnode)
+{
+    LIST_HEAD(bio_purge_list, buf) purge_list =
+        LIST_HEAD_INITIALIZER(purge_list);
+    struct buf * bp;
 
-    return bp;
+    if (atomic_read(&vnode->vn_bpo.bh_count) == 0)
+        return;
+
+    for (size_t i = 0; i < BIO_HASH_SIZE; i++) {
+        struct bio_bucket * bucket = &bio_hash[i];
+        struct buf * bp_tmp;
+
+        mtx_lock(&bucket->lock);
+        LIST_FOREACH_SAFE(bp, &bucket->head, b_hashentry_, bp_tmp) {
+            if (bp->b_file.vnode != vnode)
+                continue;
+
+            BUF_LOCK(bp);
+            LIST_REMOVE(bp, b_hashentry_);
+            bp->b_flags &= ~B_CACHE;
+            mtx_lock(&bio_qlock);
+            if (bp->b_qindex == BIO_Q_READ) {
+                /* Cancel a pending read-ahead. */
+                bp->b_flags &= ~(B_BUSY | B_ASYNC);
+                bp->b_flags |= B_DONE;
+                waitq_wakeup_all(bio_waitq(bp));
+            }
+            bioq_remove(bp);
+            bio_size -= bp->b_bufsize;
+            mtx_unlock(&bio_qlock);
+
+            if (bp->b_flags & B_RAHEAD)
+                atomic_inc(&bio_ra_wasted);
+
+            if (bp->b_flags & B_BUSY) {
+                /* The current owner will free it on brelse(). */
+                bp->b_flags |= B_INVAL;
+            } else {
+                bp->b_flags |= B_BUSY;
+                LIST_INSERT_HEAD(&purge_list, bp, b_hashentry_);
+            }
+            BUF_UNLOCK(bp);
+            atomic_dec(&vnode->vn_bpo.bh_count);
+        }
+        mtx_unlock(&bucket->lock);
+    }
+
+    while ((bp = LIST_FIRST(&purge_list))) {
+        LIST_REMOVE(bp, b_hashentry_);
+
+        BUF_LOCK(bp);
+        if (bp->b_flags & B_DELWRI)
+            _bio_writeout(bp);
+        BUF_UNLOCK(bp);
+        vrfree(bp);
+    }
 }
 
 static void bl_brelse(struct buf * bp)
@@ -386,39 +894,69 @@ static void bl_brelse(struct buf * bp)
 
     bp->b_flags &= ~B_BUSY;
 
-    mtx_lock(&cache_lock);
-    TAILQ_INSERT_TAIL(&relse_list, bp, relse_entry_);
-    mtx_unlock(&cache_lock);
+    if (bp->b_flags & B_CACHE) {
+        mtx_lock(&bio_qlock);
+        bioq_insert(bp);
+        mtx_unlock(&bio_qlock);
+    }
+
+    waitq_wakeup_all(bio_waitq(bp));
 }
 
 void brelse(struct buf * bp)
 {
+    int inval;
+
     BUF_LOCK(bp);
+    inval = bp->b_flags & B_INVAL;
+    if (inval && (bp->b_flags & B_DELWRI))
+        _bio_writeout(bp);
     bl_brelse(bp);
     BUF_UNLOCK(bp);
+
+    if (inval)
+        vrfree(bp);
 }
 
 void biodone(struct buf * bp)
 {
+    int inval = 0;
+
     BUF_LOCK(bp);
 
-    KASSERT(bp->b_flags & B_DONE, "dup biodone");
+    KASSERT(!(bp->b_flags & B_DONE), "dup biodone");
 
     bp->b_flags |= B_DONE;
 
-    if (bp->b_flags & B_ASYNC)
+    if (bp->b_flags & B_ASYNC) {
+        bp->b_flags &= ~B_ASYNC;
+        inval = bp->b_flags & B_INVAL;
         bl_brelse(bp);
+    } else {
+        waitq_wakeup_all(bio_waitq(bp));
+    }
 
     BUF_UNLOCK(bp);
+
+    if (inval)
+        vrfree(bp);
 }
 
 static int biowait_timo(struct buf * bp, long timeout)
 {
-    /* TODO timeout */
+    int err;
 
-    while (!(bp->b_flags & B_DONE));
+    BUF_LOCK(bp);
+    while (!(bp->b_flags & B_DONE)) {
+        err = waitq_wait(bio_waitq(bp), &bp->lock, timeout);
+        if (err == -ETIMEDOUT)
+            return err;
+        BUF_LOCK(bp);
+    }
+    err = bp->b_error;
+    BUF_UNLOCK(bp);
 
-    return bp->b_error;
+    return err;
 }
 
 int biowait(struct buf * bp)
@@ -427,53 +965,76 @@ int biowait(struct buf * bp)
 }
 
 /**
- * Cleanup released buffers.
- * @param freebufs  tells if released buffers should be freed after write out.
+ * Write out delayed writes and trim the cache to its max size.
+ * Only a bounded number of buffers is processed on each call.
  */
-static void bio_clean(uintptr_t freebufs)
+static void bio_clean(uintptr_t arg)
 {
-    struct buf * bp;
-    struct buf * bp_tmp;
-
-    if (mtx_trylock(&cache_lock))
-        return; /* Don't enter if we don't get exclusive access. */
-
-    TAILQ_FOREACH_SAFE(bp, &relse_list, relse_entry_, bp_tmp) {
-        file_t * file;
+    for (int i = 0; i < BIO_CLEAN_BATCH; i++) {
+        if (!bio_flush_one())
+            break;
+    }
 
-        /* Skip if already locked or BUSY */
-        if (mtx_trylock(&bp->lock) || (bp->b_flags & B_BUSY))
-            continue;
+    bio_evict(bio_max_size);
 
-        file = &bp->b_file;
+    /* Make sure a lost wakeup doesn't leave read-aheads pending. */
+    if (bio_ra_tid > 0 && !TAILQ_EMPTY(&bio_queues[BIO_Q_READ]))
+        thread_release(bio_ra_tid);
+}
+/*
+ * Idle task for cleaning up buffers.
+ */
+IDLE_TASK(bio_clean, 0);
 
-        /* Write out if delayed write was set. */
-        if (bp->b_flags & B_DELWRI) {
-            bp->b_flags |= B_BUSY;
-            bp->b_flags &= ~B_ASYNC;
+/**
+ * Read in buffers queued for read-ahead.
+ */
+static void * bio_ra_thread(void * arg)
+{
+    while (1) {
+        struct buf * bp;
 
-            _bio_writeout(bp);
+        mtx_lock(&bio_qlock);
+        TAILQ_FOREACH(bp, &bio_queues[BIO_Q_READ], b_qentry_) {
+            if (!mtx_trylock(&bp->lock))
+                break;
         }
+        if (bp)
+            bioq_remove(bp);
+        mtx_unlock(&bio_qlock);
 
-        if (freebufs &&
-            !(bp->b_flags & B_LOCKED) &&
-            !VN_TRYLOCK(file->vnode)) {
-            SPLAY_REMOVE(bufhd_splay, &file->vnode->vn_bpo.sroot, bp);
-            TAILQ_REMOVE(&relse_list, bp, relse_entry_);
-            vrfree(bp);
-            VN_UNLOCK(file->vnode);
-        } else {
-            bp->b_flags &= ~B_BUSY;
-            BUF_UNLOCK(bp);
+        if (!bp) {
+            thread_wait();
+            continue;
         }
+
+        _bio_readin(bp);
+        bp->b_flags &= ~B_DONE; /* biodone() marks it done. */
+        BUF_UNLOCK(bp);
+        biodone(bp);
     }
 
-    mtx_unlock(&cache_lock);
+    return NULL;
+}
+
+int __kinit__ bio_init(void)
+{
+    SUBSYS_DEP(proc_init);
+    SUBSYS_INIT("bio");
+
+    struct sched_param param = {
+        .sched_policy = SCHED_OTHER,
+        .sched_priority = NICE_MAX,
+    };
+
+    bio_ra_tid = kthread_create("bio", &param, 0, bio_ra_thread, NULL);
+    if (bio_ra_tid < 0) {
+        KERROR(KERROR_ERR, "Failed to create a thread for bio read-ahead\n");
+        return bio_ra_tid;
+    }
+
+    return 0;
 }
-/*
- * Idle task for cleaning up buffers.
- */
-IDLE_TASK(bio_clean, 0);
 
 int bio_geterror(struct buf * bp)
 {
@@ -38,6 +38,7 @@
 #include <kinit.h>
 #include <klocks.h>
 #include <ksched.h>
+#include <ksignal.h>
 #include <kstring.h>
 #include <libkern.h>
 
@@ -54,31 +55,18 @@ static mtx_t timelock = MTX_INITIALIZER(MTX_TYPE_SPIN, 0);
 
 /**
  * Update time counters.
+ * The uptime is derived directly from the HW timer so that seconds and
+ * nanoseconds are always consistent, which is required for absolute
+ * deadlines.
  */
 static void _update_time(void)
 {
-    static uint64_t utime_last;
-    static uint64_t sec_next;
     uint64_t utime = get_utime();
-    uint64_t usecdiff;
 
     KASSERT(mtx_test(&timelock), "timelock should be locked");
 
-    /* Update seconds */
-    if (utime >= sec_next) {
-        uptime.tv_sec++;
-        sec_next = utime + SEC_US;
-    }
-
-    /* Update nsecs */
-    if (utime_last > utime)
-        usecdiff = (~0 - utime_last) + utime;
-    else
-        usecdiff = utime - utime_last;
-    uptime.tv_nsec = (uptime.tv_nsec + usecdiff * 1000);
-    uptime.tv_nsec = uptime.tv_nsec - (uptime.tv_nsec / SEC_NS) * SEC_NS;
-
-    utime_last = utime;
+    uptime.tv_sec = utime / SEC_US;
+    uptime.tv_nsec = (utime % SEC_US) * 1000;
 }
 
 void update_time(void)
@@ -90,7 +78,7 @@ void update_time(void)
 
 static void update_time_nonblocking(void)
 {
-    if (mtx_trylock(&timelock))
+    if (!sched_is_boot_cpu() || mtx_trylock(&timelock))
         return;
     _update_time();
     mtx_unlock(&timelock);
@@ -187,8 +175,71 @@ static intptr_t sys_settime(__user void * user_args)
     return 0;
 }
 
+static intptr_t sys_nanosleep(__user void * user_args)
+{
+    struct _time_nanosleep_args args;
+    struct timespec now, ts, remain;
+    int err;
+
+    err = copyin(user_args, &args, sizeof(args));
+    if (err) {
+        set_errno(EFAULT);
+        return -1;
+    }
+
+    if (args.rqtp.tv_sec < 0 || args.rqtp.tv_nsec < 0 ||
+        args.rqtp.tv_nsec >= SEC_NS) {
+        set_errno(EINVAL);
+        return -1;
+    }
+
+    switch (args.clk_id) {
+    case CLOCK_UPTIME:
+    case CLOCK_MONOTONIC:
+        nanotime(&now);
+        break;
+    case CLOCK_REALTIME:
+        update_time();
+        getrealtime(&now);
+        break;
+    default:
+        set_errno(EINVAL);
+        return -1;
+    }
+
+    if (args.flags & TIMER_ABSTIME) {
+        if (args.rqtp.tv_sec < now.tv_sec ||
+            (args.rqtp.tv_sec == now.tv_sec &&
+             args.rqtp.tv_nsec <= now.tv_nsec))
+            return 0; /* Already passed. */
+        timespec_sub(&ts, &args.rqtp, &now);
+    } else {
+        ts = args.rqtp;
+    }
+
+    err = ksignal_sigsleep(&ts, &remain);
+    if (err < 0) {
+        set_errno(-err);
+        return -1;
+    }
+
+    if (remain.tv_sec > 0 || remain.tv_nsec > 0) {
+        if (!(args.flags & TIMER_ABSTIME) && args.rmtp &&
+            copyout(&remain, (__user struct timespec *)args.rmtp,
+                    sizeof(remain))) {
+            set_errno(EFAULT);
+            return -1;
+        }
+        set_errno(EINTR);
+        return -1;
+    }
+
+    return 0;
+}
+
 static const syscall_handler_t time_sysfnmap[] = {
     ARRDECL_SYSCALL_HNDL(SYSCALL_TIME_GETTIME, sys_gettime),
     ARRDECL_SYSCALL_HNDL(SYSCALL_TIME_SETTIME, sys_settime),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_TIME_NANOSLEEP, sys_nanosleep),
 };
 SYSCALL_HANDLERDEF(time_syscall, time_sysfnmap)
@@ -32,6 +32,7 @@
  */
 
 #include <errno.h>
+#include <sys/queue.h>
 #include <sys/sysctl.h>
 #include <bitmap.h>
 #include <dynmem.h>
@@ -39,6 +40,7 @@
 #include <klocks.h>
 #include <kmem.h>
 #include <kstring.h>
+#include <libkern.h>
 
 #define DYNMEM_START configDYNMEM_START
 #define DYNMEM_END   (configDYNMEM_START + configDYNMEM_SIZE)
@@ -62,11 +64,12 @@
  */
 #define DYNMEM_MAPSIZE  ((configDYNMEM_SIZE) / DYNMEM_PAGE_SIZE)
 
-#if E2BITMAP_SIZE(DYNMEM_MAPSIZE) > 0
-#define DYNMEM_BITMAPSIZE       E2BITMAP_SIZE(DYNMEM_MAPSIZE)
-#else
-#define DYNMEM_BITMAPSIZE       1
-#endif
+#define DYNMEM_BITMAPSIZE       E2BITMAP_SIZE(DYNMEM_MAPSIZE + 31)
+
+/**
+ * Number of free extent size class bins.
+ */
+#define DYNMEM_NR_BINS          32
 
 #define SIZEOF_DYNMEMMAP        (DYNMEM_MAPSIZE * sizeof(uint32_t))
 #define SIZEOF_DYNMEMMAP_BITMAP (DYNMEM_BITMAPSIZE * sizeof(uint32_t))
@@ -75,7 +78,8 @@ struct dynmem_desc {
     unsigned control    : 10;
     unsigned ap         : 3;
     unsigned rl         : 1;
-    unsigned _padding   : 2;
+    unsigned fr         : 1; /*!< First or last page of a free extent. */
+    unsigned _padding   : 1;
     unsigned refcount   : 16;
 };
 
@@ -83,8 +87,33 @@ struct dynmem_desc {
  * Dynmemmap allocation table.
  */
 static struct dynmem_desc dynmemmap[DYNMEM_MAPSIZE];
+
+/**
+ * Bitmap of reserved areas.
+ * Only used for building the initial set of free extents.
+ */
 static uint32_t dynmemmap_bitmap[DYNMEM_BITMAPSIZE];
 
+/*
+ * Free extents.
+ * Free dynmem is tracked as extents of contiguous free pages. The first and
+ * the last page of a free extent are tagged with the fr bit in dynmemmap.
+ * The free extent descriptor of the first page holds the length of the
+ * extent and the descriptor of the last page holds the index of the first
+ * page, so a freed region can be coalesced with its neighbours in constant
+ * time. Free extents are kept in bins by log2 of their length and a bitmap
+ * of non-empty bins is used to find a large enough extent without scanning
+ * the allocation table.
+ */
+struct dynmem_fext {
+    size_t len;     /*!< Length of the extent, valid on the first page. */
+    size_t head;    /*!< Index of the first page, valid on the last page. */
+    LIST_ENTRY(dynmem_fext) fext_link_;
+};
+static struct dynmem_fext dynmem_fext[DYNMEM_MAPSIZE];
+static LIST_HEAD(fext_list, dynmem_fext) dynmem_bins[DYNMEM_NR_BINS];
+static uint32_t dynmem_bins_bmap; /*!< Non-empty bins. */
+
 /**
  * Struct for temporary storage.
  */
@@ -136,6 +165,14 @@ static size_t dynmem_reserved;
 SYSCTL_UINT(_vm_dynmem, OID_AUTO, reserved, CTLFLAG_RD, &dynmem_reserved, 0,
             "Amount of reserved dynmem");
 
+/**
+ * Number of free extents.
+ */
+static size_t dynmem_nr_fext;
+SYSCTL_UINT(_vm_dynmem, OID_AUTO, nr_free_extents, CTLFLAG_RD,
+            &dynmem_nr_fext, 0,
+            "Number of free extents");
+
 static inline void * dindex2addr(size_t di)
 {
     return (void *)(DYNMEM_START + di * DYNMEM_PAGE_SIZE);
@@ -170,6 +207,139 @@ static int addr_is_valid(const void * addr, int test)
     return !!1;
 }
 
+static inline int fext_bin(size_t len)
+{
+    return fls(len) - 1;
+}
+
+/**
+ * Insert a free extent.
+ * @note dynmem_region_lock must be held before calling this function.
+ */
+static void fext_insert(size_t start, size_t len)
+{
+    const size_t end = start + len - 1;
+    const int bin = fext_bin(len);
+
+    dynmemmap[start].fr = 1;
+    dynmemmap[end].fr = 1;
+    dynmem_fext[start].len = len;
+    dynmem_fext[end].head = start;
+    LIST_INSERT_HEAD(&dynmem_bins[bin], &dynmem_fext[start], fext_link_);
+    dynmem_bins_bmap |= 1u << bin;
+    dynmem_nr_fext++;
+}
+
+/**
+ * Remove a free extent.
+ * @note dynmem_region_lock must be held before calling this function.
+ * @param start is the index of the first page of the extent.
+ */
+static void fext_remove(size_t start)
+{
+    const size_t len = dynmem_fext[start].len;
+    const int bin = fext_bin(len);
+
+    LIST_REMOVE(&dynmem_fext[start], fext_link_);
+    if (LIST_EMPTY(&dynmem_bins[bin]))
+        dynmem_bins_bmap &= ~(1u << bin);
+    dynmemmap[start].fr = 0;
+    dynmemmap[start + len - 1].fr = 0;
+    dynmem_nr_fext--;
+}
+
+/**
+ * Find a free extent of at least len pages.
+ * @note dynmem_region_lock must be held before calling this function.
+ * @param[out] retval is the index of the first page of the extent found.
+ * @param len is the minimum length of the extent.
+ * @return  Returns zero if a free extent was found; Value other than zero if
+ *          there is no large enough free extent.
+ */
+static int fext_find(size_t * retval, size_t len)
+{
+    const int floor_bin = fext_bin(len);
+    const int ceil_bin = fls(len - 1);
+    const uint32_t mask = dynmem_bins_bmap & ~((1u << ceil_bin) - 1);
+    struct dynmem_fext * fe;
+
+    /* Any extent in bins starting from ceil_bin is large enough. */
+    if (mask) {
+        fe = LIST_FIRST(&dynmem_bins[ffs(mask) - 1]);
+        *retval = fe - dynmem_fext;
+        return 0;
+    }
+
+    /* The bin of len may still contain a large enough extent. */
+    if (floor_bin != ceil_bin) {
+        LIST_FOREACH(fe, &dynmem_bins[floor_bin], fext_link_) {
+            if (fe->len >= len) {
+                *retval = fe - dynmem_fext;
+                return 0;
+            }
+        }
+    }
+
+    return -ENOMEM;
+}
+
+/**
+ * Get the length of the largest free extent in pages.
+ * @note dynmem_region_lock must be held before calling this function.
+ */
+static size_t fext_largest(void)
+{
+    struct dynmem_fext * fe;
+    size_t largest = 0;
+
+    if (!dynmem_bins_bmap)
+        return 0;
+
+    LIST_FOREACH(fe, &dynmem_bins[fls(dynmem_bins_bmap) - 1], fext_link_) {
+        if (fe->len > largest)
+            largest = fe->len;
+    }
+
+    return largest;
+}
+
+static int sysctl_dynmem_largest_free(SYSCTL_HANDLER_ARGS)
+{
+    unsigned largest;
+
+    mtx_lock(&dynmem_region_lock);
+    largest = fext_largest() * DYNMEM_PAGE_SIZE;
+    mtx_unlock(&dynmem_region_lock);
+
+    return sysctl_handle_int(oidp, &largest, sizeof(largest), req);
+}
+
+SYSCTL_PROC(_vm_dynmem, OID_AUTO, largest_free, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_dynmem_largest_free, "IU",
+            "Size of the largest free extent");
+
+/**
+ * Fragmentation percentage.
+ * The percentage of free dynmem that is not part of the largest free extent.
+ */
+static int sysctl_dynmem_fragm(SYSCTL_HANDLER_ARGS)
+{
+    unsigned fragm = 0;
+
+    mtx_lock(&dynmem_region_lock);
+    if (dynmem_free > 0) {
+        fragm = 100 - (fext_largest() * DYNMEM_PAGE_SIZE) /
+                      (dynmem_free / 100);
+    }
+    mtx_unlock(&dynmem_region_lock);
+
+    return sysctl_handle_int(oidp, &fragm, sizeof(fragm), req);
+}
+
+SYSCTL_PROC(_vm_dynmem, OID_AUTO, fragm, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_dynmem_fragm, "IU",
+            "Fragmentation percentage");
+
 static void mark_reserved_areas(void)
 {
     struct dynmem_reserved_area ** areap;
@@ -199,12 +369,33 @@ static void mark_reserved_areas(void)
     }
 }
 
+/**
+ * Create the initial free extents from the memory not reserved.
+ */
+static void init_free_extents(void)
+{
+    size_t start = 0;
+
+    mtx_lock(&dynmem_region_lock);
+    for (size_t i = 0; i <= DYNMEM_MAPSIZE; i++) {
+        if (i < DYNMEM_MAPSIZE &&
+            bitmap_status(dynmemmap_bitmap, i, SIZEOF_DYNMEMMAP_BITMAP) == 0)
+            continue;
+
+        if (i > start)
+            fext_insert(start, i - start);
+        start = i + 1;
+    }
+    mtx_unlock(&dynmem_region_lock);
+}
+
 /**
  * Called from kinit.c
  */
 void dynmem_init(void)
 {
     mark_reserved_areas();
+    init_free_extents();
 }
 
 /**
@@ -294,16 +485,15 @@ static void * kmap_allocation(size_t base, size_t size, uint32_t ap,
 void * dynmem_alloc_region(size_t size, uint32_t ap, uint32_t ctrl)
 {
     size_t pos;
+    size_t ext_len;
     void * retval = NULL;
-    int err;
 
     if (size == 0)
         return NULL;
 
     mtx_lock(&dynmem_region_lock);
 
-    if (bitmap_block_search(&pos, size, dynmemmap_bitmap,
-                           SIZEOF_DYNMEMMAP_BITMAP)) {
+    if (fext_find(&pos, size)) {
         KERROR(KERROR_ERR, "%s(size %u): Out of dynmem, free %u/%u\n",
                __func__, size, dynmem_free, configDYNMEM_SIZE);
         goto out;
@@ -312,9 +502,12 @@ void * dynmem_alloc_region(size_t size, uint32_t ap, uint32_t ctrl)
     /* Update sysctl stats */
     dynmem_free -= size * DYNMEM_PAGE_SIZE;
 
-    err = bitmap_block_update(dynmemmap_bitmap, 1, pos, size,
-                              SIZEOF_DYNMEMMAP_BITMAP);
-    KASSERT(err == 0, "dynmem map update OOB");
+    /* Allocate from the beginning of the extent and free the rest. */
+    ext_len = dynmem_fext[pos].len;
+    fext_remove(pos);
+    if (ext_len > size)
+        fext_insert(pos + size, ext_len - size);
+
     retval = kmap_allocation(pos, size, ap, ctrl);
 
 out:
@@ -351,8 +544,9 @@ out:
 void dynmem_free_region(void * addr)
 {
     size_t i;
+    size_t start;
+    size_t len;
     struct dynmem_desc * dp;
-    int err;
 
     mtx_lock(&dynmem_region_lock);
 
@@ -382,9 +576,25 @@ void dynmem_free_region(void * addr)
 
     /* Mark the region as unused. */
     memset(dp, 0, dynmem_region.num_pages * sizeof(struct dynmem_desc));
-    err = bitmap_block_update(dynmemmap_bitmap, 1, i, dynmem_region.num_pages,
-                              SIZEOF_DYNMEMMAP_BITMAP);
-    KASSERT(err == 0, "vreg map update OOB");
+
+    /* Coalesce with the neighbouring free extents. */
+    start = i;
+    len = dynmem_region.num_pages;
+    if (start > 0 && dynmemmap[start - 1].fr) {
+        const size_t prev = dynmem_fext[start - 1].head;
+
+        len += dynmem_fext[prev].len;
+        fext_remove(prev);
+        start = prev;
+    }
+    if (i + dynmem_region.num_pages < DYNMEM_MAPSIZE &&
+        dynmemmap[i + dynmem_region.num_pages].fr) {
+        const size_t next = i + dynmem_region.num_pages;
+
+        len += dynmem_fext[next].len;
+        fext_remove(next);
+    }
+    fext_insert(start, len);
 
     /* Update sysctl stats */
     dynmem_free += dynmem_region.num_pages * DYNMEM_PAGE_SIZE;
@@ -32,6 +32,9 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
 #include <sys/priv.h>
 #include <sys/sysctl.h>
 #include <syscall.h>
@@ -60,13 +63,14 @@ SYSCTL_INT(_kern, KERN_MAXSIZ, maxsiz, CTLFLAG_RW,
 
 /**
  * Calculate the size of a new stack allocation for main().
+ * @param proc is the process.
  * @param emin is the required stack size idicated by the executable.
  */
-static size_t get_new_main_stack_size(ssize_t emin)
+static size_t get_new_main_stack_size(struct proc_info * proc, ssize_t emin)
 {
     const ssize_t kmin = main_stack_dfl;
     const ssize_t kmax = main_stack_max;
-    const ssize_t rlim = curproc->rlim[RLIMIT_STACK].rlim_cur;
+    const ssize_t rlim = proc->rlim[RLIMIT_STACK].rlim_cur;
     ssize_t dmin, dmax;
 
     dmin = (emin > 0 && emin > kmin) ? emin : kmin;
@@ -76,23 +80,26 @@ static size_t get_new_main_stack_size(ssize_t emin)
 }
 
 /**
- * Create a new thread for executing main()
+ * Create a new stack and a thread definition for executing main()
+ * @param proc is the process.
+ * @param args[out] is the thread definition.
  * @param stack_size is the preferred stack size;
  *                   0 if the system default shall be used.
  */
-static pthread_t new_main_thread(int uargc, uintptr_t uargv, uintptr_t uenvp,
-                                 size_t stack_size)
+static int new_main_thread_def(struct proc_info * proc,
+                               struct _sched_pthread_create_args * args,
+                               int uargc, uintptr_t uargv, uintptr_t uenvp,
+                               size_t stack_size)
 {
     struct buf * stack_region;
-    struct buf * code_region = (*curproc->mm.regions)[MM_CODE_REGION];
-    struct _sched_pthread_create_args args;
+    struct buf * code_region = (*proc->mm.regions)[MM_CODE_REGION];
 
-    stack_size = get_new_main_stack_size(stack_size);
-    stack_region = vm_new_userstack_curproc(stack_size);
+    stack_size = get_new_main_stack_size(proc, stack_size);
+    stack_region = vm_new_userstack(proc, stack_size);
     if (!stack_region)
         return -ENOMEM;
 
-    args = (struct _sched_pthread_create_args){
+    *args = (struct _sched_pthread_create_args){
         .param.sched_policy = current_thread->param.sched_policy,
         .param.sched_priority = current_thread->param.sched_priority,
         .stack_addr = (void *)(stack_region->b_mmu.vaddr),
@@ -106,18 +113,77 @@ static pthread_t new_main_thread(int uargc, uintptr_t uargv, uintptr_t uenvp,
         .del_thread = NULL /* Not needed for main(). */
     };
 
-    KASSERT(args.stack_size > 0,
+    KASSERT(args->stack_size > 0,
             "Size of the main stack must be greater than zero\n");
 
+    return 0;
+}
+
+/**
+ * Create a new thread for executing main()
+ * @param stack_size is the preferred stack size;
+ *                   0 if the system default shall be used.
+ */
+static pthread_t new_main_thread(int uargc, uintptr_t uargv, uintptr_t uenvp,
+                                 size_t stack_size)
+{
+    struct _sched_pthread_create_args args;
+    int err;
+
+    err = new_main_thread_def(curproc, &args, uargc, uargv, uenvp, stack_size);
+    if (err)
+        return err;
+
     return thread_create(&args, THREAD_MODE_USER);
 }
 
+/**
+ * Load a new image to a process that has no user regions loaded.
+ */
+static int load_image(struct exec_loadfn * loader, struct proc_info * proc,
+                      file_t * file, size_t * stack_size)
+{
+    uintptr_t vaddr = 0; /* RFE Shouldn't matter if elf is not dyn? */
+    int err;
+
+    /*
+     * Do what is necessary on exec here as the loader might need to alter the
+     * capabilities and it could be an unexpected result if whatever the loader
+     * does would be overriden.
+     */
+    priv_cred_init_exec(&proc->cred);
+
+    /* Load the image */
+    err = loader->load(proc, file, &vaddr, stack_size);
+    KERROR_DBG("Proc image loaded (err = %d)\n", err);
+
+    return err;
+}
+
+/**
+ * Map the environment of a newly loaded image.
+ */
+static int map_env(struct proc_info * proc, struct buf * env_bp)
+{
+    int err;
+
+    err = vm_insert_region(proc, env_bp, VM_INSOP_MAP_REG);
+    if (err < 0) {
+        KERROR_DBG("Unable to map a new env\n");
+        return err;
+    }
+    vm_fixmemmap_proc(proc);
+
+    KERROR_DBG("Memory mapping done (pid = %d)\n", proc->pid);
+
+    return 0;
+}
+
 int exec_file(struct exec_loadfn * loader, int fildes,
               char name[PROC_NAME_SIZE], struct buf * env_bp,
               int uargc, uintptr_t uargv, uintptr_t uenvp)
 {
     file_t * file;
-    uintptr_t vaddr = 0; /* RFE Shouldn't matter if elf is not dyn? */
     size_t stack_size;
     pthread_t tid;
     int err;
@@ -142,16 +208,10 @@ int exec_file(struct exec_loadfn * loader, int fildes,
     /* Unload user regions before loading a new image. */
     (void)vm_unload_regions(curproc, MM_HEAP_REGION, -1);
 
-    /*
-     * Do what is necessary on exec here as the loader might need to alter the
-     * capabilities and it could be an unexpected result if whatever the loader
-     * does would be overriden.
-     */
-    priv_cred_init_exec(&curproc->cred);
+    /* The memory of a vfork() parent is no longer used. */
+    proc_vfork_release(curproc);
 
-    /* Load the image */
-    err = loader->load(curproc, file, &vaddr, &stack_size);
-    KERROR_DBG("Proc image loaded (err = %d)\n", err);
+    err = load_image(loader, curproc, file, &stack_size);
     if (err) {
         const struct ksignal_param sigparm = { .si_code = SEGV_MAPERR };
 
@@ -171,14 +231,9 @@ int exec_file(struct exec_loadfn * loader, int fildes,
     }
 
     /* Map new environment */
-    err = vm_insert_region(curproc, env_bp, VM_INSOP_MAP_REG);
-    if (err < 0) {
-        KERROR_DBG("Unable to map a new env\n");
+    err = map_env(curproc, env_bp);
+    if (err)
         goto fail;
-    }
-    vm_fixmemmap_proc(curproc);
-
-    KERROR_DBG("Memory mapping done (pid = %d)\n", curproc->pid);
 
     /* Close CLOEXEC files */
     fs_fildes_close_exec(curproc);
@@ -312,12 +367,57 @@ static int get_loader(int fildes, struct exec_loadfn ** loader)
     return err;
 }
 
+/**
+ * Copy in & out arguments and environ.
+ * @param[out] env_bp is set to the new env buffer, also on failure.
+ * @param[out] envp is set to the user space address of the environ.
+ * @param[out] name is set to the name of the new image.
+ */
+static int copyin_env(__user char * const * argv, size_t nargv,
+                      __user char * const * env, size_t nenv,
+                      struct buf ** env_bp, uintptr_t * envp,
+                      char name[PROC_NAME_SIZE])
+{
+    struct buf * bp;
+    size_t arg_offset = 0;
+    int err;
+
+    bp = geteblk(MMU_PGSIZE_COARSE);
+    *env_bp = bp;
+    if (!bp)
+        return -ENOMEM;
+
+    /* Currently copyin_aa() requires vaddr to be set. */
+    bp->b_mmu.vaddr = configUENV_BASE_ADDR;
+    bp->b_uflags = VM_PROT_READ | VM_PROT_WRITE;
+
+    /* Clone argv */
+    err = clone_aa(bp, (__user char *)argv, nargv, &arg_offset);
+    if (err) {
+        KERROR_DBG("Failed to clone args (%d)\n", err);
+        return err;
+    }
+    arg_offset = memalign(arg_offset);
+    *envp = bp->b_mmu.vaddr + arg_offset;
+
+    /* Clone env */
+    err = clone_aa(bp, (__user char *)env, nenv, &arg_offset);
+    if (err) {
+        KERROR_DBG("Failed to clone env (%d)\n", err);
+        return err;
+    }
+
+    strlcpy(name, (char *)(bp->b_data) + (nargv + 1) * sizeof(char *),
+            PROC_NAME_SIZE);
+
+    return 0;
+}
+
 static intptr_t sys_exec(__user void * user_args)
 {
     struct _exec_args args;
     char name[PROC_NAME_SIZE];
     struct buf * env_bp = NULL;
-    size_t arg_offset = 0;
     uintptr_t envp;
     struct exec_loadfn * loader;
     int err;
@@ -339,56 +439,282 @@ static intptr_t sys_exec(__user void * user_args)
     if (err)
         goto fail;
 
+    err = copyin_env(args.argv, args.nargv, args.env, args.nenv,
+                     &env_bp, &envp, name);
+    if (err)
+        goto fail;
+
     /*
-     * Copy in & out arguments and environ.
+     * Execute.
      */
-    env_bp = geteblk(MMU_PGSIZE_COARSE);
-    if (!env_bp) {
-        err = -ENOMEM;
+    err = exec_file(loader, args.fd, name, env_bp, args.nargv,
+                    env_bp->b_mmu.vaddr, envp);
+    if (err)
         goto fail;
+
+    return 0;
+fail:
+    if (env_bp && env_bp->vm_ops->rfree) {
+        env_bp->vm_ops->rfree(env_bp);
     }
+    set_errno(-err);
+    return -1;
+}
 
-    /* Currently copyin_aa() requires vaddr to be set. */
-    env_bp->b_mmu.vaddr = configUENV_BASE_ADDR;
-    env_bp->b_uflags = VM_PROT_READ | VM_PROT_WRITE;
+/**
+ * dup2() a file descriptor of a spawned process.
+ */
+static int spawn_dup2(struct proc_info * proc, int fd, int newfd)
+{
+    files_t * const files = proc->files;
+    file_t * file;
 
-    /* Clone argv */
-    err = clone_aa(env_bp, (__user char *)args.argv, args.nargv, &arg_offset);
+    if (newfd < 0 || newfd >= files->count)
+        return -EBADF;
+
+    file = fs_fildes_ref(files, fd, 1);
+    if (!file)
+        return -EBADF;
+
+    if (fd == newfd) {
+        fs_fildes_ref(files, fd, -1);
+        return 0;
+    }
+
+    (void)fs_fildes_close(proc, newfd);
+    files->fd[newfd] = file; /* The ref is now owned by newfd. */
+
+    return 0;
+}
+
+/**
+ * open() a file to a spawned process.
+ * The file is opened by the calling process, which has the same credentials,
+ * working directory and umask as the new process, and the descriptor is then
+ * moved to the new process.
+ */
+static int spawn_open(struct proc_info * proc,
+                      const struct _spawn_file_action * act)
+{
+    files_t * const files = proc->files;
+    vnode_autorele vnode_t * vnode = NULL;
+    char * path;
+    int fd;
+    int err;
+
+    if (act->fa_fd < 0 || act->fa_fd >= files->count)
+        return -EBADF;
+
+    path = kmalloc(PATH_MAX);
+    if (!path)
+        return -ENOMEM;
+
+    err = copyinstr((__user char *)act->fa_path, path, PATH_MAX, NULL);
+    if (err)
+        goto out;
+
+    err = fs_namei_proc(&vnode, AT_FDCWD, path, 0);
     if (err) {
-        KERROR_DBG("Failed to clone args (%d)\n", err);
+        if (!(act->fa_oflag & O_CREAT))
+            goto out;
+
+        /* umask is handled in fs_creat_curproc() */
+        err = fs_creat_curproc(path, S_IFREG | act->fa_mode, &vnode);
+        if (err)
+            goto out;
+    }
+
+    fd = fs_fildes_create_curproc(vnode, act->fa_oflag);
+    if (fd < 0) {
+        err = fd;
+        goto out;
+    }
+
+    (void)fs_fildes_close(proc, act->fa_fd);
+    files->fd[act->fa_fd] = curproc->files->fd[fd];
+    curproc->files->fd[fd] = NULL;
+out:
+    kfree(path);
+    return err;
+}
+
+/**
+ * Apply file actions to a spawned process in the given order.
+ */
+static int spawn_file_actions(struct proc_info * proc,
+                              const struct _spawn_file_action * fa, size_t nfa)
+{
+    for (size_t i = 0; i < nfa; i++) {
+        int err;
+
+        switch (fa[i].fa_type) {
+        case _SPAWN_FA_CLOSE:
+            err = fs_fildes_close(proc, fa[i].fa_fd);
+            break;
+        case _SPAWN_FA_DUP2:
+            err = spawn_dup2(proc, fa[i].fa_fd, fa[i].fa_newfd);
+            break;
+        case _SPAWN_FA_OPEN:
+            err = spawn_open(proc, &fa[i]);
+            break;
+        default:
+            err = -EINVAL;
+        }
+        if (err) {
+            KERROR_DBG("File action %u failed (%d)\n", i, err);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Build a new process image directly from an executable file.
+ * Unlike fork() followed by exec() the address space of the calling process is
+ * never copied, the new process is created with an empty memory map and
+ * the image is loaded to it from the calling thread.
+ */
+static intptr_t sys_exec_spawn(__user void * user_args)
+{
+    struct _exec_spawn_args args;
+    struct _spawn_file_action * fa = NULL;
+    char name[PROC_NAME_SIZE];
+    struct buf * env_bp = NULL;
+    uintptr_t envp;
+    struct exec_loadfn * loader;
+    struct proc_info * new_proc = NULL;
+    struct _sched_pthread_create_args main_def;
+    file_t * file = NULL;
+    size_t stack_size;
+    pid_t pid;
+    int err;
+
+    KERROR_DBG("%s: curpid: %d\n", __func__, curproc->pid);
+
+    err = priv_check(&curproc->cred, PRIV_PROC_FORK);
+    if (err)
+        goto fail;
+
+    err = copyin(user_args, &args, sizeof(args));
+    if (err) {
+        err = -EFAULT;
         goto fail;
     }
-    arg_offset = memalign(arg_offset);
-    envp = env_bp->b_mmu.vaddr + arg_offset;
 
-    /* Clone env */
-    err = clone_aa(env_bp, (__user char *)args.env, args.nenv, &arg_offset);
+    if (!args.argv || !args.env || args.nfa > _SPAWN_FA_MAX ||
+        (args.attr.sa_flags & ~(POSIX_SPAWN_RESETIDS | POSIX_SPAWN_SETPGROUP |
+                                POSIX_SPAWN_SETSIGDEF |
+                                POSIX_SPAWN_SETSIGMASK))) {
+        err = -EINVAL;
+        goto fail;
+    }
+
+    err = get_loader(args.fd, &loader);
+    if (err)
+        goto fail;
+
+    if (args.nfa > 0) {
+        const size_t fa_size = args.nfa * sizeof(struct _spawn_file_action);
+
+        fa = kmalloc(fa_size);
+        if (!fa) {
+            err = -ENOMEM;
+            goto fail;
+        }
+
+        err = copyin((__user void *)args.fa, fa, fa_size);
+        if (err) {
+            err = -EFAULT;
+            goto fail;
+        }
+    }
+
+    err = copyin_env(args.argv, args.nargv, args.env, args.nenv,
+                     &env_bp, &envp, name);
+    if (err)
+        goto fail;
+
+    file = fs_fildes_ref(curproc->files, args.fd, 1);
+    if (!file) {
+        err = -EBADF;
+        goto fail;
+    }
+    if (!S_ISREG(file->vnode->vn_mode)) {
+        err = -ENOEXEC;
+        goto fail;
+    }
+
+    err = proc_spawn_create(&new_proc);
     if (err) {
-        KERROR_DBG("Failed to clone env (%d)\n", err);
+        new_proc = NULL;
         goto fail;
     }
 
-    strlcpy(name, (char *)(env_bp->b_data) + (args.nargv + 1) * sizeof(char *),
-            sizeof(name));
+    /* The executable is not passed to the new process. */
+    (void)fs_fildes_close(new_proc, args.fd);
 
-    /*
-     * Execute.
-     */
-    err = exec_file(loader, args.fd, name, env_bp, args.nargv,
-                    env_bp->b_mmu.vaddr, envp);
+    err = spawn_file_actions(new_proc, fa, args.nfa);
     if (err)
         goto fail;
 
-    return 0;
+    if (args.attr.sa_flags & POSIX_SPAWN_RESETIDS) {
+        new_proc->cred.euid = new_proc->cred.uid;
+        new_proc->cred.egid = new_proc->cred.gid;
+    }
+
+    if (args.attr.sa_flags & POSIX_SPAWN_SETSIGDEF) {
+        err = ksignal_reset_ksigactions(&new_proc->sigs,
+                                        &args.attr.sa_sigdefault);
+        if (err)
+            goto fail;
+    }
+
+    err = load_image(loader, new_proc, file, &stack_size);
+    if (err)
+        goto fail;
+
+    err = map_env(new_proc, env_bp);
+    if (err)
+        goto fail;
+    env_bp = NULL; /* Owned by new_proc now. */
+
+    /* Close CLOEXEC files */
+    fs_fildes_close_exec(new_proc);
+
+    strlcpy(new_proc->name, name, sizeof(new_proc->name));
+
+    err = new_main_thread_def(new_proc, &main_def, args.nargv - 1,
+                              configUENV_BASE_ADDR, envp, stack_size);
+    if (err)
+        goto fail;
+
+    pid = proc_spawn_commit(new_proc, &args.attr, &main_def);
+    new_proc = NULL;
+    if (pid < 0) {
+        err = pid;
+        goto fail;
+    }
+
+    fs_fildes_ref(curproc->files, args.fd, -1);
+    kfree(fa);
+
+    return pid;
 fail:
+    if (new_proc)
+        proc_spawn_abort(new_proc);
+    if (file)
+        fs_fildes_ref(curproc->files, args.fd, -1);
     if (env_bp && env_bp->vm_ops->rfree) {
         env_bp->vm_ops->rfree(env_bp);
     }
+    kfree(fa);
     set_errno(-err);
     return -1;
 }
 
 static const syscall_handler_t exec_sysfnmap[] = {
     ARRDECL_SYSCALL_HNDL(SYSCALL_EXEC_EXEC, sys_exec),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_EXEC_SPAWN, sys_exec_spawn),
 };
 SYSCALL_HANDLERDEF(exec_syscall, exec_sysfnmap)
@@ -228,6 +228,21 @@ static int load_section(struct elf_ctx * ctx, size_t sect_index,
     }
 
     prot = p_flags2b_uflags(phdr->p_flags);
+
+    /*
+     * Read-only segments are paged in on demand and shared with the other
+     * processes executing the same file.
+     */
+    if (!(prot & VM_PROT_WRITE) && phdr->p_filesz > 0) {
+        sect = vm_text_newsect(ctx->file->vnode, phdr->p_offset,
+                               phdr->p_filesz, phdr->p_vaddr + ctx->rbase,
+                               phdr->p_memsz, prot);
+        if (sect) {
+            *region = sect;
+            return 0;
+        }
+    }
+
     sect = vm_newsect(phdr->p_vaddr + ctx->rbase, phdr->p_memsz, prot);
     if (!sect) {
         return -ENOMEM;
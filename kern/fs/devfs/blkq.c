@@ -0,0 +1,393 @@
+/**
+ *******************************************************************************
+ * @file    blkq.c
+ * @author  Olli Vanhoja
+ * @brief   Block device request queue.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/*
+ * Requests are dispatched in C-LOOK order: the next request is the one with
+ * the lowest block number following the previously dispatched request, and
+ * when there is no such request the sweep starts again from the lowest block
+ * number in the queue.
+ *
+ * Requests are dispatched by the blkq thread. A submitter only inserts its
+ * request into the queue, hands the queue over to the thread if the queue
+ * was idle, and sleeps in biowait(). While the thread is busy with a driver
+ * call the requests submitted meanwhile are sorted and merged in the queue.
+ * The thread drains a queue completely before moving to the next one.
+ *
+ * Before the thread exists, e.g. when the MBR is read at boot, the submitter
+ * dispatches the queued requests itself.
+ */
+
+#include <errno.h>
+#include <sys/types.h>
+#include <buf.h>
+#include <fs/blkq.h>
+#include <fs/devfs.h>
+#include <kerror.h>
+#include <kinit.h>
+#include <kmalloc.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <thread.h>
+#include <waitq.h>
+
+static pthread_t blkq_tid;
+
+/*
+ * Queues handed over to the blkq thread. A queue is in the list only while
+ * its bq_active is set and the thread hasn't yet started draining it.
+ * Lock order: bq_lock -> blkq_pending_lock.
+ */
+static TAILQ_HEAD(blkq_pending_head, blkq) blkq_pending =
+    TAILQ_HEAD_INITIALIZER(blkq_pending);
+static mtx_t blkq_pending_lock = MTX_INITIALIZER(MTX_TYPE_SPIN,
+                                                 MTX_OPT_DEFAULT);
+static struct waitq blkq_waitq;
+
+void blkq_init(struct blkq * bq, size_t maxblks)
+{
+    memset(bq, 0, sizeof(struct blkq));
+    mtx_init(&bq->bq_lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+    TAILQ_INIT(&bq->bq_head);
+    bq->bq_maxblks = maxblks;
+}
+
+static size_t req_nblks(struct dev_info * devnfo, struct buf * bp)
+{
+    return (bp->b_bcount + devnfo->block_size - 1) / devnfo->block_size;
+}
+
+/**
+ * Insert a request in the block number order.
+ * Requests to the same block are kept in the submission order.
+ */
+static void blkq_insert(struct blkq * bq, struct buf * bp)
+{
+    struct buf * it;
+
+    /* Sequential requests are the common case, so start from the tail. */
+    TAILQ_FOREACH_REVERSE(it, &bq->bq_head, blkq_head, b_qentry_) {
+        if (it->b_blkno <= bp->b_blkno)
+            break;
+    }
+    if (it)
+        TAILQ_INSERT_AFTER(&bq->bq_head, it, bp, b_qentry_);
+    else
+        TAILQ_INSERT_HEAD(&bq->bq_head, bp, b_qentry_);
+
+    bq->bq_nr_requests++;
+    if (++bq->bq_depth > bq->bq_max_depth)
+        bq->bq_max_depth = bq->bq_depth;
+}
+
+/**
+ * Select the next request to be dispatched.
+ */
+static struct buf * blkq_first(struct blkq * bq)
+{
+    struct buf * bp;
+
+    TAILQ_FOREACH(bp, &bq->bq_head, b_qentry_) {
+        if (bp->b_blkno >= bq->bq_pos)
+            return bp;
+    }
+
+    return TAILQ_FIRST(&bq->bq_head);
+}
+
+/**
+ * Test if next can be appended to a merged request ending to prev.
+ */
+static int blkq_can_merge(struct dev_info * devnfo, struct buf * prev,
+                          struct buf * next, size_t nblks)
+{
+    const size_t bsize = devnfo->block_size;
+    const unsigned long is_read = prev->b_flags & B_READ;
+
+    if ((next->b_flags & B_READ) != is_read ||
+        !(devnfo->flags & (is_read ? DEV_FLAGS_MB_READ : DEV_FLAGS_MB_WRITE)))
+        return 0;
+
+    if (prev->b_bcount % bsize || next->b_bcount % bsize ||
+        next->b_blkno != prev->b_blkno + prev->b_bcount / bsize)
+        return 0;
+
+    return nblks + next->b_bcount / bsize <= devnfo->blkq->bq_maxblks;
+}
+
+/**
+ * Remove the next request from the queue to run, together with the
+ * requests that can be merged with it.
+ * bq_lock must be held.
+ */
+static void blkq_collect(struct dev_info * devnfo, struct blkq_head * run)
+{
+    struct blkq * bq = devnfo->blkq;
+    struct buf * bp = blkq_first(bq);
+    size_t nblks = req_nblks(devnfo, bp);
+
+    while (1) {
+        struct buf * next = TAILQ_NEXT(bp, b_qentry_);
+
+        TAILQ_REMOVE(&bq->bq_head, bp, b_qentry_);
+        TAILQ_INSERT_TAIL(run, bp, b_qentry_);
+        bq->bq_depth--;
+
+        if (!next || !blkq_can_merge(devnfo, bp, next, nblks))
+            break;
+
+        nblks += req_nblks(devnfo, next);
+        bq->bq_nr_merged++;
+        bp = next;
+    }
+
+    bq->bq_pos = bp->b_blkno + req_nblks(devnfo, bp);
+    bq->bq_nr_dispatch++;
+}
+
+static ssize_t blkq_xfer(struct dev_info * devnfo, int write, size_t blkno,
+                         uint8_t * data, size_t bcount)
+{
+    if (write) {
+        if (!devnfo->write)
+            return -EOPNOTSUPP;
+        return devnfo->write(devnfo, blkno, data, bcount, 0);
+    } else {
+        if (!devnfo->read)
+            return -EOPNOTSUPP;
+        return devnfo->read(devnfo, blkno, data, bcount, 0);
+    }
+}
+
+/**
+ * Complete the requests of a run.
+ * @param ret is the number of bytes transferred for the whole run or an
+ *            error.
+ */
+static void blkq_complete(struct blkq_head * run, ssize_t ret)
+{
+    struct buf * bp;
+    size_t left = (ret > 0) ? ret : 0;
+
+    while ((bp = TAILQ_FIRST(run))) {
+        const size_t done = min(left, bp->b_bcount);
+
+        TAILQ_REMOVE(run, bp, b_qentry_);
+        left -= done;
+        bp->b_resid = bp->b_bcount - done;
+        if (bp->b_resid) {
+            bp->b_flags |= B_ERROR;
+            bp->b_error = (ret < 0) ? (int)ret : -EIO;
+        }
+        biodone(bp);
+    }
+}
+
+/**
+ * Dispatch a run of requests to the driver.
+ * Requests that are not contiguous in memory are transferred through a
+ * bounce buffer.
+ */
+static void blkq_dispatch(struct dev_info * devnfo, struct blkq_head * run)
+{
+    struct buf * first = TAILQ_FIRST(run);
+    struct buf * bp;
+    const int write = !(first->b_flags & B_READ);
+    size_t bcount = 0;
+    int contig = 1;
+    uint8_t * data;
+    ssize_t ret;
+
+    TAILQ_FOREACH(bp, run, b_qentry_) {
+        if (bp->b_data != first->b_data + bcount)
+            contig = 0;
+        bcount += bp->b_bcount;
+    }
+
+    if (contig) {
+        ret = blkq_xfer(devnfo, write, first->b_blkno,
+                        (uint8_t *)first->b_data, bcount);
+        blkq_complete(run, ret);
+        return;
+    }
+
+    data = kmalloc(bcount);
+    if (!data) {
+        /* Fall back to transferring the requests one by one. */
+        while ((bp = TAILQ_FIRST(run))) {
+            struct blkq_head one = TAILQ_HEAD_INITIALIZER(one);
+
+            TAILQ_REMOVE(run, bp, b_qentry_);
+            TAILQ_INSERT_TAIL(&one, bp, b_qentry_);
+            ret = blkq_xfer(devnfo, write, bp->b_blkno,
+                            (uint8_t *)bp->b_data, bp->b_bcount);
+            blkq_complete(&one, ret);
+        }
+        return;
+    }
+
+    if (write) {
+        size_t off = 0;
+
+        TAILQ_FOREACH(bp, run, b_qentry_) {
+            memcpy(data + off, (void *)bp->b_data, bp->b_bcount);
+            off += bp->b_bcount;
+        }
+    }
+
+    ret = blkq_xfer(devnfo, write, first->b_blkno, data, bcount);
+
+    if (!write && ret > 0) {
+        size_t off = 0;
+
+        TAILQ_FOREACH(bp, run, b_qentry_) {
+            if (off >= (size_t)ret)
+                break;
+            memcpy((void *)bp->b_data, data + off,
+                   min(bp->b_bcount, (size_t)ret - off));
+            off += bp->b_bcount;
+        }
+    }
+
+    kfree(data);
+    blkq_complete(run, ret);
+}
+
+/**
+ * Dispatch queued requests until the queue is empty.
+ * bq_lock must be held and bq_active set by the caller.
+ */
+static void blkq_drain(struct blkq * bq)
+{
+    struct dev_info * devnfo = bq->bq_devnfo;
+
+    while (!TAILQ_EMPTY(&bq->bq_head)) {
+        struct blkq_head run = TAILQ_HEAD_INITIALIZER(run);
+
+        blkq_collect(devnfo, &run);
+        mtx_unlock(&bq->bq_lock);
+        blkq_dispatch(devnfo, &run);
+        mtx_lock(&bq->bq_lock);
+    }
+    bq->bq_active = 0;
+}
+
+void blkq_strategy(struct dev_info * devnfo, struct buf * bp)
+{
+    struct blkq * bq = devnfo->blkq;
+
+    KASSERT(bq, "devnfo should have a blkq");
+
+    bp->b_flags &= ~(B_DONE | B_ERROR);
+    bp->b_error = 0;
+    bp->b_resid = bp->b_bcount;
+
+    mtx_lock(&bq->bq_lock);
+    blkq_insert(bq, bp);
+    if (!bq->bq_active) {
+        bq->bq_active = 1;
+        bq->bq_devnfo = devnfo;
+
+        if (blkq_tid > 0) {
+            mtx_lock(&blkq_pending_lock);
+            TAILQ_INSERT_TAIL(&blkq_pending, bq, bq_pending_entry_);
+            waitq_wakeup(&blkq_waitq);
+            mtx_unlock(&blkq_pending_lock);
+        } else {
+            blkq_drain(bq);
+        }
+    }
+    mtx_unlock(&bq->bq_lock);
+}
+
+ssize_t blkq_rw(struct dev_info * devnfo, int write, off_t blkno,
+                uint8_t * buf, size_t bcount)
+{
+    struct buf req = {
+        .b_data = (uintptr_t)buf,
+        .b_bufsize = bcount,
+        .b_bcount = bcount,
+        .b_blkno = blkno,
+        .b_flags = B_BUSY | (write ? 0 : B_READ),
+    };
+    int err;
+
+    mtx_init(&req.lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+
+    blkq_strategy(devnfo, &req);
+    err = biowait(&req);
+    if (err)
+        return err;
+
+    return req.b_bcount - req.b_resid;
+}
+
+static void * blkq_thread(void * arg)
+{
+    while (1) {
+        struct blkq * bq;
+
+        mtx_lock(&blkq_pending_lock);
+        bq = TAILQ_FIRST(&blkq_pending);
+        if (!bq) {
+            (void)waitq_wait(&blkq_waitq, &blkq_pending_lock, 0);
+            continue;
+        }
+        TAILQ_REMOVE(&blkq_pending, bq, bq_pending_entry_);
+        mtx_unlock(&blkq_pending_lock);
+
+        mtx_lock(&bq->bq_lock);
+        blkq_drain(bq);
+        mtx_unlock(&bq->bq_lock);
+    }
+
+    return NULL;
+}
+
+int __kinit__ blkq_thread_init(void)
+{
+    SUBSYS_DEP(proc_init);
+    SUBSYS_INIT("blkq");
+
+    struct sched_param param = {
+        .sched_policy = SCHED_OTHER,
+        .sched_priority = NZERO,
+    };
+
+    waitq_init(&blkq_waitq);
+    blkq_tid = kthread_create("blkq", &param, 0, blkq_thread, NULL);
+    if (blkq_tid < 0) {
+        KERROR(KERROR_ERR, "Failed to create a thread for blkq\n");
+        return blkq_tid;
+    }
+
+    return 0;
+}
@@ -34,6 +34,8 @@
 #include <errno.h>
 #include <sys/dev_major.h>
 #include <sys/ioctl.h>
+#include <fs/blkq.h>
+#include <fs/dcache.h>
 #include <fs/devfs.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
@@ -87,6 +89,7 @@ int __kinit__ devfs_init(void)
      */
     static fs_t devfs_fs = {
         .fsname = DEVFS_FSNAME,
+        .fs_flags = FS_FLAG_DCACHE,
         .mount = devfs_mount,
         .sblist_head = SLIST_HEAD_INITIALIZER(),
     };
@@ -148,6 +151,7 @@ int make_dev(struct dev_info * devnfo, uid_t uid, gid_t gid, int perms,
         return -EEXIST;
 
     err = devfs_vnode_ops.mknod(vn_devfs, devnfo->dev_name, mode, devnfo, &vn);
+    dcache_invalidate(vn_devfs, devnfo->dev_name);
     if (err)
         return err;
 
@@ -167,6 +171,7 @@ void destroy_dev(vnode_t * vn)
     char name[NAME_MAX];
 
     vn_devfs->vnode_ops->revlookup(vn_devfs, &vn->vn_num, name, sizeof(name));
+    dcache_invalidate(vn_devfs, name);
     vn_devfs->vnode_ops->unlink(vn_devfs, name);
 }
 
@@ -253,6 +258,9 @@ ssize_t dev_read(file_t * file, struct uio * uio, size_t bcount)
     if (err)
         return err;
 
+    if (devnfo->blkq)
+        return blkq_rw(devnfo, 0, offset, buf, bcount);
+
     if ((devnfo->flags & DEV_FLAGS_MB_READ) &&
             ((bcount / devnfo->block_size) > 1)) {
         return devnfo->read(devnfo, offset, buf, bcount, oflags);
@@ -305,6 +313,9 @@ ssize_t dev_write(file_t * file, struct uio * uio, size_t bcount)
     if (err)
         return err;
 
+    if (devnfo->blkq)
+        return blkq_rw(devnfo, 1, offset, buf, bcount);
+
     if ((devnfo->flags & DEV_FLAGS_MB_WRITE) &&
             ((bcount / devnfo->block_size) > 1)) {
         return devnfo->write(devnfo, offset, buf, bcount, oflags);
@@ -38,6 +38,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <buf.h>
 #include <kerror.h>
 #include <kinit.h>
 #include <kstring.h>
@@ -69,6 +70,11 @@ static int fresult2errno(int fresult);
 static struct fs fatfs_fs = {
     .fsname = FATFS_FSNAME,
     .fs_majornum = VDEV_MJNR_FATFS,
+    /*
+     * Not FS_FLAG_DCACHE, FAT name lookups are case-insensitive but the
+     * dcache is keyed by the exact name.
+     */
+    .fs_flags = 0,
     .mount = fatfs_mount,
     .sblist_head = SLIST_HEAD_INITIALIZER(),
 };
@@ -252,6 +258,7 @@ static int fatfs_mount(fs_t * fs, const char * source, uint32_t mode,
 
 fail:
     if (retval && fatfs_sb) {
+        fatfs_ra_free(fatfs_sb);
         kfree(fatfs_sb);
     } else {
         *sb = &fatfs_sb->sb;
@@ -273,6 +280,7 @@ static int fatfs_umount(struct fs_superblock * fs_sb)
      */
     fs_remove_superblock(fs_sb->fs, &fatfs_sb->sb);
     f_umount(&fatfs_sb->ff_fs);
+    fatfs_ra_free(fatfs_sb);
     vrele(fatfs_sb->ff_devfile.vnode);
     inpool_destroy(&fatfs_sb->inpool);
     kfree(fatfs_sb);
@@ -696,7 +704,7 @@ ssize_t fatfs_read(file_t * file, struct uio * uio, size_t count)
     if (err)
         return err;
 
-    err = f_read(&in->fp, buf, count, &count_out);
+    err = f_read(&in->fp, buf, count, &count_out, &file->f_ra);
     if (err)
         return fresult2errno(err);
 
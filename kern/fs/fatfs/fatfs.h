@@ -64,6 +64,30 @@ struct fatfs_inode {
     };
 };
 
+/**
+ * Number of read-ahead buffers per mount.
+ */
+#define FATFS_RA_BUFS           4
+
+/**
+ * Initial read-ahead window in sectors.
+ */
+#define FATFS_RA_MIN            8
+
+/**
+ * Max read-ahead window in sectors.
+ */
+#define FATFS_RA_MAX            64
+
+/**
+ * Sectors read ahead from the device.
+ */
+struct fatfs_ra_buf {
+    DWORD sector;       /*!< First sector in the buffer. */
+    unsigned nsect;     /*!< Number of valid sectors; 0 if unused. */
+    uint8_t * data;     /*!< Room for FATFS_RA_MAX sectors. */
+};
+
 /**
  * FatFs superblock.
  */
@@ -73,6 +97,9 @@ struct fatfs_sb {
     file_t ff_devfile;          /*!< Fs device. */
     FATFS ff_fs;                /*!< ff descriptor. */
     char fpath_root[2];         /*!< fpath for root. */
+    /** Read-ahead buffers, protected by ff_fs.sobj. */
+    struct fatfs_ra_buf ff_ra[FATFS_RA_BUFS];
+    unsigned ff_ra_next;        /*!< Next read-ahead buffer to be reused. */
 };
 
 /**
@@ -99,6 +126,11 @@ struct fatfs_sb {
 #define get_inode_of_vnode(vn) \
     (containerof(vn, struct fatfs_inode, in_vnode))
 
+/**
+ * Free the read-ahead buffers of a mount.
+ */
+void fatfs_ra_free(struct fatfs_sb * ffsb);
+
 ssize_t fatfs_read(file_t * file, struct uio * uio, size_t count);
 ssize_t fatfs_write(file_t * file, struct uio * uio, size_t count);
 int fatfs_create(vnode_t * dir, const char * name, mode_t mode,
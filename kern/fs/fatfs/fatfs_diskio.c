@@ -37,12 +37,125 @@
 #include <libkern.h>
 #include <hal/core.h>
 #include <kerror.h>
+#include <kmalloc.h>
 #include <fs/fs.h>
 #include <fs/devfs.h>
 #include "fatfs.h"
 
+/*
+ * Sequential file data reads are followed by a read-ahead of the next
+ * sectors with a single multi-block device read. The sectors read ahead are
+ * kept in a small set of per mount buffers, so each reader of a different
+ * file can have its own buffer. Sequential access is tracked per open file
+ * in struct file_ra that is passed down by f_read(). All functions here are
+ * called while holding the FatFs lock of the mount.
+ */
+
+/**
+ * Read sectors directly from the device.
+ * A private copy of the device file is used for the seek pointer.
+ * @return Returns the number of bytes read; Otherwise a negative errno.
+ */
+static ssize_t fatfs_dev_read(struct fatfs_sb * ffsb, uint8_t * buff,
+                              DWORD sector, size_t count)
+{
+    file_t file = ffsb->ff_devfile;
+    struct vnode_ops * vnops = file.vnode->vnode_ops;
+    struct uio uio;
+    ssize_t retval;
+
+    retval = vnops->lseek(&file, sector, SEEK_SET);
+    if (retval < 0)
+        return retval;
+
+    uio_init_kbuf(&uio, buff, count);
+    return vnops->read(&file, &uio, count);
+}
+
+/**
+ * Copy sectors from a read-ahead buffer.
+ * @return Returns 1 if all the sectors were found; Otherwise 0.
+ */
+static int fatfs_ra_lookup(struct fatfs_sb * ffsb, uint8_t * buff,
+                           DWORD sector, size_t nsect)
+{
+    const size_t ssize = ffsb->ff_fs.ssize;
+
+    for (size_t i = 0; i < FATFS_RA_BUFS; i++) {
+        struct fatfs_ra_buf * rab = &ffsb->ff_ra[i];
+
+        if (rab->nsect > 0 && sector >= rab->sector &&
+            sector + nsect <= rab->sector + rab->nsect) {
+            memcpy(buff, rab->data + (sector - rab->sector) * ssize,
+                   nsect * ssize);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Read ahead nsect sectors starting from sector.
+ * The least recently filled buffer is reused.
+ */
+static void fatfs_ra_fill(struct fatfs_sb * ffsb, DWORD sector, size_t nsect)
+{
+    const size_t ssize = ffsb->ff_fs.ssize;
+    struct fatfs_ra_buf * rab = &ffsb->ff_ra[ffsb->ff_ra_next];
+    ssize_t n;
+
+    if (!rab->data) {
+        rab->data = kmalloc(FATFS_RA_MAX * ssize);
+        if (!rab->data)
+            return;
+    }
+    ffsb->ff_ra_next = (ffsb->ff_ra_next + 1) % FATFS_RA_BUFS;
+
+    rab->nsect = 0;
+    n = fatfs_dev_read(ffsb, rab->data, sector, nsect * ssize);
+    if (n > 0) {
+        /* The read may end short at the end of the device. */
+        rab->sector = sector;
+        rab->nsect = n / ssize;
+    }
+}
+
+/**
+ * Update the read-ahead buffers after sectors were written to the device.
+ */
+static void fatfs_ra_update(struct fatfs_sb * ffsb, const uint8_t * buff,
+                            DWORD sector, size_t nsect)
+{
+    const size_t ssize = ffsb->ff_fs.ssize;
+
+    for (size_t i = 0; i < FATFS_RA_BUFS; i++) {
+        struct fatfs_ra_buf * rab = &ffsb->ff_ra[i];
+        const DWORD start = max(sector, rab->sector);
+        const DWORD end = min(sector + nsect, rab->sector + rab->nsect);
+
+        if (rab->nsect == 0 || start >= end)
+            continue;
+
+        memcpy(rab->data + (start - rab->sector) * ssize,
+               buff + (start - sector) * ssize, (end - start) * ssize);
+    }
+}
+
+void fatfs_ra_free(struct fatfs_sb * ffsb)
+{
+    for (size_t i = 0; i < FATFS_RA_BUFS; i++) {
+        kfree(ffsb->ff_ra[i].data);
+        ffsb->ff_ra[i].data = NULL;
+        ffsb->ff_ra[i].nsect = 0;
+    }
+}
+
 /**
  * Read sector(s).
+ * File data reads are served from the read-ahead buffers when possible.
+ * Otherwise the sectors are read with a single device read, followed by a
+ * read-ahead if the file is read sequentially.
  * @param buff      is a data buffer to store read data.
  * @param sector    is a sector address in LBA.
  * @param count     is the number of bytes to read.
@@ -51,21 +164,30 @@
 DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
                         unsigned int count)
 {
-    file_t * file = &get_ffsb_of_fffs(ff_fs)->ff_devfile;
-    struct vnode_ops * vnops = file->vnode->vnode_ops;
-    struct uio uio;
+    struct fatfs_sb * ffsb = get_ffsb_of_fffs(ff_fs);
+    /* Reads to the window are FAT and directory accesses. */
+    struct file_ra * ra = (buff != ff_fs->win) ? ff_fs->ra : NULL;
+    const size_t nsect = count / ff_fs->ssize;
+    unsigned ra_window = 0;
     ssize_t retval;
 
-    retval = vnops->lseek(file, sector, SEEK_SET);
-    if (retval < 0) {
-#ifdef configFATFS_DEBUG
-        KERROR(KERROR_ERR, "%s(): err %i\n", __func__, retval);
-#endif
-        return RES_ERROR;
+    if (fatfs_ra_lookup(ffsb, buff, sector, nsect)) {
+        if (ra)
+            ra->ra_next = sector + nsect;
+        return 0;
     }
 
-    uio_init_kbuf(&uio, buff, count);
-    retval = vnops->read(file, &uio, count);
+    if (ra) {
+        if (sector == ra->ra_next) {
+            /* Sequential access, grow the window. */
+            ra_window = min(max(ra->ra_window * 2, FATFS_RA_MIN),
+                            FATFS_RA_MAX);
+        }
+        ra->ra_window = ra_window;
+        ra->ra_next = sector + nsect;
+    }
+
+    retval = fatfs_dev_read(ffsb, buff, sector, count);
     if (retval < 0) {
 #ifdef configFATFS_DEBUG
         KERROR(KERROR_ERR, "fatfs_disk_read(): err %i\n", retval);
@@ -81,11 +203,16 @@ DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
         return RES_PARERR;
     }
 
+    if (ra_window > 0)
+        fatfs_ra_fill(ffsb, sector + nsect, ra_window);
+
     return 0;
 }
 
 /**
  * Write sector(s).
+ * The sectors are written to the device with a single write and the copies
+ * of the sectors in the read-ahead buffers are updated.
  * @param buff      is the data buffer to be written.
  * @param sector    is a sector address in LBA.
  * @param count     is the number of bytes to write.
@@ -93,12 +220,17 @@ DRESULT fatfs_disk_read(FATFS * ff_fs, uint8_t * buff, DWORD sector,
 DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
                          unsigned int count)
 {
-    file_t * file = &get_ffsb_of_fffs(ff_fs)->ff_devfile;
-    struct vnode_ops * vnops = file->vnode->vnode_ops;
+    struct fatfs_sb * ffsb = get_ffsb_of_fffs(ff_fs);
+    file_t file = ffsb->ff_devfile;
+    struct vnode_ops * vnops = file.vnode->vnode_ops;
     struct uio uio;
     ssize_t retval;
 
-    retval = vnops->lseek(file, sector, SEEK_SET);
+    /*
+     * Use a private copy of the device file as the seek pointer of the
+     * shared one would race with other writers.
+     */
+    retval = vnops->lseek(&file, sector, SEEK_SET);
     if (retval < 0) {
 #ifdef configFATFS_DEBUG
         KERROR(KERROR_ERR, "%s(): err %i\n", __func__, retval);
@@ -107,7 +239,7 @@ DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
     }
 
     uio_init_kbuf(&uio, (void *)buff, count);
-    retval = vnops->write(file, &uio, count);
+    retval = vnops->write(&file, &uio, count);
     if (retval < 0) {
 #ifdef configFATFS_DEBUG
         KERROR(KERROR_ERR, "%s(): err %i\n", __func__, retval);
@@ -115,6 +247,9 @@ DRESULT fatfs_disk_write(FATFS * ff_fs, const uint8_t * buff, DWORD sector,
         return RES_ERROR;
     }
 
+    /* Only the sectors that were completely written. */
+    fatfs_ra_update(ffsb, buff, sector, retval / ff_fs->ssize);
+
     if (retval != (ssize_t)count)
         return RES_PARERR;
 
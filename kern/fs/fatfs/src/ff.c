@@ -410,6 +410,7 @@ static void unlock_fs(FATFS * fs, FRESULT res)
             res != FR_INVALID_DRIVE &&
             res != FR_INVALID_OBJECT &&
             res != FR_TIMEOUT, "fs is valid");
+    fs->ra = NULL;
     mtx_unlock(&fs->sobj);
 }
 
@@ -2188,8 +2189,10 @@ fail:
  * @param buff Pointer to data buffer.
  * @param btr Number of bytes to read.
  * @param br Pointer to number of bytes read.
+ * @param ra Pointer to the read-ahead state of the reader, can be NULL.
  */
-FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
+FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br,
+               struct file_ra * ra)
 {
     DWORD clst;
     DWORD sect;
@@ -2204,6 +2207,7 @@ FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br)
     KASSERT(fp->fs, "fs should be set");
     if (lock_fs(fp->fs))
         return FR_TIMEOUT;
+    fp->fs->ra = ra;                            /* Cleared by unlock_fs() */
     if (fp->err)                                /* Check error */
         return LEAVE_FF(fp->fs, (FRESULT)fp->err);
     if (!(fp->flag & FA_READ))                  /* Check access mode */
@@ -26,6 +26,8 @@ __BEGIN_DECLS
 #include "integer.h"    /* Basic integer types */
 #include "ffconf.h"     /* FatFs configuration options */
 
+struct file_ra;
+
 /*
  * Type of path name strings on FatFs API
  */
@@ -71,6 +73,7 @@ typedef struct {
     WORD    n_rootdir;      /* Number of root directory entries (FAT12/16) */
     WORD    ssize;          /* uint8_ts per sector (512, 1024, 2048 or 4096) */
     mtx_t   sobj;           /* Identifier of sync object */
+    struct file_ra * ra;    /* Read-ahead state of the file being read */
     unsigned opt;           /* fs mount options */
     DWORD   last_clust;     /* Last allocated cluster */
     DWORD   free_clust;     /* Number of free clusters */
@@ -173,7 +176,8 @@ typedef enum {
 /* FatFs module application interface                           */
 
 FRESULT f_open(FF_FIL * fp, FATFS * fs, const TCHAR * path, uint8_t mode);
-FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br);
+FRESULT f_read(FF_FIL * fp, void * buff, unsigned int btr, unsigned int * br,
+               struct file_ra * ra);
 FRESULT f_write(FF_FIL * fp, const void * buff, unsigned int btw,
                 unsigned int * bw);
 FRESULT f_lseek(FF_FIL * fp, DWORD ofs);
@@ -38,6 +38,7 @@
 #include <termios.h>
 #include <unistd.h>
 #include <buf.h>
+#include <fs/dcache.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
 #include <fs/mbr.h>
@@ -284,6 +285,9 @@ int fs_umount(struct fs_superblock * sb)
     root->vn_prev_mountpoint = root;
     VN_UNLOCK(root);
 
+    dcache_purge_sb(sb);
+    vm_text_purge_sb(sb);
+
     return sb->umount(sb);
 }
 
@@ -324,7 +328,7 @@ int lookup_vnode(vnode_t ** result, vnode_t * root, const char * str, int oflags
 
 again:  /* Get vnode by name in this dir. */
         vnode = NULL;
-        retval = (*result)->vnode_ops->lookup(*result, nodename, &vnode);
+        retval = dcache_lookup(*result, nodename, &vnode);
         vrele(*result);
         KASSERT((retval == 0 && vnode != NULL) || (retval != 0),
                 "vnode should be valid if !retval");
@@ -545,6 +549,7 @@ int fs_fildes_set(file_t * fildes, vnode_t * vnode, int oflags)
 
     fildes->vnode = vnode;
     fildes->oflags = oflags;
+    fildes->f_ra = (struct file_ra){ 0 };
     kobj_init(&fildes->f_obj, fs_fildes_dtor);
 
     return 0;
@@ -580,6 +585,13 @@ perms_ok:
         goto out;
     }
 
+    /* Text of a running executable can't be modified. */
+    if ((oflags & O_WRONLY) && S_ISREG(vnode->vn_mode)) {
+        retval = vm_text_purge(vnode);
+        if (retval)
+            goto out;
+    }
+
     retval = vnode->vnode_ops->stat(vnode, &stat_buf);
     if (retval) {
         goto out;
@@ -849,6 +861,7 @@ int fs_creat_curproc(const char * pathname, mode_t mode, vnode_t ** result)
     mode &= ~S_IFMT; /* Filter out file type bits */
     mode &= ~curproc->files->umask;
     retval = dir->vnode_ops->create(dir, name, mode, result);
+    dcache_invalidate(dir, name);
 
     KERROR_DBG("%s() result: %p\n", __func__, *result);
 
@@ -900,7 +913,10 @@ int fs_link_curproc(int fd1, const char * path1,
         return err;
     }
 
-    return vndir_dst->vnode_ops->link(vndir_dst, vn_src, targetname);
+    err = vndir_dst->vnode_ops->link(vndir_dst, vn_src, targetname);
+    dcache_invalidate(vndir_dst, targetname);
+
+    return err;
 }
 
 int fs_unlink_curproc(int fd, const char * path, int atflags)
@@ -951,7 +967,10 @@ int fs_unlink_curproc(int fd, const char * path, int atflags)
         return err;
     }
 
-    return dir->vnode_ops->unlink(dir, filename);
+    err = dir->vnode_ops->unlink(dir, filename);
+    dcache_invalidate(dir, filename);
+
+    return err;
 }
 
 int fs_mkdir_curproc(const char * pathname, mode_t mode)
@@ -973,7 +992,10 @@ int fs_mkdir_curproc(const char * pathname, mode_t mode)
 
     mode &= ~S_IFMT; /* Filter out file type bits */
     mode &= ~curproc->files->umask;
-    return dir->vnode_ops->mkdir(dir, name, mode);
+    err = dir->vnode_ops->mkdir(dir, name, mode);
+    dcache_invalidate(dir, name);
+
+    return err;
 }
 
 int fs_rmdir_curproc(const char * pathname)
@@ -998,7 +1020,10 @@ int fs_rmdir_curproc(const char * pathname)
         return err;
     }
 
-    return dir->vnode_ops->rmdir(dir, name);
+    err = dir->vnode_ops->rmdir(dir, name);
+    dcache_invalidate(dir, name);
+
+    return err;
 }
 
 int fs_utimes_curproc(int fildes, const struct timespec times[2])
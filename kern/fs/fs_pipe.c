@@ -32,8 +32,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/priv.h>
+#include <sys/sysctl.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <buf.h>
@@ -42,35 +46,57 @@
 #include <kerror.h>
 #include <kinit.h>
 #include <kmalloc.h>
+#include <kstring.h>
 #include <libkern.h>
 #include <proc.h>
-#include <queue_r.h>
 #include <kern_ipc.h>
+#include <waitq.h>
 
 /*
+ * The pipe data is kept in a ring buffer and copied in and out with at most
+ * two memcpy()s per call. Readers sleep in sp_rwait while the pipe is empty
+ * and writers sleep in sp_wwait while it's full. Writes of at most PIPE_BUF
+ * bytes wait until the whole write fits into the buffer so they are never
+ * interleaved with other writes.
+ *
+ * splice() and tee() move data between a pipe and another file by passing a
+ * span of the ring buffer directly to the read or write function of the other
+ * file, so the data is copied only once in the kernel. While the span is out
+ * of sp_lock it's protected by SP_RBUSY or SP_WBUSY, which keep the other
+ * readers or writers of the pipe waiting.
+ *
  * TODO
- * - We should guarantee atomicity for transactions uder PIPE_BUF bytes
  * - Setting O_ASYNC should cause SIGIO to be sent if new input becomes
  *   available
  */
 
-/*
- * Just a humble guess that lazy yield may render improved performance on
- * MP system.
- */
-#ifdef configMP
-#define PIPE_YIELD_STRATEGY THREAD_YIELD_LAZY
-#else
-#define PIPE_YIELD_STRATEGY THREAD_YIELD_IMMEDIATE
-#endif
+SYSCTL_DECL(_kern_ipc);
+SYSCTL_NODE(_kern, OID_AUTO, ipc, CTLFLAG_RW, 0,
+            "IPC");
+
+static size_t pipe_max_size = 256 * 1024;
+SYSCTL_UINT(_kern_ipc, OID_AUTO, pipe_max_size, CTLFLAG_RW,
+            &pipe_max_size, 0,
+            "Max pipe capacity settable with F_SETPIPE_SZ");
+
+#define SP_RCLOSED  0x01 /*!< The read end is closed. */
+#define SP_WCLOSED  0x02 /*!< The write end is closed. */
+#define SP_RBUSY    0x04 /*!< Data at the read index is being spliced out. */
+#define SP_WBUSY    0x08 /*!< Free space is being spliced into. */
 
 /**
  * Pipe descriptor pointed by file->stream.
  */
 struct stream_pipe {
     struct vnode vnode;
-    struct queue_cb q;
     struct buf * bp;
+    size_t sp_size;             /*!< Capacity of the ring buffer. */
+    size_t sp_rd;               /*!< Read index. */
+    size_t sp_len;              /*!< Number of bytes in the ring buffer. */
+    int sp_flags;
+    mtx_t sp_lock;              /*!< Protects the ring buffer and sp_flags. */
+    struct waitq sp_rwait;      /*!< Readers waiting for data. */
+    struct waitq sp_wwait;      /*!< Writers waiting for space. */
     file_t file0; /*!< Read end. */
     file_t file1; /*!< Write end. */
     uid_t owner;
@@ -83,6 +109,8 @@ struct stream_pipe {
 
 static ssize_t fs_pipe_write(file_t * file, struct uio * uio, size_t count);
 static ssize_t fs_pipe_read(file_t * file, struct uio * uio, size_t count);
+static int fs_pipe_ioctl(file_t * file, unsigned request, void * arg,
+                         size_t arg_len);
 static int fs_pipe_stat(vnode_t * vnode, struct stat * stat);
 static int fs_pipe_chmod(vnode_t * vnode, mode_t mode);
 static int fs_pipe_chown(vnode_t * vnode, uid_t owner, gid_t group);
@@ -90,6 +118,7 @@ static int fs_pipe_chown(vnode_t * vnode, uid_t owner, gid_t group);
 static vnode_ops_t fs_pipe_ops = {
     .write = fs_pipe_write,
     .read = fs_pipe_read,
+    .ioctl = fs_pipe_ioctl,
     .stat = fs_pipe_stat,
     .chmod = fs_pipe_chmod,
     .chown = fs_pipe_chown,
@@ -118,10 +147,30 @@ int __kinit__ fs_pipe_init(void)
     return 0;
 }
 
+/**
+ * Destructor for the pipe end file descriptors.
+ * Marks the end closed and wakes up the threads waiting on the other end.
+ */
+static void fs_pipe_fildes_dtor(struct kobj * obj)
+{
+    file_t * file = containerof(obj, struct file, f_obj);
+    struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
+
+    mtx_lock(&pipe->sp_lock);
+    pipe->sp_flags |= (file == &pipe->file0) ? SP_RCLOSED : SP_WCLOSED;
+    mtx_unlock(&pipe->sp_lock);
+
+    waitq_wakeup_all(&pipe->sp_rwait);
+    waitq_wakeup_all(&pipe->sp_wwait);
+
+    vrele(file->vnode);
+}
+
 static void init_file(file_t * file, vnode_t * vn, struct stream_pipe * pipe,
                       int oflags)
 {
     fs_fildes_set(file, vn, oflags);
+    kobj_init(&file->f_obj, fs_pipe_fildes_dtor);
 
     file->oflags &= ~O_CLOEXEC;
     file->stream = pipe;
@@ -161,26 +210,24 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
      * | pipe       |<--.
      * +------------+   |
      * | bp         |----------.
-     * | q          |   |      |
-     * |  data      |-------------------.
-     * | file0      |   |      |        |
-     * |  stream    |---+      |        |
-     * |  ...       |   |      |        |
-     * | file1      |   |      |        |
-     * |  stream    |---|      |        |
-     * |  ...       |   |      |        |
-     * | vnode      |   |      |        |
-     * |  specinfo  |---       |        |
-     * | owner      |          \/       |
-     * | group      |      +--------+   |
-     * +------------+      | buf    |   |
-     *                     +--------+   |
+     * | file0      |   |      |
+     * |  stream    |---+      |
+     * |  ...       |   |      |
+     * | file1      |   |      |
+     * |  stream    |---|      |
+     * |  ...       |   |      |
+     * | vnode      |   |      |
+     * |  specinfo  |---       |
+     * | owner      |          \/
+     * | group      |      +--------+
+     * +------------+      | buf    |
+     *                     +--------+
      *                     | b_data |---+
      *                     +--------+   |
      *                                  |
      *                                  \/
      *                               +-------+
-     *                               |       |
+     *                               | ring  |
      */
     pipe = kzalloc(sizeof(struct stream_pipe));
     bp = geteblk(len);
@@ -195,9 +242,12 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
     file1 = &pipe->file1;
     vnode = &pipe->vnode;
 
-    /* Init queue */
+    /* Init the ring buffer */
     pipe->bp = bp;
-    pipe->q = queue_create((char *)bp->b_data, sizeof(char), len);
+    pipe->sp_size = len;
+    mtx_init(&pipe->sp_lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+    waitq_init(&pipe->sp_rwait);
+    waitq_init(&pipe->sp_wwait);
     pipe->owner = curproc->cred.euid;
     pipe->group = curproc->cred.egid;
 
@@ -235,81 +285,432 @@ int fs_pipe_destroy(vnode_t * vnode)
     return 0;
 }
 
+static struct stream_pipe * file2pipe(file_t * file)
+{
+    if (file->vnode->vnode_ops != &fs_pipe_ops)
+        return NULL;
+    return (struct stream_pipe *)file->stream;
+}
+
+/**
+ * Copy count bytes to the ring buffer.
+ * sp_lock must be held and there must be enough space in the buffer.
+ */
+static void ring_put(struct stream_pipe * pipe, const uint8_t * src,
+                     size_t count)
+{
+    uint8_t * data = (uint8_t *)pipe->bp->b_data;
+    const size_t wr = (pipe->sp_rd + pipe->sp_len) % pipe->sp_size;
+    const size_t n = min(count, pipe->sp_size - wr);
+
+    memcpy(data + wr, src, n);
+    memcpy(data, src + n, count - n);
+    pipe->sp_len += count;
+}
+
+/**
+ * Remove count bytes from the head of the ring buffer.
+ * sp_lock must be held.
+ */
+static void ring_consume(struct stream_pipe * pipe, size_t count)
+{
+    pipe->sp_rd = (pipe->sp_rd + count) % pipe->sp_size;
+    pipe->sp_len -= count;
+}
+
+/**
+ * Copy count bytes from the ring buffer.
+ * sp_lock must be held and there must be enough data in the buffer.
+ */
+static void ring_get(struct stream_pipe * pipe, uint8_t * dst, size_t count)
+{
+    const uint8_t * data = (uint8_t *)pipe->bp->b_data;
+    const size_t n = min(count, pipe->sp_size - pipe->sp_rd);
+
+    memcpy(dst, data + pipe->sp_rd, n);
+    memcpy(dst + n, data, count - n);
+    ring_consume(pipe, count);
+}
+
 static ssize_t fs_pipe_write(file_t * file, struct uio * uio, size_t count)
 {
     struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
-    char * buf_addr;
+    uint8_t * buf_addr;
+    size_t wr = 0;
     int err;
 
     if (!(file->oflags & O_WRONLY))
         return -EBADF;
 
-    if (kobj_ref(&pipe->file0.f_obj)) {
-        return -EPIPE;
-    }
-
     err = uio_get_kaddr(uio, (void **)(&buf_addr));
     if (err)
         return err;
 
-    /* TODO Implement O_NONBLOCK */
-
-    for (size_t i = 0; i < count;) {
-        if (queue_push(&pipe->q, buf_addr + i))
-            i++;
-        /*
-         * FIXME Yielding is really needed but currently there seems to some
-         *       strange performance issues.
-         */
-#if 0
-        thread_yield(PIPE_YIELD_STRATEGY);
-#endif
+    mtx_lock(&pipe->sp_lock);
+    while (wr < count) {
+        const size_t space = pipe->sp_size - pipe->sp_len;
+        size_t n;
+
+        if (pipe->sp_flags & SP_RCLOSED) {
+            err = -EPIPE;
+            break;
+        }
+
+        if (space == 0 || (count <= PIPE_BUF && space < count) ||
+            (pipe->sp_flags & SP_WBUSY)) {
+            if (file->oflags & O_NONBLOCK) {
+                err = -EAGAIN;
+                break;
+            }
+
+            err = waitq_wait(&pipe->sp_wwait, &pipe->sp_lock, 0);
+            mtx_lock(&pipe->sp_lock);
+            if (err)
+                break; /* Interrupted by a signal. */
+            continue;
+        }
+
+        n = min(count - wr, space);
+        ring_put(pipe, buf_addr + wr, n);
+        wr += n;
+
+        waitq_wakeup_all(&pipe->sp_rwait);
     }
+    mtx_unlock(&pipe->sp_lock);
 
-    return count;
+    return (wr > 0) ? (ssize_t)wr : err;
 }
 
 static ssize_t fs_pipe_read(file_t * file, struct uio * uio, size_t count)
 {
     struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
-    char * buf_addr;
-    int oflags = file->oflags;
-    int trycount = 0;
+    uint8_t * buf_addr;
+    ssize_t retval;
     int err;
 
-    /*
-     * TODO Atomic pipes
-     *
-     * Instead of using that trycount we should actually make pipes atomic per
-     * PIPE_BUF and return immediately after some data is received.
-     */
-
-    if (!(oflags & O_RDONLY))
+    if (!(file->oflags & O_RDONLY))
         return -EBADF;
 
     err = uio_get_kaddr(uio, (void **)(&buf_addr));
     if (err)
         return err;
 
-    for (size_t i = 0; i < count;) {
-        if (queue_isempty(&pipe->q) &&
-            ((trycount++ > 5 && (i > 0 || (oflags & O_NONBLOCK))) ||
-            kobj_ref(&pipe->file1.f_obj))) {
-            return i;
+    if (count == 0)
+        return 0;
+
+    mtx_lock(&pipe->sp_lock);
+    while (pipe->sp_len == 0 || (pipe->sp_flags & SP_RBUSY)) {
+        if (!(pipe->sp_flags & SP_RBUSY) && (pipe->sp_flags & SP_WCLOSED)) {
+            retval = 0; /* EOF */
+            goto out;
+        }
+
+        if (file->oflags & O_NONBLOCK) {
+            retval = -EAGAIN;
+            goto out;
         }
 
-        if (queue_pop(&pipe->q, buf_addr + i))
-            i++;
-        /*
-         * FIXME Yielding is really needed but currently there seems to some
-         *       strange performance issues.
-         */
-#if 0
-        thread_yield(PIPE_YIELD_STRATEGY);
-#endif
+        err = waitq_wait(&pipe->sp_rwait, &pipe->sp_lock, 0);
+        mtx_lock(&pipe->sp_lock);
+        if (err) {
+            retval = err; /* Interrupted by a signal. */
+            goto out;
+        }
     }
 
-    return count;
+    retval = min(count, pipe->sp_len);
+    ring_get(pipe, buf_addr, retval);
+
+    waitq_wakeup_all(&pipe->sp_wwait);
+out:
+    mtx_unlock(&pipe->sp_lock);
+
+    return retval;
+}
+
+static int fs_pipe_ioctl(file_t * file, unsigned request, void * arg,
+                         size_t arg_len)
+{
+    struct stream_pipe * pipe = (struct stream_pipe *)file->stream;
+
+    switch (request) {
+    case FIONREAD:
+        sizetto(pipe->sp_len, arg, arg_len);
+        break;
+    case FIONSPACE:
+        sizetto(pipe->sp_size - pipe->sp_len, arg, arg_len);
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int fs_pipe_getsize(file_t * file)
+{
+    struct stream_pipe * pipe = file2pipe(file);
+
+    if (!pipe)
+        return -EBADF;
+
+    return pipe->sp_size;
+}
+
+int fs_pipe_setsize(file_t * file, size_t len)
+{
+    struct stream_pipe * pipe = file2pipe(file);
+    struct buf * bp;
+    struct buf * old;
+    size_t nbytes;
+
+    if (!pipe)
+        return -EBADF;
+
+    len = memalign_size(max(len, 1), MMU_PGSIZE_COARSE);
+    if (len > pipe_max_size &&
+        priv_check(&curproc->cred, PRIV_VFS_ADMIN))
+        return -EPERM;
+
+    bp = geteblk(len);
+    if (!bp)
+        return -ENOMEM;
+
+    mtx_lock(&pipe->sp_lock);
+    if (pipe->sp_len > len || (pipe->sp_flags & (SP_RBUSY | SP_WBUSY))) {
+        mtx_unlock(&pipe->sp_lock);
+        bp->vm_ops->rfree(bp);
+        return -EBUSY;
+    }
+
+    /* Move the data to the beginning of the new buffer. */
+    old = pipe->bp;
+    nbytes = pipe->sp_len;
+    ring_get(pipe, (uint8_t *)bp->b_data, nbytes);
+    pipe->sp_rd = 0;
+    pipe->sp_len = nbytes;
+    pipe->bp = bp;
+    pipe->sp_size = len;
+    pipe->vnode.vn_len = len;
+    mtx_unlock(&pipe->sp_lock);
+
+    waitq_wakeup_all(&pipe->sp_wwait);
+    old->vm_ops->rfree(old);
+
+    return len;
+}
+
+static int is_nonblock(file_t * file, unsigned flags)
+{
+    return (file->oflags & O_NONBLOCK) || (flags & SPLICE_F_NONBLOCK);
+}
+
+/**
+ * Wait until there is data in the pipe and mark it busy.
+ * sp_lock must be held and it's held on return.
+ * @return Returns 1 if the data was marked busy;
+ *         0 on EOF;
+ *         -EINTR if interrupted by a signal;
+ *         Otherwise a negative errno.
+ */
+static int pipe_busy_data(struct stream_pipe * pipe, int nonblock)
+{
+    int err;
+
+    while (pipe->sp_len == 0 || (pipe->sp_flags & SP_RBUSY)) {
+        if (!(pipe->sp_flags & SP_RBUSY) && (pipe->sp_flags & SP_WCLOSED))
+            return 0;
+        if (nonblock)
+            return -EAGAIN;
+
+        err = waitq_wait(&pipe->sp_rwait, &pipe->sp_lock, 0);
+        mtx_lock(&pipe->sp_lock);
+        if (err)
+            return err; /* Interrupted by a signal. */
+    }
+
+    pipe->sp_flags |= SP_RBUSY;
+    return 1;
+}
+
+/**
+ * Wait until there is free space in the pipe and mark it busy.
+ * sp_lock must be held and it's held on return.
+ */
+static int pipe_busy_space(struct stream_pipe * pipe, int nonblock)
+{
+    int err;
+
+    while (pipe->sp_len == pipe->sp_size || (pipe->sp_flags & SP_WBUSY)) {
+        if (pipe->sp_flags & SP_RCLOSED)
+            return -EPIPE;
+        if (nonblock)
+            return -EAGAIN;
+
+        err = waitq_wait(&pipe->sp_wwait, &pipe->sp_lock, 0);
+        mtx_lock(&pipe->sp_lock);
+        if (err)
+            return err; /* Interrupted by a signal. */
+    }
+    if (pipe->sp_flags & SP_RCLOSED)
+        return -EPIPE;
+
+    pipe->sp_flags |= SP_WBUSY;
+    return 1;
+}
+
+/**
+ * Write data from the pipe to out.
+ */
+static ssize_t pipe_splice_out(struct stream_pipe * pipe, file_t * out,
+                               size_t count, int nonblock)
+{
+    vnode_t * vn = out->vnode;
+    size_t done = 0;
+    ssize_t ret;
+
+    mtx_lock(&pipe->sp_lock);
+    ret = pipe_busy_data(pipe, nonblock);
+    if (ret <= 0)
+        goto out;
+
+    while (done < count && pipe->sp_len > 0) {
+        uint8_t * data = (uint8_t *)pipe->bp->b_data + pipe->sp_rd;
+        const size_t n = min(count - done,
+                             min(pipe->sp_len, pipe->sp_size - pipe->sp_rd));
+        struct uio uio;
+
+        mtx_unlock(&pipe->sp_lock);
+        uio_init_kbuf(&uio, data, n);
+        ret = vn->vnode_ops->write(out, &uio, n);
+        mtx_lock(&pipe->sp_lock);
+        if (ret <= 0)
+            break;
+
+        ring_consume(pipe, ret);
+        done += ret;
+        waitq_wakeup_all(&pipe->sp_wwait);
+        if ((size_t)ret < n)
+            break;
+    }
+
+    pipe->sp_flags &= ~SP_RBUSY;
+    waitq_wakeup_all(&pipe->sp_rwait);
+out:
+    mtx_unlock(&pipe->sp_lock);
+
+    return (done > 0) ? (ssize_t)done : ret;
+}
+
+/**
+ * Read data from in to the pipe.
+ */
+static ssize_t pipe_splice_in(struct stream_pipe * pipe, file_t * in,
+                              size_t count, int nonblock)
+{
+    vnode_t * vn = in->vnode;
+    size_t done = 0;
+    ssize_t ret;
+
+    mtx_lock(&pipe->sp_lock);
+    ret = pipe_busy_space(pipe, nonblock);
+    if (ret <= 0)
+        goto out;
+
+    while (done < count && pipe->sp_len < pipe->sp_size) {
+        const size_t wr = (pipe->sp_rd + pipe->sp_len) % pipe->sp_size;
+        uint8_t * data = (uint8_t *)pipe->bp->b_data + wr;
+        const size_t n = min(count - done,
+                             min(pipe->sp_size - pipe->sp_len,
+                                 pipe->sp_size - wr));
+        struct uio uio;
+
+        mtx_unlock(&pipe->sp_lock);
+        uio_init_kbuf(&uio, data, n);
+        ret = vn->vnode_ops->read(in, &uio, n);
+        mtx_lock(&pipe->sp_lock);
+        if (ret <= 0)
+            break;
+
+        pipe->sp_len += ret;
+        done += ret;
+        waitq_wakeup_all(&pipe->sp_rwait);
+        if ((size_t)ret < n)
+            break;
+    }
+
+    pipe->sp_flags &= ~SP_WBUSY;
+    waitq_wakeup_all(&pipe->sp_wwait);
+out:
+    mtx_unlock(&pipe->sp_lock);
+
+    return (done > 0) ? (ssize_t)done : ret;
+}
+
+ssize_t fs_pipe_splice(file_t * in, file_t * out, size_t count,
+                       unsigned flags)
+{
+    struct stream_pipe * pin = file2pipe(in);
+    struct stream_pipe * pout = file2pipe(out);
+
+    if (pin == pout)
+        return -EINVAL;
+    if (count == 0)
+        return 0;
+
+    if (pin)
+        return pipe_splice_out(pin, out, count, is_nonblock(in, flags));
+    return pipe_splice_in(pout, in, count, is_nonblock(out, flags));
+}
+
+ssize_t fs_pipe_tee(file_t * in, file_t * out, size_t count, unsigned flags)
+{
+    struct stream_pipe * pin = file2pipe(in);
+    struct stream_pipe * pout = file2pipe(out);
+    const int nonblock = is_nonblock(in, flags) || is_nonblock(out, flags);
+    const uint8_t * data;
+    size_t rd, n, n1;
+    ssize_t ret;
+
+    if (!pin || !pout || pin == pout)
+        return -EINVAL;
+    if (count == 0)
+        return 0;
+
+    /*
+     * Only one of the pipes is locked at time, so the data of the input pipe
+     * is marked busy while it's copied to the output pipe.
+     */
+    mtx_lock(&pin->sp_lock);
+    ret = pipe_busy_data(pin, nonblock);
+    data = (uint8_t *)pin->bp->b_data;
+    rd = pin->sp_rd;
+    count = min(count, pin->sp_len);
+    mtx_unlock(&pin->sp_lock);
+    if (ret <= 0)
+        return ret;
+
+    mtx_lock(&pout->sp_lock);
+    ret = pipe_busy_space(pout, nonblock);
+    if (ret > 0) {
+        n = min(count, pout->sp_size - pout->sp_len);
+        n1 = min(n, pin->sp_size - rd);
+        ring_put(pout, data + rd, n1);
+        ring_put(pout, data, n - n1);
+        ret = n;
+
+        pout->sp_flags &= ~SP_WBUSY;
+        waitq_wakeup_all(&pout->sp_rwait);
+        waitq_wakeup_all(&pout->sp_wwait);
+    }
+    mtx_unlock(&pout->sp_lock);
+
+    mtx_lock(&pin->sp_lock);
+    pin->sp_flags &= ~SP_RBUSY;
+    mtx_unlock(&pin->sp_lock);
+    waitq_wakeup_all(&pin->sp_rwait);
+
+    return ret;
 }
 
 int fs_pipe_stat(vnode_t * vnode, struct stat * stat)
@@ -323,7 +724,7 @@ int fs_pipe_stat(vnode_t * vnode, struct stat * stat)
     stat->st_uid = pipe->owner;
     stat->st_gid = pipe->group;
     stat->st_rdev = 0;
-    stat->st_size = pipe->bp->b_bcount;
+    stat->st_size = pipe->sp_size;
     stat->st_atim = pipe->sp_atime;
     stat->st_mtim = pipe->sp_mtime;
     stat->st_ctim = pipe->sp_ctime;
@@ -35,6 +35,8 @@
 #include <stdint.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <mount.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -43,6 +45,7 @@
 #include <errno.h>
 #include <kerror.h>
 #include <libkern.h>
+#include <kmalloc.h>
 #include <kstring.h>
 #include <vm/vm.h>
 #include <vm/vm_copyinstruct.h>
@@ -53,17 +56,90 @@
 #include <fs/devfs.h>
 #include <fs/fs.h>
 #include <fs/fs_util.h>
+#include <kern_ipc.h>
 
-static int sys_readwrite(__user void * user_args, int write)
+#define RW_WRITE    0x1 /*!< Write instead of read. */
+#define RW_POS      0x2 /*!< Use the given offset instead of the file offset. */
+
+/**
+ * Read or write a file through a list of UIO buffers.
+ * All the buffers are transferred with a single file reference and the
+ * transfer stops on the first short read or write.
+ * @param offset is the file offset used if RW_POS is set in flags.
+ * @return Returns the number of bytes transferred;
+ *         Otherwise a negative errno.
+ */
+static ssize_t fs_readwrite(int fildes, struct uio * uio, int uiocnt,
+                            off_t offset, int flags)
 {
-    struct _fs_readwrite_args args;
-    int err, retval;
-    vnode_t * vnode;
+    const int write = flags & RW_WRITE;
     file_t * file;
+    file_t pfile;
+    vnode_t * vnode;
+    ssize_t total = 0;
+    ssize_t retval = 0;
+
+    file = fs_fildes_ref(curproc->files, fildes, 1);
+    if (!file)
+        return -EBADF;
+    vnode = file->vnode;
+
+    /*
+     * Check that file is opened with a correct mode and the vnode exist.
+     */
+    if (!((file->oflags & ((write) ? O_WRONLY : O_RDONLY)) && vnode)) {
+        retval = -EBADF;
+        goto out;
+    }
+
+    if (flags & RW_POS) {
+        if (S_ISFIFO(vnode->vn_mode) || S_ISSOCK(vnode->vn_mode)) {
+            retval = -ESPIPE;
+            goto out;
+        }
+        if (offset < 0) {
+            retval = -EINVAL;
+            goto out;
+        }
+
+        /*
+         * Do the IO through a private copy of the open file so the shared
+         * file offset is neither used nor updated.
+         */
+        pfile = *file;
+        pfile.seek_pos = offset;
+        file = &pfile;
+    }
+
+    for (int i = 0; i < uiocnt; i++) {
+        const size_t count = uio[i].bufsize;
+
+        retval = (write) ? vnode->vnode_ops->write(file, &uio[i], count) :
+                           vnode->vnode_ops->read(file, &uio[i], count);
+        if (retval < 0)
+            break;
+
+        total += retval;
+        if ((size_t)retval < count)
+            break;
+    }
+
+out:
+    fs_fildes_ref(curproc->files, fildes, -1);
+    return (total > 0) ? total : retval;
+}
+
+static intptr_t sys_readwrite(__user void * user_args, int flags)
+{
+    struct _fs_preadwrite_args args = { .offset = 0 };
     struct uio uio;
+    ssize_t retval;
+    int err;
 
-    /* Copyin args. */
-    err = copyin(user_args, &args, sizeof(args));
+    /* Copyin args. _fs_readwrite_args is a prefix of _fs_preadwrite_args. */
+    err = copyin(user_args, &args, (flags & RW_POS) ?
+                 sizeof(struct _fs_preadwrite_args) :
+                 sizeof(struct _fs_readwrite_args));
     if (err) {
         set_errno(EFAULT);
         return -1;
@@ -71,48 +147,154 @@ static int sys_readwrite(__user void * user_args, int write)
 
     /* Init uio struct. */
     err = uio_init_ubuf(&uio, (__user void *)args.buf, args.nbytes,
-                        (write) ? VM_PROT_WRITE : VM_PROT_READ);
+                        (flags & RW_WRITE) ? VM_PROT_WRITE : VM_PROT_READ);
     if (err) {
         set_errno(EFAULT);
         return -1;
     }
 
-    file = fs_fildes_ref(curproc->files, args.fildes, 1);
-    if (!file) {
-        set_errno(EBADF);
+    retval = fs_readwrite(args.fildes, &uio, 1, args.offset, flags);
+    if (retval < 0) {
+        set_errno(-retval);
         return -1;
     }
-    vnode = file->vnode;
 
-    /*
-     * Check that file is opened with a correct mode and the vnode exist.
-     */
-    if (!((file->oflags & ((write) ? O_WRONLY : O_RDONLY)) && vnode)) {
-        set_errno(EBADF);
-        retval = -1;
+    return retval;
+}
+
+static intptr_t sys_read(__user void * user_args)
+{
+    return sys_readwrite(user_args, 0);
+}
+
+static intptr_t sys_write(__user void * user_args)
+{
+    return sys_readwrite(user_args, RW_WRITE);
+}
+
+static intptr_t sys_pread(__user void * user_args)
+{
+    return sys_readwrite(user_args, RW_POS);
+}
+
+static intptr_t sys_pwrite(__user void * user_args)
+{
+    return sys_readwrite(user_args, RW_WRITE | RW_POS);
+}
+
+/**
+ * readv() and writev().
+ * A vector of at most PIPE_BUF bytes is transferred through a kernel buffer
+ * with a single call to the vnode operation, which makes small vectored
+ * writes to pipes atomic and avoids per element calls for small records.
+ */
+static intptr_t sys_readwritev(__user void * user_args, int flags)
+{
+    struct _fs_readwritev_args args;
+    struct iovec * iov = NULL;
+    struct uio * uio = NULL;
+    size_t total = 0;
+    ssize_t retval;
+    int err;
+
+    err = copyin(user_args, &args, sizeof(args));
+    if (err) {
+        retval = -EFAULT;
         goto out;
     }
 
-    retval = (write) ? vnode->vnode_ops->write(file, &uio, args.nbytes) :
-                       vnode->vnode_ops->read(file, &uio, args.nbytes);
-    if (retval < 0) {
-        set_errno(-retval);
-        retval = -1;
+    if (args.iovcnt <= 0 || args.iovcnt > IOV_MAX) {
+        retval = -EINVAL;
+        goto out;
+    }
+
+    iov = kmalloc(args.iovcnt * sizeof(struct iovec));
+    uio = kmalloc(args.iovcnt * sizeof(struct uio));
+    if (!(iov && uio)) {
+        retval = -ENOMEM;
+        goto out;
+    }
+
+    err = copyin((__user void *)args.iov, iov,
+                 args.iovcnt * sizeof(struct iovec));
+    if (err) {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    for (int i = 0; i < args.iovcnt; i++) {
+        if (iov[i].iov_len > SSIZE_MAX - total) {
+            retval = -EINVAL;
+            goto out;
+        }
+        total += iov[i].iov_len;
     }
 
+    if (total <= PIPE_BUF) {
+        uint8_t kbuf[PIPE_BUF];
+        size_t off = 0;
+
+        if (flags & RW_WRITE) {
+            for (int i = 0; i < args.iovcnt; i++) {
+                err = copyin((__user void *)iov[i].iov_base, kbuf + off,
+                             iov[i].iov_len);
+                if (err) {
+                    retval = err;
+                    goto out;
+                }
+                off += iov[i].iov_len;
+            }
+        }
+
+        uio_init_kbuf(&uio[0], kbuf, total);
+        retval = fs_readwrite(args.fildes, &uio[0], 1, 0, flags);
+
+        if (!(flags & RW_WRITE) && retval > 0) {
+            for (int i = 0; i < args.iovcnt && off < (size_t)retval; i++) {
+                const size_t n = min(iov[i].iov_len, (size_t)retval - off);
+
+                err = copyout(kbuf + off, (__user void *)iov[i].iov_base, n);
+                if (err) {
+                    retval = err;
+                    goto out;
+                }
+                off += n;
+            }
+        }
+        goto out;
+    }
+
+    for (int i = 0; i < args.iovcnt; i++) {
+        err = uio_init_ubuf(&uio[i], (__user void *)iov[i].iov_base,
+                            iov[i].iov_len,
+                            (flags & RW_WRITE) ? VM_PROT_WRITE : VM_PROT_READ);
+        if (err) {
+            retval = err;
+            goto out;
+        }
+    }
+
+    retval = fs_readwrite(args.fildes, uio, args.iovcnt, 0, flags);
+
 out:
-    fs_fildes_ref(curproc->files, args.fildes, -1);
+    kfree(iov);
+    kfree(uio);
+
+    if (retval < 0) {
+        set_errno(-retval);
+        return -1;
+    }
     return retval;
 }
 
-static intptr_t sys_read(__user void * user_args)
+static intptr_t sys_readv(__user void * user_args)
 {
-    return sys_readwrite(user_args, 0);
+    return sys_readwritev(user_args, 0);
 }
 
-static intptr_t sys_write(__user void * user_args)
+static intptr_t sys_writev(__user void * user_args)
 {
-    return sys_readwrite(user_args, !0);
+    return sys_readwritev(user_args, RW_WRITE);
 }
 
 static intptr_t sys_lseek(__user void * user_args)
@@ -163,6 +345,116 @@ out:
     return retval;
 }
 
+/**
+ * Make a private positional copy of a file for an offset given to splice().
+ * The IO is done through the copy so the shared file offset is neither used
+ * nor updated.
+ * @param[out] pfile returns the copy.
+ */
+static int splice_pfile(file_t * file, off_t offset, file_t * pfile)
+{
+    vnode_t * vn = file->vnode;
+
+    if (S_ISFIFO(vn->vn_mode) || S_ISSOCK(vn->vn_mode))
+        return -ESPIPE;
+    if (offset < 0)
+        return -EINVAL;
+
+    *pfile = *file;
+    pfile->seek_pos = offset;
+
+    return 0;
+}
+
+static intptr_t sys_splice(__user void * user_args)
+{
+    struct _fs_splice_args args;
+    file_t * in;
+    file_t * out;
+    file_t pin;
+    file_t pout;
+    ssize_t retval;
+
+    if (copyin(user_args, &args, sizeof(args))) {
+        set_errno(EFAULT);
+        return -1;
+    }
+
+    in = fs_fildes_ref(curproc->files, args.fd_in, 1);
+    out = fs_fildes_ref(curproc->files, args.fd_out, 1);
+    if (!(in && out && (in->oflags & O_RDONLY) && (out->oflags & O_WRONLY))) {
+        retval = -EBADF;
+        goto out;
+    }
+
+    if (args.off_in != -1) {
+        retval = splice_pfile(in, args.off_in, &pin);
+        if (retval)
+            goto out;
+    }
+    if (args.off_out != -1) {
+        retval = splice_pfile(out, args.off_out, &pout);
+        if (retval)
+            goto out;
+    }
+
+    retval = fs_pipe_splice((args.off_in != -1) ? &pin : in,
+                            (args.off_out != -1) ? &pout : out,
+                            args.len, args.flags);
+
+    if (args.off_in != -1)
+        args.off_in = pin.seek_pos;
+    if (args.off_out != -1)
+        args.off_out = pout.seek_pos;
+    if (retval >= 0)
+        (void)copyout(&args, user_args, sizeof(args));
+out:
+    if (in)
+        fs_fildes_ref(curproc->files, args.fd_in, -1);
+    if (out)
+        fs_fildes_ref(curproc->files, args.fd_out, -1);
+
+    if (retval < 0) {
+        set_errno(-retval);
+        return -1;
+    }
+    return retval;
+}
+
+static intptr_t sys_tee(__user void * user_args)
+{
+    struct _fs_tee_args args;
+    file_t * in;
+    file_t * out;
+    ssize_t retval;
+
+    if (copyin(user_args, &args, sizeof(args))) {
+        set_errno(EFAULT);
+        return -1;
+    }
+
+    in = fs_fildes_ref(curproc->files, args.fd_in, 1);
+    out = fs_fildes_ref(curproc->files, args.fd_out, 1);
+    if (!(in && out && (in->oflags & O_RDONLY) && (out->oflags & O_WRONLY))) {
+        retval = -EBADF;
+        goto out;
+    }
+
+    retval = fs_pipe_tee(in, out, args.len, args.flags);
+
+out:
+    if (in)
+        fs_fildes_ref(curproc->files, args.fd_in, -1);
+    if (out)
+        fs_fildes_ref(curproc->files, args.fd_out, -1);
+
+    if (retval < 0) {
+        set_errno(-retval);
+        return -1;
+    }
+    return retval;
+}
+
 static intptr_t sys_open(__user void * user_args)
 {
     struct _fs_open_args * args = NULL;
@@ -415,6 +707,24 @@ static intptr_t sys_fcntl(__user void * user_args)
         file->oflags |= args.third.ival & (O_APPEND | O_SYNC | O_NONBLOCK);
         retval = 0;
         break;
+    case F_GETPIPE_SZ:
+        retval = fs_pipe_getsize(file);
+        if (retval < 0) {
+            set_errno(-retval);
+            retval = -1;
+        }
+        break;
+    case F_SETPIPE_SZ:
+        if (args.third.ival < 0) {
+            set_errno(EINVAL);
+            break;
+        }
+        retval = fs_pipe_setsize(file, args.third.ival);
+        if (retval < 0) {
+            set_errno(-retval);
+            retval = -1;
+        }
+        break;
     case F_GETOWN:
         /* TODO F_GETOWN needed for sockets */
     case F_SETOWN:
@@ -1124,5 +1434,11 @@ static const syscall_handler_t fs_sysfnmap[] = {
     ARRDECL_SYSCALL_HNDL(SYSCALL_FS_UMASK, sys_umask),
     ARRDECL_SYSCALL_HNDL(SYSCALL_FS_MOUNT, sys_mount),
     ARRDECL_SYSCALL_HNDL(SYSCALL_FS_UMOUNT, sys_umount),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_SPLICE, sys_splice),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_TEE, sys_tee),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_PREAD, sys_pread),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_PWRITE, sys_pwrite),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_READV, sys_readv),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_FS_WRITEV, sys_writev),
 };
 SYSCALL_HANDLERDEF(fs_syscall, fs_sysfnmap)
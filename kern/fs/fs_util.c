@@ -148,6 +148,7 @@ void fs_vnode_init(vnode_t * vnode, ino_t vn_num, struct fs_superblock * sb,
 {
     vnode->vn_num = vn_num;
     vnode->vn_refcount = ATOMIC_INIT(0);
+    vnode->vn_bpo.bh_count = ATOMIC_INIT(0);
     vnode->vn_next_mountpoint = vnode;
     vnode->vn_prev_mountpoint = vnode;
     vnode->sb = sb;
@@ -157,20 +158,8 @@ void fs_vnode_init(vnode_t * vnode, ino_t vn_num, struct fs_superblock * sb,
 
 void fs_vnode_cleanup(vnode_t * vnode)
 {
-    struct buf * var;
-    struct buf * nxt;
-
     KASSERT(vnode != NULL, "vnode can't be null.");
 
     /* Release associated buffers. */
-    if (!SPLAY_EMPTY(&vnode->vn_bpo.sroot)) {
-        for (var = SPLAY_MIN(bufhd_splay, &vnode->vn_bpo.sroot);
-                var != NULL; var = nxt) {
-            nxt = SPLAY_NEXT(bufhd_splay, &vnode->vn_bpo.sroot, var);
-            SPLAY_REMOVE(bufhd_splay, &vnode->vn_bpo.sroot, var);
-            if (!(var->b_flags & B_DONE))
-                var->b_flags |= B_DELWRI;
-            brelse(var);
-        }
-   }
+    bio_vnode_purge(vnode);
 }
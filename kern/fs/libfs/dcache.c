@@ -0,0 +1,339 @@
+/**
+ *******************************************************************************
+ * @file    dcache.c
+ * @author  Olli Vanhoja
+ * @brief   VFS name lookup cache.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+/*
+ * Name lookup cache.
+ *
+ * Entries are kept in a hash table keyed by the directory vnode pointer and
+ * the name. Each hash chain is a singly linked list that is read without
+ * locking under an RCU reader lock, while insertions and removals are
+ * serialized with dcache_lock. A new entry is fully initialized before it's
+ * published at the head of a chain and a removed entry keeps its next
+ * pointer intact, so a reader walking the chain concurrently always sees a
+ * consistent list. Removed entries are freed, and the vnode references held
+ * by them released, with rcu_call().
+ *
+ * An entry holds a reference to both the directory and the resulting vnode,
+ * the latter is NULL for a negative entry. The cached vnode is the raw
+ * result returned by the file system, i.e. before get_top_vnode(), so
+ * mounting on a cached vnode doesn't make the entry stale.
+ *
+ * A lookup that misses the cache calls the file system without holding any
+ * locks, so the directory may be modified before the result is entered to
+ * the cache. dcache_gen is incremented on every invalidation and the result
+ * is dropped if the generation has changed since the lookup started.
+ */
+
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <errno.h>
+#include <fs/dcache.h>
+#include <fs/fs.h>
+#include <kerror.h>
+#include <kinit.h>
+#include <klocks.h>
+#include <kmalloc.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <rcu.h>
+
+#define DCACHE_HASH_SIZE    128
+
+struct dcache_entry {
+    struct dcache_entry * de_next;      /*!< Next entry in the hash chain. */
+    TAILQ_ENTRY(dcache_entry) de_fifo;  /*!< Eviction order. */
+    vnode_t * de_dir;                   /*!< Directory vnode. */
+    vnode_t * de_vnode;                 /*!< Result vnode or NULL. */
+    struct rcu_cb de_rcu;
+    char de_name[0];
+};
+
+static struct dcache_entry * dcache_hash[DCACHE_HASH_SIZE];
+static TAILQ_HEAD(dcache_fifo, dcache_entry) dcache_fifo =
+    TAILQ_HEAD_INITIALIZER(dcache_fifo);
+static mtx_t dcache_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+static unsigned dcache_gen;
+static int dcache_initialized;
+static uint32_t dcache_siphash_key[2];
+
+SYSCTL_DECL(_vfs_dcache);
+SYSCTL_NODE(_vfs, OID_AUTO, dcache, CTLFLAG_RW, 0,
+            "Name lookup cache");
+
+static unsigned dcache_max_entries = configVFS_DCACHE_MAX;
+SYSCTL_UINT(_vfs_dcache, OID_AUTO, max_entries, CTLFLAG_RW,
+            &dcache_max_entries, 0,
+            "Maximum number of cache entries");
+
+static unsigned dcache_nr_entries;
+SYSCTL_UINT(_vfs_dcache, OID_AUTO, nr_entries, CTLFLAG_RD,
+            &dcache_nr_entries, 0,
+            "Number of cache entries");
+
+static unsigned dcache_hits;
+SYSCTL_UINT(_vfs_dcache, OID_AUTO, hits, CTLFLAG_RD,
+            &dcache_hits, 0,
+            "Number of positive cache hits");
+
+static unsigned dcache_neg_hits;
+SYSCTL_UINT(_vfs_dcache, OID_AUTO, neg_hits, CTLFLAG_RD,
+            &dcache_neg_hits, 0,
+            "Number of negative cache hits");
+
+static unsigned dcache_misses;
+SYSCTL_UINT(_vfs_dcache, OID_AUTO, misses, CTLFLAG_RD,
+            &dcache_misses, 0,
+            "Number of cache misses");
+
+static int sysctl_dcache_hit_ratio(SYSCTL_HANDLER_ARGS)
+{
+    const uint64_t hits = dcache_hits + dcache_neg_hits;
+    const uint64_t total = hits + dcache_misses;
+    unsigned ratio = (total) ? (unsigned)((hits * 100) / total) : 0;
+
+    return sysctl_handle_int(oidp, &ratio, sizeof(ratio), req);
+}
+
+SYSCTL_PROC(_vfs_dcache, OID_AUTO, hit_ratio, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_dcache_hit_ratio, "IU",
+            "Cache hit ratio [%]");
+
+int __kinit__ dcache_init(void)
+{
+    SUBSYS_INIT("dcache");
+
+    dcache_siphash_key[0] = krandom();
+    dcache_siphash_key[1] = krandom();
+    dcache_initialized = 1;
+
+    return 0;
+}
+
+static struct dcache_entry ** dcache_bucket(vnode_t * dir, const char * name,
+                                            size_t len)
+{
+    uint32_t hash;
+
+    hash = halfsiphash32(name, len, dcache_siphash_key);
+    hash ^= (uintptr_t)dir >> 4;
+
+    return &dcache_hash[hash & (DCACHE_HASH_SIZE - 1)];
+}
+
+static void dcache_free_entry(struct rcu_cb * cb)
+{
+    struct dcache_entry * de = containerof(cb, struct dcache_entry, de_rcu);
+
+    vrele(de->de_vnode);
+    vrele(de->de_dir);
+    kfree(de);
+}
+
+/**
+ * Remove an entry from the cache.
+ * The entry is freed after the next grace period.
+ * dcache_lock must be held.
+ */
+static void dcache_remove(struct dcache_entry * de)
+{
+    struct dcache_entry ** pp;
+
+    pp = dcache_bucket(de->de_dir, de->de_name,
+                       strlenn(de->de_name, NAME_MAX + 1));
+    while (*pp != de) {
+        KASSERT(*pp, "de must be in the chain");
+        pp = &(*pp)->de_next;
+    }
+    rcu_assign_pointer(*pp, de->de_next);
+
+    TAILQ_REMOVE(&dcache_fifo, de, de_fifo);
+    dcache_nr_entries--;
+    rcu_call(&de->de_rcu, dcache_free_entry);
+}
+
+/**
+ * Add a new entry to the cache.
+ * The references held by the caller are not consumed.
+ */
+static void dcache_enter(vnode_t * dir, const char * name, size_t len,
+                         vnode_t * vnode, unsigned gen)
+{
+    struct dcache_entry * de;
+    struct dcache_entry ** bucket;
+
+    de = kmalloc(sizeof(struct dcache_entry) + len + 1);
+    if (!de)
+        return;
+
+    if (vref(dir)) {
+        kfree(de);
+        return;
+    }
+    if (vnode && vref(vnode)) {
+        vrele(dir);
+        kfree(de);
+        return;
+    }
+    de->de_dir = dir;
+    de->de_vnode = vnode;
+    memcpy(de->de_name, name, len);
+    de->de_name[len] = '\0';
+
+    bucket = dcache_bucket(dir, name, len);
+
+    mtx_lock(&dcache_lock);
+    if (gen != dcache_gen || dcache_max_entries == 0) {
+        goto drop;
+    }
+
+    /* A concurrent lookup may have already entered the same name. */
+    for (struct dcache_entry * tmp = *bucket; tmp; tmp = tmp->de_next) {
+        if (tmp->de_dir == dir && !strcmp(tmp->de_name, de->de_name))
+            goto drop;
+    }
+
+    while (dcache_nr_entries >= dcache_max_entries) {
+        dcache_remove(TAILQ_FIRST(&dcache_fifo));
+    }
+
+    de->de_next = *bucket;
+    rcu_assign_pointer(*bucket, de);
+    TAILQ_INSERT_TAIL(&dcache_fifo, de, de_fifo);
+    dcache_nr_entries++;
+    mtx_unlock(&dcache_lock);
+
+    return;
+drop:
+    mtx_unlock(&dcache_lock);
+    dcache_free_entry(&de->de_rcu);
+}
+
+int dcache_lookup(vnode_t * dir, const char * name, vnode_t ** result)
+{
+    struct rcu_lock_ctx rcu_ctx;
+    struct dcache_entry * de;
+    size_t len;
+    unsigned gen;
+    int retval;
+
+    len = strlenn(name, NAME_MAX + 1);
+    if (!dcache_initialized || !(dir->sb->fs->fs_flags & FS_FLAG_DCACHE) ||
+        len > NAME_MAX || !strcmp(name, "..")) {
+        return dir->vnode_ops->lookup(dir, name, result);
+    }
+
+    gen = ACCESS_ONCE(dcache_gen);
+
+    rcu_ctx = rcu_read_lock();
+    de = rcu_dereference(*dcache_bucket(dir, name, len));
+    while (de) {
+        if (de->de_dir == dir && !strcmp(de->de_name, name)) {
+            vnode_t * vnode = de->de_vnode;
+
+            if (!vnode) {
+                rcu_read_unlock(&rcu_ctx);
+                dcache_neg_hits++;
+                return -ENOENT;
+            }
+            if (!vref(vnode)) {
+                rcu_read_unlock(&rcu_ctx);
+                dcache_hits++;
+                *result = vnode;
+                return 0;
+            }
+            break;
+        }
+        de = rcu_dereference(de->de_next);
+    }
+    rcu_read_unlock(&rcu_ctx);
+    dcache_misses++;
+
+    retval = dir->vnode_ops->lookup(dir, name, result);
+    if (retval == 0) {
+        dcache_enter(dir, name, len, *result, gen);
+    } else if (retval == -ENOENT) {
+        dcache_enter(dir, name, len, NULL, gen);
+    }
+
+    return retval;
+}
+
+void dcache_invalidate(vnode_t * dir, const char * name)
+{
+    struct dcache_entry * de;
+    vnode_t * vnode = NULL;
+
+    mtx_lock(&dcache_lock);
+    dcache_gen++;
+
+    de = *dcache_bucket(dir, name, strlenn(name, NAME_MAX + 1));
+    while (de) {
+        if (de->de_dir == dir && !strcmp(de->de_name, name)) {
+            vnode = de->de_vnode;
+            dcache_remove(de);
+            break;
+        }
+        de = de->de_next;
+    }
+
+    /*
+     * Negative entries under a removed directory would keep it referenced
+     * until they are evicted.
+     */
+    if (vnode && S_ISDIR(vnode->vn_mode)) {
+        struct dcache_entry * tmp;
+
+        TAILQ_FOREACH_SAFE(de, &dcache_fifo, de_fifo, tmp) {
+            if (de->de_dir == vnode)
+                dcache_remove(de);
+        }
+    }
+    mtx_unlock(&dcache_lock);
+}
+
+void dcache_purge_sb(struct fs_superblock * sb)
+{
+    struct dcache_entry * de;
+    struct dcache_entry * tmp;
+
+    mtx_lock(&dcache_lock);
+    dcache_gen++;
+    TAILQ_FOREACH_SAFE(de, &dcache_fifo, de_fifo, tmp) {
+        if (de->de_dir->sb == sb || (de->de_vnode && de->de_vnode->sb == sb))
+            dcache_remove(de);
+    }
+    mtx_unlock(&dcache_lock);
+
+    /* Release the vnode references before returning. */
+    rcu_synchronize();
+}
@@ -205,6 +205,7 @@ int __kinit__ ramfs_init(void)
     static fs_t ramfs_fs = {
         .fsname = RAMFS_FSNAME,
         .fs_majornum = VDEV_MJNR_RAMFS,
+        .fs_flags = FS_FLAG_DCACHE,
         .mount = ramfs_mount,
         .sblist_head = SLIST_HEAD_INITIALIZER(),
     };
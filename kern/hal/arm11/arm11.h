@@ -218,6 +218,27 @@ void core_set_tls_addr(__user struct _sched_tls_desc * tls);
     __asm__ volatile ("SEV");               \
 } while (0)
 
+/**
+ * Get the index of the current CPU.
+ * Reads the CPU ID field of the MPIDR. Cores without the multiprocessing
+ * extensions, e.g. ARM1176, return MIDR for the MPIDR read, and a core
+ * marked as uniprocessor by the U bit is always the CPU 0.
+ */
+static inline int cpu_get_index(void)
+{
+    uint32_t mpidr;
+
+    __asm__ volatile (
+        "MRC p15, 0, %[rd], c0, c0, 5"
+        : [rd]"=r" (mpidr));
+
+    /* Bit 31 set marks the MP format and bit 30 (U) a uniprocessor. */
+    if ((mpidr & 0xc0000000) != 0x80000000)
+        return 0;
+
+    return mpidr & 0x3;
+}
+
 #endif /* configMP */
 
 /**
@@ -49,6 +49,24 @@ static mtx_t mmu_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
 
 #define mmu_disable_ints() __asm__ volatile ("cpsid if")
 
+/**
+ * L2 descriptor types.
+ * A small page descriptor has bit 1 set and XN in bit 0.
+ * @{
+ */
+#define MMU_L2_TYPE_MASK    0x3
+#define MMU_L2_FAULT        0x0
+#define MMU_L2_LARGE        0x1
+#define MMU_L2_SMALL        0x2
+/**
+ * @}
+ */
+
+#define MMU_L2_IS_LARGE(pte) (((pte) & MMU_L2_TYPE_MASK) == MMU_L2_LARGE)
+#define MMU_L2_IS_SMALL(pte) ((pte) & MMU_L2_SMALL)
+#define MMU_L1_IS_SECTION(pte) \
+    (((pte) & 0x3) == MMU_PTE_SECTION)
+
 /**
  * MMU must be enabled early in the init to make atomic operations work
  * and to speed up the boot as caching can be enabled.
@@ -138,6 +156,42 @@ int mmu_init_pagetable(const mmu_pagetable_t * pt)
     return 0;
 }
 
+/**
+ * Make a section entry.
+ * @param region    is the region the section belongs to.
+ * @param paddr     is the physical address of the section.
+ * @param dom       is the domain of the section.
+ */
+static uint32_t section_pte(const mmu_region_t * region, uintptr_t paddr,
+                            uint32_t dom)
+{
+    uint32_t pte;
+
+    pte = paddr & 0xfff00000;               /* Set physical address */
+    pte |= (region->ap & 0x3) << 10;        /* Set access permissions (AP) */
+    pte |= (region->ap & 0x4) << 13;        /* Set access permissions (APX) */
+    pte |= (dom & 0x7) << 5;                /* Set domain */
+    pte |= (region->control & 0x3) << 16;   /* Set nG & S bits */
+    pte |= (region->control & 0x10);        /* Set XN bit */
+    pte |= (region->control & 0x60) >> 3;   /* Set C & B bits */
+    pte |= (region->control & 0x380) << 5;  /* Set TEX bits */
+    pte |= MMU_PTE_SECTION;                 /* Set entry type */
+
+    return pte;
+}
+
+/**
+ * Update a L1 entry and the section gauge.
+ */
+static void l1_set(uint32_t * l1, uint32_t pte)
+{
+    if (MMU_L1_IS_SECTION(*l1))
+        mmu_mapped_pages[MMU_PGSZ_SECTION]--;
+    if (MMU_L1_IS_SECTION(pte))
+        mmu_mapped_pages[MMU_PGSZ_SECTION]++;
+    *l1 = pte;
+}
+
 /**
  * Map a section of physical memory in multiples of 1 MB in virtual memory.
  * @param region    Structure that specifies the memory region.
@@ -154,22 +208,14 @@ static void mmu_map_section_region(const mmu_region_t * region)
     p_pte += region->vaddr >> 20;            /* Set to first pte in region */
     p_pte += pages;                          /* Set to last pte in region */
 
-    pte = region->paddr & 0xfff00000;       /* Set physical address */
-    pte |= (region->ap & 0x3) << 10;        /* Set access permissions (AP) */
-    pte |= (region->ap & 0x4) << 13;        /* Set access permissions (APX) */
-    pte |= (region->pt->pt_dom & 0x7) << 5; /* Set domain */
-    pte |= (region->control & 0x3) << 16;   /* Set nG & S bits */
-    pte |= (region->control & 0x10);        /* Set XN bit */
-    pte |= (region->control & 0x60) >> 3;   /* Set C & B bits */
-    pte |= (region->control & 0x380) << 5;  /* Set TEX bits */
-    pte |= MMU_PTE_SECTION;                 /* Set entry type */
+    pte = section_pte(region, region->paddr, region->pt->pt_dom);
 
     MMU_LOCK();
     s = get_interrupt_state();
     mmu_disable_ints();
 
     for (i = pages; i >= 0; i--) {
-        *p_pte-- = pte + (i << 20); /* i = 1 MB section */
+        l1_set(p_pte--, pte + (i << 20)); /* i = 1 MB section */
     }
 
     cpu_invalidate_caches();
@@ -177,8 +223,177 @@ static void mmu_map_section_region(const mmu_region_t * region)
     MMU_UNLOCK();
 }
 
+/**
+ * Get the master page table entry pointing to a coarse page table.
+ * @param pt    is the coarse page table.
+ * @param j     is the index of a table in pt.
+ * @return Returns a pointer to the L1 entry or NULL if pt is not attached to
+ *         a master page table.
+ */
+static uint32_t * coarse_l1_pte(const mmu_pagetable_t * pt, size_t j)
+{
+    uint32_t * ttb = (uint32_t *)pt->master_pt_addr;
+
+    if (!ttb)
+        return NULL;
+    return ttb + ((pt->vaddr + j * MMU_PGSIZE_SECTION) >> 20);
+}
+
+static uint32_t coarse_pte(const mmu_pagetable_t * pt, size_t j)
+{
+    uint32_t pte;
+
+    pte = ((pt->pt_addr + j * MMU_PTSZ_COARSE) & 0xfffffc00);
+    pte |= pt->pt_dom << 5;
+    pte |= MMU_PTE_COARSE;
+
+    return pte;
+}
+
+/**
+ * Test if the coarse table j of pt is hidden by a promoted section.
+ */
+static int coarse_promoted(const mmu_pagetable_t * pt, size_t j)
+{
+    const uint32_t * l1 = coarse_l1_pte(pt, j);
+
+    return l1 && MMU_L1_IS_SECTION(*l1);
+}
+
+/**
+ * Add or remove a coarse table entry to/from the page gauges.
+ * A large page is counted by the first entry of its group.
+ */
+static void l2_account(const uint32_t * p_pte, int sign)
+{
+    const uint32_t pte = *p_pte;
+
+    if (MMU_L2_IS_LARGE(pte)) {
+        if (!((uintptr_t)p_pte & (MMU_NR_LARGE_ENTR * sizeof(uint32_t) - 1)))
+            mmu_mapped_pages[MMU_PGSZ_LARGE] += sign;
+    } else if (MMU_L2_IS_SMALL(pte)) {
+        mmu_mapped_pages[MMU_PGSZ_SMALL] += sign;
+    }
+}
+
+/**
+ * Update a coarse table entry and the page gauges.
+ */
+static void l2_set(uint32_t * p_pte, uint32_t pte)
+{
+    l2_account(p_pte, -1);
+    *p_pte = pte;
+    l2_account(p_pte, 1);
+}
+
+/**
+ * Add or remove all entries of the coarse table j of pt to/from the gauges.
+ */
+static void coarse_account(const mmu_pagetable_t * pt, size_t j, int sign)
+{
+    const uint32_t * p_pte = (uint32_t *)pt->pt_addr + j * MMU_NR_COARSE_ENTR;
+
+    for (size_t i = 0; i < MMU_NR_COARSE_ENTR; i++) {
+        l2_account(p_pte + i, sign);
+    }
+}
+
+/**
+ * Replace section entries that were promoted from the coarse tables first to
+ * last of pt with pointers to the coarse tables again.
+ * The coarse tables are always kept up to date, so a promoted section must be
+ * demoted before any of the entries of its coarse table are changed.
+ */
+static void demote_sections(const mmu_pagetable_t * pt, size_t first,
+                            size_t last)
+{
+    for (size_t j = first; j <= last; j++) {
+        uint32_t * l1 = coarse_l1_pte(pt, j);
+
+        if (l1 && MMU_L1_IS_SECTION(*l1)) {
+            l1_set(l1, coarse_pte(pt, j));
+            coarse_account(pt, j, 1);
+        }
+    }
+}
+
+/**
+ * Replace a large page with small pages.
+ * All entries of a large page must be identical, so the large page containing
+ * p_pte must be split before only some of its entries are changed.
+ * @param p_pte is a pointer to any entry of the large page.
+ */
+static void split_large_page(uint32_t * p_pte)
+{
+    uint32_t * first;
+    uint32_t lpte, pte;
+
+    first = (uint32_t *)((uintptr_t)p_pte &
+                         ~(MMU_NR_LARGE_ENTR * sizeof(uint32_t) - 1));
+    lpte = *first;
+    if (!MMU_L2_IS_LARGE(lpte))
+        return;
+
+    pte = lpte & 0xffff0e3c;            /* Address, AP, APX, nG, S, C & B */
+    pte |= ((lpte >> 12) & 0x7) << 6;   /* Move TEX bits */
+    pte |= (lpte >> 15) & 0x1;          /* Move XN bit */
+    pte |= MMU_L2_SMALL;
+
+    for (int i = 0; i < MMU_NR_LARGE_ENTR; i++) {
+        l2_set(first + i, pte + (i << 12));
+    }
+}
+
+/**
+ * Prepare the entries [first, first + count) of a coarse page table to be
+ * rewritten.
+ */
+static void coarse_prepare(const mmu_region_t * region, uint32_t * p_pte,
+                           size_t count)
+{
+    const uint32_t * pt_base = (uint32_t *)region->pt->pt_addr;
+    const size_t ifirst = p_pte - pt_base;
+
+    demote_sections(region->pt, ifirst / MMU_NR_COARSE_ENTR,
+                    (ifirst + count - 1) / MMU_NR_COARSE_ENTR);
+    split_large_page(p_pte);
+    split_large_page(p_pte + count - 1);
+}
+
+#ifdef configMMU_LARGE_PAGES
+/**
+ * Promote the coarse tables fully covered by a region to sections.
+ * @param region    is the region just mapped.
+ * @param p_pte     is a pointer to the first entry of the region.
+ */
+static void promote_sections(const mmu_region_t * region, uint32_t * p_pte)
+{
+    const mmu_pagetable_t * pt = region->pt;
+    const size_t ifirst = p_pte - (uint32_t *)pt->pt_addr;
+    const size_t iend = ifirst + region->num_pages;
+    size_t j;
+
+    for (j = (ifirst + MMU_NR_COARSE_ENTR - 1) / MMU_NR_COARSE_ENTR;
+         (j + 1) * MMU_NR_COARSE_ENTR <= iend; j++) {
+        const uintptr_t paddr = region->paddr +
+            (j * MMU_NR_COARSE_ENTR - ifirst) * MMU_PGSIZE_COARSE;
+        uint32_t * l1 = coarse_l1_pte(pt, j);
+
+        if (!l1 || (paddr & (MMU_PGSIZE_SECTION - 1)) ||
+            *l1 != coarse_pte(pt, j))
+            continue;
+
+        coarse_account(pt, j, -1);
+        l1_set(l1, section_pte(region, paddr, pt->pt_dom));
+    }
+}
+#endif
+
 /**
  * Map a section of physical memory over a (contiguous set of) page table(s).
+ * Aligned parts of the region are mapped with large pages and coarse tables
+ * fully covered by the region are replaced with section entries if
+ * configMMU_LARGE_PAGES is enabled.
  * @note xn bit an ap configuration is copied to all pages in this region.
  * @note One page table maps a 1MB of memory.
  * @param region    Structure that specifies the memory region.
@@ -186,14 +401,14 @@ static void mmu_map_section_region(const mmu_region_t * region)
 static void mmu_map_coarse_region(const mmu_region_t * region)
 {
     uint32_t * p_pte;
-    uint32_t pte;
-    const int pages = region->num_pages - 1;
+    uint32_t pte, lpte;
+    const size_t pages = region->num_pages;
+    size_t i;
     istate_t s;
 
     /* Page table base address */
     p_pte  = (uint32_t *)region->pt->pt_addr;
     p_pte += (region->vaddr & 0xff000) >> 12;   /* First */
-    p_pte += pages;                             /* Last pte */
 
     KASSERT(p_pte, "p_pte not null");
 
@@ -204,16 +419,42 @@ static void mmu_map_coarse_region(const mmu_region_t * region)
     pte |= (region->control & 0x10) >> 4;   /* Set XN bit */
     pte |= (region->control & 0x60) >> 3;   /* Set C & B bits */
     pte |= (region->control & 0x380) >> 1;  /* Set TEX bits */
-    pte |= 0x2;                             /* Set entry type (4 kB page) */
+    pte |= MMU_L2_SMALL;                    /* Set entry type (4 kB page) */
+
+    lpte = pte & 0x00000e3c;                /* AP, APX, nG, S, C & B */
+    lpte |= (region->control & 0x10) << 11; /* Set XN bit */
+    lpte |= (region->control & 0x380) << 5; /* Set TEX bits */
+    lpte |= MMU_L2_LARGE;                   /* Set entry type (64 kB page) */
 
     MMU_LOCK();
     s = get_interrupt_state();
     mmu_disable_ints();
 
-    for (int i = pages; i >= 0; i--) {
-        *p_pte-- = pte + (i << 12); /* i = 4 KB small page */
+    coarse_prepare(region, p_pte, pages);
+
+    for (i = 0; i < pages;) {
+#ifdef configMMU_LARGE_PAGES
+        const uintptr_t vaddr = region->vaddr + (i << 12);
+        const uintptr_t paddr = region->paddr + (i << 12);
+
+        if (pages - i >= MMU_NR_LARGE_ENTR &&
+            !((vaddr | paddr) & (MMU_PGSIZE_LARGE - 1))) {
+            const uint32_t e = lpte | (paddr & 0xffff0000);
+
+            for (int k = 0; k < MMU_NR_LARGE_ENTR; k++) {
+                l2_set(p_pte + i++, e);
+            }
+            continue;
+        }
+#endif
+        l2_set(p_pte + i, pte + (i << 12)); /* i = 4 KB small page */
+        i++;
     }
 
+#ifdef configMMU_LARGE_PAGES
+    promote_sections(region, p_pte);
+#endif
+
     cpu_invalidate_caches();
     set_interrupt_state(s);
     MMU_UNLOCK();
@@ -264,7 +505,7 @@ static void mmu_unmap_section_region(const mmu_region_t * region)
     mmu_disable_ints();
 
     for (int i = pages; i >= 0; i--) {
-        *p_pte-- = pte + (i << 20); /* i = 1 MB section */
+        l1_set(p_pte--, pte + (i << 20)); /* i = 1 MB section */
     }
 
     cpu_invalidate_caches();
@@ -286,14 +527,16 @@ static void mmu_unmap_coarse_region(const mmu_region_t * region)
     /* Page table base address */
     p_pte  = (uint32_t *)region->pt->pt_addr;
     p_pte += (region->vaddr & 0x000ff000) >> 12;    /* First */
-    p_pte += pages;                                 /* Last pte */
 
     MMU_LOCK();
     s = get_interrupt_state();
     mmu_disable_ints();
 
+    coarse_prepare(region, p_pte, region->num_pages);
+    p_pte += pages;                                 /* Last pte */
+
     for (int i = pages; i >= 0; i--) {
-        *p_pte-- = pte + (i << 12); /* i = 4 KB small page */
+        l2_set(p_pte--, pte + (i << 12)); /* i = 4 KB small page */
     }
 
     cpu_invalidate_caches();
@@ -330,15 +573,13 @@ static void attach_coarse_pagetable(const mmu_pagetable_t * restrict pt)
     ttb = (uint32_t *)pt->master_pt_addr;
 
     for (size_t j = 0; j < pt->nr_tables; j++) {
-        uint32_t pte;
+        const int promoted = coarse_promoted(pt, j);
         size_t i;
 
-        pte = ((pt->pt_addr + j * MMU_PTSZ_COARSE) & 0xfffffc00);
-        pte |= pt->pt_dom << 5;
-        pte |= MMU_PTE_COARSE;
-
         i = (pt->vaddr + j * MMU_PGSIZE_SECTION) >> 20;
-        ttb[i] = pte;
+        l1_set(ttb + i, coarse_pte(pt, j));
+        if (promoted)
+            coarse_account(pt, j, 1);
     }
 }
 
@@ -413,8 +654,10 @@ int mmu_detach_pagetable(const mmu_pagetable_t * pt)
     mmu_disable_ints();
 
     for (j = 0; j < nr_tables; j++) {
+        if (coarse_promoted(pt, j))
+            coarse_account(pt, j, 1);
         i = (pt->vaddr + j * MMU_PGSIZE_SECTION) >> 20;
-        ttb[i] = MMU_PTE_FAULT;
+        l1_set(ttb + i, MMU_PTE_FAULT);
     }
 
     cpu_invalidate_caches();
@@ -424,6 +667,46 @@ int mmu_detach_pagetable(const mmu_pagetable_t * pt)
     return 0;
 }
 
+/**
+ * Add or remove the entries of a page table to/from the page gauges.
+ * The entries of a coarse table hidden by a promoted section are not counted
+ * as the section is already counted in the master page table.
+ * @param pt    is the page table.
+ * @param sign  is 1 to add and -1 to remove.
+ */
+void mmu_account_pagetable(const mmu_pagetable_t * pt, int sign)
+{
+    istate_t s;
+
+    MMU_LOCK();
+    s = get_interrupt_state();
+    mmu_disable_ints();
+
+    switch (pt->pt_type) {
+    case MMU_PTT_MASTER: {
+        const uint32_t * ttb = (uint32_t *)pt->pt_addr;
+        const size_t nr_entries = mmu_sizeof_pt(pt) / sizeof(uint32_t);
+
+        for (size_t i = 0; i < nr_entries; i++) {
+            if (MMU_L1_IS_SECTION(ttb[i]))
+                mmu_mapped_pages[MMU_PGSZ_SECTION] += sign;
+        }
+        break;
+    }
+    case MMU_PTT_COARSE:
+        for (size_t j = 0; j < pt->nr_tables; j++) {
+            if (!coarse_promoted(pt, j))
+                coarse_account(pt, j, sign);
+        }
+        break;
+    default:
+        break;
+    }
+
+    set_interrupt_state(s);
+    MMU_UNLOCK();
+}
+
 /**
  * Read domain access bits.
  */
@@ -510,14 +793,19 @@ void * mmu_translate_vaddr(const mmu_pagetable_t * pt, uintptr_t vaddr)
         }
         break;
     case MMU_PTT_COARSE:
-        page_size = MMU_PGSIZE_COARSE;
-        mask    = 0xfffff000;
-        offset &= 0x00000fff;
         p_pte   = (uintptr_t *)pt->pt_addr;
         p_pte  += (vaddr & 0x000ff000) >> 12;
         pte     = *p_pte;
 
-        if (!(pte & 2)) {
+        if (MMU_L2_IS_LARGE(pte)) {
+            page_size = MMU_PGSIZE_LARGE;
+            mask    = 0xffff0000;
+            offset &= 0x0000ffff;
+        } else if (pte & MMU_L2_SMALL) {
+            page_size = MMU_PGSIZE_COARSE;
+            mask    = 0xfffff000;
+            offset &= 0x00000fff;
+        } else {
             return NULL;
         }
         break;
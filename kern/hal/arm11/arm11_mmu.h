@@ -93,6 +93,8 @@
  * @{
  */
 #define MMU_PGSIZE_COARSE   4096    /*!< Size of a coarse page table page. */
+#define MMU_PGSIZE_LARGE    65536   /*!< Size of a coarse page table large
+                                     *   page. */
 #define MMU_PGSIZE_SECTION  1048576 /*!< Size of a master page table section. */
 /**
  * @}
@@ -106,6 +108,8 @@
 #define MMU_NR_COARSE_ENTR  (MMU_PTSZ_COARSE / 4)
 /** Number of page table entries in master page table. */
 #define MMU_NR_SECTION_ENTR (MMU_PTSZ_MASTER / 4)
+/** Number of coarse page table entries used by a large page. */
+#define MMU_NR_LARGE_ENTR   (MMU_PGSIZE_LARGE / MMU_PGSIZE_COARSE)
 /**
  * @}
  */
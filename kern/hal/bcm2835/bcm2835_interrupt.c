@@ -50,8 +50,9 @@ void irq_enable(int irq)
         mmio_write(BCMIRQ_ENABLE_IRQ1, 1 << irq);
         mmio_end(&s_entry);
     } else if (irq >= 32 && irq <= 63) {
+        /* GPU IRQs 0..31 as numbered by arm_handle_sys_interrupt(). */
         mmio_start(&s_entry);
-        mmio_write(BCMIRQ_ENABLE_IRQ2, 1 << (irq - 32));
+        mmio_write(BCMIRQ_ENABLE_IRQ1, 1 << (irq - 32));
         mmio_end(&s_entry);
     } else {
         KERROR(KERROR_ERR, "%s(): Invalid IRQ%d\n", __func__, irq);
@@ -64,15 +65,15 @@ void irq_disable(int irq)
 
     if (irq >= 0 && irq <= 7) {
         mmio_start(&s_entry);
-        mmio_write(BCMIRQ_DISABLE_BASIC, 1 < irq);
+        mmio_write(BCMIRQ_DISABLE_BASIC, 1 << irq);
         mmio_end(&s_entry);
     } else if (irq >= 29 && irq <= 31) {
         mmio_start(&s_entry);
-        mmio_write(BCMIRQ_DISABLE_IRQ1, 1 < irq);
+        mmio_write(BCMIRQ_DISABLE_IRQ1, 1 << irq);
         mmio_end(&s_entry);
     } else if (irq >= 32 && irq <= 63) {
         mmio_start(&s_entry);
-        mmio_write(BCMIRQ_DISABLE_IRQ2, 1 < (irq - 32));
+        mmio_write(BCMIRQ_DISABLE_IRQ1, 1 << (irq - 32));
         mmio_end(&s_entry);
     } else {
         KERROR(KERROR_ERR, "%s(): Invalid IRQ%d\n", __func__, irq);
@@ -0,0 +1,54 @@
+/**
+ *******************************************************************************
+ * @file    bcm2835_mp.c
+ * @author  Olli Vanhoja
+ * @brief   BCM2835 MP support.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/*
+ * These are stubs. BCM2835 has a single ARM1176 core, so there is nothing to
+ * start and no other core to send an IPI to. They only allow building an MP
+ * kernel for the platform, which then runs on the boot CPU alone, and
+ * configMP_START_CPUS must not be enabled for it.
+ */
+
+#include <errno.h>
+#include <hal/core.h>
+
+int hal_mp_start_cpu(int cpu_index)
+{
+    return -ENOTSUP;
+}
+
+void hal_mp_send_ipi(int cpu_index)
+{
+    /*
+     * There is no interrupt source for an IPI. SEV wouldn't wake a core
+     * sleeping in WFI either, so there is nothing to do here.
+     */
+}
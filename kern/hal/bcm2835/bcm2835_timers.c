@@ -73,6 +73,10 @@
 #define ARM_TIMER_EN            0x80
 #define ARM_TIMER_INT_EN        0x20
 
+#define SYS_TIMER_M1            0x2 /* Match 1, also the bit in IRQ1. */
+#define SYS_TIMER_M3            0x8 /* Match 3, also the bit in IRQ1. */
+#define SYS_TIMER_M3_IRQ        (32 + 3)
+
 #define SYS_CLOCK               700000 /* kHz */
 
 static enum irq_ack arm_timer_ack(int irq)
@@ -93,7 +97,7 @@ static enum irq_ack arm_timer_ack(int irq)
 
 static void arm_timer_handle(int irq)
 {
-    sched_handler();
+    sched_tick();
     hw_timers_run();
 }
 
@@ -103,6 +107,71 @@ static struct irq_handler bcm2835_timer_irq_handler = {
     .handle = arm_timer_handle,
 };
 
+static enum irq_ack sys_timer_ack(int irq)
+{
+    istate_t s_entry;
+    enum irq_ack retval = IRQ_HANDLED;
+
+    mmio_start(&s_entry);
+    if (mmio_read(SYS_TIMER_STATUS) & SYS_TIMER_M3) {
+        mmio_write(SYS_TIMER_STATUS, SYS_TIMER_M3);
+        retval = IRQ_NEEDS_HANDLING;
+    }
+    mmio_end(&s_entry);
+
+    return retval;
+}
+
+static void sys_timer_handle(int irq)
+{
+    hw_timers_event_run();
+
+    /*
+     * Reschedule on the IRQ exit to run the threads woken up by the events
+     * without waiting for the next tick. This is not a tick, so no CPU time
+     * or time slice is accounted to the current thread.
+     */
+    sched_handler();
+}
+
+static struct irq_handler bcm2835_sys_timer_irq_handler = {
+    .name = "System Timer",
+    .ack = sys_timer_ack,
+    .handle = sys_timer_handle,
+};
+
+int hw_timers_oneshot_set(uint64_t deadline)
+{
+    istate_t s_entry;
+    int retval = 0;
+
+    mmio_start(&s_entry);
+    mmio_write(SYS_TIMER_C3, (uint32_t)deadline);
+
+    /*
+     * The compare only matches on equality so check that the deadline
+     * didn't pass while it was written.
+     */
+    if ((int32_t)((uint32_t)deadline - mmio_read(SYS_TIMER_CLO)) <= 0) {
+        mmio_write(SYS_TIMER_STATUS, SYS_TIMER_M3);
+        retval = -EAGAIN;
+    }
+    mmio_end(&s_entry);
+
+    return retval;
+}
+
+void hw_timers_oneshot_clear(void)
+{
+    istate_t s_entry;
+
+    mmio_start(&s_entry);
+    /* Move the match as far as possible. */
+    mmio_write(SYS_TIMER_C3, mmio_read(SYS_TIMER_CLO) - 1);
+    mmio_write(SYS_TIMER_STATUS, SYS_TIMER_M3);
+    mmio_end(&s_entry);
+}
+
 static int enable_arm_timer(unsigned freq_hz)
 {
     istate_t s_entry;
@@ -135,6 +204,53 @@ static int enable_arm_timer(unsigned freq_hz)
     return irq_register(0, &bcm2835_timer_irq_handler);
 }
 
+#ifdef configSCHED_TICKLESS
+int hw_timers_tickless_enter(uint64_t deadline)
+{
+    istate_t s_entry;
+    uint32_t now;
+
+    mmio_start(&s_entry);
+    now = mmio_read(SYS_TIMER_CLO);
+    if ((int32_t)((uint32_t)deadline - now) <= 0) {
+        mmio_end(&s_entry);
+        return -EAGAIN;
+    }
+
+    /*
+     * The system timer match IRQ is only used to wake up the CPU from WFI,
+     * therefore no handler is registered for it and it's cleared before
+     * interrupts are enabled again.
+     */
+    mmio_write(SYS_TIMER_C1, (uint32_t)deadline);
+    mmio_write(SYS_TIMER_STATUS, SYS_TIMER_M1);
+    mmio_write(BCMIRQ_ENABLE_IRQ1, SYS_TIMER_M1);
+
+    /* Stop the scheduling timer. */
+    mmio_write(ARM_TIMER_CONTROL, ARM_TIMER_23BIT);
+    mmio_write(ARM_TIMER_IRQ_CLEAR, 0);
+    mmio_end(&s_entry);
+
+    return 0;
+}
+
+void hw_timers_tickless_exit(void)
+{
+    istate_t s_entry;
+
+    mmio_start(&s_entry);
+    mmio_write(BCMIRQ_DISABLE_IRQ1, SYS_TIMER_M1);
+    mmio_write(SYS_TIMER_STATUS, SYS_TIMER_M1);
+
+    /* Restart the scheduling timer and get the first tick immediately. */
+    mmio_write(ARM_TIMER_LOAD, 1);
+    mmio_write(ARM_TIMER_CONTROL,
+               ARM_TIMER_PRESCALE_16 | ARM_TIMER_EN |
+               ARM_TIMER_INT_EN | ARM_TIMER_23BIT);
+    mmio_end(&s_entry);
+}
+#endif
+
 __weak_reference(bcm_udelay, udelay);
 void bcm_udelay(uint32_t delay)
 {
@@ -159,8 +275,15 @@ uint64_t get_utime(void)
 
 static int bcm_interrupt_postinit(void)
 {
+    int err;
+
     SUBSYS_INIT("schedtimer");
 
+    hw_timers_oneshot_clear();
+    err = irq_register(SYS_TIMER_M3_IRQ, &bcm2835_sys_timer_irq_handler);
+    if (err)
+        return err;
+
     return enable_arm_timer(configSCHED_HZ);
 }
 HW_POSTINIT_ENTRY(bcm_interrupt_postinit);
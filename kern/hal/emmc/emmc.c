@@ -69,7 +69,9 @@
 #include <stdint.h>
 #include <sys/dev_major.h>
 #include <sys/ioctl.h>
+#include <sys/sysctl.h>
 #include <sys/types.h>
+#include <fs/blkq.h>
 #include <fs/mbr.h>
 #include <hal/hw_timers.h>
 #include <kerror.h>
@@ -120,6 +122,46 @@ static const char * err_irpts[] = {
 
 static mtx_t emmc_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DINT);
 
+/**
+ * Max number of blocks transferred with a single multiple block command.
+ */
+#define EMMC_MAX_MERGE_BLKS 128
+
+/*
+ * The request queue is kept outside of struct emmc_block_dev because the
+ * device struct is cleared if the card is reinitialized.
+ */
+static struct blkq emmc_blkq =
+    BLKQ_INITIALIZER(emmc_blkq, EMMC_MAX_MERGE_BLKS);
+
+SYSCTL_DECL(_hw_emmc);
+SYSCTL_NODE(_hw, OID_AUTO, emmc, CTLFLAG_RW, 0,
+            "EMMC driver");
+
+SYSCTL_UINT(_hw_emmc, OID_AUTO, max_merge, CTLFLAG_RW,
+            &emmc_blkq.bq_maxblks, 0,
+            "Max number of blocks in a merged request");
+
+SYSCTL_UINT(_hw_emmc, OID_AUTO, qdepth, CTLFLAG_RD,
+            &emmc_blkq.bq_depth, 0,
+            "Number of queued requests");
+
+SYSCTL_UINT(_hw_emmc, OID_AUTO, max_qdepth, CTLFLAG_RD,
+            &emmc_blkq.bq_max_depth, 0,
+            "Max number of queued requests");
+
+SYSCTL_UINT(_hw_emmc, OID_AUTO, requests, CTLFLAG_RD,
+            &emmc_blkq.bq_nr_requests, 0,
+            "Number of requests submitted");
+
+SYSCTL_UINT(_hw_emmc, OID_AUTO, merged, CTLFLAG_RD,
+            &emmc_blkq.bq_nr_merged, 0,
+            "Number of requests merged to an adjacent request");
+
+SYSCTL_UINT(_hw_emmc, OID_AUTO, commands, CTLFLAG_RD,
+            &emmc_blkq.bq_nr_dispatch, 0,
+            "Number of data commands issued by the request queue");
+
 static ssize_t sd_read(struct dev_info * dev, off_t offset, uint8_t * buf,
                        size_t count, int oflags);
 static ssize_t sd_write(struct dev_info * dev, off_t offset, uint8_t * buf,
@@ -1315,6 +1357,7 @@ static int emmc_card_init(struct emmc_block_dev ** edev)
     ret->dev.lseek = sd_lseek;
     ret->dev.ioctl = sd_ioctl;
     ret->dev.flags = DEV_FLAGS_MB_READ | DEV_FLAGS_MB_WRITE;
+    ret->dev.blkq = &emmc_blkq;
     ret->base_clock = base_clock;
 
 #ifdef configEMMC_DEBUG
@@ -30,11 +30,21 @@
  *******************************************************************************
  */
 
+#include <errno.h>
 #include <sys/linker_set.h>
+#include <hal/core.h>
 #include <hal/hw_timers.h>
+#include <klocks.h>
 
 SET_DECLARE(timer_tasks, timer_task_t);
 
+/**
+ * One-shot timer events sorted by the deadline.
+ */
+static TAILQ_HEAD(hw_timer_eventq, hw_timer_event) hw_eventq =
+    TAILQ_HEAD_INITIALIZER(hw_eventq);
+static mtx_t hw_eventq_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+
 void hw_timers_run(void)
 {
     timer_task_t ** task_p;
@@ -44,3 +54,109 @@ void hw_timers_run(void)
         task();
     }
 }
+
+int __attribute__((weak)) hw_timers_oneshot_set(uint64_t deadline)
+{
+    return -ENOTSUP;
+}
+
+void __attribute__((weak)) hw_timers_oneshot_clear(void)
+{
+}
+
+/**
+ * Program the one-shot timer for the first event in hw_eventq.
+ * If the first event has already expired the timer is set to fire as soon
+ * as possible. hw_eventq_lock must be held.
+ */
+static void hw_eventq_program(void)
+{
+    struct hw_timer_event * ev = TAILQ_FIRST(&hw_eventq);
+    uint64_t deadline;
+
+    if (!ev) {
+        hw_timers_oneshot_clear();
+        return;
+    }
+
+    deadline = ev->deadline;
+    while (hw_timers_oneshot_set(deadline) == -EAGAIN) {
+        deadline = get_utime() + 1;
+    }
+}
+
+int hw_timers_event_add(struct hw_timer_event * ev)
+{
+    struct hw_timer_event * it;
+    istate_t s;
+    int err = 0;
+
+    if (ev->deadline <= get_utime())
+        return -EAGAIN;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+    mtx_lock(&hw_eventq_lock);
+
+    TAILQ_FOREACH(it, &hw_eventq, entry_) {
+        if (it->deadline > ev->deadline)
+            break;
+    }
+    if (it)
+        TAILQ_INSERT_BEFORE(it, ev, entry_);
+    else
+        TAILQ_INSERT_TAIL(&hw_eventq, ev, entry_);
+    ev->queued = 1;
+
+    if (TAILQ_FIRST(&hw_eventq) == ev) {
+        err = hw_timers_oneshot_set(ev->deadline);
+        if (err) {
+            TAILQ_REMOVE(&hw_eventq, ev, entry_);
+            ev->queued = 0;
+            hw_eventq_program();
+        }
+    }
+
+    mtx_unlock(&hw_eventq_lock);
+    set_interrupt_state(s);
+
+    return err;
+}
+
+void hw_timers_event_cancel(struct hw_timer_event * ev)
+{
+    istate_t s;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+    mtx_lock(&hw_eventq_lock);
+
+    if (ev->queued) {
+        const int first = TAILQ_FIRST(&hw_eventq) == ev;
+
+        TAILQ_REMOVE(&hw_eventq, ev, entry_);
+        ev->queued = 0;
+        if (first)
+            hw_eventq_program();
+    }
+
+    mtx_unlock(&hw_eventq_lock);
+    set_interrupt_state(s);
+}
+
+void hw_timers_event_run(void)
+{
+    struct hw_timer_event * ev;
+
+    mtx_lock(&hw_eventq_lock);
+    while ((ev = TAILQ_FIRST(&hw_eventq)) && ev->deadline <= get_utime()) {
+        TAILQ_REMOVE(&hw_eventq, ev, entry_);
+        ev->queued = 0;
+
+        mtx_unlock(&hw_eventq_lock);
+        ev->fn(ev->arg);
+        mtx_lock(&hw_eventq_lock);
+    }
+    hw_eventq_program();
+    mtx_unlock(&hw_eventq_lock);
+}
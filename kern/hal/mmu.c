@@ -65,6 +65,22 @@ unsigned long mmu_pfps; /*!< Page faults per second average. Fixed point, 11
 SYSCTL_UINT(_vm, OID_AUTO, pfps, CTLFLAG_RD, (&mmu_pfps), 0,
     "Page faults per second average.");
 
+unsigned mmu_mapped_pages[MMU_PGSZ_COUNT];
+
+SYSCTL_DECL(_vm_pgsize);
+SYSCTL_NODE(_vm, OID_AUTO, pgsize, CTLFLAG_RW, 0,
+            "Mappings by page size");
+
+SYSCTL_UINT(_vm_pgsize, OID_AUTO, small, CTLFLAG_RD,
+            &mmu_mapped_pages[MMU_PGSZ_SMALL], 0,
+            "Number of small pages currently mapped");
+SYSCTL_UINT(_vm_pgsize, OID_AUTO, large, CTLFLAG_RD,
+            &mmu_mapped_pages[MMU_PGSZ_LARGE], 0,
+            "Number of large pages currently mapped");
+SYSCTL_UINT(_vm_pgsize, OID_AUTO, section, CTLFLAG_RD,
+            &mmu_mapped_pages[MMU_PGSZ_SECTION], 0,
+            "Number of sections currently mapped");
+
 size_t mmu_sizeof_pt(const mmu_pagetable_t * pt)
 {
     size_t nr_tables;
@@ -167,7 +183,9 @@ int mmu_ptcpy(mmu_pagetable_t * dest, const mmu_pagetable_t * src)
         return -3;
     }
 
+    mmu_account_pagetable(dest, -1);
     memcpy((void *)(dest->pt_addr), (void *)(src->pt_addr), len_src);
+    mmu_account_pagetable(dest, 1);
 
     return 0;
 }
@@ -87,9 +87,10 @@ struct buf {
     const struct vm_ops * vm_ops;
 
     void * allocator_data;  /*!< Allocator specific data. */
-    SPLAY_ENTRY(buf) sentry_;
+    LIST_ENTRY(buf) b_hashentry_; /*!< bio hash bucket entry. */
     LIST_ENTRY(buf) shmem_entry_; /*!< shmem sync list entry. */
-    TAILQ_ENTRY(buf) relse_entry_; /*!< bio relse list entry. */
+    TAILQ_ENTRY(buf) b_qentry_; /*!< bio queue entry. */
+    unsigned b_qindex;      /*!< bio queue the buffer is in. */
 
     struct kobj b_obj;
     mtx_t lock;
@@ -116,6 +117,32 @@ typedef struct vm_ops {
      */
     struct buf * (*rclone)(struct buf * old_region);
 
+    /**
+     * Create a page granular copy-on-write region.
+     * The new region shares all the pages of the current region and only
+     * the pages written to are copied later on by rpage().
+     * @note Can be null.
+     * @param cur_region    is a pointer to the current region.
+     */
+    struct buf * (*rshadow)(struct buf * cur_region);
+
+    /**
+     * Get the physical address of a page of a page granular region.
+     * @note Can be null.
+     * @note The region must not be shared if VM_RPAGE_WRITE is set.
+     * @param this      is the current region.
+     * @param iblock    is the page index within the region.
+     * @param flags     VM_RPAGE_ flags.
+     * @param[out] paddr returns the physical address of the page.
+     * @return  Returns 1 if the page is only mapped by this region;
+     *          0 if the page is shared;
+     *          -ENOENT if the page is not in core and VM_RPAGE_FILL is
+     *          not set;
+     *          Otherwise a negative errno code is returned.
+     */
+    int (*rpage)(struct buf * this, size_t iblock, int flags,
+                 uintptr_t * paddr);
+
     /**
      * Free this region.
      * @note Can be null.
@@ -124,13 +151,23 @@ typedef struct vm_ops {
     void (*rfree)(struct buf * this);
 } vm_ops_t;
 
+/* rpage() flags */
+#define VM_RPAGE_WRITE  0x1 /*!< Make the page private to the region. */
+#define VM_RPAGE_FILL   0x2 /*!< Read the page in if it's not in core. */
+
 /* generic */
+#define B_READ      0x0000001  /*!< Read request, write if not set. */
 #define B_DONE      0x0000002  /*!< Transaction finished. */
 #define B_ERROR     0x0000004  /*!< Transaction aborted. */
 #define B_BUSY      0x0000008  /*!< Buffer busy. */
 #define B_LOCKED    0x0000010  /*!< Locked in memory. */
 #define B_DIRTY     0x0000020
+#define B_CACHE     0x0000040  /*!< Buffer is in the buffer cache. */
+#define B_INVAL     0x0000080  /*!< Free the buffer on brelse(). */
 #define B_NOCOPY    0x0000100  /*!< Don't copy-on-write this buf. */
+#define B_REUSED    0x0000200  /*!< Buffer has been found from the cache. */
+#define B_VALID     0x0000400  /*!< Buffer contains valid data. */
+#define B_RAHEAD    0x0000800  /*!< Read-ahead buffer not used yet. */
 #define B_NOSYNC    0x0001000  /*!< Never synch to the fs. */
 #define B_ASYNC     0x0002000  /*!< Start I/O but don't wait for completion. */
 #define B_DELWRI    0x0004000  /*!< Delayed write. */
@@ -143,9 +180,6 @@ typedef struct vm_ops {
 #define BUF_LOCK(bp)    mtx_lock(&(bp)->lock)
 #define BUF_UNLOCK(bp)  mtx_unlock(&(bp)->lock)
 
-int biobuf_compar(struct buf * a, struct buf * b);
-SPLAY_PROTOTYPE(bufhd_splay, buf, sentry_, biobuf_compar);
-
 /**
  * Read a block corresponding to vnode and blkno.
  * If the buffer is not found (i.e. the block is not cached in memory,
@@ -172,15 +206,30 @@ int bread(vnode_t * vnode, size_t blkno, int size, struct buf ** bpp);
  * @param[in]   vnode   is a pointer to a vnode.
  * @param[in]   blkno   is a block number.
  * @param[in]   size    is the size to be read.
- * @param[in]   rablks
- * @param[in]   rasizes
- * @param[in]   nrablks
+ * @param[in]   rablks  is an array of block numbers to be read ahead.
+ * @param[in]   rasizes is an array of sizes of the read-ahead blocks.
+ * @param[in]   nrablks is the number of read-ahead blocks.
  * @param[out]  bpp     points to the returned buffer.
  * @return      Returns 0 if succeed; A negative errno if failed.
  */
 int  breadn(vnode_t * vnode, size_t blkno, int size, size_t rablks[],
             int rasizes[], int nrablks, struct buf ** bpp);
 
+/**
+ * Get a buffer as bread() using an open file.
+ * bread_ra() tracks the access pattern of the file and starts an adaptive
+ * read-ahead with breadn() while the file is read sequentially. The window
+ * is doubled on each sequential read up to vm.bio.ra_max blocks. The
+ * read-ahead state of the file is locked internally, so the same file can
+ * be read concurrently.
+ * @param[in]   file    is the open file.
+ * @param[in]   blkno   is a block number.
+ * @param[in]   size    is the size to be read.
+ * @param[out]  bpp     points to the returned buffer.
+ * @return      Returns 0 if succeed; A negative errno if failed.
+ */
+int bread_ra(file_t * file, size_t blkno, int size, struct buf ** bpp);
+
 /**
  * Write a block.
  * This will block until IO is complete.
@@ -212,6 +261,13 @@ void bio_clrbuf(struct buf * bp);
  * If the block is found in the cache, mark it as having been found, make it
  * busy and return. Otherwise, return an empty block of the correct size.  It
  * is up to the caller to ensure that the cache blocks are of the correct size.
+ * If the block is busy the caller sleeps until it's released.
+ * @param[in]   vnode       is a vnode pointer.
+ * @param[in]   blkno       is the block number.
+ * @param[in]   size        is the size of the block.
+ * @param[in]   slptimeo    is the timeout for waiting a busy block in
+ *                          milliseconds; 0 waits forever.
+ * @return  Returns the buffer; NULL if out of memory or the timeout expired.
  */
 struct buf * getblk(vnode_t * vnode, size_t blkno, size_t size, int slptimeo)
     __attribute__ ((warn_unused_result));
@@ -243,6 +299,14 @@ struct buf * geteblk_special(size_t size, uint32_t control)
  */
 struct buf * incore(vnode_t * vnode, size_t blkno);
 
+/**
+ * Remove all buffers associated with a vnode from the buffer cache.
+ * Delayed writes are written out before the buffers are freed. Buffers
+ * that are currently busy are freed when they are released with brelse().
+ * @param[in]   vnode   is a vnode pointer.
+ */
+void bio_vnode_purge(vnode_t * vnode);
+
 /**
  * Readin file backed buffer.
  * @param bp is the buffer.
@@ -281,8 +345,9 @@ void biodone(struct buf * bp);
 
 /**
  * Wait for operations on the buffer to complete.
+ * The caller sleeps until biodone() is called for the buffer.
  * @param[in] buf   is the buffer.
- * @return  Returns 0 if IO was complete; In case of IO error -EIO.
+ * @return  Returns 0 if IO was complete; Otherwise the error of the IO.
  */
 int biowait(struct buf * bp);
 
@@ -0,0 +1,127 @@
+/**
+ *******************************************************************************
+ * @file    blkq.h
+ * @author  Olli Vanhoja
+ * @brief   Block device request queue.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup blkq
+ * Block device request queue.
+ * A block request queue sits between devfs and a block device driver.
+ * Requests are described by buf structures and kept sorted by the block
+ * number. Requests to adjacent blocks in the same direction are coalesced
+ * into a single driver call, so a driver supporting multiple block transfers
+ * can use a single multi-block command for them. Completion of each request
+ * is signaled with biodone(). Requests are dispatched by a kernel thread,
+ * so the requests submitted while a driver call is in progress are merged
+ * with each other.
+ * @{
+ */
+
+#pragma once
+#ifndef BLKQ_H
+#define BLKQ_H
+
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <klocks.h>
+
+struct buf;
+struct dev_info;
+
+/**
+ * Block request queue.
+ */
+struct blkq {
+    mtx_t bq_lock;
+    TAILQ_HEAD(blkq_head, buf) bq_head; /*!< Requests sorted by b_blkno. */
+    size_t bq_maxblks;      /*!< Max number of blocks in a merged request. */
+    size_t bq_pos;          /*!< Block following the last dispatched request. */
+    int bq_active;          /*!< The queue is being dispatched. */
+    struct dev_info * bq_devnfo; /*!< Device of the queue. */
+    TAILQ_ENTRY(blkq) bq_pending_entry_; /*!< blkq thread pending list. */
+
+    /* Stats */
+    size_t bq_depth;        /*!< Number of queued requests. */
+    size_t bq_max_depth;    /*!< Max observed bq_depth. */
+    size_t bq_nr_requests;  /*!< Number of requests submitted. */
+    size_t bq_nr_merged;    /*!< Number of requests merged to another one. */
+    size_t bq_nr_dispatch;  /*!< Number of driver calls. */
+};
+
+/**
+ * Block request queue static initializer.
+ * @param _bq_      is the queue being initialized.
+ * @param _maxblks_ is the max number of blocks in a single driver call.
+ */
+#define BLKQ_INITIALIZER(_bq_, _maxblks_) {                         \
+    .bq_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, MTX_OPT_DEFAULT),   \
+    .bq_head = TAILQ_HEAD_INITIALIZER((_bq_).bq_head),              \
+    .bq_maxblks = (_maxblks_),                                      \
+}
+
+/**
+ * Initialize a block request queue.
+ * @param bq        is the queue.
+ * @param maxblks   is the max number of blocks in a single driver call.
+ */
+void blkq_init(struct blkq * bq, size_t maxblks);
+
+/**
+ * Submit an I/O request to the request queue of a device.
+ * The request is described by b_data, b_bcount and b_blkno of bp, and it's
+ * a read if B_READ is set in b_flags; Otherwise a write. The request is
+ * completed with biodone() and b_error and b_resid are set accordingly.
+ * The request is dispatched asynchronously by the blkq thread, so this
+ * function may return before the request is completed; Use biowait() to
+ * wait for the completion. Before the blkq thread is started the request is
+ * dispatched by the calling thread.
+ * @param devnfo    is the device, devnfo->blkq must be set.
+ * @param bp        is the request.
+ */
+void blkq_strategy(struct dev_info * devnfo, struct buf * bp);
+
+/**
+ * Read or write a device synchronously through its request queue.
+ * @param devnfo    is the device, devnfo->blkq must be set.
+ * @param write     selects a write if set; Otherwise a read.
+ * @param blkno     is the first block.
+ * @param buf       is the data buffer in kernel space.
+ * @param bcount    is the transfer size in bytes.
+ * @return  Returns the number of bytes transferred;
+ *          Otherwise a negative errno.
+ */
+ssize_t blkq_rw(struct dev_info * devnfo, int write, off_t blkno,
+                uint8_t * buf, size_t bcount);
+
+#endif /* BLKQ_H */
+
+/**
+ * @}
+ */
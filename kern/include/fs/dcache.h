@@ -0,0 +1,101 @@
+/**
+ *******************************************************************************
+ * @file    dcache.h
+ * @author  Olli Vanhoja
+ * @brief   VFS name lookup cache.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+/**
+ * @addtogroup dcache
+ * VFS name lookup cache.
+ * The name cache maps a (directory vnode, name) pair to the vnode returned
+ * by the lookup() vnode operation of the file system. Readers walk the cache
+ * under an RCU reader lock, so a cache hit doesn't take any locks nor call
+ * the file system. Failed lookups are cached as negative entries.
+ * Only file systems setting FS_FLAG_DCACHE are cached.
+ * @{
+ */
+
+#pragma once
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <fs/fs.h>
+
+#ifdef configVFS_DCACHE
+
+/**
+ * Lookup a name in a directory.
+ * The cache is checked first and on a miss the lookup() vnode operation of
+ * dir is called and its result is added to the cache.
+ * @param dir is the directory vnode.
+ * @param name is the name of the entry.
+ * @param[out] result returns a referenced vnode.
+ * @return Returns the same values as the lookup() vnode operation.
+ */
+int dcache_lookup(vnode_t * dir, const char * name, vnode_t ** result);
+
+/**
+ * Invalidate a cache entry.
+ * Must be called when a directory entry is added or removed.
+ * @param dir is the directory vnode.
+ * @param name is the name of the entry.
+ */
+void dcache_invalidate(vnode_t * dir, const char * name);
+
+/**
+ * Remove all cache entries referencing vnodes of a superblock.
+ * The references held by the cache are released before returning.
+ * @param sb is a pointer to the superblock.
+ */
+void dcache_purge_sb(struct fs_superblock * sb);
+
+#else /* !configVFS_DCACHE */
+
+static inline int dcache_lookup(vnode_t * dir, const char * name,
+                                vnode_t ** result)
+{
+    return dir->vnode_ops->lookup(dir, name, result);
+}
+
+static inline void dcache_invalidate(vnode_t * dir, const char * name)
+{
+}
+
+static inline void dcache_purge_sb(struct fs_superblock * sb)
+{
+}
+
+#endif
+
+#endif /* DCACHE_H */
+
+/**
+ * @}
+ */
@@ -56,6 +56,8 @@
 
 #define FS_FLAG_INIT    0x01 /*!< File system initialized. */
 #define FS_FLAG_FAIL    0x08 /*!< File system has failed. */
+#define FS_FLAG_DCACHE  0x10 /*!< Name lookups can be cached by the VFS.
+                              *   Only for case-sensitive names. */
 
 #define PATH_DELIMS     "/"
 
@@ -96,9 +98,8 @@ struct statvfs;
 /*
  * Types for buffer pointer storage object in vnode.
  */
-SPLAY_HEAD(bufhd_splay, buf);
 struct bufhd {
-    struct bufhd_splay sroot;
+    atomic_t bh_count; /*!< Number of buffers in the buffer cache. */
 };
 
 typedef struct vnode {
@@ -122,10 +123,11 @@ typedef struct vnode {
                                  * required by the ops. */
 
     /**
-     * Pointer to a buffer pointer storage object.
+     * Buffer pointer storage object.
      * vn_bpo represents a set of buffers belonging to the same vnode where
      * different buffers cover different non-overlapping ranges of data
-     * within the vnode.
+     * within the vnode. The buffers themselves are stored in the global
+     * buffer cache.
      */
     struct bufhd vn_bpo;
 
@@ -169,6 +171,15 @@ typedef struct vnode {
  */
 #define VNOVAL  (-1)
 
+/**
+ * Read-ahead state of an open file.
+ */
+struct file_ra {
+    size_t ra_next;     /*!< Next block on sequential access. */
+    size_t ra_end;      /*!< End of the blocks already read ahead. */
+    unsigned ra_window; /*!< Current read-ahead window in blocks. */
+};
+
 /**
  * File descriptor.
  */
@@ -177,6 +188,7 @@ typedef struct file {
     int oflags;         /*!< File status flags. */
     vnode_t * vnode;
     void * stream;      /*!< Pointer to a special file stream data or info. */
+    struct file_ra f_ra; /*!< Read-ahead state of sequential reads. */
     struct kobj f_obj;
 } file_t;
 
@@ -213,6 +225,7 @@ typedef struct files_struct {
 typedef struct fs {
     char fsname[8];
     unsigned fs_majornum; /*!< Virtual major device number of the filesystem. */
+    uint32_t fs_flags;    /*!< File system flags. */
     mtx_t fs_giant;
 
     /**
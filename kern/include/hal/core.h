@@ -124,6 +124,35 @@ void hal_thread_yield(void);
 
 void stack_dump(sw_stack_frame_t frame);
 
+#ifdef configMP
+/**
+ * @addtogroup HAL_MP
+ * Platform specific MP support.
+ * @{
+ */
+
+/**
+ * Start a secondary CPU core.
+ * The core shall call sched_cpu_start() once its stacks and MMU are
+ * initialized.
+ * @param cpu_index is the index of the CPU core to be started.
+ * @return  Returns 0 if the core was started;
+ *          Otherwise a negative errno code is returned.
+ */
+int hal_mp_start_cpu(int cpu_index);
+
+/**
+ * Send a reschedule IPI to a CPU core.
+ * The receiving core shall wake up from idle sleep.
+ * @param cpu_index is the index of the receiving CPU core.
+ */
+void hal_mp_send_ipi(int cpu_index);
+
+/**
+ * @}
+ */
+#endif
+
 /*
  * Core Implementation must provide following either as inlined functions or
  * macros:
@@ -131,6 +160,7 @@ void stack_dump(sw_stack_frame_t frame);
  * + enable_interrupt()
  * + req_context_switch()
  * + idle_sleep()
+ * + cpu_get_index() if configMP is set
  * and the following types:
  * + hw_stack_frame_t - is a struct that describes hardware backed stack frame.
  * + sw_stack_frame_t - is a struct that describes software backed stack frame.
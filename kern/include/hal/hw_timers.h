@@ -36,6 +36,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/queue.h>
 
 /**
  * Get us timestamp.
@@ -65,4 +66,71 @@ typedef void timer_task_t(void);
  */
 void hw_timers_run(void);
 
+/**
+ * One-shot hardware timer event.
+ * The event is owned by the caller and it must stay valid until it has
+ * expired or it has been canceled.
+ */
+struct hw_timer_event {
+    uint64_t deadline;          /*!< Expiry time in usec. */
+    void (*fn)(void * arg);     /*!< Called in interrupt context on expiry. */
+    void * arg;                 /*!< Argument for fn. */
+    int queued;                 /*!< Set while the event is queued. */
+    TAILQ_ENTRY(hw_timer_event) entry_;
+};
+
+/**
+ * Add a one-shot hardware timer event.
+ * @param ev is a pointer to the event.
+ * @return  Returns 0 if the event was added;
+ *          -EAGAIN if the deadline has already passed;
+ *          -ENOTSUP if the platform doesn't support one-shot timers.
+ */
+int hw_timers_event_add(struct hw_timer_event * ev);
+
+/**
+ * Cancel a one-shot hardware timer event.
+ * It's safe to call this function for an expired event.
+ * @param ev is a pointer to the event.
+ */
+void hw_timers_event_cancel(struct hw_timer_event * ev);
+
+/**
+ * Run expired one-shot timer events.
+ * Shall be called by the HW specific one-shot timer interrupt handler.
+ */
+void hw_timers_event_run(void);
+
+/**
+ * Program the HW specific one-shot timer.
+ * @param deadline is the expiry time in usec.
+ * @return  Returns 0 if the timer was programmed;
+ *          -EAGAIN if the deadline has already passed;
+ *          Otherwise a negative errno is returned.
+ */
+int hw_timers_oneshot_set(uint64_t deadline);
+
+/**
+ * Disable the HW specific one-shot timer.
+ */
+void hw_timers_oneshot_clear(void);
+
+#ifdef configSCHED_TICKLESS
+/**
+ * Stop the periodic timer interrupt and set a one-shot wakeup.
+ * Shall be called with interrupts disabled.
+ * @param deadline is the wakeup time in usec.
+ * @return Returns 0 if the periodic timer was stopped;
+ *         Otherwise a negative errno is returned.
+ */
+int hw_timers_tickless_enter(uint64_t deadline);
+
+/**
+ * Restart the periodic timer interrupt.
+ * Shall be called with interrupts disabled. The first tick is delivered
+ * immediately after interrupts are enabled.
+ */
+void hw_timers_tickless_exit(void);
+#endif
+
 #endif /* HW_TIMERS_H */
@@ -223,6 +223,22 @@ typedef struct mmu_region {
 struct proc_info;
 struct thread_info;
 
+/**
+ * Page sizes used for mappings.
+ */
+enum mmu_pgsize {
+    MMU_PGSZ_SMALL,     /*!< Coarse page table small page. */
+    MMU_PGSZ_LARGE,     /*!< Coarse page table large page. */
+    MMU_PGSZ_SECTION,   /*!< Master page table section. */
+    MMU_PGSZ_COUNT
+};
+
+/**
+ * Number of pages currently mapped by page size.
+ * Updated by the HAL when it writes, copies or frees page table entries.
+ */
+extern unsigned mmu_mapped_pages[MMU_PGSZ_COUNT];
+
 /**
  * MMU Abort type.
  */
@@ -263,6 +279,12 @@ void mmu_domain_access_set(uint32_t value, uint32_t mask);
 void mmu_control_set(uint32_t value, uint32_t mask);
 void * mmu_translate_vaddr(const mmu_pagetable_t * pt, uintptr_t vaddr);
 
+/**
+ * Add (sign = 1) or remove (sign = -1) the entries of a page table to/from
+ * mmu_mapped_pages.
+ */
+void mmu_account_pagetable(const mmu_pagetable_t * pt, int sign);
+
 const char * mmu_abo_strtype(const struct mmu_abo_param * restrict abo);
 
 /**
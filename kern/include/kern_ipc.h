@@ -51,4 +51,47 @@ int fs_pipe_curproc_creat(struct files_struct * files, int fildes[2],
  */
 int fs_pipe_destroy(vnode_t * vnode);
 
+/**
+ * Get the capacity of a pipe.
+ * @param file is a pipe end.
+ * @return Returns the capacity in bytes;
+ *         Otherwise a negative errno.
+ */
+int fs_pipe_getsize(file_t * file);
+
+/**
+ * Change the capacity of a pipe.
+ * The size is rounded up to a multiple of the page size.
+ * @param file is a pipe end.
+ * @param len is the new minimum capacity in bytes.
+ * @return Returns the new capacity in bytes;
+ *         Otherwise a negative errno.
+ */
+int fs_pipe_setsize(file_t * file, size_t len);
+
+/**
+ * Move data between a pipe and another file.
+ * One of the files must be a pipe and the data is copied only once, directly
+ * between the pipe buffer and the other file.
+ * @param in is the file opened for reading.
+ * @param out is the file opened for writing.
+ * @param count is the maximum number of bytes to move.
+ * @param flags is a bitwise or of SPLICE_F flags.
+ * @return Returns the number of bytes moved; 0 on EOF;
+ *         Otherwise a negative errno.
+ */
+ssize_t fs_pipe_splice(file_t * in, file_t * out, size_t count,
+                       unsigned flags);
+
+/**
+ * Copy data from a pipe to another pipe without consuming it.
+ * @param in is the read end of the source pipe.
+ * @param out is the write end of the destination pipe.
+ * @param count is the maximum number of bytes to copy.
+ * @param flags is a bitwise or of SPLICE_F flags.
+ * @return Returns the number of bytes copied; 0 on EOF;
+ *         Otherwise a negative errno.
+ */
+ssize_t fs_pipe_tee(file_t * in, file_t * out, size_t count, unsigned flags);
+
 #endif /* KERN_IPC_H */
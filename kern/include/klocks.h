@@ -42,6 +42,7 @@
 #ifndef KLOCKS_H_
 #define KLOCKS_H_
 
+#include <sys/queue.h>
 #include <sys/types_pthread.h>
 #include <machine/atomic.h>
 #include <hal/core.h>
@@ -73,6 +74,7 @@
  * MTX_TYPE_UNDEF       -
  * MTX_TYPE_SPIN        MTX_OPT_SLEEP, MTX_OPT_PRICEIL, MTX_OPT_DINT
  * MTX_TYPE_TICKET      MTX_OPT_PRICEIL, MTX_OPT_DINT
+ * MTX_TYPE_ADAPTIVE    MTX_OPT_PRICEIL
  */
 
 /**
@@ -84,6 +86,11 @@ enum mtx_type {
     MTX_TYPE_TICKET,        /*!< Use ticket spin locking. This will also use
                              *   yield which may not be sufficient for blocking
                              *   interrupt handlers and such. */
+    MTX_TYPE_ADAPTIVE,      /*!< Spin while the owner is running on another
+                             *   CPU, otherwise block. The owner inherits the
+                             *   priority of a higher priority waiter.
+                             *   Spins if interrupts are disabled, so it
+                             *   can't be used in interrupt handlers. */
 };
 
 
@@ -114,6 +121,47 @@ enum mtx_type {
  */
 #define MTX_OPT_TIMEOUT(x) (0xf & (x))
 
+struct thread_info;
+struct mtx_waiter;
+
+#ifdef configLOCK_PROFILE
+/**
+ * Lock contention profiling counters of a lock class.
+ */
+struct mtx_lock_class {
+    const char * lc_name;
+    unsigned lc_nr_acquired;    /*!< Number of acquisitions. */
+    unsigned lc_nr_contended;   /*!< Number of contended acquisitions. */
+    uint64_t lc_wait_usec;      /*!< Total wait time of contended
+                                 *   acquisitions. */
+};
+
+/**
+ * Define a lock class.
+ * The counters of the class are exported under debug.lock.<name>.
+ * Requires sys/sysctl.h.
+ */
+#define MTX_LOCK_CLASS(_name_, _descr_)                                     \
+    struct mtx_lock_class mtx_lclass_##_name_ = { .lc_name = #_name_ };    \
+    SYSCTL_DECL(_debug_lock);                                               \
+    SYSCTL_NODE(_debug_lock, OID_AUTO, _name_, CTLFLAG_RW, 0, _descr_);     \
+    SYSCTL_UINT(_debug_lock_##_name_, OID_AUTO, acquired, CTLFLAG_RD,       \
+                &mtx_lclass_##_name_.lc_nr_acquired, 0,                     \
+                "Number of acquisitions");                                  \
+    SYSCTL_UINT(_debug_lock_##_name_, OID_AUTO, contended, CTLFLAG_RD,      \
+                &mtx_lclass_##_name_.lc_nr_contended, 0,                    \
+                "Number of contended acquisitions");                        \
+    SYSCTL_PROC(_debug_lock_##_name_, OID_AUTO, wait_usec,                  \
+                CTLTYPE_U64 | CTLFLAG_RD,                                   \
+                &mtx_lclass_##_name_.lc_wait_usec, 0, sysctl_handle_64,     \
+                "QU", "Total wait time [us]")
+
+#define _MTX_LCLASS_INIT(_name_) .mtx_lclass = &mtx_lclass_##_name_,
+#else
+#define MTX_LOCK_CLASS(_name_, _descr_)
+#define _MTX_LCLASS_INIT(_name_)
+#endif
+
 /**
  * Sleep/spin mutex.
  */
@@ -132,6 +180,18 @@ typedef struct mtx {
         int p_lock;
         int p_saved;
     } pri;
+    struct mtx_adaptive {
+        struct thread_info * owner;     /*!< Current owner. */
+        atomic_t nr_waiters;
+        LIST_HEAD(mtx_waiters, mtx_waiter) waiters; /*!< Blocked threads. */
+        /** The thread having the mutex in its contested list. */
+        struct thread_info * pi_owner;
+        LIST_ENTRY(mtx) contested_entry_;
+    } adaptive;                 /*!< Adaptive mutex. */
+#ifdef configLOCK_PROFILE
+    struct mtx_lock_class * mtx_lclass; /*!< Profiling class; NULL for the
+                                         *   default class of the type. */
+#endif
 #ifdef configLOCK_DEBUG
     char * mtx_ldebug;
 #endif
@@ -163,6 +223,24 @@ void mtx_init(mtx_t * mtx, enum mtx_type type, unsigned int opt);
     .mtx_lock = ATOMIC_INIT(0),                 \
     .ticket.queue = ATOMIC_INIT(0),             \
     .ticket.dequeue = ATOMIC_INIT(0),           \
+    .adaptive.nr_waiters = ATOMIC_INIT(0),      \
+}
+
+/**
+ * Static initializer for a kernel mutex belonging to a lock class.
+ * @param type is the lock type.
+ * @param opt OR'd lock options.
+ * @param lclass is the name of a class defined with MTX_LOCK_CLASS().
+ */
+#define MTX_INITIALIZER_CLASS(type, opt, lclass) (mtx_t){   \
+    .mod.mtx_type = (type),                                 \
+    .mod.mtx_flags = (opt),                                 \
+    .mod.mtx_modcsum = MTX_MODCSUM(type, opt),              \
+    .mtx_lock = ATOMIC_INIT(0),                             \
+    .ticket.queue = ATOMIC_INIT(0),                         \
+    .ticket.dequeue = ATOMIC_INIT(0),                       \
+    .adaptive.nr_waiters = ATOMIC_INIT(0),                  \
+    _MTX_LCLASS_INIT(lclass)                                \
 }
 
 /* Mutex functions */
@@ -46,7 +46,11 @@
 
 struct thread_info;
 
+#ifdef configMP
+#define KSCHED_CPU_COUNT    configMP_CPU_COUNT
+#else
 #define KSCHED_CPU_COUNT    1
+#endif
 
 /**
  * Struct describing a generic thread scheduler.
@@ -78,6 +82,33 @@ struct scheduler {
      * @return  Number of threads scheduled in the context of sobj.
      */
     unsigned (*get_nr_active_threads)(struct scheduler * sobj);
+    /**
+     * Remove a thread from this scheduler.
+     * Optional, only required if the scheduler implements steal().
+     * @param sobj is a pointer to the scheduling object.
+     * @param thread is a pointer to the thread to be removed.
+     */
+    void (*remove)(struct scheduler * sobj, struct thread_info * thread);
+    /**
+     * Update the scheduling position of a thread after its priority was
+     * changed.
+     * Optional, only required if the scheduler caches the priority of
+     * threads in its run queues.
+     * @param sobj is a pointer to the scheduling object.
+     * @param thread is a pointer to the thread.
+     */
+    void (*reprio)(struct scheduler * sobj, struct thread_info * thread);
+    /**
+     * Steal a thread for execution on another CPU.
+     * Optional. The scheduler shall select a candidate thread, claim it by
+     * calling sched_migrate_claim() and remove it from the scheduler if the
+     * claim succeeded.
+     * @param sobj is a pointer to the scheduling object.
+     * @param cpu_index is the index of the CPU stealing the thread.
+     * @return  Returns a pointer to the stolen thread;
+     *          Or a NULL pointer if there was no thread to steal.
+     */
+    struct thread_info * (*steal)(struct scheduler * sobj, unsigned cpu_index);
 };
 
 /**
@@ -105,6 +136,12 @@ typedef void thread_cdtor_t(struct thread_info * td);
 typedef void thread_fork_handler_t(struct thread_info * td,
                                    struct thread_info * old);
 
+/**
+ * Declare a task run on every scheduling tick.
+ */
+#define SCHED_TICK_TASK(fun)            \
+    DATA_SET(sched_tick_tasks, fun)
+
 #define SCHED_PRE_SCHED_TASK(fun)       \
     DATA_SET(pre_sched_tasks, fun)
 
@@ -138,12 +175,67 @@ SYSCTL_DECL(_kern_sched);
  */
 int get_cpu_index(void);
 
+/**
+ * Test if the caller is executing on the boot CPU.
+ * System wide tasks that should be only run once per tick, e.g. timers,
+ * are executed on the boot CPU.
+ */
+#ifdef configMP
+#define sched_is_boot_cpu() (get_cpu_index() == 0)
+#else
+#define sched_is_boot_cpu() 1
+#endif
+
+#ifdef configMP
+/**
+ * Test if there are threads waiting in the readyq of the current CPU.
+ */
+int sched_readyq_pending(void);
+
+/**
+ * Entry point of a secondary CPU core.
+ * The platform specific startup code shall call this function on a secondary
+ * core once stacks and the MMU are set up for the core.
+ */
+void sched_cpu_start(void) __attribute__((noreturn));
+
+/**
+ * Claim a thread for migration to another CPU.
+ * Should be only called by a scheduler implementing steal(). On success the
+ * thread is set to the READY state and the caller shall remove the thread
+ * from its queues.
+ * @param thread is a pointer to the thread.
+ * @param cpu_index is the index of the CPU the thread would be migrated to.
+ * @return  Returns 1 if the thread was claimed; Otherwise 0.
+ */
+int sched_migrate_claim(struct thread_info * thread, unsigned cpu_index);
+
+/**
+ * Try to steal a thread from the busiest CPU to the current CPU.
+ * This is called by the idle thread.
+ * @return  Returns 1 if a thread was stolen; Otherwise 0.
+ */
+int sched_idle_steal(void);
+#endif
+
 /**
  * Return load averages in integer format scaled to 100.
  * @param[out] loads load averages.
  */
 void sched_get_loads(uint32_t loads[3]);
 
+/**
+ * Account a scheduling tick to the current thread and reschedule.
+ * This is called by the periodic scheduling timer interrupt and it runs the
+ * tick tasks before calling sched_handler().
+ */
+void sched_tick(void);
+
+/**
+ * Select the next thread to run on the current CPU.
+ * This doesn't account any CPU time, so it can be used to reschedule
+ * outside of the periodic tick, e.g. after waking up threads from an IRQ.
+ */
 void sched_handler(void);
 
 #endif /* KSCHED_H */
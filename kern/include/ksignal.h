@@ -238,8 +238,20 @@ int ksignal_sigtimedwait(siginfo_t * retval, const sigset_t * restrict set,
 /**
  * Sleep until timeout or a non-ignored signal is received.
  * Only for syscalls.
+ * @param timeout is the sleep time.
+ * @param[out] remain is set to the unslept time if not NULL.
  */
-int ksignal_sigsleep(const struct timespec * restrict timeout);
+int ksignal_sigsleep(const struct timespec * restrict timeout,
+                     struct timespec * restrict remain);
+
+/**
+ * Check if the current thread has been killed by a fatal signal.
+ * A killed thread should return from a blocking syscall as soon as possible
+ * and it's terminated by ksignal_syscall_exit().
+ * @return  Returns a non-zero value if a fatal signal is pending;
+ *          Otherwise 0.
+ */
+int ksignal_isfatal_pending(void);
 
 /**
  * Check if a signal is blocked.
@@ -285,6 +297,15 @@ void ksignal_get_ksigaction(struct ksigaction * action,
  */
 int ksignal_reset_ksigaction(struct signals * sigs, int signum);
 
+/**
+ * Reset signal actions of a set of signals to default.
+ * @param sigs is a pointer to a signals struct; will be locked in this func.
+ * @param set is the set of signals.
+ * @returns Returns 0 if operation succeed;
+ *          Otherwise a negative error code is returned.
+ */
+int ksignal_reset_ksigactions(struct signals * sigs, const sigset_t * set);
+
 /**
  * Set signal action.
  * @note action can be allocated from stack as its data will be copied.
@@ -49,6 +49,22 @@
 enum mempool_type {
     MEMPOOL_TYPE_NONBLOCKING,   /*!< Non-blocing mempool. */
     MEMPOOL_TYPE_BLOCKING,      /*!< Blocking mempool. */
+    MEMPOOL_TYPE_PERCPU,        /*!< Non-blocking mempool with per CPU
+                                 *   magazine caches. */
+};
+
+/**
+ * Number of elements in a per CPU magazine.
+ */
+#define MEMPOOL_MAG_SIZE 8
+
+/**
+ * Per CPU magazine of cached mempool elements.
+ */
+struct mempool_magazine {
+    mtx_t lock;     /*!< Protects the magazine from stealing CPUs. */
+    unsigned count;
+    void * elem[MEMPOOL_MAG_SIZE];
 };
 
 /**
@@ -59,6 +75,7 @@ struct mempool {
     enum mempool_type type;
     mtx_t lock;
     sema_t sema;
+    struct mempool_magazine * mag; /*!< Per CPU magazines. */
     void * data;
     uintptr_t pool[0];
 };
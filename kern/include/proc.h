@@ -57,6 +57,7 @@
 #include <sys/priv.h>
 #include <sys/resource.h>
 #include <sys/times.h>
+#include <spawn.h>
 #include <fs/fs.h>
 #include <klocks.h>
 #include <ksignal.h>
@@ -85,6 +86,7 @@ enum proc_state {
  */
 #define PROC_NAME_SIZE 16
 
+struct _sched_pthread_create_args;
 struct mmu_abo_param;
 struct thread_info;
 
@@ -161,6 +163,12 @@ struct proc_info {
     TAILQ_ENTRY(proc_info) pgrp_proc_entry_;
 
     struct thread_info * main_thread; /*!< Main thread of this process. */
+
+    /**
+     * Set if the parent is sleeping in vfork() until this process calls
+     * exec or exits.
+     */
+    int * vfork_done;
 };
 
 /**
@@ -407,6 +415,47 @@ dev_t get_ctty(struct proc_info * proc);
  */
 pid_t proc_fork(void);
 
+/**
+ * Create a new process sharing the memory of the current process.
+ * The calling thread is suspended until the child calls exec or exits.
+ * @return  New PID; 0 if returning fork; Negative errno if unable to fork.
+ */
+pid_t proc_vfork(void);
+
+/**
+ * Release the parent of a vforked process.
+ * Must be called once the process no longer uses the memory of the parent.
+ * @param proc is a pointer to the process.
+ */
+void proc_vfork_release(struct proc_info * proc);
+
+/**
+ * Create a new child process of the current process with an empty memory map.
+ * The new process is not visible to the rest of the system until it's
+ * committed with proc_spawn_commit().
+ * @param[out] new_proc is set to the new process.
+ * @return Returns 0 if succeed; Otherwise a negative errno is returned.
+ */
+int proc_spawn_create(struct proc_info ** new_proc);
+
+/**
+ * Insert a spawned process into the system and start its main thread.
+ * If the main thread can't be created the process exits with status 127.
+ * @param new_proc  is a pointer to a process created by proc_spawn_create().
+ * @param attr      are the spawn attributes.
+ * @param main_def  is the main thread definition.
+ * @return  Returns the PID of the new process if succeed;
+ *          Otherwise a negative errno is returned and new_proc is freed.
+ */
+pid_t proc_spawn_commit(struct proc_info * new_proc,
+                        const posix_spawnattr_t * attr,
+                        struct _sched_pthread_create_args * main_def);
+
+/**
+ * Free a process created by proc_spawn_create() but never committed.
+ */
+void proc_spawn_abort(struct proc_info * new_proc);
+
 #ifdef PROC_INTERNAL
 
 extern struct mempool * proc_pool;
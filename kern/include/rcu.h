@@ -59,8 +59,13 @@ struct rcu_cb {
     struct rcu_cb * next;
 };
 
+struct thread_info;
+
 /**
  * Take a reader lock.
+ * Read-side critical sections can be nested and the thread may be switched
+ * out while holding the lock, but it should not block for long as that
+ * delays the grace period.
  */
 struct rcu_lock_ctx rcu_read_lock(void);
 
@@ -69,6 +74,20 @@ struct rcu_lock_ctx rcu_read_lock(void);
  */
 void rcu_read_unlock(struct rcu_lock_ctx * restrict ctx);
 
+/**
+ * Report a quiescent state for the current CPU.
+ * Called by the scheduler.
+ * @param prev is the thread that was interrupted.
+ * @param switched is set if prev was switched out.
+ */
+void rcu_sched_qs(struct thread_info * prev, int switched);
+
+/**
+ * Release the RCU state of a thread that is being removed.
+ * Called by the scheduler.
+ */
+void rcu_thread_removed(struct thread_info * thread);
+
 /**
  * Assign an RCU managed pointer.
  */
@@ -95,6 +114,8 @@ void rcu_call(struct rcu_cb * cb, void (*fn)(struct rcu_cb *));
 
 /**
  * Wait for all RCU readers to unlock.
+ * Waits until all read-side critical sections that were started before the
+ * call have ended and calls the callbacks registered before the call.
  */
 void rcu_synchronize(void);
 
@@ -44,6 +44,7 @@
 #include <sched.h>
 #include <machine/atomic.h>
 #include <hal/core.h>
+#include <hal/hw_timers.h>
 #include <hal/mmu.h>
 #include <ksignal.h>
 
@@ -121,6 +122,7 @@ struct thread_info {
      */
     struct sched_thread_data {
         enum thread_state state;    /*!< Thread execution state. */
+        unsigned cpu;               /*!< Index of the CPU owning the thread. */
         unsigned policy_flags;      /*!< Scheduling policy specific flags */
         int ts_counter;             /*!< Thread time slice counter;
                                      *   Set to -1 if not used. */
@@ -139,13 +141,33 @@ struct thread_info {
             struct thread_sched_rr {
                 TAILQ_ENTRY(thread_info) runq_entry_;
             } rr;
+            /* Priority RR policy */
+            struct thread_sched_prr {
+                int level;          /*!< Run queue level. */
+                TAILQ_ENTRY(thread_info) runq_entry_;
+            } prr;
         };
     } sched;
     struct sched_param param;       /*!< Scheduling parameters set by user. */
+    struct {
+        int boosted;                /*!< Priority lent by a mutex waiter. */
+        int saved_prio;             /*!< Priority before the boost. */
+        /** Owned adaptive mutexes that have waiters. */
+        LIST_HEAD(mtx_contested, mtx) contested;
+    } pi;                           /*!< Priority inheritance. */
+    unsigned cpu_affinity;          /*!< Allowed CPUs mask, 0 = any CPU. */
 
     /* Timers */
     int wait_tim;                   /*!< Reference to a timeout timer. */
     int lock_tim;                   /*!< Timer used by klocks. */
+    struct hw_timer_event wait_hrtim; /*!< High-resolution timeout. */
+
+    /* RCU */
+    struct {
+        int nesting;                /*!< Read-side critical section nesting. */
+        int phase;                  /*!< Grace period phase of the reader. */
+        int blocked;                /*!< Switched out in a critical section. */
+    } rcu;
 
     thread_stack_frames_t sframe;
     struct tls_regs tls_regs;       /*!< Thread local registers. */
@@ -194,7 +216,15 @@ enum thread_eyield_strategy {
 };
 
 /* External variables *********************************************************/
+#ifdef configMP
+/**
+ * Get the thread currently executing on this CPU.
+ */
+struct thread_info * sched_get_current_thread(void);
+#define current_thread (sched_get_current_thread())
+#else
 extern struct thread_info * current_thread;
+#endif
 
 /**
  * Compare two thread_info structs.
@@ -254,6 +284,17 @@ enum thread_state thread_state_get(struct thread_info * thread);
 enum thread_state thread_state_set(struct thread_info * thread,
                                    enum thread_state state);
 
+/**
+ * Set thread state if the current state equals to old_state.
+ * @param thread is a pointer to the thread.
+ * @param old_state is the expected current state.
+ * @param new_state is the new thread state.
+ * @return Returns 1 if the state was changed; Otherwise 0.
+ */
+int thread_state_test_and_set(struct thread_info * thread,
+                              enum thread_state old_state,
+                              enum thread_state new_state);
+
 /**
  * @}
  */
@@ -286,6 +327,18 @@ enum thread_mode {
 pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
                         enum thread_mode thread_mode);
 
+/**
+ * Create a new main thread for a process other than the current process.
+ * The new thread has no parent thread and it's left in init state, the caller
+ * must call thread_ready() once the thread is ready to be run.
+ * @param thread_def    Thread definitions.
+ * @param pid_owner     is the owner process of the new thread.
+ * @return  >= 0 Thread id of the newly created thread;
+ *           < 0 Otherwise a negative errno code is returned.
+ */
+pthread_t thread_create_proc(struct _sched_pthread_create_args * thread_def,
+                             pid_t pid_owner);
+
 /**
  * Create a simple detached kernel thread.
  * @param stack_size    selects the allocated stack size; If the value is zero
@@ -338,6 +391,14 @@ struct thread_info * thread_remove_ready(void);
  */
 void thread_wait(void);
 
+/**
+ * Wait until the current thread is released.
+ * Like thread_wait() but the caller has already set the state of
+ * current_thread to THREAD_STATE_BLOCKED. This allows the caller to mark
+ * the thread blocked atomically with respect to its wakeup condition.
+ */
+void thread_wait_blocked(void);
+
 /**
  * Release a waiting thread.
  */
@@ -349,6 +410,14 @@ void thread_release(pthread_t thread_id);
  */
 void thread_sleep(long millisec);
 
+/**
+ * Sleep the current thread for usec.
+ * Sleeps shorter than two scheduler ticks are timed with a one-shot hardware
+ * timer if the platform supports it.
+ * @param usec is the sleep time.
+ */
+void thread_usleep(uint64_t usec);
+
 /**
  * Wake-up the current thread if it's sleeping after millisec.
  * The timer created with this function shall be relased by calling
@@ -362,6 +431,24 @@ int thread_alarm(long millisec);
  */
 void thread_alarm_rele(int timer_id);
 
+/**
+ * Block the current thread and wake it up after usec.
+ * Like thread_alarm() but short timeouts are timed with a one-shot hardware
+ * timer. The thread is already blocked when the alarm is set, so that an
+ * alarm firing immediately isn't lost, and the caller shall wait by calling
+ * thread_wait_blocked(). The alarm shall be released by calling
+ * thread_ualarm_rele().
+ * @returns Returns 0 if the alarm was set;
+ *          -ETIMEDOUT if the timeout has already expired;
+ *          Otherwise a negative errno is returned.
+ */
+int thread_ualarm(uint64_t usec);
+
+/**
+ * Release the alarm created with thread_ualarm().
+ */
+void thread_ualarm_rele(void);
+
 /**
  * Yield turn.
  */
@@ -377,6 +464,16 @@ int thread_set_policy(pthread_t thread_id, unsigned policy);
  */
 unsigned thread_get_policy(pthread_t thread_id);
 
+/**
+ * Set thread CPU affinity.
+ * @param thread_id is the thread id.
+ * @param cpu_affinity is a mask of CPUs allowed to execute the thread.
+ * @return  0; -ESRCH if the thread doesn't exist;
+ *          -EINVAL if the mask doesn't contain any existing CPU;
+ *          -EPERM if the thread is an internal thread.
+ */
+int thread_set_affinity(pthread_t thread_id, unsigned cpu_affinity);
+
 /**
  * Set thread priority.
  * @param   thread_id Thread id.
@@ -385,6 +482,15 @@ unsigned thread_get_policy(pthread_t thread_id);
  */
 int thread_set_priority(pthread_t thread_id, int priority);
 
+/**
+ * Set the priority of a thread descriptor.
+ * The thread is moved to the run queue of the new priority if its scheduler
+ * caches priorities. Doesn't validate the priority.
+ * @param   thread is a pointer to the thread descriptor.
+ * @param   priority is the new priority.
+ */
+void thread_p_set_priority(struct thread_info * thread, int priority);
+
 /**
  * Get thread priority.
  * @param thread_id is the thread id.
@@ -90,6 +90,13 @@ void timers_start(int tim);
  */
 void timers_stop(int tim);
 
+/**
+ * Get the time of the next timer expiry.
+ * The returned time can be earlier than the actual expiry but never later.
+ * @return Returns the expiry time in usec.
+ */
+uint64_t timers_next_expiry(void);
+
 /**
  * Release a timer index.
  * Releases a timer for new reservations.
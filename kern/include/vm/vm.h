@@ -34,6 +34,7 @@
 #ifndef _VM_VM_H
 #define _VM_VM_H
 
+#include <sys/types.h>
 #include <hal/mmu.h>
 #include <klocks.h>
 #include <sys/tree.h>
@@ -50,7 +51,9 @@
  * @}
  */
 
+struct fs_superblock;
 struct proc_info;
+struct vnode;
 
 /**
  * VM page table structure.
@@ -66,6 +69,25 @@ struct vm_pt {
 /* struct ptlist */
 RB_HEAD(ptlist, vm_pt);
 
+/**
+ * VM region index node.
+ * A node of the per process interval tree of regions. The tree is keyed by
+ * the start address and each node knows the highest end address of its
+ * subtree, so an address or a range can be resolved in O(log n) even if
+ * some regions are overlapping.
+ */
+struct vm_region_node {
+    RB_ENTRY(vm_region_node) entry_;
+    struct buf * region;    /*!< The region or NULL if not in the tree. */
+    uintptr_t start;        /*!< First address of the region. */
+    uintptr_t end;          /*!< Last address of the region. */
+    uintptr_t max_end;      /*!< Highest end address in the subtree. */
+    int region_nr;          /*!< Region number. */
+};
+
+/* struct vm_regtree */
+RB_HEAD(vm_regtree, vm_region_node);
+
 /**
  * MM struct for processes.
  */
@@ -80,6 +102,10 @@ struct vm_mm_struct {
                                  *   [n] = allocs
                                  */
     int nr_regions;             /*!< Number of regions allocated. */
+    /** Index nodes of regions, one for each region number. */
+    struct vm_region_node * (*regnodes)[];
+    /** Interval tree of regions by address. */
+    struct vm_regtree regtree_head;
     mtx_t regions_lock;
 };
 
@@ -168,6 +194,27 @@ struct vm_pt * ptlist_get_pt(struct vm_mm_struct * mm, uintptr_t vaddr,
  */
 void ptlist_free(struct ptlist * ptlist_head);
 
+/**
+ * Insert a region index node into a region tree.
+ * The node must have region, start, end and region_nr set.
+ */
+void vm_regtree_insert(struct vm_regtree * head, struct vm_region_node * node);
+
+/**
+ * Remove a region index node from a region tree.
+ */
+void vm_regtree_remove(struct vm_regtree * head, struct vm_region_node * node);
+
+/**
+ * Find the lowest region overlapping an address range.
+ * @param start is the first address of the range.
+ * @param end is the last address of the range.
+ * @return Returns a pointer to the index node of the region;
+ *         Otherwise NULL.
+ */
+struct vm_region_node * vm_regtree_find(struct vm_regtree * head,
+                                        uintptr_t start, uintptr_t end);
+
 /**
  * @return  Returns positive value indicating number of copied page tables;
  *          Zero idicating that no page tables were copied;
@@ -284,6 +331,34 @@ int vm_find_reg(struct proc_info * proc, uintptr_t uaddr, struct buf ** bp);
  */
 struct buf * vm_newsect(uintptr_t vaddr, size_t size, int prot);
 
+/**
+ * Create a demand paged read-only section backed by a file.
+ * The pages are read in from the file on the first access and shared with
+ * all the other sections created for the same segment of the same vnode.
+ * Bytes from filesz to size are zero filled.
+ * @param vn is the vnode of the file.
+ * @param offset is the file offset of the data at vaddr.
+ * @param filesz is the number of bytes to be read from the file.
+ * @param vaddr is the address of the new section.
+ * @param size is the size of the new section.
+ * @param prot is a OR'd VM_PROT flags mask, VM_PROT_WRITE is not allowed.
+ * @return Returns the new section; NULL if the section can't be created.
+ */
+struct buf * vm_text_newsect(struct vnode * vn, off_t offset, size_t filesz,
+                             uintptr_t vaddr, size_t size, int prot);
+
+/**
+ * Purge the cached text pages of a vnode that is not executed anymore.
+ * @return Returns 0 if succeed;
+ *         -ETXTBSY if the vnode is still mapped by vm_text_newsect() sections.
+ */
+int vm_text_purge(struct vnode * vn);
+
+/**
+ * Purge the cached text pages of the vnodes of a file system.
+ */
+void vm_text_purge_sb(struct fs_superblock * sb);
+
 /**
  * Create a new section to a randomly selected address.
  * Returned section is inserted and mapped to the process if operation succeeds.
@@ -299,12 +374,13 @@ struct buf * vm_rndsect(struct proc_info * proc, size_t size, int prot,
                         struct buf * old_bp);
 
 /**
- * Create a new user space stack for the current process.
+ * Create a new user space stack for a process.
  * Create and map new user stack, free the old stack.
+ * @param proc is a pointer to the process.
  * @param size is the minimum size of the new stack.
  * @return Returns the new buf struct if allocated; Otherwise NULL.
  */
-struct buf * vm_new_userstack_curproc(size_t size);
+struct buf * vm_new_userstack(struct proc_info * proc, size_t size);
 
 /**
  * Update usr access permissions based on b_uflags.
@@ -326,6 +402,31 @@ int vm_mm_init(struct vm_mm_struct * mm, int nr_regions);
  */
 void vm_mm_destroy(struct vm_mm_struct * mm);
 
+/**
+ * Set the region of a region number.
+ * Sets the region pointer in the regions array and updates the region tree
+ * accordingly.
+ * @note mm must be locked or not yet visible to other threads and region_nr
+ *       must be a valid index to the regions array.
+ * @param mm is a pointer to the mm struct.
+ * @param region_nr is the region number.
+ * @param region is the new region, can be NULL.
+ */
+void vm_mm_set_region(struct vm_mm_struct * mm, int region_nr,
+                      struct buf * region);
+
+/**
+ * Find a region overlapping an address range.
+ * @note mm must be locked.
+ * @param mm is a pointer to the mm struct.
+ * @param start is the first address of the range.
+ * @param end is the last address of the range.
+ * @return Returns the region number of the region found;
+ *         Otherwise -1.
+ */
+int vm_mm_find_region(struct vm_mm_struct * mm, uintptr_t start,
+                      uintptr_t end);
+
 /**
  * Reallocate MM regions array to a new size given in new_count.
  * If new_count is smaller than the current size of regions array
@@ -382,6 +483,30 @@ int vm_map_region(struct buf * region, struct vm_pt * pt);
  */
 int vm_mapproc_region(struct proc_info * proc, struct buf * region);
 
+/**
+ * Resolve a write to a page of a COW region of a process.
+ * A region shared with other processes is first replaced with a page granular
+ * COW region that shares all the pages of the old region, then only the page
+ * containing vaddr is copied and mapped writable. A region not shared anymore
+ * is taken over without copying.
+ * @param proc is a pointer to the process.
+ * @param region_nr is the region number of the COW region.
+ * @param vaddr is the user space address written to.
+ * @return Zero if succeed; non-zero error code otherwise.
+ */
+int vm_cow_page(struct proc_info * proc, int region_nr, uintptr_t vaddr);
+
+/**
+ * Map a page of a region of a process after a translation fault.
+ * A page of a demand paged region is read in if it's not in core yet;
+ * Other regions are just mapped again.
+ * @param proc is a pointer to the process.
+ * @param region_nr is the region number.
+ * @param vaddr is the user space address accessed.
+ * @return Zero if succeed; non-zero error code otherwise.
+ */
+int vm_fill_page(struct proc_info * proc, int region_nr, uintptr_t vaddr);
+
 /**
  * Unmap a VM region from a given process.
  * @param proc is a pointer to the process.
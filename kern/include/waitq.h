@@ -0,0 +1,116 @@
+/**
+ *******************************************************************************
+ * @file    waitq.h
+ * @author  Olli Vanhoja
+ * @brief   Kernel wait queues.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/**
+ * @addtogroup waitq
+ * Wait queues.
+ * A wait queue is a list of threads sleeping until some condition becomes
+ * true. The condition is protected by a mutex owned by the user of the
+ * wait queue. A thread checks the condition while holding the mutex and
+ * calls waitq_wait(), which releases the mutex and puts the thread to
+ * sleep atomically with respect to waitq_wakeup() and waitq_wakeup_all().
+ * The condition must be always checked again after a wakeup.
+ * @{
+ */
+
+#pragma once
+#ifndef WAITQ_H
+#define WAITQ_H
+
+#include <sys/queue.h>
+#include <klocks.h>
+
+struct thread_info;
+
+/**
+ * A waiting thread.
+ * Wait queue entries are allocated from the stack of the waiting thread.
+ */
+struct waitq_entry {
+    struct thread_info * we_thread;
+    struct waitq * we_wq;
+    int we_woken;
+    int we_timedout;    /*!< Set by the timeout timer. */
+    TAILQ_ENTRY(waitq_entry) we_entry_;
+};
+
+/**
+ * Wait queue.
+ */
+struct waitq {
+    mtx_t wq_lock;
+    TAILQ_HEAD(waitq_head, waitq_entry) wq_head;
+};
+
+/**
+ * Wait queue static initializer.
+ */
+#define WAITQ_INITIALIZER(_wq_) {                                   \
+    .wq_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT),     \
+    .wq_head = TAILQ_HEAD_INITIALIZER((_wq_).wq_head),              \
+}
+
+/**
+ * Initialize a wait queue.
+ * @param wq is a pointer to the wait queue.
+ */
+void waitq_init(struct waitq * wq);
+
+/**
+ * Release a mutex and wait for a wakeup.
+ * The mutex is not locked again on return.
+ * @param wq        is a pointer to the wait queue.
+ * @param mtx       is the mutex protecting the wait condition; Can be NULL.
+ * @param timeout   is the timeout in milliseconds; 0 waits forever.
+ * @return  Returns 0 if the thread was woken up;
+ *          -ETIMEDOUT if the timeout expired;
+ *          -EINTR if the thread was released for some other reason.
+ */
+int waitq_wait(struct waitq * wq, mtx_t * mtx, long timeout);
+
+/**
+ * Wake up the first thread waiting in a wait queue.
+ * @param wq is a pointer to the wait queue.
+ */
+void waitq_wakeup(struct waitq * wq);
+
+/**
+ * Wake up all threads waiting in a wait queue.
+ * @param wq is a pointer to the wait queue.
+ */
+void waitq_wakeup_all(struct waitq * wq);
+
+#endif /* WAITQ_H */
+
+/**
+ * @}
+ */
@@ -212,7 +212,7 @@ static void map_vmstack2proc(struct proc_info * proc, struct buf * vmstack)
 {
     struct vm_pt * vpt;
 
-    (*proc->mm.regions)[MM_STACK_REGION] = vmstack;
+    vm_mm_set_region(&proc->mm, MM_STACK_REGION, vmstack);
     vm_updateusr_ap(vmstack);
 
     vpt = ptlist_get_pt(&proc->mm, vmstack->b_mmu.vaddr,
@@ -30,10 +30,37 @@
  *******************************************************************************
  */
 
+/*
+ * Adaptive mutexes
+ * ================
+ *
+ * An adaptive mutex is a spin lock that records its owner. A thread failing
+ * to get the lock keeps spinning as long as the owner is running on another
+ * CPU, because then the lock is likely released soon. Otherwise the thread
+ * adds itself to the wait list of the mutex and blocks. The wait lists are
+ * protected by turnstile chain locks that are selected by hashing the address
+ * of the mutex, so the mutex struct doesn't need to contain another lock.
+ *
+ * A blocking waiter with a higher priority lends its priority to the owner.
+ * A mutex that has waiters is linked to the contested list of its owner, and
+ * the priority of the owner is recomputed from the waiters of all of its
+ * contested mutexes whenever a wait list changes or the owner releases one
+ * of the mutexes. The priority is changed through the scheduler, so the owner
+ * is also moved to the run queue of its new priority. The highest priority
+ * waiter is woken up on release but it must still compete for the lock with
+ * other threads.
+ *
+ * Lock order: turnstile chain lock -> mtx_pi_lock -> scheduler locks.
+ */
+
 #include <errno.h>
+#ifdef configLOCK_PROFILE
+#include <sys/sysctl.h>
+#endif
 #include <hal/hw_timers.h>
 #include <kerror.h>
 #include <kstring.h>
+#include <libkern.h>
 #include <thread.h>
 #include <timers.h>
 #include <klocks.h>
@@ -58,6 +85,72 @@
  */
 istate_t cpu_istate;
 
+#define MTX_TSCHAIN_SIZE 16
+#define MTX_TSCHAIN(mtx) \
+    (&mtx_tschain[((uintptr_t)(mtx) >> 4) & (MTX_TSCHAIN_SIZE - 1)])
+
+/**
+ * A thread blocked on an adaptive mutex.
+ * Allocated from the stack of the waiting thread.
+ */
+struct mtx_waiter {
+    struct thread_info * mw_thread;
+    int mw_woken;
+    LIST_ENTRY(mtx_waiter) mw_entry_;
+};
+
+/**
+ * Turnstile chain locks protecting the wait lists of adaptive mutexes.
+ */
+static mtx_t mtx_tschain[MTX_TSCHAIN_SIZE] = {
+    [0 ... MTX_TSCHAIN_SIZE - 1] = MTX_INITIALIZER(MTX_TYPE_SPIN,
+                                                   MTX_OPT_DEFAULT),
+};
+
+/**
+ * Protects the contested lists of threads and the pi_owner links of mutexes.
+ * The wait list of a mutex is only modified while holding this lock, so that
+ * the owner can read the wait lists of its contested mutexes.
+ */
+static mtx_t mtx_pi_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+
+#ifdef configLOCK_PROFILE
+SYSCTL_DECL(_debug_lock);
+SYSCTL_NODE(_debug, OID_AUTO, lock, CTLFLAG_RW, 0,
+            "Kernel lock profiling");
+
+MTX_LOCK_CLASS(spin, "Spin locks");
+MTX_LOCK_CLASS(ticket, "Ticket locks");
+MTX_LOCK_CLASS(adaptive, "Adaptive mutexes");
+
+static void mtx_prof_acquired(mtx_t * mtx, uint64_t wait_start)
+{
+    struct mtx_lock_class * lc = mtx->mtx_lclass;
+
+    if (!lc) {
+        switch (mtx->mod.mtx_type) {
+        case MTX_TYPE_TICKET:
+            lc = &mtx_lclass_ticket;
+            break;
+        case MTX_TYPE_ADAPTIVE:
+            lc = &mtx_lclass_adaptive;
+            break;
+        default:
+            lc = &mtx_lclass_spin;
+        }
+    }
+
+    lc->lc_nr_acquired++;
+    if (wait_start) {
+        lc->lc_nr_contended++;
+        lc->lc_wait_usec += get_utime() - wait_start;
+    }
+}
+#define MTX_PROF_ACQUIRED(mtx, wait_start) mtx_prof_acquired(mtx, wait_start)
+#else
+#define MTX_PROF_ACQUIRED(mtx, wait_start) do { } while (0)
+#endif
+
 static void priceil_set(mtx_t * mtx)
 {
     if (MTX_OPT(mtx, MTX_OPT_PRICEIL)) {
@@ -66,6 +159,223 @@ static void priceil_set(mtx_t * mtx)
     }
 }
 
+static istate_t tschain_lock(mtx_t * chain)
+{
+    istate_t s = get_interrupt_state();
+
+    disable_interrupt();
+    mtx_lock(chain);
+
+    return s;
+}
+
+static void tschain_unlock(mtx_t * chain, istate_t s)
+{
+    mtx_unlock(chain);
+    set_interrupt_state(s);
+}
+
+/**
+ * Update the priority of a thread from the waiters of its contested mutexes.
+ * The thread gets the highest priority of the waiters if it's higher than
+ * its own priority. Lower sched_priority value is a higher priority.
+ * mtx_pi_lock must be held.
+ */
+static void pi_update(struct thread_info * thread)
+{
+    const int base = (thread->pi.boosted) ? thread->pi.saved_prio :
+                                            thread->param.sched_priority;
+    int prio = base;
+    mtx_t * mtx;
+
+    LIST_FOREACH(mtx, &thread->pi.contested, adaptive.contested_entry_) {
+        struct mtx_waiter * mw;
+
+        LIST_FOREACH(mw, &mtx->adaptive.waiters, mw_entry_) {
+            const int wprio = mw->mw_thread->param.sched_priority;
+
+            if (wprio >= NICE_MIN && wprio < prio)
+                prio = wprio;
+        }
+    }
+
+    thread->pi.saved_prio = base;
+    thread->pi.boosted = (prio != base);
+    if (prio != thread->param.sched_priority)
+        thread_p_set_priority(thread, prio);
+}
+
+/**
+ * Link a mutex to the contested list of its owner.
+ * mtx_pi_lock must be held.
+ */
+static void pi_link(mtx_t * mtx, struct thread_info * owner)
+{
+    if (!mtx->adaptive.pi_owner) {
+        LIST_INSERT_HEAD(&owner->pi.contested, mtx, adaptive.contested_entry_);
+        mtx->adaptive.pi_owner = owner;
+    }
+    pi_update(owner);
+}
+
+/**
+ * Unlink a mutex from the contested list of its owner.
+ * mtx_pi_lock must be held.
+ */
+static void pi_unlink(mtx_t * mtx)
+{
+    struct thread_info * owner = mtx->adaptive.pi_owner;
+
+    if (owner) {
+        LIST_REMOVE(mtx, adaptive.contested_entry_);
+        mtx->adaptive.pi_owner = NULL;
+        pi_update(owner);
+    }
+}
+
+/**
+ * Update the priority of the owner after the wait list of a mutex changed.
+ * mtx_pi_lock must be held.
+ */
+static void pi_waiters_changed(mtx_t * mtx)
+{
+    if (LIST_EMPTY(&mtx->adaptive.waiters))
+        pi_unlink(mtx);
+    else if (mtx->adaptive.pi_owner)
+        pi_update(mtx->adaptive.pi_owner);
+}
+
+/**
+ * Test if a thread trying to get an adaptive mutex can block.
+ */
+static int adaptive_may_block(void)
+{
+    return current_thread && !(get_interrupt_state() & PSR_INT_MASK);
+}
+
+/**
+ * Test if the owner of an adaptive mutex is running on another CPU.
+ */
+static int adaptive_owner_running(mtx_t * mtx)
+{
+#ifdef configMP
+    struct thread_info * owner = ACCESS_ONCE(mtx->adaptive.owner);
+
+    return owner && owner != current_thread &&
+           thread_state_get(owner) == THREAD_STATE_EXEC;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Block until the owner of an adaptive mutex releases it.
+ * The lock must be tried again after returning.
+ */
+static void adaptive_block(mtx_t * mtx)
+{
+    struct mtx_waiter mw = {
+        .mw_thread = current_thread,
+        .mw_woken = 0,
+    };
+    mtx_t * chain = MTX_TSCHAIN(mtx);
+    struct thread_info * owner;
+    istate_t s;
+
+    s = tschain_lock(chain);
+    mtx_lock(&mtx_pi_lock);
+    LIST_INSERT_HEAD(&mtx->adaptive.waiters, &mw, mw_entry_);
+    atomic_inc(&mtx->adaptive.nr_waiters);
+    cpu_wmb();
+
+    /*
+     * The owner doesn't see us if it released the lock before nr_waiters
+     * was incremented.
+     */
+    if (atomic_read(&mtx->mtx_lock) == 0) {
+        LIST_REMOVE(&mw, mw_entry_);
+        atomic_dec(&mtx->adaptive.nr_waiters);
+        mtx_unlock(&mtx_pi_lock);
+        tschain_unlock(chain, s);
+        return;
+    }
+
+    /*
+     * The owner clears the owner pointer before checking nr_waiters, so if
+     * we still see it here the owner will unlink the mutex on release.
+     */
+    owner = mtx->adaptive.owner;
+    if (owner)
+        pi_link(mtx, owner);
+    thread_state_set(current_thread, THREAD_STATE_BLOCKED);
+    mtx_unlock(&mtx_pi_lock);
+    tschain_unlock(chain, s);
+
+    thread_wait_blocked();
+
+    s = tschain_lock(chain);
+    if (!mw.mw_woken) {
+        mtx_lock(&mtx_pi_lock);
+        LIST_REMOVE(&mw, mw_entry_);
+        atomic_dec(&mtx->adaptive.nr_waiters);
+        pi_waiters_changed(mtx);
+        mtx_unlock(&mtx_pi_lock);
+    }
+    tschain_unlock(chain, s);
+}
+
+/**
+ * Clear the owner of an adaptive mutex before releasing it.
+ * If the mutex is contested it's unlinked from the contested list of the
+ * current thread and the priority of the thread is recomputed.
+ */
+static void adaptive_disown(mtx_t * mtx)
+{
+    istate_t s;
+
+    mtx->adaptive.owner = NULL;
+    cpu_wmb();
+    if (atomic_read(&mtx->adaptive.nr_waiters) == 0)
+        return;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+    mtx_lock(&mtx_pi_lock);
+    pi_unlink(mtx);
+    mtx_unlock(&mtx_pi_lock);
+    set_interrupt_state(s);
+}
+
+/**
+ * Wake up the highest priority waiter of an adaptive mutex.
+ */
+static void adaptive_wakeup(mtx_t * mtx)
+{
+    mtx_t * chain = MTX_TSCHAIN(mtx);
+    struct mtx_waiter * mw;
+    struct mtx_waiter * best = NULL;
+    istate_t s;
+
+    s = tschain_lock(chain);
+    /* New waiters are inserted to the head so prefer the oldest of equals. */
+    LIST_FOREACH(mw, &mtx->adaptive.waiters, mw_entry_) {
+        if (!best || mw->mw_thread->param.sched_priority <=
+                     best->mw_thread->param.sched_priority)
+            best = mw;
+    }
+    if (best) {
+        mtx_lock(&mtx_pi_lock);
+        LIST_REMOVE(best, mw_entry_);
+        atomic_dec(&mtx->adaptive.nr_waiters);
+        /* The mutex might already have a new owner. */
+        pi_waiters_changed(mtx);
+        mtx_unlock(&mtx_pi_lock);
+        best->mw_woken = 1;
+        thread_release(best->mw_thread->id);
+    }
+    tschain_unlock(chain, s);
+}
+
 static void priceil_restore(mtx_t * mtx)
 {
     if (MTX_OPT(mtx, MTX_OPT_PRICEIL)) {
@@ -86,6 +396,13 @@ void mtx_init(mtx_t * mtx, enum mtx_type type, unsigned int opt)
     mtx->mtx_lock = ATOMIC_INIT(0);
     mtx->ticket.queue = ATOMIC_INIT(0);
     mtx->ticket.dequeue = ATOMIC_INIT(0);
+    mtx->adaptive.owner = NULL;
+    mtx->adaptive.nr_waiters = ATOMIC_INIT(0);
+    LIST_INIT(&mtx->adaptive.waiters);
+    mtx->adaptive.pi_owner = NULL;
+#ifdef configLOCK_PROFILE
+    mtx->mtx_lclass = NULL;
+#endif
 #ifdef configLOCK_DEBUG
     mtx->mtx_ldebug = NULL;
 #endif
@@ -101,6 +418,9 @@ int _mtx_lock(mtx_t * mtx, char * whr)
     const int sleep_mode = MTX_OPT(mtx, MTX_OPT_SLEEP);
     const int opt_timeout = (mtx->mod.mtx_flags & 0xf) * 1000;
     uint64_t start_time = (opt_timeout) ? get_utime() : 0;
+#ifdef configLOCK_PROFILE
+    uint64_t wait_start = 0;
+#endif
 #ifdef configLOCK_DEBUG
     unsigned deadlock_cnt = 0;
 
@@ -157,6 +477,16 @@ int _mtx_lock(mtx_t * mtx, char * whr)
             thread_yield(THREAD_YIELD_LAZY);
             break;
 
+        case MTX_TYPE_ADAPTIVE:
+            if (!atomic_test_and_set(&mtx->mtx_lock)) {
+                mtx->adaptive.owner = current_thread;
+                goto out;
+            }
+
+            if (adaptive_may_block() && !adaptive_owner_running(mtx))
+                adaptive_block(mtx);
+            break;
+
         default:
             MTX_TYPE_NOTSUP();
             if (MTX_OPT(mtx, MTX_OPT_DINT))
@@ -165,11 +495,17 @@ int _mtx_lock(mtx_t * mtx, char * whr)
             return -ENOTSUP;
         }
 
+#ifdef configLOCK_PROFILE
+        if (!wait_start)
+            wait_start = get_utime();
+#endif
+
 #ifdef configMP
         cpu_wfe(); /* Sleep until event. */
 #endif
     }
 out:
+    MTX_PROF_ACQUIRED(mtx, wait_start);
 
     /* Handle priority ceiling. */
     priceil_set(mtx);
@@ -214,7 +550,8 @@ int _mtx_sleep(mtx_t * mtx, long timeout, char * whr)
         retval = mtx_lock(mtx);
         timers_release(current_thread->wait_tim);
         current_thread->wait_tim = TMNOVAL;
-    } else if (mtx->mod.mtx_type == MTX_TYPE_SPIN) {
+    } else if (mtx->mod.mtx_type == MTX_TYPE_SPIN ||
+               mtx->mod.mtx_type == MTX_TYPE_ADAPTIVE) {
         retval = mtx_lock(mtx);
     } else {
 fail:
@@ -253,6 +590,7 @@ int _mtx_trylock(mtx_t * mtx, char * whr)
 
         if (atomic_read(&mtx->ticket.dequeue) == ticket) {
             atomic_set(&mtx->mtx_lock, 1);
+            MTX_PROF_ACQUIRED(mtx, 0);
             return 0; /* Got it */
         } else {
             atomic_dec(&mtx->ticket.queue);
@@ -262,6 +600,12 @@ int _mtx_trylock(mtx_t * mtx, char * whr)
         }
         break;
 
+    case MTX_TYPE_ADAPTIVE:
+        retval = atomic_test_and_set(&mtx->mtx_lock);
+        if (!retval)
+            mtx->adaptive.owner = current_thread;
+        break;
+
     default:
         MTX_TYPE_NOTSUP();
         if (MTX_OPT(mtx, MTX_OPT_DINT))
@@ -270,6 +614,9 @@ int _mtx_trylock(mtx_t * mtx, char * whr)
         return -ENOTSUP;
     }
 
+    if (!retval)
+        MTX_PROF_ACQUIRED(mtx, 0);
+
     /* Handle priority ceiling. */
     priceil_set(mtx);
 
@@ -298,7 +645,15 @@ void mtx_unlock(mtx_t * mtx)
 
     if (mtx->mod.mtx_type == MTX_TYPE_TICKET)
         atomic_inc(&mtx->ticket.dequeue);
-    atomic_set(&mtx->mtx_lock, 0);
+    if (mtx->mod.mtx_type == MTX_TYPE_ADAPTIVE) {
+        adaptive_disown(mtx);
+        atomic_set(&mtx->mtx_lock, 0);
+        cpu_wmb();
+        if (atomic_read(&mtx->adaptive.nr_waiters) > 0)
+            adaptive_wakeup(mtx);
+    } else {
+        atomic_set(&mtx->mtx_lock, 0);
+    }
 
     if (MTX_OPT(mtx, MTX_OPT_DINT))
         set_interrupt_state(cpu_istate);
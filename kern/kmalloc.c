@@ -33,6 +33,7 @@
 #include <machine/atomic.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/queue.h>
 #include <sys/sysctl.h>
 #include <dynmem.h>
 #include <hal/core.h>
@@ -50,6 +51,7 @@
  */
 #define KM_SIGNATURE_VALID      0XBAADF00D /*!< a valid mblock entry. */
 #define KM_SIGNATURE_INVALID    0xDEADF00D /*!< an invalid mblock entry. */
+#define KM_SIGNATURE_SLAB       0xBAADCAFE /*!< a slab object. */
 
 /**
  * kmalloc statistics strcut.
@@ -86,17 +88,26 @@ SYSCTL_INT(_vm_kmalloc, OID_AUTO, fragm_rat, CTLFLAG_RD,
         &fragm_ratio, 0, "Fragmentation percentage");
 #endif
 
+/**
+ * Memory block tag.
+ * Every allocation returned by kmalloc is preceded by a tag regardless of
+ * whether it's an mblock or a slab object.
+ */
+struct kmalloc_tag {
+    atomic_t refcount;      /*!< Ref count. */
+    void * ptr;             /*!< Memory block desc validatation. ptr should
+                             * point to the data section of this block. */
+    unsigned signature;     /* Magic number for extra security. */
+};
+
 /**
  * Memory block descriptor.
  */
 typedef struct mblock {
-    unsigned signature;     /* Magic number for extra security. */
     size_t size;            /* Size of data area of this block. */
     struct mblock * next;   /* Pointer to the next memory block desc. */
     struct mblock * prev;   /* Pointer to the previous memory block desc. */
-    atomic_t refcount;      /*!< Ref count. */
-    void * ptr;             /*!< Memory block desc validatation. ptr should
-                             * point to the data section of this mblock. */
+    struct kmalloc_tag tag;
     char data[];
 } mblock_t;
 
@@ -110,7 +121,9 @@ typedef struct mblock {
  */
 void * kmalloc_base;
 
-static mtx_t kmalloc_giant_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, 0);
+MTX_LOCK_CLASS(kmalloc_giant, "kmalloc giant lock");
+static mtx_t kmalloc_giant_lock = MTX_INITIALIZER_CLASS(MTX_TYPE_ADAPTIVE, 0,
+                                                        kmalloc_giant);
 
 /*
  * CB and data pointer array for lazy freeing data.
@@ -128,6 +141,13 @@ static struct queue_cb lazy_free_queue = QUEUE_INITIALIZER(lazy_free_queue_data,
  */
 #define get_mblock(p) ((mblock_t *)((uint8_t *)p - MBLOCK_SIZE))
 
+/**
+ * Get pointer to the tag of a memory block.
+ * @param p is the memory block address.
+ */
+#define get_tag(p) \
+    ((struct kmalloc_tag *)((uint8_t *)p - sizeof(struct kmalloc_tag)))
+
 /**
  * Convert MBytes to Bytes
  * @param v is a size in MBytes.
@@ -178,9 +198,9 @@ static mblock_t * extend(mblock_t * last, size_t s)
     b->prev = last;
     if (last)
         last->next = b;
-    b->signature = KM_SIGNATURE_VALID;
-    b->ptr = b->data;
-    b->refcount = ATOMIC_INIT(0);
+    b->tag.signature = KM_SIGNATURE_VALID;
+    b->tag.ptr = b->data;
+    b->tag.refcount = ATOMIC_INIT(0);
 
     /*
      * If there is still space left in the new region it has to be
@@ -192,9 +212,9 @@ static mblock_t * extend(mblock_t * last, size_t s)
 
         bl = (mblock_t *)((size_t)b + s); /* Get pointer to the new block. */
         bl->size = memfree_b - MBLOCK_SIZE;
-        bl->signature = KM_SIGNATURE_VALID;
-        bl->ptr = bl->data;
-        bl->refcount = ATOMIC_INIT(0);
+        bl->tag.signature = KM_SIGNATURE_VALID;
+        bl->tag.ptr = bl->data;
+        bl->tag.refcount = ATOMIC_INIT(0);
         bl->next = NULL;
         bl->prev = b;
 
@@ -216,14 +236,15 @@ static mblock_t * find_mblock(mblock_t ** last, size_t size)
     mblock_t * b = kmalloc_base;
 
     do {
-        if (b->ptr == NULL) {
+        if (b->tag.ptr == NULL) {
             KERROR(KERROR_ERR,
-                   "Invalid mblock: p = %p sign = %x\n", b->ptr, b->signature);
+                   "Invalid mblock: p = %p sign = %x\n",
+                   b->tag.ptr, b->tag.signature);
             b = NULL;
             break;
         }
         *last = b;
-        if ((atomic_read(&b->refcount) == 0) && b->size >= size)
+        if ((atomic_read(&b->tag.refcount) == 0) && b->size >= size)
             break;
     } while ((b = b->next) != NULL);
 
@@ -242,9 +263,9 @@ static void split_mblock(mblock_t * b, size_t s)
     nb->size = b->size - s - MBLOCK_SIZE;
     nb->next = b->next;
     nb->prev = b;
-    nb->refcount = ATOMIC_INIT(0);
-    nb->signature = KM_SIGNATURE_VALID;
-    nb->ptr = nb->data;
+    nb->tag.refcount = ATOMIC_INIT(0);
+    nb->tag.signature = KM_SIGNATURE_VALID;
+    nb->tag.ptr = nb->data;
 
     b->size = s;
     b->next = nb;
@@ -260,7 +281,7 @@ static void split_mblock(mblock_t * b, size_t s)
  */
 static mblock_t * merge(mblock_t * b)
 {
-    if (b->next && (atomic_read(&b->next->refcount) == 0)) {
+    if (b->next && (atomic_read(&b->next->tag.refcount) == 0)) {
         /*
          * Don't merge if these blocks are not in contiguous memory space.
          * If they aren't it means that they are from diffent areas of dynmem
@@ -270,7 +291,7 @@ static mblock_t * merge(mblock_t * b)
         }
 
         /* Mark signature of the next block invalid. */
-        b->next->signature = KM_SIGNATURE_INVALID;
+        b->next->tag.signature = KM_SIGNATURE_INVALID;
 
         b->size += MBLOCK_SIZE + b->next->size;
 
@@ -303,15 +324,19 @@ static int valid_addr(void * p)
         return 0;
 
     /* Validation */
-    return (p == (get_mblock(p)->ptr) &&
-            get_mblock(p)->signature == KM_SIGNATURE_VALID);
+    return (p == get_tag(p)->ptr &&
+            (get_tag(p)->signature == KM_SIGNATURE_VALID ||
+             get_tag(p)->signature == KM_SIGNATURE_SLAB));
 }
 
-void * kmalloc(size_t size)
+/**
+ * Allocate a memory block from the mblock list.
+ * @param size is the size of the block, it shall be aligned.
+ */
+static void * mblock_alloc(size_t s)
 {
     mblock_t * b;
     mblock_t * last;
-    size_t s = memalign(size);
 
     mtx_lock(&kmalloc_giant_lock);
     if (kmalloc_base) {
@@ -344,12 +369,263 @@ void * kmalloc(size_t size)
 
     update_stat_up(&(kmalloc_stat.kms_mem_alloc), b->size);
 
-    atomic_set(&b->refcount, 1);
+    atomic_set(&b->tag.refcount, 1);
     mtx_unlock(&kmalloc_giant_lock);
 
     return b->data;
 }
 
+#ifdef configKMALLOC_SLAB
+/*
+ * Slab caches.
+ *
+ * Small allocations are served from slab caches, one for each power of two
+ * size class between KMALLOC_SLAB_MIN and KMALLOC_SLAB_MAX. A slab is a
+ * large block allocated from the mblock list and divided into objects of
+ * equal size. Free objects of a slab are linked through their data areas.
+ * Slabs with free objects are kept in the partial list of the cache and a
+ * slab is returned to the mblock list once all of its objects are free,
+ * unless it's the last slab with free objects in the cache.
+ */
+
+#define KMALLOC_SLAB_SIZE   16384   /*!< Size of a slab in bytes. */
+#define KMALLOC_SLAB_MIN    16      /*!< Smallest size class. */
+#define KMALLOC_SLAB_MAX    2048    /*!< Largest size class. */
+
+struct kmalloc_slab;
+
+/**
+ * Slab object descriptor.
+ */
+struct kmalloc_slobj {
+    struct kmalloc_slab * slab; /*!< The slab containing this object. */
+    struct kmalloc_tag tag;
+    char data[];
+};
+
+/**
+ * Get pointer to a slab object descriptor by memory block pointer.
+ */
+#define get_slobj(p) \
+    ((struct kmalloc_slobj *)((uint8_t *)p - sizeof(struct kmalloc_slobj)))
+
+/**
+ * Next pointer of a free slab object.
+ */
+#define SLOBJ_NEXT(obj) (*(struct kmalloc_slobj **)((obj)->data))
+
+/**
+ * Slab descriptor.
+ */
+struct kmalloc_slab {
+    struct kmalloc_cache * cache;
+    LIST_ENTRY(kmalloc_slab) slab_link_; /*!< Partial list entry. */
+    unsigned nr_free;                   /*!< Number of free objects. */
+    struct kmalloc_slobj * freelist;    /*!< List of free objects. */
+    char objs[];
+};
+
+/**
+ * Slab cache for a size class.
+ */
+struct kmalloc_cache {
+    size_t size;            /*!< Object size. */
+    unsigned objs_per_slab; /*!< Number of objects in a slab. */
+    mtx_t lock;
+    LIST_HEAD(slab_list, kmalloc_slab) partial_slabs;
+    /* Stats */
+    unsigned nr_slabs;      /*!< Number of slabs allocated. */
+    unsigned nr_free;       /*!< Number of free objects. */
+    unsigned nr_inuse;      /*!< Number of objects in use. */
+    unsigned nr_allocs;     /*!< Number of allocations. */
+    unsigned nr_frees;      /*!< Number of frees. */
+};
+
+/*
+ * Apply a macro for each size class.
+ */
+#define KMALLOC_FOREACH_CACHE(apply) \
+    apply(0, 16)                    \
+    apply(1, 32)                    \
+    apply(2, 64)                    \
+    apply(3, 128)                   \
+    apply(4, 256)                   \
+    apply(5, 512)                   \
+    apply(6, 1024)                  \
+    apply(7, 2048)
+
+#define KMALLOC_CACHE_INIT(_i_, _size_)                                 \
+    [_i_] = {                                                           \
+        .size = (_size_),                                               \
+        .objs_per_slab = (KMALLOC_SLAB_SIZE - sizeof(struct kmalloc_slab)) \
+                         / (sizeof(struct kmalloc_slobj) + (_size_)),   \
+        .lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DINT),           \
+        .partial_slabs = LIST_HEAD_INITIALIZER(partial_slabs),          \
+    },
+
+static struct kmalloc_cache kmalloc_caches[] = {
+    KMALLOC_FOREACH_CACHE(KMALLOC_CACHE_INIT)
+};
+
+/*
+ * Export per cache stats to sysctl.
+ */
+#define KMALLOC_CACHE_SYSCTL(_i_, _size_)                                   \
+    SYSCTL_NODE(_vm_kmalloc, OID_AUTO, cache##_size_, CTLFLAG_RW, 0,         \
+                "kmalloc " #_size_ " bytes cache");                         \
+    SYSCTL_UINT(_vm_kmalloc_cache##_size_, OID_AUTO, slabs, CTLFLAG_RD,     \
+                &kmalloc_caches[_i_].nr_slabs, 0,                           \
+                "Number of slabs allocated.");                              \
+    SYSCTL_UINT(_vm_kmalloc_cache##_size_, OID_AUTO, free, CTLFLAG_RD,      \
+                &kmalloc_caches[_i_].nr_free, 0,                            \
+                "Number of free objects.");                                 \
+    SYSCTL_UINT(_vm_kmalloc_cache##_size_, OID_AUTO, inuse, CTLFLAG_RD,     \
+                &kmalloc_caches[_i_].nr_inuse, 0,                           \
+                "Number of objects in use.");                               \
+    SYSCTL_UINT(_vm_kmalloc_cache##_size_, OID_AUTO, allocs, CTLFLAG_RD,    \
+                &kmalloc_caches[_i_].nr_allocs, 0,                          \
+                "Number of allocations.");                                  \
+    SYSCTL_UINT(_vm_kmalloc_cache##_size_, OID_AUTO, frees, CTLFLAG_RD,     \
+                &kmalloc_caches[_i_].nr_frees, 0,                           \
+                "Number of frees.");
+
+KMALLOC_FOREACH_CACHE(KMALLOC_CACHE_SYSCTL)
+
+/**
+ * Get the cache for an allocation size.
+ * @param size is the aligned allocation size <= KMALLOC_SLAB_MAX.
+ */
+static struct kmalloc_cache * get_cache(size_t size)
+{
+    if (size <= KMALLOC_SLAB_MIN)
+        return &kmalloc_caches[0];
+
+    return &kmalloc_caches[fls(size - 1) - fls(KMALLOC_SLAB_MIN - 1)];
+}
+
+/**
+ * Create a new slab for a cache.
+ */
+static struct kmalloc_slab * slab_create(struct kmalloc_cache * cache)
+{
+    const size_t obj_size = sizeof(struct kmalloc_slobj) + cache->size;
+    struct kmalloc_slab * slab;
+
+    slab = mblock_alloc(KMALLOC_SLAB_SIZE);
+    if (!slab)
+        return NULL;
+
+    slab->cache = cache;
+    slab->nr_free = cache->objs_per_slab;
+    slab->freelist = NULL;
+
+    for (size_t i = cache->objs_per_slab; i > 0; i--) {
+        struct kmalloc_slobj * obj;
+
+        obj = (struct kmalloc_slobj *)(slab->objs + (i - 1) * obj_size);
+        obj->slab = slab;
+        obj->tag.refcount = ATOMIC_INIT(0);
+        obj->tag.ptr = obj->data;
+        obj->tag.signature = KM_SIGNATURE_SLAB;
+        SLOBJ_NEXT(obj) = slab->freelist;
+        slab->freelist = obj;
+    }
+
+    return slab;
+}
+
+static void * slab_alloc(struct kmalloc_cache * cache)
+{
+    struct kmalloc_slab * slab;
+    struct kmalloc_slobj * obj;
+
+    mtx_lock(&cache->lock);
+    slab = LIST_FIRST(&cache->partial_slabs);
+    if (!slab) {
+        /* The mblock allocator must not be called while holding the lock. */
+        mtx_unlock(&cache->lock);
+        slab = slab_create(cache);
+        if (!slab)
+            return NULL;
+        mtx_lock(&cache->lock);
+
+        LIST_INSERT_HEAD(&cache->partial_slabs, slab, slab_link_);
+        cache->nr_slabs++;
+        cache->nr_free += cache->objs_per_slab;
+    }
+
+    obj = slab->freelist;
+    slab->freelist = SLOBJ_NEXT(obj);
+    if (--slab->nr_free == 0)
+        LIST_REMOVE(slab, slab_link_);
+
+    cache->nr_free--;
+    cache->nr_inuse++;
+    cache->nr_allocs++;
+
+    atomic_set(&obj->tag.refcount, 1);
+    mtx_unlock(&cache->lock);
+
+    return obj->data;
+}
+
+static void slab_free(void * p)
+{
+    struct kmalloc_slobj * obj = get_slobj(p);
+    struct kmalloc_slab * slab = obj->slab;
+    struct kmalloc_cache * cache = slab->cache;
+    int release = 0;
+
+    mtx_lock(&cache->lock);
+    SLOBJ_NEXT(obj) = slab->freelist;
+    slab->freelist = obj;
+    if (slab->nr_free++ == 0)
+        LIST_INSERT_HEAD(&cache->partial_slabs, slab, slab_link_);
+
+    cache->nr_free++;
+    cache->nr_inuse--;
+    cache->nr_frees++;
+
+    /* Keep at least one slab worth of free objects in the cache. */
+    if (slab->nr_free == cache->objs_per_slab &&
+        cache->nr_free > cache->objs_per_slab) {
+        LIST_REMOVE(slab, slab_link_);
+        cache->nr_slabs--;
+        cache->nr_free -= cache->objs_per_slab;
+        release = 1;
+    }
+    mtx_unlock(&cache->lock);
+
+    if (release)
+        kfree(slab);
+}
+#endif
+
+/**
+ * Get the size of the data area of a memory block.
+ */
+static size_t get_size(void * p)
+{
+#ifdef configKMALLOC_SLAB
+    if (get_tag(p)->signature == KM_SIGNATURE_SLAB)
+        return get_slobj(p)->slab->cache->size;
+#endif
+
+    return get_mblock(p)->size;
+}
+
+void * kmalloc(size_t size)
+{
+    size_t s = memalign(size);
+
+#ifdef configKMALLOC_SLAB
+    if (s <= KMALLOC_SLAB_MAX)
+        return slab_alloc(get_cache(s));
+#endif
+
+    return mblock_alloc(s);
+}
+
 void * kcalloc(size_t nelem, size_t elsize)
 {
     size_t * p;
@@ -388,26 +664,35 @@ void * kzalloc_crit(size_t size)
 
 void kfree(void * p)
 {
+    struct kmalloc_tag * tag;
     mblock_t * b;
 
     if (!valid_addr(p))
         return;
 
-    b = get_mblock(p);
-    if (atomic_read(&b->refcount) <= 0) { /* Already freed. */
+    tag = get_tag(p);
+    if (atomic_read(&tag->refcount) <= 0) { /* Already freed. */
         return;
     }
 
-    atomic_dec(&b->refcount);
-    if (atomic_read(&b->refcount) > 0)
+    atomic_dec(&tag->refcount);
+    if (atomic_read(&tag->refcount) > 0)
         return;
 
+#ifdef configKMALLOC_SLAB
+    if (tag->signature == KM_SIGNATURE_SLAB) {
+        slab_free(p);
+        return;
+    }
+#endif
+
+    b = get_mblock(p);
     mtx_lock(&kmalloc_giant_lock);
 
     update_stat_down(&(kmalloc_stat.kms_mem_alloc), b->size);
 
     /* Try merge with previous mblock if possible. */
-    if (b->prev && (atomic_read(&b->prev->refcount) == 0)) {
+    if (b->prev && (atomic_read(&b->prev->tag.refcount) == 0)) {
         b = merge(b->prev);
     }
 
@@ -453,9 +738,8 @@ void kfree_lazy(void * p)
     disable_interrupt();
 
     if (!queue_push(&lazy_free_queue, &p)) {
-        mblock_t * b = get_mblock(p);
         KERROR(KERROR_WARN, "kfree lazy queue full, leaked %u bytes\n",
-               (uint32_t)b->size);
+               (uint32_t)get_size(p));
     }
 
     set_interrupt_state(istate);
@@ -483,7 +767,6 @@ void * krealloc(void * p, size_t size)
 {
     size_t s; /* Aligned size. */
     mblock_t * b; /* Old block. */
-    mblock_t * nb; /* New block. */
     void * np; /* Pointer to the data section of the new block. */
     void * retval = NULL;
 
@@ -497,6 +780,24 @@ void * krealloc(void * p, size_t size)
         return NULL;
 
     s = memalign(size);
+
+#ifdef configKMALLOC_SLAB
+    if (get_tag(p)->signature == KM_SIGNATURE_SLAB) {
+        const size_t old_size = get_size(p);
+
+        if (old_size >= s)
+            return p;
+
+        np = kmalloc(s);
+        if (!np)
+            return NULL;
+
+        memcpy(np, p, old_size);
+        kfree(p);
+        return np;
+    }
+#endif
+
     b = get_mblock(p);
 
     if (b->size >= s) { /* Requested to shrink. */
@@ -507,7 +808,7 @@ void * krealloc(void * p, size_t size)
         } /* else don't split. */
     } else { /* new size is larger. */
         /* Try to merge with next block. */
-        if (b->next && (atomic_read(&b->next->refcount) == 0) &&
+        if (b->next && (atomic_read(&b->next->tag.refcount) == 0) &&
                 ((b->size + MBLOCK_SIZE + b->next->size) >= s)) {
             size_t old_size = b->size;
 
@@ -541,8 +842,7 @@ alloc_new_block:
                 goto out;
             }
 
-            nb = get_mblock(np);
-            memcpy(nb->data, b->data, b->size);
+            memcpy(np, b->data, b->size);
             /* Free the old mblock. */
             kfree(p);
             retval = np;
@@ -557,7 +857,7 @@ out:
 void * kpalloc(void * p)
 {
     if (valid_addr(p)) {
-        atomic_inc(&(get_mblock(p)->refcount));
+        atomic_inc(&(get_tag(p)->refcount));
     }
     return p;
 }
@@ -621,7 +921,7 @@ static void stat_fragmentation(uintptr_t arg)
         return;
 
     do {
-        if (atomic_read(&b->refcount) == 0) {
+        if (atomic_read(&b->tag.refcount) == 0) {
             blocks_free++;
         }
         blocks_total++;
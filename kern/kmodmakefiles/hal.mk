@@ -17,6 +17,7 @@ ifeq ($(configBCM2835),y)
 	hal-SRC-y += hal/bcm2835/bcm2835_gpio.c
 	hal-SRC-y += hal/bcm2835/bcm2835_interrupt.c
 	hal-SRC-y += hal/bcm2835/bcm2835_mmio.c
+	hal-SRC-$(configMP) += hal/bcm2835/bcm2835_mp.c
 	hal-SRC-y += hal/bcm2835/bcm2835_timers.c
 	hal-SRC-$(configBCM_MB) += hal/bcm2835/bcm2835_mailbox.c
 	hal-SRC-$(configBCM_MB) += hal/bcm2835/bcm2835_prop.c
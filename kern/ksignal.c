@@ -77,6 +77,7 @@
 #include <sys/tree.h>
 #include <sys/types.h>
 #include <coredump.h>
+#include <hal/hw_timers.h>
 #include <kerror.h>
 #include <kmalloc.h>
 #include <ksched.h>
@@ -777,6 +778,14 @@ static int ksignal_queue_sig(struct signals * sigs, int signum,
             } else {
                 KSIGFLAG_SET(sigs, KSIGFLAG_SA_KILL);
             }
+
+            /*
+             * Wake up the thread if it's sleeping in a syscall, so it can
+             * notice the signal with ksignal_isfatal_pending().
+             */
+            if (thread != current_thread &&
+                thread_state_get(thread) == THREAD_STATE_BLOCKED)
+                thread_release(thread->id);
         } else {
             /*
              * Otherwise the thread is in user mode and we can just terminate
@@ -919,13 +928,15 @@ int ksignal_sigtimedwait(siginfo_t * retval, const sigset_t * restrict set,
     return 0;
 }
 
-int ksignal_sigsleep(const struct timespec * restrict timeout)
+int ksignal_sigsleep(const struct timespec * restrict timeout,
+                     struct timespec * restrict remain)
 {
     struct signals * sigs = &current_thread->sigs;
     ksigmtx_t * s_lock = &sigs->s_lock;
     struct ksiginfo * ksiginfo;
     int64_t usec, unslept;
-    int timer_id;
+    uint64_t start;
+    int err;
 
     forward_proc_signals_curproc();
 
@@ -955,27 +966,51 @@ int ksignal_sigsleep(const struct timespec * restrict timeout)
             if (sa_handler != SIG_IGN && sa_handler != SIG_DFL &&
                     signum != _SIGMTX) {
                 ksig_unlock(s_lock);
+                if (remain)
+                    *remain = *timeout;
                 return timeout->tv_sec;
             }
         }
     }
 
-    usec = timeout->tv_sec * 1000000 + timeout->tv_nsec / 1000;
-    timer_id = thread_alarm(usec / 1000);
-    if (timer_id < 0)
-        return timer_id;
+    usec = (int64_t)timeout->tv_sec * 1000000 + timeout->tv_nsec / 1000;
+    start = get_utime();
+    err = thread_ualarm(usec);
+    if (err) {
+        ksig_unlock(s_lock);
+        if (remain)
+            *remain = (struct timespec){ 0 };
+        return (err == -ETIMEDOUT) ? 0 : err;
+    }
 
     /* This syscall callable function is now interruptible */
     KSIGFLAG_SET(sigs, KSIGFLAG_INTERRUPTIBLE);
     ksig_unlock(s_lock);
 
-    thread_wait();
-    timers_stop(timer_id);
-    unslept = usec - timers_get_split(timer_id);
-    thread_alarm_rele(timer_id);
+    thread_wait_blocked();
+    thread_ualarm_rele();
+
+    unslept = usec - (int64_t)(get_utime() - start);
+    if (unslept < 0)
+        unslept = 0;
+    if (remain) {
+        remain->tv_sec = unslept / 1000000;
+        remain->tv_nsec = (unslept % 1000000) * 1000;
+    }
+
+    return unslept / 1000000;
+}
+
+int ksignal_isfatal_pending(void)
+{
+    struct signals * sigs = &current_thread->sigs;
+    int retval;
 
-    unslept = (unslept > 0) ? unslept / 1000000 : 0;
-    return unslept;
+    while (ksig_lock(&sigs->s_lock));
+    retval = KSIGFLAG_IS_SET(sigs, KSIGFLAG_SA_KILL);
+    ksig_unlock(&sigs->s_lock);
+
+    return retval;
 }
 
 int ksignal_isblocked(struct signals * sigs, int signum)
@@ -1106,6 +1141,25 @@ int ksignal_reset_ksigaction(struct signals * sigs, int signum)
     return 0;
 }
 
+int ksignal_reset_ksigactions(struct signals * sigs, const sigset_t * set)
+{
+    int err = 0;
+
+    while (ksig_lock(&sigs->s_lock));
+
+    for (int signum = 1; signum < _SIG_MAX_; signum++) {
+        if (sigismember(set, signum)) {
+            err = ksignal_reset_ksigaction(sigs, signum);
+            if (err)
+                break;
+        }
+    }
+
+    ksig_unlock(&sigs->s_lock);
+
+    return err;
+}
+
 /**
  * Set signal action struct.
  * @note Always copied, so action struct can be allocated from stack.
@@ -1792,7 +1846,7 @@ static intptr_t sys_signal_sigsleep(__user void * user_args)
         .tv_nsec = args.tnsec,
     };
 
-    return ksignal_sigsleep(&timeout);
+    return ksignal_sigsleep(&timeout, NULL);
 }
 
 static intptr_t sys_signal_set_return(__user void * user_args)
@@ -30,27 +30,85 @@
  *******************************************************************************
  */
 
+#include <sys/sysctl.h>
+#include <hal/core.h>
 #include <kmalloc.h>
+#include <ksched.h>
 #include <mempool.h>
 
+/*
+ * Per CPU magazine stats.
+ * A hit is a get or return served by the magazine of the current CPU and a
+ * miss is an operation that had to refill or drain the magazine.
+ */
+static unsigned mempool_hits[KSCHED_CPU_COUNT];
+static unsigned mempool_misses[KSCHED_CPU_COUNT];
+
+SYSCTL_NODE(_vm, OID_AUTO, mempool, CTLFLAG_RW, 0,
+            "mempool stats");
+
+static int sysctl_mempool_sum(struct sysctl_oid * oidp, unsigned * counters,
+                              struct sysctl_req * req)
+{
+    unsigned sum = 0;
+
+    for (size_t i = 0; i < KSCHED_CPU_COUNT; i++) {
+        sum += counters[i];
+    }
+
+    return sysctl_handle_int(oidp, &sum, sizeof(sum), req);
+}
+
+static int sysctl_mempool_hits(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_mempool_sum(oidp, mempool_hits, req);
+}
+
+static int sysctl_mempool_misses(SYSCTL_HANDLER_ARGS)
+{
+    return sysctl_mempool_sum(oidp, mempool_misses, req);
+}
+
+SYSCTL_PROC(_vm_mempool, OID_AUTO, hits, CTLTYPE_UINT | CTLFLAG_RD, NULL, 0,
+            sysctl_mempool_hits, "IU",
+            "Number of operations served by per CPU magazines.");
+SYSCTL_PROC(_vm_mempool, OID_AUTO, misses, CTLTYPE_UINT | CTLFLAG_RD, NULL, 0,
+            sysctl_mempool_misses, "IU",
+            "Number of per CPU magazine refills and drains.");
+
 struct mempool * mempool_init(enum mempool_type type, size_t bsize,
                               unsigned count)
 {
     struct mempool * mp;
     uint8_t * elem;
     const size_t data_bsize = count * bsize;
-    const size_t pool_bsize = count * sizeof(void *);
+    /* One extra slot because a full queue always has one free slot. */
+    const size_t pool_bsize = (count + 1) * sizeof(void *);
 
     mp = kzalloc(sizeof(struct mempool) + pool_bsize);
     elem = kzalloc(data_bsize);
-    if (!(mp && elem))
+    if (!(mp && elem)) {
+        kfree(mp);
+        kfree(elem);
         return NULL;
+    }
 
     mp->head = queue_create(&mp->pool, sizeof(void *), pool_bsize);
 
+    mp->type = type;
     mtx_init(&mp->lock, MTX_TYPE_TICKET, 0);
     if (type == MEMPOOL_TYPE_BLOCKING) {
         sema_init(&mp->sema, count);
+    } else if (type == MEMPOOL_TYPE_PERCPU) {
+        mp->mag = kzalloc(KSCHED_CPU_COUNT * sizeof(struct mempool_magazine));
+        if (!mp->mag) {
+            kfree(mp);
+            kfree(elem);
+            return NULL;
+        }
+        for (size_t i = 0; i < KSCHED_CPU_COUNT; i++) {
+            mtx_init(&mp->mag[i].lock, MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+        }
     }
 
     mp->data = elem;
@@ -68,15 +126,121 @@ void mempool_destroy(struct mempool ** mp)
     struct mempool * p = *mp;
 
     /* No need to lock */
+    kfree(p->mag);
     kfree(p->data);
     kfree(p);
     *mp = NULL;
 }
 
+/**
+ * Steal an element from the magazine of another CPU.
+ * The free elements may all be cached in the magazines of other CPUs
+ * even though the shared pool is empty.
+ */
+static void * mag_steal(struct mempool * mp, int cpu)
+{
+    for (int i = 0; i < KSCHED_CPU_COUNT; i++) {
+        struct mempool_magazine * mag = &mp->mag[i];
+        void * elem = NULL;
+
+        if (i == cpu)
+            continue;
+
+        mtx_lock(&mag->lock);
+        if (mag->count > 0)
+            elem = mag->elem[--mag->count];
+        mtx_unlock(&mag->lock);
+        if (elem)
+            return elem;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get an element through the magazine of the current CPU.
+ * If the magazine is empty it's refilled with up to half of its capacity
+ * from the shared pool, and if the shared pool is empty too an element is
+ * stolen from another CPU.
+ */
+static void * mag_get(struct mempool * mp)
+{
+    struct mempool_magazine * mag;
+    void * elem = NULL;
+    istate_t s;
+    int cpu;
+
+    /* We must not migrate or get interrupted while using the magazine. */
+    s = get_interrupt_state();
+    disable_interrupt();
+
+    cpu = get_cpu_index();
+    mag = &mp->mag[cpu];
+    mtx_lock(&mag->lock);
+    if (mag->count == 0) {
+        mtx_lock(&mp->lock);
+        while (mag->count < MEMPOOL_MAG_SIZE / 2 &&
+               queue_pop(&mp->head, &mag->elem[mag->count])) {
+            mag->count++;
+        }
+        mtx_unlock(&mp->lock);
+        mempool_misses[cpu]++;
+    } else {
+        mempool_hits[cpu]++;
+    }
+    if (mag->count > 0)
+        elem = mag->elem[--mag->count];
+    mtx_unlock(&mag->lock);
+
+    /* Our own magazine lock must not be held while stealing. */
+    if (!elem)
+        elem = mag_steal(mp, cpu);
+
+    set_interrupt_state(s);
+
+    return elem;
+}
+
+/**
+ * Return an element through the magazine of the current CPU.
+ * If the magazine is full half of its elements are drained to the shared
+ * pool.
+ */
+static void mag_return(struct mempool * mp, void * p)
+{
+    struct mempool_magazine * mag;
+    istate_t s;
+    int cpu;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+
+    cpu = get_cpu_index();
+    mag = &mp->mag[cpu];
+    mtx_lock(&mag->lock);
+    if (mag->count == MEMPOOL_MAG_SIZE) {
+        mtx_lock(&mp->lock);
+        while (mag->count > MEMPOOL_MAG_SIZE / 2) {
+            (void)queue_push(&mp->head, &mag->elem[--mag->count]);
+        }
+        mtx_unlock(&mp->lock);
+        mempool_misses[cpu]++;
+    } else {
+        mempool_hits[cpu]++;
+    }
+    mag->elem[mag->count++] = p;
+    mtx_unlock(&mag->lock);
+
+    set_interrupt_state(s);
+}
+
 void * mempool_get(struct mempool * mp)
 {
     void * elem = NULL;
 
+    if (mp->type == MEMPOOL_TYPE_PERCPU)
+        return mag_get(mp);
+
     if (mp->type == MEMPOOL_TYPE_BLOCKING)
         sema_down(&mp->sema);
 
@@ -89,6 +253,11 @@ void * mempool_get(struct mempool * mp)
 
 void mempool_return(struct mempool * mp, void * p)
 {
+    if (mp->type == MEMPOOL_TYPE_PERCPU) {
+        mag_return(mp, p);
+        return;
+    }
+
     mtx_lock(&mp->lock);
     (void)queue_push(&mp->head, &p);
     mtx_unlock(&mp->lock);
@@ -198,15 +198,15 @@ static void init_kernel_proc(void)
     mtx_init(&(kprocvm_heap->lock), MTX_TYPE_SPIN, 0);
 
     mtx_lock(&kernel_proc->mm.regions_lock);
-    (*kernel_proc->mm.regions)[MM_CODE_REGION] = kprocvm_code;
+    vm_mm_set_region(&kernel_proc->mm, MM_CODE_REGION, kprocvm_code);
     /*
      * proc 0 stack shouldn't be set here because NULL for
      * MM_STACK_REGION is a special case for intialization because
      * proc 1 is really not forked from the kernel but rather just
      * spawned and constructed by hand in kinit.
      */
-    (*kernel_proc->mm.regions)[MM_STACK_REGION] = NULL;
-    (*kernel_proc->mm.regions)[MM_HEAP_REGION] = kprocvm_heap;
+    vm_mm_set_region(&kernel_proc->mm, MM_STACK_REGION, NULL);
+    vm_mm_set_region(&kernel_proc->mm, MM_HEAP_REGION, kprocvm_heap);
     mtx_unlock(&kernel_proc->mm.regions_lock);
 
     /*
@@ -520,6 +520,9 @@ void proc_thread_removed(pid_t pid, pthread_t thread_id)
         p->main_thread = NULL;
         p->state = PROC_STATE_ZOMBIE;
 
+        /* Wake up the parent if it's still waiting in vfork(). */
+        proc_vfork_release(p);
+
         /*
          * Invalidate sigs.
          */
@@ -543,14 +546,16 @@ void proc_update_times(void)
         curproc->tms.tms_utime++;
     }
 }
-SCHED_PRE_SCHED_TASK(proc_update_times);
+SCHED_TICK_TASK(proc_update_times);
 
 int proc_abo_handler(const struct mmu_abo_param * restrict abo)
 {
     const uintptr_t vaddr = abo->far;
     struct vm_mm_struct * mm;
+    struct buf * region;
     const char * abo_str = mmu_abo_strerror(abo);
-    int err;
+    char uap[5];
+    int region_nr, err;
 
     if (!abo->proc) {
         return -ESRCH;
@@ -563,83 +568,59 @@ int proc_abo_handler(const struct mmu_abo_param * restrict abo)
     mm = &abo->proc->mm;
 
     mtx_lock(&mm->regions_lock);
-    for (int i = 0; i < mm->nr_regions; i++) {
-        struct buf * region = (*mm->regions)[i];
-        uintptr_t reg_start, reg_end;
-        char uap[5];
-
-        if (!region)
-            continue;
-
-        reg_start = region->b_mmu.vaddr;
-        reg_end = region->b_mmu.vaddr + region->b_bufsize - 1;
-
-        vm_get_uapstring(uap, region);
-        KERROR_DBG("sect %d: vaddr: %x - %x paddr: %x uap: %s\n",
-                   i, (unsigned)reg_start, (unsigned)reg_end,
-                   (unsigned)region->b_mmu.paddr, uap);
+    region_nr = vm_mm_find_region(mm, vaddr, vaddr);
+    if (region_nr < 0) {
+        KERROR_DBG("No mapping found\n");
+        err = -EFAULT;
+        goto fail;
+    }
+    region = (*mm->regions)[region_nr];
 
-        if (!VM_ADDR_IS_IN_RANGE(vaddr, reg_start, reg_end))
-            continue; /* if not in range then try next region. */
+    vm_get_uapstring(uap, region);
+    KERROR_DBG("sect %d: vaddr: %x - %x paddr: %x uap: %s\n",
+               region_nr, (unsigned)region->b_mmu.vaddr,
+               (unsigned)(region->b_mmu.vaddr + region->b_bufsize - 1),
+               (unsigned)region->b_mmu.paddr, uap);
 
+    if (MMU_ABORT_IS_TRANSLATION_FAULT(abo->fsr)) { /* Translation fault */
         /*
-         * This is the correct region.
+         * Sometimes we see translation faults due to ordering of region
+         * replacements during exec. This is something we have to accept
+         * with the current implementation if we want to make exec more
+         * robust in failure cases.
+         * This may happen if new section A is bigger that old_A and
+         * due to that old_B is close to old_A and also overlaps A. Now
+         * if old_A is replaced with A but old_B is unmapped later in time
+         * it will cause the unmap operation to unmap some of the pages
+         * now belonging to A.
+         * Demand paged regions are also unmapped until the page is
+         * accessed for the first time, vm_fill_page() reads it in.
          */
+        mtx_unlock(&mm->regions_lock);
+        err = vm_fill_page(abo->proc, region_nr, vaddr);
 
-        if (MMU_ABORT_IS_TRANSLATION_FAULT(abo->fsr)) { /* Translation fault */
-            /*
-             * Sometimes we see translation faults due to ordering of region
-             * replacements during exec. This is something we have to accept
-             * with the current implementation if we want to make exec more
-             * robust in failure cases.
-             * This may happen if new section A is bigger that old_A and
-             * due to that old_B is close to old_A and also overlaps A. Now
-             * if old_A is replaced with A but old_B is unmapped later in time
-             * it will cause the unmap operation to unmap some of the pages
-             * now belonging to A.
-             */
-            mtx_unlock(&mm->regions_lock);
-            vm_mapproc_region(abo->proc, region);
-
-            KERROR_DBG("%s \"%s\" of a valid memory region (%d) fixed by remapping the region\n",
-                       mmu_abo_strtype(abo), abo_str, i);
-
-            return 0;
-        }
-
-        /* Test for COW flag. */
-        if ((region->b_uflags & VM_PROT_COW) != VM_PROT_COW) {
-            KERROR_DBG("Memory protection error\n");
-            err = -EACCES; /* Memory protection error. */
-            goto fail;
-        }
-
-        if (!region->vm_ops->rclone) {
-            KERROR_DBG("rclone() not supported\n");
-            err = -ENOTSUP; /* rclone() not supported. */
-            goto fail;
-        }
+        KERROR_DBG("%s \"%s\" of a valid memory region (%d) fixed by remapping the region (%d)\n",
+                   mmu_abo_strtype(abo), abo_str, region_nr, err);
 
-        region = region->vm_ops->rclone(region);
-        if (!region) {
-            KERROR_DBG("Can't clone region; COW failed\n");
-            err = -ENOMEM; /* Can't clone region; COW failed. */
-            goto fail;
-        }
-        /*
-         * The old region remains marked as COW as it would be racy to change
-         * its state.
-         */
-
-        mtx_unlock(&mm->regions_lock);
-        err = vm_replace_region(abo->proc, region, i, VM_INSOP_MAP_REG);
+        return err;
+    }
 
-        KERROR_DBG("COW done (%d)\n", err);
-        return err; /* COW done. */
+    /* Test for COW flag. */
+    if ((region->b_uflags & VM_PROT_COW) != VM_PROT_COW) {
+        KERROR_DBG("Memory protection error\n");
+        err = -EACCES; /* Memory protection error. */
+        goto fail;
     }
 
-    KERROR_DBG("No mapping found\n");
-    err = -EFAULT;
+    /*
+     * Only the faulting page is copied, the rest of the region is still
+     * shared with the other processes.
+     */
+    mtx_unlock(&mm->regions_lock);
+    err = vm_cow_page(abo->proc, region_nr, vaddr);
+
+    KERROR_DBG("COW done (%d)\n", err);
+    return err; /* COW done. */
 fail:
     mtx_unlock(&mm->regions_lock);
 
@@ -681,6 +662,25 @@ static intptr_t sys_proc_fork(__user void * user_args)
     }
 }
 
+static intptr_t sys_proc_vfork(__user void * user_args)
+{
+    int err;
+
+    err = priv_check(&curproc->cred, PRIV_PROC_FORK);
+    if (err) {
+        set_errno(-err);
+        return -1;
+    }
+
+    pid_t pid = proc_vfork();
+    if (pid < 0) {
+        set_errno(-pid);
+        return -1;
+    } else {
+        return pid;
+    }
+}
+
 static intptr_t sys_proc_wait(__user void * user_args)
 {
     struct _proc_wait_args args;
@@ -1269,7 +1269,9 @@ static intptr_t sys_proc_setpolicy(__user void * user_args)
 
     if (((args.policy != SCHED_OTHER || curproc->cred.euid != p_euid) &&
          (err = priv_check(&curproc->cred, PRIV_SCHED_SETPOLICY))) ||
-        (err = thread_set_policy(tid, args.policy))) {
+        (err = thread_set_policy(tid, args.policy)) ||
+        (args.cpu_affinity &&
+         (err = thread_set_affinity(tid, args.cpu_affinity)))) {
         set_errno(-err);
         return -1;
     }
@@ -1484,5 +1486,6 @@ static const syscall_handler_t proc_sysfnmap[] = {
     ARRDECL_SYSCALL_HNDL(SYSCALL_PROC_SETRLIM, sys_proc_setrlim),
     ARRDECL_SYSCALL_HNDL(SYSCALL_PROC_TIMES, sys_proc_times),
     ARRDECL_SYSCALL_HNDL(SYSCALL_PROC_GETBREAK, sys_proc_getbreak),
+    ARRDECL_SYSCALL_HNDL(SYSCALL_PROC_VFORK, sys_proc_vfork),
 };
 SYSCALL_HANDLERDEF(proc_syscall, proc_sysfnmap)
@@ -39,10 +39,14 @@
 #include <buf.h>
 #include <kerror.h>
 #include <kinit.h>
+#include <kmem.h>
+#include <ksignal.h>
 #include <kstring.h>
 #include <libkern.h>
 #include <mempool.h>
 #include <proc.h>
+#include <thread.h>
+#include <waitq.h>
 
 #ifdef configCOW_ENABLED
 #define COW_ENABLED_DEFAULT 1
@@ -58,9 +62,16 @@ static pid_t proc_lastpid;  /*!< last allocated pid. */
 SYSCTL_BOOL(_kern, OID_AUTO, cow_enabled, CTLFLAG_RW,
             &cow_enabled, 0, "Enable copy on write for proc");
 
+/*
+ * A parent sleeping in vfork() waits in this queue until its child sets the
+ * vfork_done flag. The flag is protected by vfork_lock.
+ */
+static mtx_t vfork_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+static struct waitq vfork_waitq = WAITQ_INITIALIZER(vfork_waitq);
+
 int _proc_init_fork(void)
 {
-    proc_pool = mempool_init(MEMPOOL_TYPE_NONBLOCKING,
+    proc_pool = mempool_init(MEMPOOL_TYPE_PERCPU,
                              sizeof(struct proc_info),
                              configMAXPROC);
     if (!proc_pool)
@@ -88,7 +99,7 @@ static int clone_code_region(struct proc_info * new_proc,
     if (vm_reg_tmp->vm_ops->rref)
         vm_reg_tmp->vm_ops->rref(vm_reg_tmp);
 
-    (*new_proc->mm.regions)[MM_CODE_REGION] = vm_reg_tmp;
+    vm_mm_set_region(&new_proc->mm, MM_CODE_REGION, vm_reg_tmp);
 
     return 0;
 }
@@ -125,7 +136,7 @@ static int clone_regions_from(struct proc_info * new_proc,
 
         /* Don't clone regions in system page table */
         if (vm_reg_tmp->b_mmu.vaddr <= configKERNEL_END) {
-            (*new_proc->mm.regions)[i] = vm_reg_tmp;
+            vm_mm_set_region(&new_proc->mm, i, vm_reg_tmp);
             continue;
         }
 
@@ -174,7 +185,7 @@ static int clone_regions_from(struct proc_info * new_proc,
                 }
             }
         }
-        (*new_proc->mm.regions)[i] = vm_reg_tmp;
+        vm_mm_set_region(&new_proc->mm, i, vm_reg_tmp);
 
         /*
          * Map the region to new_proc.
@@ -190,6 +201,28 @@ static int clone_regions_from(struct proc_info * new_proc,
     return 0;
 }
 
+/**
+ * Share regions of old_proc with new_proc starting from index.
+ * Unlike clone_regions_from() the regions are not marked COW nor mapped, the
+ * page tables of new_proc are populated lazily on page faults.
+ */
+static void share_regions_from(struct proc_info * new_proc,
+                               struct proc_info * old_proc,
+                               int index)
+{
+    for (int i = index; i < old_proc->mm.nr_regions; i++) {
+        struct buf * vm_reg_tmp;
+
+        vm_reg_tmp = (*old_proc->mm.regions)[i];
+        if (!vm_reg_tmp || (vm_reg_tmp->b_flags & B_NOTSHARED))
+            continue;
+
+        if (vm_reg_tmp->vm_ops->rref)
+            vm_reg_tmp->vm_ops->rref(vm_reg_tmp);
+        vm_mm_set_region(&new_proc->mm, i, vm_reg_tmp);
+    }
+}
+
 /**
  * Clone old process descriptor.
  */
@@ -276,17 +309,17 @@ static pid_t proc_get_next_pid(void)
     return newpid;
 }
 
-pid_t proc_fork(void)
+/**
+ * Create a new child process descriptor for old_proc.
+ * The new process inherits the process group, signal actions, credentials and
+ * file descriptors of old_proc but its memory map is left empty.
+ */
+static int new_child_proc(struct proc_info * old_proc,
+                          struct proc_info ** new_proc_out)
 {
-    /*
-     * http://pubs.opengroup.org/onlinepubs/9699919799/functions/fork.html
-     */
-
-    KERROR_DBG("%s(%u)\n", __func__, curproc->pid);
-
-    struct proc_info * const old_proc = curproc;
     struct proc_info * new_proc;
-    pid_t retval = 0;
+    int nofile_max;
+    int err;
 
     /* Check that the old process is in valid state. */
     if (!old_proc || old_proc->state == PROC_STATE_INITIAL)
@@ -301,9 +334,37 @@ pid_t proc_fork(void)
     new_proc->exit_ksiginfo = NULL;
     new_proc->files = NULL;
     new_proc->pgrp = NULL; /* Must be NULL so we don't free the old ref. */
+    new_proc->main_thread = NULL;
+    new_proc->vfork_done = NULL;
     memset(&new_proc->tms, 0, sizeof(new_proc->tms));
     /* ..and then start to fix things. */
 
+    /*
+     * Copy file descriptors.
+     * This is done first because proc_free() expects files to be set.
+     */
+    KERROR_DBG("Copy file descriptors\n");
+    nofile_max = old_proc->rlim[RLIMIT_NOFILE].rlim_max;
+    if (nofile_max < 0) {
+#if configRLIMIT_NOFILE < 0
+#error configRLIMIT_NOFILE can't be negative.
+#endif
+        nofile_max = configRLIMIT_NOFILE;
+    }
+    new_proc->files = fs_alloc_files(nofile_max, nofile_max);
+    if (!new_proc->files) {
+        KERROR_DBG(
+               "\tENOMEM when tried to allocate memory for file descriptors\n");
+        mempool_return(proc_pool, new_proc);
+        return -ENOMEM;
+    }
+    /* Copy and ref old file descriptors */
+    for (int i = 0; i < old_proc->files->count; i++) {
+        new_proc->files->fd[i] = old_proc->files->fd[i];
+        fs_fildes_ref(new_proc->files, i, 1); /* null pointer safe */
+    }
+    KERROR_DBG("All file descriptors copied\n");
+
     /*
      * Process group.
      */
@@ -311,12 +372,117 @@ pid_t proc_fork(void)
     proc_pgrp_insert(old_proc->pgrp, new_proc);
     PROC_UNLOCK();
 
+    /* fork() signals */
+    ksignal_signals_fork_reinit(&new_proc->sigs);
+
+    priv_cred_init_fork(&new_proc->cred);
+
     /*
      *  Initialize the mm struct.
      */
-    retval = vm_mm_init(&new_proc->mm, old_proc->mm.nr_regions);
+    err = vm_mm_init(&new_proc->mm, old_proc->mm.nr_regions);
+    if (err) {
+        proc_free(new_proc);
+        return err;
+    }
+
+    *new_proc_out = new_proc;
+    return 0;
+}
+
+/**
+ * Set break values from the heap region.
+ */
+static void set_proc_brk(struct proc_info * proc)
+{
+    struct buf * const heap = (proc->mm.nr_regions > MM_HEAP_REGION)
+        ? (*proc->mm.regions)[MM_HEAP_REGION]
+        : NULL;
+
+    if (!heap) {
+        proc->brk_start = NULL;
+        proc->brk_stop = NULL;
+        return;
+    }
+
+    proc->brk_start = (void *)(heap->b_mmu.vaddr + heap->b_bcount);
+    proc->brk_stop = (void *)(heap->b_mmu.vaddr + heap->b_bufsize);
+}
+
+/**
+ * Make a new child process visible to the rest of the system.
+ */
+static void insert_child_proc(struct proc_info * old_proc,
+                              struct proc_info * new_proc)
+{
+    if (new_proc->cwd) {
+        KERROR_DBG("Increment refcount for the cwd\n");
+        vref(new_proc->cwd); /* Increment refcount for the cwd */
+    }
+
+    /* Update inheritance attributes */
+    set_proc_inher(old_proc, new_proc);
+
+    /* Insert the new process into the process array */
+    procarr_insert(new_proc);
+}
+
+/**
+ * Fork the calling thread to be the main thread of new_proc.
+ */
+static int fork_main_thread(struct proc_info * old_proc,
+                            struct proc_info * new_proc)
+{
+    /*
+     * A process shall be created with a single thread. If a multi-threaded
+     * process calls fork(), the new process shall contain a replica of the
+     * calling thread.
+     * We left main_thread null if calling process has no main thread.
+     */
+    KERROR_DBG("Handle main_thread\n");
+    if (old_proc->main_thread) {
+        KERROR_DBG("Call thread_fork() to get a new main thread for the fork.\n");
+        if (!(new_proc->main_thread = thread_fork(new_proc->pid))) {
+            KERROR_DBG("\tthread_fork() failed\n");
+            return -EAGAIN;
+        }
+
+        KERROR_DBG("\tthread_fork() fork OK\n");
+
+        /*
+         * We set new proc's mpt as the current mpt because the new main thread
+         * is going to return directly to the user space.
+         */
+        new_proc->main_thread->curr_mpt = &new_proc->mm.mpt;
+        new_proc->state = PROC_STATE_READY;
+
+        KERROR_DBG("Set the new main_thread (%d) ready\n",
+                   new_proc->main_thread->id);
+        thread_ready(new_proc->main_thread->id);
+    } else {
+        KERROR_DBG("No thread to fork.\n");
+        new_proc->main_thread = NULL;
+        new_proc->state = PROC_STATE_READY;
+    }
+
+    return 0;
+}
+
+pid_t proc_fork(void)
+{
+    /*
+     * http://pubs.opengroup.org/onlinepubs/9699919799/functions/fork.html
+     */
+
+    KERROR_DBG("%s(%u)\n", __func__, curproc->pid);
+
+    struct proc_info * const old_proc = curproc;
+    struct proc_info * new_proc;
+    pid_t retval = 0;
+
+    retval = new_child_proc(old_proc, &new_proc);
     if (retval)
-        goto out;
+        return retval;
 
     /*
      * Clone the master page table.
@@ -358,100 +524,226 @@ pid_t proc_fork(void)
     if (retval)
         goto out;
 
+    set_proc_brk(new_proc);
+
     /*
-     * Set break values.
+     * Select PID.
      */
-    new_proc->brk_start = (void *)(
-            (*new_proc->mm.regions)[MM_HEAP_REGION]->b_mmu.vaddr +
-            (*new_proc->mm.regions)[MM_HEAP_REGION]->b_bcount);
-    new_proc->brk_stop = (void *)(
-            (*new_proc->mm.regions)[MM_HEAP_REGION]->b_mmu.vaddr +
-            (*new_proc->mm.regions)[MM_HEAP_REGION]->b_bufsize);
+    new_proc->pid = proc_get_next_pid();
 
-    /* fork() signals */
-    ksignal_signals_fork_reinit(&new_proc->sigs);
+    insert_child_proc(old_proc, new_proc);
+
+    retval = fork_main_thread(old_proc, new_proc);
+    if (retval)
+        goto out;
+
+    KERROR_DBG("Fork %d -> %d created.\n", old_proc->pid, new_proc->pid);
+    retval = new_proc->pid;
+out:
+    if (unlikely(retval < 0)) {
+        proc_free(new_proc);
+    }
+    return retval;
+}
+
+pid_t proc_vfork(void)
+{
+    KERROR_DBG("%s(%u)\n", __func__, curproc->pid);
+
+    struct proc_info * const old_proc = curproc;
+    struct proc_info * new_proc;
+    int done = 0;
+    pid_t retval;
+
+    retval = new_child_proc(old_proc, &new_proc);
+    if (retval)
+        return retval;
 
     /*
-     * Copy file descriptors.
+     * The child gets a fresh copy of the kernel master page table and its L2
+     * page tables are created on demand when the shared regions are accessed
+     * for the first time. This way vfork() doesn't need to copy nor COW any
+     * page tables of the parent.
      */
-    KERROR_DBG("Copy file descriptors\n");
-    int nofile_max = old_proc->rlim[RLIMIT_NOFILE].rlim_max;
-    if (nofile_max < 0) {
-#if configRLIMIT_NOFILE < 0
-#error configRLIMIT_NOFILE can't be negative.
-#endif
-        nofile_max = configRLIMIT_NOFILE;
-    }
-    new_proc->files = fs_alloc_files(nofile_max, nofile_max);
-    if (!new_proc->files) {
-        KERROR_DBG(
-               "\tENOMEM when tried to allocate memory for file descriptors\n");
-        retval = -ENOMEM;
+    if (mmu_ptcpy(&new_proc->mm.mpt, &mmu_pagetable_master)) {
+        retval = -EAGAIN;
         goto out;
     }
-    /* Copy and ref old file descriptors */
-    for (int i = 0; i < old_proc->files->count; i++) {
-        new_proc->files->fd[i] = old_proc->files->fd[i];
-        fs_fildes_ref(new_proc->files, i, 1); /* null pointer safe */
-    }
-    KERROR_DBG("All file descriptors copied\n");
+
+    retval = clone_code_region(new_proc, old_proc);
+    if (retval)
+        goto out;
 
     /*
-     * Select PID.
+     * The stack is the only region that is copied. The child returns through
+     * the libc syscall wrappers, which would otherwise overwrite the stack
+     * frames of the suspended parent thread.
      */
+    retval = clone_stack(new_proc, old_proc);
+    if (retval) {
+        KERROR_DBG("Cloning stack region failed.\n");
+        goto out;
+    }
+
+    share_regions_from(new_proc, old_proc, MM_HEAP_REGION);
+    set_proc_brk(new_proc);
+
+    new_proc->vfork_done = &done;
     new_proc->pid = proc_get_next_pid();
 
-    if (new_proc->cwd) {
-        KERROR_DBG("Increment refcount for the cwd\n");
-        vref(new_proc->cwd); /* Increment refcount for the cwd */
-    }
+    insert_child_proc(old_proc, new_proc);
 
-    /* Update inheritance attributes */
-    set_proc_inher(old_proc, new_proc);
+    retval = fork_main_thread(old_proc, new_proc);
+    if (retval)
+        goto out;
 
-    priv_cred_init_fork(&new_proc->cred);
+    KERROR_DBG("vfork %d -> %d created.\n", old_proc->pid, new_proc->pid);
+    retval = new_proc->pid;
 
-    /* Insert the new process into the process array */
-    procarr_insert(new_proc);
+    /* There is nobody to release us if there was no thread to fork. */
+    if (!old_proc->main_thread)
+        proc_vfork_release(new_proc);
 
     /*
-     * A process shall be created with a single thread. If a multi-threaded
-     * process calls fork(), the new process shall contain a replica of the
-     * calling thread.
-     * We left main_thread null if calling process has no main thread.
+     * Wait until the child releases the shared memory. Only a fatal signal
+     * ends the wait early, and then done must be detached from the child
+     * because it's allocated from the stack of this thread. The child can't
+     * be freed before it has released us, so new_proc is still valid if done
+     * isn't set.
      */
-    KERROR_DBG("Handle main_thread\n");
-    if (old_proc->main_thread) {
-        KERROR_DBG("Call thread_fork() to get a new main thread for the fork.\n");
-        if (!(new_proc->main_thread = thread_fork(new_proc->pid))) {
-            KERROR_DBG("\tthread_fork() failed\n");
-            retval = -EAGAIN;
-            goto out;
+    mtx_lock(&vfork_lock);
+    while (!done) {
+        if (ksignal_isfatal_pending()) {
+            new_proc->vfork_done = NULL;
+            break;
+        }
+        (void)waitq_wait(&vfork_waitq, &vfork_lock, 0);
+        mtx_lock(&vfork_lock);
+    }
+    mtx_unlock(&vfork_lock);
+out:
+    if (unlikely(retval < 0)) {
+        proc_free(new_proc);
+    }
+    return retval;
+}
+
+void proc_vfork_release(struct proc_info * proc)
+{
+    mtx_lock(&vfork_lock);
+    if (proc->vfork_done) {
+        *proc->vfork_done = 1;
+        proc->vfork_done = NULL;
+        waitq_wakeup_all(&vfork_waitq);
+    }
+    mtx_unlock(&vfork_lock);
+}
+
+int proc_spawn_create(struct proc_info ** new_proc)
+{
+    struct proc_info * proc;
+    int err;
+
+    KERROR_DBG("%s(%u)\n", __func__, curproc->pid);
+
+    err = new_child_proc(curproc, &proc);
+    if (err)
+        return err;
+
+    if (mmu_ptcpy(&proc->mm.mpt, &mmu_pagetable_master)) {
+        proc_free(proc);
+        return -EAGAIN;
+    }
+
+    *new_proc = proc;
+    return 0;
+}
+
+/**
+ * Set the process group of a spawned process.
+ */
+static int spawn_setpgroup(struct proc_info * new_proc, pid_t pgroup)
+{
+    struct session * const s = curproc->pgrp->pg_session;
+    const pid_t pg_id = (pgroup == 0) ? new_proc->pid : pgroup;
+    int err = 0;
+
+    if (pgroup < 0)
+        return -EINVAL;
+
+    PROC_LOCK();
+    if (pg_id != new_proc->pid) {
+        struct pgrp * pg;
+
+        pg = proc_session_search_pg(s, pg_id);
+        if (pg)
+            proc_pgrp_insert(pg, new_proc);
+        else
+            err = -EPERM;
+    } else if (!proc_pgrp_create(s, new_proc)) {
+        err = -ENOMEM;
+    }
+    PROC_UNLOCK();
+
+    return err;
+}
+
+pid_t proc_spawn_commit(struct proc_info * new_proc,
+                        const posix_spawnattr_t * attr,
+                        struct _sched_pthread_create_args * main_def)
+{
+    struct proc_info * const old_proc = curproc;
+    const sigset_t * sigmask;
+    struct thread_info * thread;
+    pthread_t tid;
+    int err;
+
+    set_proc_brk(new_proc);
+    new_proc->pid = proc_get_next_pid();
+
+    if (attr->sa_flags & POSIX_SPAWN_SETPGROUP) {
+        err = spawn_setpgroup(new_proc, attr->sa_pgroup);
+        if (err) {
+            proc_free(new_proc);
+            return err;
         }
+    }
 
-        KERROR_DBG("\tthread_fork() fork OK\n");
+    insert_child_proc(old_proc, new_proc);
+
+    tid = thread_create_proc(main_def, new_proc->pid);
+    thread = (tid > 0) ? thread_lookup(tid) : NULL;
+    if (!thread) {
+        KERROR_DBG("Failed to create a new main() (%d)\n", tid);
 
         /*
-         * We set new proc's mpt as the current mpt because the new main thread
-         * is going to return directly to the user space.
+         * POSIX allows reporting errors that occur after the process was
+         * created as if the child exited with status 127.
          */
-        new_proc->main_thread->curr_mpt = &new_proc->mm.mpt;
-        new_proc->state = PROC_STATE_READY;
+        new_proc->exit_code = 127;
+        new_proc->state = PROC_STATE_ZOMBIE;
+        ksignal_signals_dtor(&new_proc->sigs);
+        fs_fildes_close_all(new_proc, 0);
 
-        KERROR_DBG("Set the new main_thread (%d) ready\n",
-                   new_proc->main_thread->id);
-        thread_ready(new_proc->main_thread->id);
-    } else {
-        KERROR_DBG("No thread to fork.\n");
-        new_proc->main_thread = NULL;
-        new_proc->state = PROC_STATE_READY;
+        return new_proc->pid;
     }
 
-    KERROR_DBG("Fork %d -> %d created.\n", old_proc->pid, new_proc->pid);
-    retval = new_proc->pid;
-out:
-    if (unlikely(retval < 0)) {
-        proc_free(new_proc);
-    }
-    return retval;
+    /* The signal mask is inherited from the calling thread by default. */
+    sigmask = (attr->sa_flags & POSIX_SPAWN_SETSIGMASK)
+        ? &attr->sa_sigmask
+        : &current_thread->sigs.s_block;
+    (void)ksignal_sigsmask(&thread->sigs, SIG_SETMASK, sigmask, NULL);
+
+    new_proc->main_thread = thread;
+    new_proc->state = PROC_STATE_READY;
+    thread_ready(tid);
+
+    KERROR_DBG("Spawn %d -> %d created.\n", old_proc->pid, new_proc->pid);
+
+    return new_proc->pid;
+}
+
+void proc_spawn_abort(struct proc_info * new_proc)
+{
+    proc_free(new_proc);
 }
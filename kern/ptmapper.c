@@ -197,6 +197,8 @@ void ptmapper_free(mmu_pagetable_t * pt)
         return;
     }
 
+    mmu_account_pagetable(pt, -1);
+
     block = PTM_ADDR2BLOCK(pt->pt_addr);
     PTM_FREE(block, size);
 
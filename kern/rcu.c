@@ -31,89 +31,203 @@
  *******************************************************************************
  */
 
+/*
+ * Quiescent-state-based RCU.
+ *
+ * A read-side critical section only increments a nesting counter of the
+ * current thread and records the grace period phase the reader started in.
+ * A CPU passes a quiescent state every time sched_handler() runs while the
+ * interrupted thread isn't inside a read-side critical section. A reader
+ * that is switched out inside a critical section is counted as a blocked
+ * reader of its phase until it calls rcu_read_unlock().
+ *
+ * A grace period starts by advancing rcu_gp_seq, which also flips the phase
+ * for new readers, and ends once every online CPU has passed a quiescent
+ * state and there are no blocked readers left in the old phase.
+ *
+ * Callbacks registered with rcu_call() are collected to a batch that is
+ * run after the next grace period. The rcu kthread starts a grace period
+ * periodically if there are callbacks waiting.
+ */
+
 #include <machine/atomic.h>
+#include <sys/sysctl.h>
 #include <buf.h>
 #include <hal/core.h>
+#include <hal/hw_timers.h>
 #include <idle.h>
 #include <kerror.h>
 #include <kinit.h>
+#include <klocks.h>
+#include <ksched.h>
 #include <thread.h>
 #include <rcu.h>
 
-static atomic_t rcu_ctrl = ATOMIC_INIT(0);
+#define RCU_PHASE(_seq_) ((_seq_) & 1)
+
+/**
+ * Grace period sequence number.
+ * Incremented when a new grace period is started.
+ */
+static unsigned rcu_gp_seq;
+
+/**
+ * Number of readers blocked inside a read-side critical section per phase.
+ */
+static atomic_t rcu_blocked[2] = { ATOMIC_INIT(0), ATOMIC_INIT(0) };
 
-#define RCU_CTR_A_OFFSET     0
-#define RCU_CTR_B_OFFSET    15
-#define RCU_CLOCK_OFFSET    30
+/**
+ * Per CPU quiescent state tracking.
+ */
+static struct rcu_cpu {
+    unsigned qs_seq;    /*!< Grace period of the last quiescent state. */
+    int online;         /*!< Set when the CPU has entered the scheduler. */
+} rcu_cpu[KSCHED_CPU_COUNT];
 
-#define RCU_CTR_MASK        0x7fff
-#define RCU_CLOCK_MASK      0x1
+/**
+ * Callbacks waiting for the next batch.
+ */
+static struct rcu_cb * rcu_cb_next;
+static uint64_t rcu_cb_next_ts; /*!< Time of the first callback in the batch. */
+static mtx_t rcu_cb_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+
+static pthread_t rcu_sync_thread_tid;
 
-#define RCU_CTRL_TO_CTR_A(_x_) (((_x_) >> RCU_CTR_A_OFFSET) & RCU_CTR_MASK)
-#define RCU_CTRL_TO_CTR_B(_x_) (((_x_) >> RCU_CTR_B_OFFSET) & RCU_CTR_MASK)
-#define RCU_CTRL_TO_CLOCK(_x_) (((_x_) >> RCU_CLOCK_OFFSET) & RCU_CLOCK_MASK);
+SYSCTL_DECL(_kern_rcu);
+SYSCTL_NODE(_kern, OID_AUTO, rcu, CTLFLAG_RW, 0,
+            "RCU");
 
-#define RCU_CTR_ONE(_clock_) \
-    ((_clock_) ? 1 << RCU_CTR_B_OFFSET : 1 << RCU_CTR_A_OFFSET)
+static unsigned rcu_nr_gp;
+SYSCTL_UINT(_kern_rcu, OID_AUTO, nr_gp, CTLFLAG_RD,
+            &rcu_nr_gp, 0, "Number of grace periods");
 
-#define RCU_GET_CTR(_ctrl_, _clock_) \
-    ((_clock_) ? RCU_CTRL_TO_CTR_B(_ctrl_) : RCU_CTRL_TO_CTR_A(_ctrl_))
+static unsigned rcu_nr_callbacks;
+SYSCTL_UINT(_kern_rcu, OID_AUTO, nr_callbacks, CTLFLAG_RD,
+            &rcu_nr_callbacks, 0, "Number of callbacks called");
 
-#define RCU_GET_CURCTR(_ctrl_) \
-    (RCU_GET_CTR((_ctrl_), RCU_CTRL_TO_CLOCK(_ctrl_)))
+static unsigned rcu_gp_len_max;
+SYSCTL_UINT(_kern_rcu, OID_AUTO, gp_len_max, CTLFLAG_RD,
+            &rcu_gp_len_max, 0, "Maximum grace period length [us]");
 
-static struct rcu_cb * rcu_reclaim_list[2];
+static unsigned rcu_cb_latency_max;
+SYSCTL_UINT(_kern_rcu, OID_AUTO, cb_latency_max, CTLFLAG_RD,
+            &rcu_cb_latency_max, 0, "Maximum callback latency [us]");
 
-static pthread_t rcu_sync_thread_tid;
+#define RCU_AVG_N 4
+static unsigned rcu_gp_len_avg;
+static unsigned rcu_cb_latency_avg;
+
+static void rcu_update_stat(unsigned * avg, unsigned * max, unsigned value)
+{
+    *avg = *avg + value - (*avg >> RCU_AVG_N);
+    if (value > *max)
+        *max = value;
+}
+
+static int sysctl_rcu_gp_len_avg(SYSCTL_HANDLER_ARGS)
+{
+    unsigned avg = rcu_gp_len_avg >> RCU_AVG_N;
+
+    return sysctl_handle_int(oidp, &avg, sizeof(avg), req);
+}
+
+SYSCTL_PROC(_kern_rcu, OID_AUTO, gp_len_avg, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_rcu_gp_len_avg, "IU",
+            "Average grace period length [us]");
+
+static int sysctl_rcu_cb_latency_avg(SYSCTL_HANDLER_ARGS)
+{
+    unsigned avg = rcu_cb_latency_avg >> RCU_AVG_N;
+
+    return sysctl_handle_int(oidp, &avg, sizeof(avg), req);
+}
+
+SYSCTL_PROC(_kern_rcu, OID_AUTO, cb_latency_avg, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_rcu_cb_latency_avg, "IU",
+            "Average callback latency [us]");
 
 struct rcu_lock_ctx rcu_read_lock(void)
 {
-    int old;
-    int new;
-    int selector;
+    struct thread_info * const thread = current_thread;
+    istate_t s;
 
-    do {
-        old = atomic_read(&rcu_ctrl);
-        selector = RCU_CTRL_TO_CLOCK(old);
-        new = old + RCU_CTR_ONE(selector);
-    } while (atomic_cmpxchg(&rcu_ctrl, old, new) != old);
+    /*
+     * The phase must be recorded and nesting incremented without passing
+     * through sched_handler() in between, otherwise a quiescent state could
+     * be reported for this CPU while the reader holds a stale phase.
+     */
+    s = get_interrupt_state();
+    disable_interrupt();
+    if (thread->rcu.nesting == 0)
+        thread->rcu.phase = RCU_PHASE(ACCESS_ONCE(rcu_gp_seq));
+    thread->rcu.nesting++;
+    set_interrupt_state(s);
+    __compiler_membar();
 
-    return (struct rcu_lock_ctx){ .selector = selector };
+    return (struct rcu_lock_ctx){ .selector = thread->rcu.phase };
 }
 
 void rcu_read_unlock(struct rcu_lock_ctx * restrict ctx)
 {
-    int old;
-    int new;
+    struct thread_info * const thread = current_thread;
 
-    do {
-        old = atomic_read(&rcu_ctrl);
-        new = old - RCU_CTR_ONE(ctx->selector);
-    } while (atomic_cmpxchg(&rcu_ctrl, old, new) != old);
+    __compiler_membar();
+    if (--thread->rcu.nesting == 0 && thread->rcu.blocked) {
+        thread->rcu.blocked = 0;
+        atomic_dec(&rcu_blocked[thread->rcu.phase]);
+    }
+}
+
+void rcu_sched_qs(struct thread_info * prev, int switched)
+{
+    struct rcu_cpu * const rc = &rcu_cpu[get_cpu_index()];
+
+    if (prev && prev->rcu.nesting > 0) {
+        if (!switched)
+            return; /* The reader is still running. */
+
+        if (!prev->rcu.blocked) {
+            prev->rcu.blocked = 1;
+            atomic_inc(&rcu_blocked[prev->rcu.phase]);
+        }
+    }
+
+    rc->qs_seq = ACCESS_ONCE(rcu_gp_seq);
+    rc->online = 1;
+}
+
+void rcu_thread_removed(struct thread_info * thread)
+{
+    if (thread->rcu.blocked) {
+        thread->rcu.blocked = 0;
+        atomic_dec(&rcu_blocked[thread->rcu.phase]);
+    }
+    thread->rcu.nesting = 0;
 }
 
 void rcu_call(struct rcu_cb * cbd, void (*fn)(struct rcu_cb *))
 {
-    struct rcu_lock_ctx ctx;
-    struct rcu_cb * old;
-    struct rcu_cb ** list_head;
-
-    ctx = rcu_read_lock(); /* Use read lock to prevent a clock tick. */
-    list_head = &rcu_reclaim_list[ctx.selector];
-    do {
-        cbd->callback = fn;
-        cbd->callback_arg = cbd;
-        old = *list_head;
-        cbd->next = old;
-    } while (atomic_cmpxchg_ptr((void **)(list_head), old, cbd) != old);
-    rcu_read_unlock(&ctx);
+    istate_t s;
+
+    cbd->callback = fn;
+    cbd->callback_arg = cbd;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+    mtx_lock(&rcu_cb_lock);
+    if (!rcu_cb_next)
+        rcu_cb_next_ts = get_utime();
+    cbd->next = rcu_cb_next;
+    rcu_cb_next = cbd;
+    mtx_unlock(&rcu_cb_lock);
+    set_interrupt_state(s);
 }
 
 static inline void rcu_yield(void)
 {
 #if configRCU_SYNC_HZ > 0
     if (current_thread->id == rcu_sync_thread_tid) {
-        thread_sleep(configRCU_SYNC_HZ);
+        thread_sleep(1000 / configSCHED_HZ);
     } else
 #endif
     {
@@ -121,65 +235,84 @@ static inline void rcu_yield(void)
     }
 }
 
-static void rcu_wait_for_readers(int old_clock)
+/**
+ * Test if all online CPUs have passed a quiescent state during the grace
+ * period gp_seq.
+ */
+static int rcu_cpus_quiescent(unsigned gp_seq)
 {
-    while (1) {
-        int ctrl = atomic_read(&rcu_ctrl);
-        if (RCU_GET_CTR(ctrl, old_clock) == 0)
-            return;
-        rcu_yield();
+    for (size_t i = 0; i < num_elem(rcu_cpu); i++) {
+        const struct rcu_cpu * rc = &rcu_cpu[i];
+
+        if (ACCESS_ONCE(rc->online) && ACCESS_ONCE(rc->qs_seq) != gp_seq)
+            return 0;
     }
+
+    return 1;
 }
 
 void rcu_synchronize(void)
 {
     static mtx_t rcu_sync_lock = MTX_INITIALIZER(MTX_TYPE_TICKET,
                                                  MTX_OPT_DEFAULT);
-    int old;
-    int old_clock;
-    int new;
+    struct rcu_cb * cbd;
+    unsigned gp_seq;
+    uint64_t start, cb_ts;
+    istate_t s;
+
+    KASSERT(current_thread->rcu.nesting == 0,
+            "rcu_synchronize() called inside a read-side critical section");
 
     /*
      * Callers of this function will get thru this in call order since
      * rcu_sync_lock is a ticket lock.
      */
     mtx_lock(&rcu_sync_lock);
+    start = get_utime();
 
-    /* Stage 1: Advance the RCU clock. */
-    do {
-retry:
-        old = atomic_read(&rcu_ctrl);
-        old_clock = RCU_CTRL_TO_CLOCK(old);
-        const int tick = RCU_GET_CTR(old, old_clock ^ 1) == 0;
-        if (!tick) {
-            /*
-             * We yield until we get a tick. A tick means that all readers of
-             * the other counter on the current grace period are ready.
-             */
-            rcu_yield();
-            goto retry;
-        }
-        new = old ^ (1 << RCU_CLOCK_OFFSET);
-    } while (atomic_cmpxchg(&rcu_ctrl, old, new) != old);
+    /* Take the callbacks registered before this grace period. */
+    s = get_interrupt_state();
+    disable_interrupt();
+    mtx_lock(&rcu_cb_lock);
+    cbd = rcu_cb_next;
+    cb_ts = rcu_cb_next_ts;
+    rcu_cb_next = NULL;
+    mtx_unlock(&rcu_cb_lock);
+    set_interrupt_state(s);
 
-    /*
-     * Stage 2: Reclaim orphaned resources.
-     * Wait until all the readers of the previous counter are ready.
-     */
-    rcu_wait_for_readers(old_clock);
-    if (rcu_reclaim_list[old_clock]) {
-        struct rcu_cb * cbd = rcu_reclaim_list[old_clock];
-        struct rcu_cb * next;
-
-        /*
-         * Call reclaim callbacks for registered CBs.
-         */
+    /* Start a new grace period and flip the phase for new readers. */
+    gp_seq = rcu_gp_seq + 1;
+    cpu_wmb();
+    WRITE_ONCE(rcu_gp_seq, gp_seq);
+    cpu_wmb();
+
+    /* The current CPU is in a quiescent state. */
+    rcu_cpu[get_cpu_index()].qs_seq = gp_seq;
+
+    while (!rcu_cpus_quiescent(gp_seq)) {
+        rcu_yield();
+    }
+    while (atomic_read(&rcu_blocked[RCU_PHASE(gp_seq - 1)]) > 0) {
+        rcu_yield();
+    }
+    cpu_wmb();
+
+    rcu_nr_gp++;
+    rcu_update_stat(&rcu_gp_len_avg, &rcu_gp_len_max, get_utime() - start);
+
+    /* Call the batch of reclaim callbacks. */
+    if (cbd) {
         do {
-            next = cbd->next;
+            struct rcu_cb * next = cbd->next;
+
             cbd->callback(cbd->callback_arg);
-        } while ((cbd = next));
+            rcu_nr_callbacks++;
+            cbd = next;
+        } while (cbd);
+
+        rcu_update_stat(&rcu_cb_latency_avg, &rcu_cb_latency_max,
+                        get_utime() - cb_ts);
     }
-    rcu_reclaim_list[old_clock] = NULL;
 
     mtx_unlock(&rcu_sync_lock);
 }
@@ -188,7 +321,8 @@ retry:
 static void * rcu_sync_thread(void * arg)
 {
     while (1) {
-        rcu_synchronize();
+        if (ACCESS_ONCE(rcu_cb_next))
+            rcu_synchronize();
         thread_sleep(configRCU_SYNC_HZ);
     }
 }
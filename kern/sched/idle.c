@@ -32,18 +32,89 @@
  *******************************************************************************
  */
 
-/* TODO Idle thread/sched is not MP safe. */
-
 #include <errno.h>
+#include <sys/sysctl.h>
 #include <buf.h>
 #include <hal/core.h>
+#include <hal/hw_timers.h>
 #include <kerror.h>
+#include <kmalloc.h>
 #include <ksched.h>
 #include <idle.h>
+#include <thread.h>
+#include <timers.h>
 
 SET_DECLARE(_idle_tasks, struct _idle_task_desc);
 
-struct thread_info * idle_info;
+/**
+ * Idle scheduler.
+ * There is a separate idle scheduler and idle thread for each CPU.
+ */
+struct sched_idle {
+    struct scheduler sched;
+    struct thread_info * idle_info;
+};
+
+#ifdef configSCHED_TICKLESS
+#define TICK_USEC (1000000 / configSCHED_HZ)
+
+/**
+ * Maximum length of a tickless idle period in usec.
+ */
+#define TICKLESS_MAX_USEC 1000000
+
+static unsigned nr_tickless;
+SYSCTL_UINT(_kern_sched, OID_AUTO, nr_tickless, CTLFLAG_RD,
+            &nr_tickless, 0, "Number of tickless idle periods.");
+
+static unsigned nr_ticks_skipped;
+SYSCTL_UINT(_kern_sched, OID_AUTO, nr_ticks_skipped, CTLFLAG_RD,
+            &nr_ticks_skipped, 0, "Number of ticks skipped while idle.");
+
+/**
+ * Sleep with the scheduler tick stopped until the next timer expiry or
+ * until any other interrupt occurs.
+ */
+static void tickless_sleep(void)
+{
+    uint64_t start, deadline;
+    unsigned nticks;
+    istate_t s;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+
+    start = get_utime();
+    deadline = timers_next_expiry();
+    if (deadline > start + TICKLESS_MAX_USEC)
+        deadline = start + TICKLESS_MAX_USEC;
+
+    /* It's not worth to stop the tick for a short sleep. */
+    if (deadline < start + 2 * TICK_USEC ||
+        hw_timers_tickless_enter(deadline)) {
+        set_interrupt_state(s);
+        idle_sleep();
+        return;
+    }
+
+    /* WFI wakes up on a pending interrupt even if interrupts are masked. */
+    idle_sleep();
+    hw_timers_tickless_exit();
+
+    /*
+     * Run the timer tasks for the skipped ticks to keep the load averages
+     * and other periodic statistics correct.
+     */
+    nticks = (get_utime() - start) / TICK_USEC;
+    for (unsigned i = 0; i < nticks; i++) {
+        hw_timers_run();
+    }
+    nr_tickless++;
+    nr_ticks_skipped += nticks;
+
+    set_interrupt_state(s);
+}
+#endif
 
 void * idle_thread(void * arg)
 {
@@ -57,24 +128,40 @@ void * idle_thread(void * arg)
             desc->fn(desc->arg);
         }
 
+#ifdef configSCHED_TICKLESS
+        tickless_sleep();
+#else
         idle_sleep();
+#endif
+#ifdef configMP
+        /*
+         * We might have been woken up by a reschedule IPI, otherwise try to
+         * steal some work from other CPUs.
+         */
+        if (sched_readyq_pending() || sched_idle_steal())
+            thread_yield(THREAD_YIELD_IMMEDIATE);
+#endif
     }
 }
 
 static int idle_insert(struct scheduler * sobj, struct thread_info * thread)
 {
-    if (idle_info)
+    struct sched_idle * idle = containerof(sobj, struct sched_idle, sched);
+
+    if (idle->idle_info)
         return -ENOTSUP;
 
     thread_flags_set(thread, SCHED_INTERNAL_FLAG);
-    idle_info = thread;
+    idle->idle_info = thread;
 
     return 0;
 }
 
 static struct thread_info * idle_schedule(struct scheduler * sobj)
 {
-    return idle_info;
+    struct sched_idle * idle = containerof(sobj, struct sched_idle, sched);
+
+    return idle->idle_info;
 }
 
 static unsigned get_nr_active(struct scheduler * sobj)
@@ -82,19 +169,37 @@ static unsigned get_nr_active(struct scheduler * sobj)
     return 0;
 }
 
-static struct scheduler sched_idle = {
-    .name = "sched_idle",
-    .insert = idle_insert,
-    .run = idle_schedule,
-    .get_nr_active_threads = get_nr_active,
+/**
+ * Initializer struct for an idle scheduler.
+ */
+static const struct sched_idle sched_idle_init = {
+    .sched.name = "sched_idle",
+    .sched.insert = idle_insert,
+    .sched.run = idle_schedule,
+    .sched.get_nr_active_threads = get_nr_active,
 };
 
 struct scheduler * sched_create_idle(void)
+{
+    struct sched_idle * sched;
+
+    sched = kmalloc(sizeof(struct sched_idle));
+    if (!sched)
+        return NULL;
+
+    *sched = sched_idle_init; /* init */
+
+    return &sched->sched;
+}
+
+pthread_t sched_idle_thread_create(void)
 {
     struct _sched_pthread_create_args tdef_idle;
     struct buf * bp;
 
     bp = geteblk(MMU_PGSIZE_COARSE);
+    if (!bp)
+        return -ENOMEM;
 
     tdef_idle = (struct _sched_pthread_create_args){
         .param.sched_policy   = SCHED_OTHER + 1,
@@ -107,7 +212,5 @@ struct scheduler * sched_create_idle(void)
         .del_thread = NULL,
     };
 
-    thread_create(&tdef_idle, THREAD_MODE_PRIV);
-
-    return &sched_idle;
+    return thread_create(&tdef_idle, THREAD_MODE_PRIV);
 }
@@ -51,6 +51,7 @@
 #include <libkern.h>
 #include <proc.h>
 #include <queue_r.h>
+#include <rcu.h>
 #include <timers.h>
 
 /* sysctl node for scheduler. */
@@ -61,14 +62,20 @@ SYSCTL_NODE(_kern, OID_AUTO, sched, CTLFLAG_RW, 0, "Scheduler");
  */
 extern struct scheduler * sched_create_fifo(void);
 extern struct scheduler * sched_create_rr(void);
+extern struct scheduler * sched_create_prr(void);
 extern struct scheduler * sched_create_idle(void);
+extern pthread_t sched_idle_thread_create(void);
 
 /**
  * An array of scheduler constructors in order of desired execution order.
  */
 static sched_constructor * const sched_ctor_arr[] = {
     &sched_create_fifo,
+#if defined(configSCHED_OTHER_PRR)
+    &sched_create_prr,
+#else
     &sched_create_rr,
+#endif
     &sched_create_idle,
 };
 #define NR_SCHEDULERS num_elem(sched_ctor_arr)
@@ -126,23 +133,61 @@ struct cpu_sched {
      */
     unsigned sched_time_avg;
 
+#ifdef configMP
+    /**
+     * The thread currently executing on this CPU.
+     */
+    struct thread_info * curr_thread;
+    int online;             /*!< Set when the CPU is executing threads. */
+    int balance_count;      /*!< Ticks until the next load balancing. */
+
+    /**
+     * Lock for sched_arr and curr_thread.
+     * Held by the CPU itself while scheduling and by other CPUs while
+     * stealing threads from this CPU.
+     */
+    mtx_t sched_lock;
+#endif
+    unsigned nr_threads;    /*!< Number of threads in threadmap. */
+    unsigned index;         /*!< CPU index. */
+
     mtx_t lock;
 };
 
 static struct cpu_sched cpu[KSCHED_CPU_COUNT];
 #define CURRENT_CPU (&cpu[get_cpu_index()])
 
+#ifdef configMP
+#define CPU_CURRENT_THREAD(_cs_) ((_cs_)->curr_thread)
+#define CPU_SCHED_LOCK(_cs_) mtx_lock(&(_cs_)->sched_lock)
+#define CPU_SCHED_UNLOCK(_cs_) mtx_unlock(&(_cs_)->sched_lock)
+#else
+#define CPU_CURRENT_THREAD(_cs_) current_thread
+#define CPU_SCHED_LOCK(_cs_)
+#define CPU_SCHED_UNLOCK(_cs_)
+#endif
+
+#if KSCHED_CPU_COUNT > 4
+#error KSCHED_CPU_COUNT > 4 is not supported
+#endif
+#define _FOREACH_CPU_1(apply) apply((&cpu[0]), cpu0)
+#define _FOREACH_CPU_2(apply) _FOREACH_CPU_1(apply) apply((&cpu[1]), cpu1)
+#define _FOREACH_CPU_3(apply) _FOREACH_CPU_2(apply) apply((&cpu[2]), cpu2)
+#define _FOREACH_CPU_4(apply) _FOREACH_CPU_3(apply) apply((&cpu[3]), cpu3)
+#define _FOREACH_CPU(n, apply) _FOREACH_CPU_##n(apply)
+#define __FOREACH_CPU(n, apply) _FOREACH_CPU(n, apply)
+
 /*
- * TODO Support MP.
+ * Apply a macro for each CPU.
  */
-#define FOREACH_CPU(apply) \
-    apply((&cpu[0]), cpu0)
+#define FOREACH_CPU(apply) __FOREACH_CPU(KSCHED_CPU_COUNT, apply)
 
 #define TKSTACK_SIZE ((configTKSTACK_END - configTKSTACK_START) + 1)
 
 /*
- * Linker sets for pre- and post-scheduling tasks.
+ * Linker sets for tick, pre- and post-scheduling tasks.
  */
+SET_DECLARE(sched_tick_tasks, sched_task_t);
 SET_DECLARE(pre_sched_tasks, sched_task_t);
 SET_DECLARE(post_sched_tasks, sched_task_t);
 
@@ -194,10 +239,12 @@ SYSCTL_UINT(_kern_sched, OID_AUTO, nr_threads, CTLFLAG_RD,
 #define SCALE_LOAD(x) (((x + (FIXED_1 / 200)) * 100) >> FSHIFT)
 
 
+#ifndef configMP
 /**
  * Pointer to the currently active thread.
  */
 struct thread_info * current_thread;
+#endif
 
 static rwlock_t loadavg_lock;
 static uint32_t loadavg[3] = { 0, 0, 0 }; /*!< CPU load averages. */
@@ -216,7 +263,11 @@ int __kinit__ sched_init(void)
      * Init cpu schedulers.
      */
     for (size_t i = 0; i < num_elem(cpu); i++) {
+        cpu[i].index = i;
         mtx_init(&cpu[i].lock, MTX_TYPE_SPIN, MTX_OPT_DINT);
+#ifdef configMP
+        mtx_init(&cpu[i].sched_lock, MTX_TYPE_SPIN, MTX_OPT_DINT);
+#endif
         RB_INIT(&cpu[i].threadmap_head);
         STAILQ_INIT(&cpu[i].readyq);
 
@@ -236,6 +287,16 @@ int __kinit__ sched_init(void)
         }
     }
 
+    /*
+     * The idle thread of the boot CPU will be the thread 0 and the rest of the
+     * CPUs create their own idle threads on startup.
+     */
+    if (sched_idle_thread_create() < 0)
+        return -ENOMEM;
+#ifdef configMP
+    CURRENT_CPU->online = 1;
+#endif
+
     return 0;
 }
 
@@ -246,7 +307,335 @@ int thread_id_compare(struct thread_info * a, struct thread_info * b)
 
 int get_cpu_index(void)
 {
-    return 0; /* TODO Return CPU index. */
+#ifdef configMP
+    const int index = cpu_get_index();
+
+    KASSERT(index < KSCHED_CPU_COUNT, "CPU index out of bounds");
+
+    return index;
+#else
+    return 0;
+#endif
+}
+
+#ifdef configMP
+struct thread_info * sched_get_current_thread(void)
+{
+    struct thread_info * thread;
+    istate_t s;
+
+    /* We must not migrate between reading the CPU index and the pointer. */
+    s = get_interrupt_state();
+    disable_interrupt();
+    thread = CURRENT_CPU->curr_thread;
+    set_interrupt_state(s);
+
+    return thread;
+}
+
+int sched_readyq_pending(void)
+{
+    return !STAILQ_EMPTY(&CURRENT_CPU->readyq);
+}
+
+static atomic_t nr_cpus_online = ATOMIC_INIT(1);
+SYSCTL_INT(_kern_sched, OID_AUTO, nr_cpus, CTLFLAG_RD,
+           &nr_cpus_online, 0, "Number of CPUs online.");
+
+void sched_cpu_start(void)
+{
+    struct cpu_sched * const cs = CURRENT_CPU;
+    pthread_t tid;
+
+    tid = sched_idle_thread_create();
+    if (tid < 0)
+        panic("Failed to create an idle thread");
+
+    /*
+     * The startup context will be stored to the stack frame of the idle
+     * thread on the first interrupt, similar to the boot CPU.
+     */
+    cs->curr_thread = thread_lookup(tid);
+    cs->online = 1;
+    atomic_inc(&nr_cpus_online);
+
+    enable_interrupt();
+    while (1) {
+        idle_sleep();
+    }
+}
+
+#ifdef configMP_START_CPUS
+/**
+ * Start secondary CPUs.
+ */
+static int sched_mp_start(void)
+{
+    for (size_t i = 1; i < num_elem(cpu); i++) {
+        int err;
+
+        err = hal_mp_start_cpu(i);
+        if (err) {
+            KERROR(KERROR_INFO, "Failed to start CPU%u (%d)\n",
+                   (unsigned)i, err);
+            break;
+        }
+    }
+
+    return 0;
+}
+HW_POSTINIT_ENTRY(sched_mp_start);
+#endif
+
+/*
+ * Thread migration counters.
+ */
+static atomic_t nr_migrations = ATOMIC_INIT(0);
+SYSCTL_INT(_kern_sched, OID_AUTO, nr_migrations, CTLFLAG_RD,
+           &nr_migrations, 0, "Number of thread migrations between CPUs.");
+
+static atomic_t nr_idle_steals = ATOMIC_INIT(0);
+SYSCTL_INT(_kern_sched, OID_AUTO, nr_idle_steals, CTLFLAG_RD,
+           &nr_idle_steals, 0, "Number of threads stolen by idle CPUs.");
+
+static atomic_t nr_balance_steals = ATOMIC_INIT(0);
+SYSCTL_INT(_kern_sched, OID_AUTO, nr_balance_steals, CTLFLAG_RD,
+           &nr_balance_steals, 0,
+           "Number of threads stolen by the periodic load balancer.");
+
+/**
+ * Minimum difference in the number of active threads between two CPUs
+ * required to steal a thread.
+ */
+#define SCHED_STEAL_IMBALANCE 2
+
+/**
+ * Test if a thread is allowed to execute on a CPU.
+ */
+static inline int sched_cpu_allowed(struct thread_info * thread,
+                                    unsigned cpu_index)
+{
+    return !thread->cpu_affinity || (thread->cpu_affinity & (1u << cpu_index));
+}
+
+/**
+ * Get the number of active threads on a CPU.
+ * The value is only approximate if called for a remote CPU.
+ */
+static unsigned cpu_load(struct cpu_sched * cs)
+{
+    unsigned load = 0;
+
+    for (size_t i = 0; i < NR_SCHEDULERS; i++) {
+        struct scheduler * sched = cs->sched_arr[i];
+
+        load += sched->get_nr_active_threads(sched);
+    }
+
+    return load;
+}
+
+/**
+ * Get the online CPU with the least threads that is allowed to execute
+ * a thread. The current CPU is preferred if there are several candidates.
+ * @return  Returns a pointer to the CPU; Or NULL if no allowed CPU is online.
+ */
+static struct cpu_sched * sched_least_loaded_cpu(struct thread_info * thread)
+{
+    struct cpu_sched * best = CURRENT_CPU;
+
+    if (!sched_cpu_allowed(thread, best->index))
+        best = NULL;
+
+    for (size_t i = 0; i < num_elem(cpu); i++) {
+        if (!cpu[i].online || !sched_cpu_allowed(thread, i))
+            continue;
+
+        if (!best || cpu[i].nr_threads < best->nr_threads)
+            best = &cpu[i];
+    }
+
+    return best;
+}
+
+int sched_migrate_claim(struct thread_info * thread, unsigned cpu_index)
+{
+    const uint32_t flags = thread_flags_get(thread);
+
+    /* Kernel threads always stay on the CPU they were created on. */
+    if ((flags & (SCHED_IN_USE_FLAG | SCHED_KWORKER_FLAG |
+                  SCHED_INTERNAL_FLAG)) != SCHED_IN_USE_FLAG ||
+        !sched_cpu_allowed(thread, cpu_index) ||
+        thread == cpu[thread->sched.cpu].curr_thread)
+        return 0;
+
+    return thread_state_test_and_set(thread, THREAD_STATE_EXEC,
+                                     THREAD_STATE_READY);
+}
+
+/**
+ * Move a claimed thread from src to the readyq of dst.
+ * The thread shall be in READY state and removed from the schedulers of src.
+ */
+static void sched_migrate(struct cpu_sched * src, struct cpu_sched * dst,
+                          struct thread_info * thread)
+{
+    struct cpu_sched * first = (src->index < dst->index) ? src : dst;
+    struct cpu_sched * second = (first == src) ? dst : src;
+    int in_use;
+
+    mtx_lock(&first->lock);
+    mtx_lock(&second->lock);
+    /* The thread might be removed after it was claimed. */
+    in_use = thread_flags_is_set(thread, SCHED_IN_USE_FLAG);
+    if (in_use) {
+        RB_REMOVE(threadmap, &src->threadmap_head, thread);
+        src->nr_threads--;
+        thread->sched.cpu = dst->index;
+        RB_INSERT(threadmap, &dst->threadmap_head, thread);
+        dst->nr_threads++;
+        STAILQ_INSERT_TAIL(&dst->readyq, thread, sched.readyq_entry_);
+    }
+    mtx_unlock(&second->lock);
+    mtx_unlock(&first->lock);
+
+    if (!in_use)
+        return;
+
+    atomic_inc(&nr_migrations);
+    if (dst->index != get_cpu_index())
+        hal_mp_send_ipi(dst->index);
+}
+
+/**
+ * Steal a thread from the busiest CPU to dst.
+ * @return  Returns 1 if a thread was stolen; Otherwise 0.
+ */
+static int sched_steal(struct cpu_sched * dst)
+{
+    struct cpu_sched * src = NULL;
+    struct thread_info * thread = NULL;
+    unsigned max_load = cpu_load(dst) + SCHED_STEAL_IMBALANCE - 1;
+
+    for (size_t i = 0; i < num_elem(cpu); i++) {
+        unsigned load;
+
+        if (&cpu[i] == dst || !cpu[i].online)
+            continue;
+
+        load = cpu_load(&cpu[i]);
+        if (load > max_load) {
+            max_load = load;
+            src = &cpu[i];
+        }
+    }
+    if (!src)
+        return 0;
+
+    /* Don't wait if the CPU is busy scheduling, we'll try again later. */
+    if (mtx_trylock(&src->sched_lock))
+        return 0;
+    for (size_t i = 0; i < NR_SCHEDULERS && !thread; i++) {
+        struct scheduler * sched = src->sched_arr[i];
+
+        if (sched->steal)
+            thread = sched->steal(sched, dst->index);
+    }
+    mtx_unlock(&src->sched_lock);
+
+    if (!thread)
+        return 0;
+
+    sched_migrate(src, dst, thread);
+    return 1;
+}
+
+int sched_idle_steal(void)
+{
+    if (!sched_steal(CURRENT_CPU))
+        return 0;
+
+    atomic_inc(&nr_idle_steals);
+    return 1;
+}
+
+/**
+ * Periodic load balancing.
+ * Called on every tick before taking the sched_lock of the CPU.
+ */
+static void sched_balance(struct cpu_sched * cs)
+{
+    if (--cs->balance_count > 0)
+        return;
+    cs->balance_count = configSCHED_BALANCE_PERIOD;
+
+    if (sched_steal(cs))
+        atomic_inc(&nr_balance_steals);
+}
+
+/**
+ * Push a thread selected for execution to another CPU if its CPU affinity
+ * doesn't allow execution on the current CPU.
+ * @return  Returns 1 if the thread was pushed to another CPU; Otherwise 0.
+ */
+static int sched_push_misplaced(struct cpu_sched * cs,
+                                struct scheduler * sched,
+                                struct thread_info * thread)
+{
+    struct cpu_sched * dst;
+
+    if (sched_cpu_allowed(thread, cs->index) || !sched->remove)
+        return 0;
+
+    dst = sched_least_loaded_cpu(thread);
+    if (!dst ||
+        !thread_state_test_and_set(thread, THREAD_STATE_EXEC,
+                                   THREAD_STATE_READY))
+        return 0;
+
+    sched->remove(sched, thread);
+    sched_migrate(cs, dst, thread);
+
+    return 1;
+}
+#endif
+
+/**
+ * Select a CPU for a new thread.
+ */
+static struct cpu_sched * sched_select_cpu(struct thread_info * thread,
+                                           enum thread_mode thread_mode)
+{
+    struct cpu_sched * cs = CURRENT_CPU;
+
+#ifdef configMP
+    /*
+     * Kernel threads stay on the CPU creating them, user threads are placed
+     * on the least loaded CPU allowed by the CPU affinity of the thread.
+     */
+    if (thread_mode == THREAD_MODE_USER) {
+        struct cpu_sched * least = sched_least_loaded_cpu(thread);
+
+        if (least)
+            cs = least;
+    }
+#endif
+
+    return cs;
+}
+
+/**
+ * Insert a thread to the threadmap of a CPU.
+ */
+static void sched_insert_threadmap(struct cpu_sched * cs,
+                                   struct thread_info * thread)
+{
+    thread->sched.cpu = cs->index;
+
+    mtx_lock(&cs->lock);
+    RB_INSERT(threadmap, &cs->threadmap_head, thread);
+    cs->nr_threads++;
+    mtx_unlock(&cs->lock);
 }
 
 static void update_nr_threads(uintptr_t arg)
@@ -273,12 +662,14 @@ static void sched_calc_loads(void)
     if (rwlock_trywrlock(&loadavg_lock) == 0) {
         count = LOAD_FREQ;
 
-        for (size_t i = 0; i < NR_SCHEDULERS; i++) {
-            struct scheduler * sched = CURRENT_CPU->sched_arr[i];
-            unsigned nr;
+        for (size_t i = 0; i < num_elem(cpu); i++) {
+            for (size_t j = 0; j < NR_SCHEDULERS; j++) {
+                struct scheduler * sched = cpu[i].sched_arr[j];
+                unsigned nr;
 
-            nr = sched->get_nr_active_threads(sched);
-            active_threads += (uint32_t)nr * FIXED_1;
+                nr = sched->get_nr_active_threads(sched);
+                active_threads += (uint32_t)nr * FIXED_1;
+            }
         }
 
         /* Load averages. */
@@ -350,17 +741,47 @@ FOREACH_CPU(CPU_SCHED_TIME_AVG)
 
 #endif
 
+void sched_tick(void)
+{
+    struct thread_info * const thread = current_thread;
+
+    if (likely(thread)) {
+        sched_task_t ** task_p;
+
+        /*
+         * Run tick tasks.
+         */
+        SET_FOREACH(task_p, sched_tick_tasks) {
+            sched_task_t * task = *(sched_task_t **)task_p;
+            task();
+        }
+
+        CPU_SCHED_LOCK(CURRENT_CPU);
+        if (thread->sched.ts_counter != -1) {
+            thread->sched.ts_counter--;
+        }
+        CPU_SCHED_UNLOCK(CURRENT_CPU);
+    }
+
+#ifdef configMP
+    sched_balance(CURRENT_CPU);
+#endif
+
+    sched_handler();
+}
+
 void sched_handler(void)
 {
-    struct thread_info * const prev_thread = current_thread;
+    struct cpu_sched * const cs = CURRENT_CPU;
+    struct thread_info * const prev_thread = CPU_CURRENT_THREAD(cs);
     sched_task_t ** task_p;
     uint64_t sched_start_time;
 
     sched_start_time = get_utime();
 
-    if (unlikely(!current_thread)) {
-        current_thread = thread_lookup(0);
-        if (!current_thread)
+    if (unlikely(!CPU_CURRENT_THREAD(cs))) {
+        CPU_CURRENT_THREAD(cs) = thread_lookup(0);
+        if (!CPU_CURRENT_THREAD(cs))
             panic("No thread 0\n");
     }
 
@@ -372,9 +793,7 @@ void sched_handler(void)
         task();
     }
 
-    if (current_thread->sched.ts_counter != -1) {
-        current_thread->sched.ts_counter--;
-    }
+    CPU_SCHED_LOCK(cs);
 
     /*
      * Exhaust global readyq.
@@ -385,8 +804,8 @@ void sched_handler(void)
         const size_t policy = thread->param.sched_policy;
         struct scheduler * sched;
 
-        KASSERT(policy < num_elem(CURRENT_CPU->sched_arr), "policy is valid");
-        sched = CURRENT_CPU->sched_arr[policy];
+        KASSERT(policy < num_elem(cs->sched_arr), "policy is valid");
+        sched = cs->sched_arr[policy];
         thread_state_set(thread, THREAD_STATE_EXEC);
         if (sched->insert(sched, thread)) {
             KERROR(KERROR_ERR, "Failed to schedule a thread (%d) to \"%s\"\n",
@@ -397,19 +816,28 @@ void sched_handler(void)
     /*
      * Run schedulers until next runnable thread is found.
      */
-    for (size_t i = 0; i < num_elem(CURRENT_CPU->sched_arr); i++) {
-        struct scheduler * const sched = CURRENT_CPU->sched_arr[i];
+    for (size_t i = 0; i < num_elem(cs->sched_arr); i++) {
+        struct scheduler * const sched = cs->sched_arr[i];
         struct thread_info * next_thread;
 
         next_thread = sched->run(sched);
+#ifdef configMP
+        while (next_thread && sched_push_misplaced(cs, sched, next_thread)) {
+            next_thread = sched->run(sched);
+        }
+#endif
         if (next_thread) {
-            current_thread = next_thread;
+            CPU_CURRENT_THREAD(cs) = next_thread;
             break;
         }
     }
+    CPU_SCHED_UNLOCK(cs);
+
+    rcu_sched_qs(prev_thread, CPU_CURRENT_THREAD(cs) != prev_thread);
+
     /* Check if we need to remap the kstack. */
-    if (current_thread != prev_thread) {
-        mmu_map_region(&current_thread->kstack_region->b_mmu);
+    if (CPU_CURRENT_THREAD(cs) != prev_thread) {
+        mmu_map_region(&CPU_CURRENT_THREAD(cs)->kstack_region->b_mmu);
     }
 
     /*
@@ -421,7 +849,7 @@ void sched_handler(void)
     }
 
 #ifdef configSCHED_TIME_AVG
-    calc_sched_time_avg(CURRENT_CPU, sched_start_time, get_utime());
+    calc_sched_time_avg(cs, sched_start_time, get_utime());
 #endif
 }
 
@@ -541,12 +969,16 @@ static void thread_init_tls(struct thread_info * new_thread,
 SCHED_THREAD_CTOR(thread_init_tls);
 SCHED_THREAD_FORK_HANDLER(thread_init_tls);
 
-pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
-                        enum thread_mode thread_mode)
+/**
+ * Create a new thread in init state.
+ * @param parent is the parent thread; Can be NULL.
+ * @param pid_owner is the owner process of the new thread.
+ */
+static pthread_t thread_new(struct _sched_pthread_create_args * thread_def,
+                            enum thread_mode thread_mode,
+                            struct thread_info * parent, pid_t pid_owner)
 {
     pthread_t thread_id;
-    struct thread_info * parent = (thread_mode == THREAD_MODE_PRIV) ? NULL : current_thread;
-    pid_t pid_owner = (parent) ? parent->pid_owner : 0;
     struct proc_info * proc_owner;
     struct thread_info * tp;
     thread_cdtor_t ** thread_ctor_p;
@@ -578,6 +1010,7 @@ pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
     tp->flags   = SCHED_IN_USE_FLAG;
     if (parent && (thread_def->flags & PTHREAD_INHERIT_SCHED)) {
         tp->param = parent->param;
+        tp->cpu_affinity = parent->cpu_affinity;
     } else {
         tp->param = thread_def->param;
     }
@@ -610,7 +1043,8 @@ pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
     }
 
     /* Select the master page table to be used on startup. */
-    if (unlikely(!parent) || thread_mode == THREAD_MODE_PRIV) {
+    if ((unlikely(!parent) && pid_owner == 0) ||
+        thread_mode == THREAD_MODE_PRIV) {
         /*
          * This branch is only taken during init or when a kernel mode thread
          * is created.
@@ -632,19 +1066,38 @@ pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
         ctor(tp);
     }
 
-    mtx_lock(&CURRENT_CPU->lock);
-    RB_INSERT(threadmap, &CURRENT_CPU->threadmap_head, tp);
-    mtx_unlock(&CURRENT_CPU->lock);
+    sched_insert_threadmap(sched_select_cpu(tp, thread_mode), tp);
+
+    atomic_inc(&anr_threads);
+    return thread_id;
+}
+
+pthread_t thread_create(struct _sched_pthread_create_args * thread_def,
+                        enum thread_mode thread_mode)
+{
+    struct thread_info * parent = (thread_mode == THREAD_MODE_PRIV) ? NULL : current_thread;
+    pid_t pid_owner = (parent) ? parent->pid_owner : 0;
+    pthread_t thread_id;
+
+    thread_id = thread_new(thread_def, thread_mode, parent, pid_owner);
+    if (thread_id < 0)
+        return thread_id;
 
     /* Put thread into readyq */
-    if (thread_ready(tp->id)) {
+    if (thread_ready(thread_id)) {
         panic("Failed to make new_thread ready");
     }
 
-    atomic_inc(&anr_threads);
     return thread_id;
 }
 
+pthread_t thread_create_proc(struct _sched_pthread_create_args * thread_def,
+                             pid_t pid_owner)
+{
+    /* The newly created thread shall remain in init state for now. */
+    return thread_new(thread_def, THREAD_MODE_USER, NULL, pid_owner);
+}
+
 struct thread_info * thread_fork(pid_t new_pid)
 {
     struct thread_info * const old_thread = current_thread;
@@ -667,6 +1120,12 @@ struct thread_info * thread_fork(pid_t new_pid)
     new_thread->id       = new_id;
     new_thread->flags   &= ~SCHED_INSYS_FLAG;
     new_thread->flags   |= SCHED_DETACH_FLAG; /* New main must be detached. */
+    if (new_thread->pi.boosted) {
+        /* The child doesn't own the mutexes of the parent. */
+        new_thread->param.sched_priority = new_thread->pi.saved_prio;
+        new_thread->pi.boosted = 0;
+    }
+    LIST_INIT(&new_thread->pi.contested);
 
     /* New thread kstack */
     if (!(new_thread->kstack_region = thread_alloc_kstack())) {
@@ -677,9 +1136,8 @@ struct thread_info * thread_fork(pid_t new_pid)
     init_sched_data(&new_thread->sched);
     thread_set_inheritance(new_thread, NULL, new_pid);
 
-    mtx_lock(&CURRENT_CPU->lock);
-    RB_INSERT(threadmap, &CURRENT_CPU->threadmap_head, new_thread);
-    mtx_unlock(&CURRENT_CPU->lock);
+    sched_insert_threadmap(sched_select_cpu(new_thread, THREAD_MODE_USER),
+                           new_thread);
 
     /*
      * Run other fork handlers registered.
@@ -697,23 +1155,60 @@ struct thread_info * thread_fork(pid_t new_pid)
 
 /* Thread state ***************************************************************/
 
-struct thread_info * thread_lookup(pthread_t thread_id)
+/**
+ * Lock the CPU owning a thread.
+ * The owner might change while we are waiting for the lock.
+ * @return  Returns a pointer to the locked CPU.
+ */
+static struct cpu_sched * cpu_lock_owner(struct thread_info * thread)
+{
+    struct cpu_sched * cs;
+
+    while (1) {
+        cs = &cpu[thread->sched.cpu];
+        mtx_lock(&cs->lock);
+        if (cs->index == thread->sched.cpu)
+            return cs;
+        mtx_unlock(&cs->lock);
+    }
+}
+
+static struct thread_info * cpu_thread_lookup(struct cpu_sched * cs,
+                                              pthread_t thread_id)
 {
     struct thread_info * thread = NULL;
     struct thread_info find = { .id = thread_id };
 
-    mtx_lock(&CURRENT_CPU->lock);
-    if (!RB_EMPTY(&CURRENT_CPU->threadmap_head)) {
-        thread = RB_FIND(threadmap, &CURRENT_CPU->threadmap_head, &find);
+    mtx_lock(&cs->lock);
+    if (!RB_EMPTY(&cs->threadmap_head)) {
+        thread = RB_FIND(threadmap, &cs->threadmap_head, &find);
     }
-    mtx_unlock(&CURRENT_CPU->lock);
+    mtx_unlock(&cs->lock);
 
     return thread;
 }
 
+struct thread_info * thread_lookup(pthread_t thread_id)
+{
+#ifdef configMP
+    for (size_t i = 0; i < num_elem(cpu); i++) {
+        struct thread_info * thread;
+
+        thread = cpu_thread_lookup(&cpu[i], thread_id);
+        if (thread)
+            return thread;
+    }
+
+    return NULL;
+#else
+    return cpu_thread_lookup(CURRENT_CPU, thread_id);
+#endif
+}
+
 int thread_ready(pthread_t thread_id)
 {
     struct thread_info * thread = thread_lookup(thread_id);
+    struct cpu_sched * cs;
     enum thread_state prev_state;
 
     if (!thread || thread_state_get(thread) == THREAD_STATE_DEAD)
@@ -724,9 +1219,15 @@ int thread_ready(pthread_t thread_id)
         return 0;
     }
 
-    mtx_lock(&CURRENT_CPU->lock);
-    STAILQ_INSERT_TAIL(&CURRENT_CPU->readyq, thread, sched.readyq_entry_);
-    mtx_unlock(&CURRENT_CPU->lock);
+    cs = &cpu[thread->sched.cpu];
+    mtx_lock(&cs->lock);
+    STAILQ_INSERT_TAIL(&cs->readyq, thread, sched.readyq_entry_);
+    mtx_unlock(&cs->lock);
+
+#ifdef configMP
+    if (cs->index != get_cpu_index())
+        hal_mp_send_ipi(cs->index);
+#endif
 
     return 0;
 }
@@ -751,7 +1252,11 @@ struct thread_info * thread_remove_ready(void)
 void thread_wait(void)
 {
     thread_state_set(current_thread, THREAD_STATE_BLOCKED);
+    thread_wait_blocked();
+}
 
+void thread_wait_blocked(void)
+{
     /*
      * Make sure we don't get stuck here.
      * This is mainly here to handle race conditions in exec().
@@ -778,33 +1283,107 @@ static void timer_event_sleep(void * event_arg)
     thread_release(thread->id);
 }
 
-void thread_sleep(long millisec)
+/**
+ * Sleeps and alarms shorter than this are timed with a one-shot HW timer.
+ */
+#define HRTIMER_MAX_USEC (2 * 1000000 / configSCHED_HZ)
+
+static void timer_event_alarm(void * event_arg)
 {
-    int timer_id;
+    struct thread_info * thread = (struct thread_info *)event_arg;
 
-    do {
-        timer_id = timers_add(timer_event_sleep, current_thread,
-            TIMERS_FLAG_ONESHOT, millisec * 1000);
-    } while (timer_id < 0);
+    thread_release(thread->id);
+}
+
+/**
+ * Set a one-shot HW timer to release the current thread after usec.
+ */
+static int thread_hrtimer_set(uint64_t usec)
+{
+    struct hw_timer_event * ev = &current_thread->wait_hrtim;
+
+    ev->deadline = get_utime() + usec;
+    ev->fn = timer_event_alarm;
+    ev->arg = current_thread;
 
+    return hw_timers_event_add(ev);
+}
+
+/**
+ * Block the current thread and set a one-shot HW timer to release it.
+ * The thread is blocked before the timer is armed, so the release can't be
+ * lost even if the timer fires immediately. The thread is left running if
+ * the timer couldn't be set.
+ */
+static int thread_hrtimer_block(uint64_t usec)
+{
+    istate_t s;
+    int err;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+    thread_state_set(current_thread, THREAD_STATE_BLOCKED);
+    err = thread_hrtimer_set(usec);
+    if (err)
+        thread_state_set(current_thread, THREAD_STATE_EXEC);
+    set_interrupt_state(s);
+
+    return err;
+}
+
+/**
+ * Block the current thread and start a kernel timer.
+ * Like thread_hrtimer_block() but for the kernel timers.
+ */
+static void thread_timer_block(int timer_id)
+{
+    istate_t s;
+
+    s = get_interrupt_state();
+    disable_interrupt();
     current_thread->wait_tim = timer_id;
+    thread_state_set(current_thread, THREAD_STATE_BLOCKED);
     timers_start(timer_id);
-    thread_wait();
+    set_interrupt_state(s);
 }
 
-static void timer_event_alarm(void * event_arg)
+void thread_sleep(long millisec)
 {
-    struct thread_info * thread = (struct thread_info *)event_arg;
+    thread_usleep((uint64_t)millisec * 1000);
+}
 
-    thread_release(thread->id);
+void thread_usleep(uint64_t usec)
+{
+    int timer_id;
+
+    if (usec < HRTIMER_MAX_USEC) {
+        int err = thread_hrtimer_block(usec);
+
+        if (err == -EAGAIN)
+            return; /* Already expired. */
+        if (err == 0) {
+            thread_wait_blocked();
+            hw_timers_event_cancel(&current_thread->wait_hrtim);
+            return;
+        }
+        /* Fallback to the kernel timers. */
+    }
+
+    do {
+        timer_id = timers_add(timer_event_sleep, current_thread,
+            TIMERS_FLAG_ONESHOT, usec);
+    } while (timer_id < 0);
+
+    thread_timer_block(timer_id);
+    thread_wait_blocked();
 }
 
-int thread_alarm(long millisec)
+static int thread_alarm_timer(uint64_t usec)
 {
     int timer_id;
 
     timer_id = timers_add(timer_event_alarm, current_thread,
-                          TIMERS_FLAG_ONESHOT, millisec * 1000);
+                          TIMERS_FLAG_ONESHOT, usec);
     if (timer_id < 0) {
         return -EAGAIN;
     }
@@ -815,6 +1394,43 @@ int thread_alarm(long millisec)
     return timer_id;
 }
 
+int thread_alarm(long millisec)
+{
+    return thread_alarm_timer((uint64_t)millisec * 1000);
+}
+
+int thread_ualarm(uint64_t usec)
+{
+    int timer_id;
+
+    if (usec < HRTIMER_MAX_USEC) {
+        int err = thread_hrtimer_block(usec);
+
+        if (err == -EAGAIN)
+            return -ETIMEDOUT;
+        if (err == 0)
+            return 0;
+        /* Fallback to the kernel timers. */
+    }
+
+    timer_id = timers_add(timer_event_alarm, current_thread,
+                          TIMERS_FLAG_ONESHOT, usec);
+    if (timer_id < 0)
+        return -EAGAIN;
+    thread_timer_block(timer_id);
+
+    return 0;
+}
+
+void thread_ualarm_rele(void)
+{
+    hw_timers_event_cancel(&current_thread->wait_hrtim);
+    if (current_thread->wait_tim >= 0) {
+        timers_release(current_thread->wait_tim);
+        current_thread->wait_tim = TMNOVAL;
+    }
+}
+
 void thread_alarm_rele(int timer_id)
 {
     timers_release(timer_id);
@@ -859,6 +1475,30 @@ unsigned thread_get_policy(pthread_t thread_id)
     return thread->param.sched_policy;
 }
 
+int thread_set_affinity(pthread_t thread_id, unsigned cpu_affinity)
+{
+    struct thread_info * thread = thread_lookup(thread_id);
+    const unsigned all_cpus = (1u << KSCHED_CPU_COUNT) - 1;
+
+    if (!thread || thread_flags_not_set(thread, SCHED_IN_USE_FLAG))
+        return -ESRCH;
+
+    if (thread_flags_is_set(thread, SCHED_INTERNAL_FLAG))
+        return -EPERM;
+
+    cpu_affinity &= all_cpus;
+    if (cpu_affinity == 0)
+        return -EINVAL;
+
+    /*
+     * The new mask is enforced next time the thread is selected for
+     * execution.
+     */
+    thread->cpu_affinity = (cpu_affinity == all_cpus) ? 0 : cpu_affinity;
+
+    return 0;
+}
+
 int thread_set_priority(pthread_t thread_id, int priority)
 {
     struct thread_info * thread = thread_lookup(thread_id);
@@ -870,11 +1510,43 @@ int thread_set_priority(pthread_t thread_id, int priority)
         return -EACCES;
     }
 
-    thread->param.sched_priority = priority;
+    thread_p_set_priority(thread, priority);
 
     return 0;
 }
 
+void thread_p_set_priority(struct thread_info * thread, int priority)
+{
+    const size_t policy = thread->param.sched_policy;
+    struct cpu_sched * cs;
+    istate_t s;
+
+    s = get_interrupt_state();
+    disable_interrupt();
+#ifdef configMP
+    /* The owner might change while we are waiting for the lock. */
+    while (1) {
+        cs = &cpu[thread->sched.cpu];
+        CPU_SCHED_LOCK(cs);
+        if (cs->index == thread->sched.cpu)
+            break;
+        CPU_SCHED_UNLOCK(cs);
+    }
+#else
+    cs = CURRENT_CPU;
+#endif
+
+    thread->param.sched_priority = priority;
+    if (policy < num_elem(cs->sched_arr) && cs->sched_arr[policy]->reprio) {
+        struct scheduler * sched = cs->sched_arr[policy];
+
+        sched->reprio(sched, thread);
+    }
+
+    CPU_SCHED_UNLOCK(cs);
+    set_interrupt_state(s);
+}
+
 int thread_get_priority(pthread_t thread_id)
 {
     struct thread_info * thread = thread_lookup(thread_id);
@@ -1022,6 +1694,7 @@ int thread_terminate(pthread_t thread_id)
 void thread_remove(pthread_t thread_id)
 {
     struct thread_info * thread = thread_lookup(thread_id);
+    struct cpu_sched * cs;
     thread_cdtor_t ** thread_dtor_p;
 
     if (thread_flags_not_set(thread, SCHED_IN_USE_FLAG))
@@ -1036,10 +1709,12 @@ void thread_remove(pthread_t thread_id)
     thread->flags = 0; /* Clear all flags */
     thread->param.sched_priority = NICE_ERR;
 
-    /* Release wait timeout timer */
+    /* Release wait timeout timers */
     if (thread->wait_tim >= 0) {
         timers_release(thread->wait_tim);
     }
+    hw_timers_event_cancel(&thread->wait_hrtim);
+    rcu_thread_removed(thread);
 
     /* Notify the owner process about removal of a thread. */
     if (thread->pid_owner != 0) {
@@ -1055,9 +1730,10 @@ void thread_remove(pthread_t thread_id)
         dtor(thread);
     }
 
-    mtx_lock(&CURRENT_CPU->lock);
-    RB_REMOVE(threadmap, &CURRENT_CPU->threadmap_head, thread);
-    mtx_unlock(&CURRENT_CPU->lock);
+    cs = cpu_lock_owner(thread);
+    RB_REMOVE(threadmap, &cs->threadmap_head, thread);
+    cs->nr_threads--;
+    mtx_unlock(&cs->lock);
 
     if (!queue_push(&CURRENT_CPU->thread_free_queue, &thread)) {
         KERROR(KERROR_ERR,
@@ -1316,7 +1992,9 @@ static intptr_t sys_thread_setpolicy(__user void * user_args)
 
     if (((curproc->pid != thread->pid_owner || args.policy != SCHED_OTHER) &&
          (err = priv_check(&curproc->cred, PRIV_SCHED_SETPOLICY))) ||
-        (err = thread_set_policy(args.id, args.policy))) {
+        (err = thread_set_policy(args.id, args.policy)) ||
+        (args.cpu_affinity &&
+         (err = thread_set_affinity(args.id, args.cpu_affinity)))) {
         set_errno(-err);
         return -1;
     }
@@ -135,6 +135,27 @@ static struct thread_info * fifo_schedule(struct scheduler * sobj)
     return NULL;
 }
 
+#ifdef configMP
+/**
+ * Steal the lowest priority thread that can be migrated.
+ */
+static struct thread_info * fifo_steal(struct scheduler * sobj,
+                                       unsigned cpu_index)
+{
+    struct sched_fifo * fifo = containerof(sobj, struct sched_fifo, sched);
+    struct thread_info * thread;
+
+    RB_FOREACH_REVERSE(thread, fiforunq, &fifo->runq_head) {
+        if (sched_migrate_claim(thread, cpu_index)) {
+            fifo_remove(sobj, thread);
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
 static unsigned get_nr_active(struct scheduler * sobj)
 {
     struct sched_fifo * fifo = containerof(sobj, struct sched_fifo, sched);
@@ -150,6 +171,10 @@ static const struct sched_fifo sched_fifo_init = {
     .sched.insert = fifo_insert,
     .sched.run = fifo_schedule,
     .sched.get_nr_active_threads = get_nr_active,
+    .sched.remove = fifo_remove,
+#ifdef configMP
+    .sched.steal = fifo_steal,
+#endif
 };
 
 struct scheduler * sched_create_fifo(void)
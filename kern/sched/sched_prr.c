@@ -0,0 +1,321 @@
+/**
+ *******************************************************************************
+ * @file    sched_prr.c
+ * @author  Olli Vanhoja
+ * @brief   Priority RR scheduler with O(1) thread selection.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/*
+ * The priority RR scheduler keeps a separate run queue for each nice level
+ * and a bitmap of non-empty levels. The next thread is always taken from the
+ * head of the highest priority non-empty queue, so selecting a thread doesn't
+ * depend on the number of threads in the scheduler.
+ *
+ * Threads that are no longer runnable are removed lazily when they reach the
+ * head of their queue, similar to sched_rr. Threads that yield are moved to a
+ * separate queue and put back to their run queues on the next call, so that
+ * yielding skips exactly one scheduling turn.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kerror.h>
+#include <kmalloc.h>
+#include <ksched.h>
+#include <libkern.h>
+#include <thread.h>
+
+#define SCHED_POLFLAG_INPRRRQ   0x01 /*!< Thread in a run queue. */
+#define SCHED_POLFLAG_INPRRYQ   0x02 /*!< Thread in the yield queue. */
+
+#define PRRRUNQ_ENTRY   sched.prr.runq_entry_
+
+#define PRR_NR_LEVELS   (NICE_MAX - NICE_MIN + 1)
+#define PRR_BMAP_BITS   (sizeof(uint32_t) * 8)
+#define PRR_BMAP_SIZE   ((PRR_NR_LEVELS + PRR_BMAP_BITS - 1) / PRR_BMAP_BITS)
+
+TAILQ_HEAD(prr_runq, thread_info);
+
+struct sched_prr {
+    struct scheduler sched;
+    unsigned nr_active;
+    uint32_t bmap[PRR_BMAP_SIZE]; /*!< Non-empty run queue levels. */
+    struct prr_runq yieldq;
+    struct prr_runq runq[PRR_NR_LEVELS];
+};
+
+static inline int get_tts(struct thread_info * thread)
+{
+    return 21 + thread_p_get_scheduling_priority(thread);
+}
+
+/**
+ * Get the run queue level of a thread.
+ * Level 0 is the highest priority level.
+ */
+static int get_level(struct thread_info * thread)
+{
+    int prio = thread_p_get_scheduling_priority(thread);
+
+    if (prio < NICE_MIN)
+        prio = NICE_MAX; /* NICE_ERR */
+    else if (prio > NICE_MAX)
+        prio = NICE_MAX;
+
+    return prio - NICE_MIN;
+}
+
+static inline void bmap_set(struct sched_prr * prr, int level)
+{
+    prr->bmap[level / PRR_BMAP_BITS] |= 1u << (level % PRR_BMAP_BITS);
+}
+
+static inline void bmap_clear(struct sched_prr * prr, int level)
+{
+    prr->bmap[level / PRR_BMAP_BITS] &= ~(1u << (level % PRR_BMAP_BITS));
+}
+
+/**
+ * Find the highest priority non-empty level.
+ * @return  Returns the level index; Or -1 if all run queues are empty.
+ */
+static int bmap_first(struct sched_prr * prr)
+{
+    for (size_t i = 0; i < PRR_BMAP_SIZE; i++) {
+        if (prr->bmap[i])
+            return i * PRR_BMAP_BITS + ffs((int)prr->bmap[i]) - 1;
+    }
+
+    return -1;
+}
+
+static void runq_insert_tail(struct sched_prr * prr,
+                             struct thread_info * thread)
+{
+    const int level = thread->sched.prr.level;
+
+    TAILQ_INSERT_TAIL(&prr->runq[level], thread, PRRRUNQ_ENTRY);
+    bmap_set(prr, level);
+}
+
+static void runq_remove(struct sched_prr * prr, struct thread_info * thread)
+{
+    const int level = thread->sched.prr.level;
+
+    TAILQ_REMOVE(&prr->runq[level], thread, PRRRUNQ_ENTRY);
+    if (TAILQ_EMPTY(&prr->runq[level]))
+        bmap_clear(prr, level);
+}
+
+static int prr_insert(struct scheduler * sobj, struct thread_info * thread)
+{
+    struct sched_prr * prr = containerof(sobj, struct sched_prr, sched);
+
+    if (!thread_test_polflag(thread, SCHED_POLFLAG_INPRRRQ)) {
+        thread->sched.prr.level = get_level(thread);
+        runq_insert_tail(prr, thread);
+        thread->sched.ts_counter = get_tts(thread);
+        thread->sched.policy_flags |= SCHED_POLFLAG_INPRRRQ;
+        prr->nr_active++;
+    }
+
+    return 0;
+}
+
+static void prr_remove(struct scheduler * sobj, struct thread_info * thread)
+{
+    struct sched_prr * prr = containerof(sobj, struct sched_prr, sched);
+
+    if (thread_test_polflag(thread, SCHED_POLFLAG_INPRRYQ)) {
+        TAILQ_REMOVE(&prr->yieldq, thread, PRRRUNQ_ENTRY);
+        thread->sched.policy_flags &= ~(SCHED_POLFLAG_INPRRYQ |
+                                        SCHED_POLFLAG_INPRRRQ);
+        prr->nr_active--;
+    } else if (thread_test_polflag(thread, SCHED_POLFLAG_INPRRRQ)) {
+        runq_remove(prr, thread);
+        thread->sched.policy_flags &= ~SCHED_POLFLAG_INPRRRQ;
+        prr->nr_active--;
+    }
+}
+
+static void prr_reprio(struct scheduler * sobj, struct thread_info * thread)
+{
+    struct sched_prr * prr = containerof(sobj, struct sched_prr, sched);
+    const int level = get_level(thread);
+
+    if (level == thread->sched.prr.level)
+        return;
+
+    if (thread_test_polflag(thread, SCHED_POLFLAG_INPRRYQ)) {
+        /* Put back to the new level by prr_unyield(). */
+        thread->sched.prr.level = level;
+    } else if (thread_test_polflag(thread, SCHED_POLFLAG_INPRRRQ)) {
+        runq_remove(prr, thread);
+        thread->sched.prr.level = level;
+        runq_insert_tail(prr, thread);
+    }
+}
+
+static void prr_thread_act(struct scheduler * sobj, struct thread_info * thread,
+                           enum thread_state state)
+{
+    switch (state) {
+    case THREAD_STATE_READY:
+        /* Thread already in readyq */
+        prr_remove(sobj, thread);
+        break;
+    case THREAD_STATE_BLOCKED:
+        prr_remove(sobj, thread);
+        break;
+    case THREAD_STATE_DEAD:
+        prr_remove(sobj, thread);
+        if (thread_flags_is_set(thread, SCHED_DETACH_FLAG))
+            thread_remove(thread->id);
+        break;
+    default:
+        KERROR(KERROR_ERR, "Thread (%d) state: %d\n", thread->id, state);
+        panic("Inconsistent thread state");
+    }
+}
+
+/**
+ * Return threads that yielded on the previous turn back to their run queues.
+ */
+static void prr_unyield(struct sched_prr * prr)
+{
+    struct thread_info * thread;
+
+    while ((thread = TAILQ_FIRST(&prr->yieldq))) {
+        TAILQ_REMOVE(&prr->yieldq, thread, PRRRUNQ_ENTRY);
+        thread->sched.policy_flags &= ~SCHED_POLFLAG_INPRRYQ;
+        runq_insert_tail(prr, thread);
+    }
+}
+
+static struct thread_info * prr_schedule(struct scheduler * sobj)
+{
+    struct sched_prr * prr = containerof(sobj, struct sched_prr, sched);
+    int level;
+
+    prr_unyield(prr);
+
+    while ((level = bmap_first(prr)) >= 0) {
+        struct thread_info * next = TAILQ_FIRST(&prr->runq[level]);
+        const enum thread_state state = thread_state_get(next);
+
+        if (thread_flags_not_set(next, SCHED_IN_USE_FLAG) ||
+            state != THREAD_STATE_EXEC) {
+            prr_thread_act(sobj, next, state);
+            continue;
+        }
+
+        if (thread_flags_is_set(next, SCHED_YIELD_FLAG)) {
+            thread_flags_clear(next, SCHED_YIELD_FLAG);
+            runq_remove(prr, next);
+            TAILQ_INSERT_TAIL(&prr->yieldq, next, PRRRUNQ_ENTRY);
+            next->sched.policy_flags |= SCHED_POLFLAG_INPRRYQ;
+            continue;
+        }
+
+        if (next->sched.ts_counter > 0)
+            return next;
+
+        /* The time slice is exhausted, move to the tail of the level. */
+        next->sched.ts_counter = get_tts(next);
+        runq_remove(prr, next);
+        runq_insert_tail(prr, next);
+        if (TAILQ_FIRST(&prr->runq[level]) == next)
+            return next;
+    }
+
+    return NULL;
+}
+
+#ifdef configMP
+/**
+ * Steal a thread from the lowest priority non-empty level.
+ */
+static struct thread_info * prr_steal(struct scheduler * sobj,
+                                      unsigned cpu_index)
+{
+    struct sched_prr * prr = containerof(sobj, struct sched_prr, sched);
+
+    for (int level = PRR_NR_LEVELS - 1; level >= 0; level--) {
+        struct thread_info * thread;
+
+        TAILQ_FOREACH_REVERSE(thread, &prr->runq[level], prr_runq,
+                              PRRRUNQ_ENTRY) {
+            if (sched_migrate_claim(thread, cpu_index)) {
+                prr_remove(sobj, thread);
+                return thread;
+            }
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+static unsigned get_nr_active(struct scheduler * sobj)
+{
+    struct sched_prr * prr = containerof(sobj, struct sched_prr, sched);
+
+    return prr->nr_active;
+}
+
+/**
+ * Initializer struct for a priority rr scheduler.
+ */
+static const struct sched_prr sched_prr_init = {
+    .sched.name = "sched_prr",
+    .sched.insert = prr_insert,
+    .sched.run = prr_schedule,
+    .sched.get_nr_active_threads = get_nr_active,
+    .sched.remove = prr_remove,
+    .sched.reprio = prr_reprio,
+#ifdef configMP
+    .sched.steal = prr_steal,
+#endif
+};
+
+struct scheduler * sched_create_prr(void)
+{
+    struct sched_prr * sched;
+
+    sched = kmalloc(sizeof(struct sched_prr));
+    if (!sched)
+        return NULL;
+
+    *sched = sched_prr_init; /* init */
+    TAILQ_INIT(&sched->yieldq);
+    for (size_t i = 0; i < PRR_NR_LEVELS; i++) {
+        TAILQ_INIT(&sched->runq[i]);
+    }
+
+    return &sched->sched;
+}
@@ -132,6 +132,28 @@ static struct thread_info * rr_schedule(struct scheduler * sobj)
     return NULL;
 }
 
+#ifdef configMP
+/**
+ * Steal the thread that was inserted last, it's probably the one that would
+ * wait for the longest time before getting its turn on this CPU.
+ */
+static struct thread_info * rr_steal(struct scheduler * sobj,
+                                     unsigned cpu_index)
+{
+    struct sched_rr * rr = containerof(sobj, struct sched_rr, sched);
+    struct thread_info * thread;
+
+    TAILQ_FOREACH_REVERSE(thread, &rr->runq_head, runq, RRRUNQ_ENTRY) {
+        if (sched_migrate_claim(thread, cpu_index)) {
+            rr_remove(sobj, thread);
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
 static unsigned get_nr_active(struct scheduler * sobj)
 {
     struct sched_rr * rr = containerof(sobj, struct sched_rr, sched);
@@ -147,6 +169,10 @@ static const struct sched_rr sched_rr_init = {
     .sched.insert = rr_insert,
     .sched.run = rr_schedule,
     .sched.get_nr_active_threads = get_nr_active,
+    .sched.remove = rr_remove,
+#ifdef configMP
+    .sched.steal = rr_steal,
+#endif
 };
 
 struct scheduler * sched_create_rr(void)
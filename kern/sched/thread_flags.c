@@ -105,3 +105,19 @@ enum thread_state thread_state_set(struct thread_info * thread,
 
     return old_state;
 }
+
+int thread_state_test_and_set(struct thread_info * thread,
+                              enum thread_state old_state,
+                              enum thread_state new_state)
+{
+    int retval = 0;
+
+    mtx_lock(&thread->sched.tdlock);
+    if (thread->sched.state == old_state) {
+        thread->sched.state = new_state;
+        retval = 1;
+    }
+    mtx_unlock(&thread->sched.tdlock);
+
+    return retval;
+}
@@ -0,0 +1,181 @@
+/**
+ *******************************************************************************
+ * @file    waitq.c
+ * @author  Olli Vanhoja
+ * @brief   Kernel wait queues.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#include <errno.h>
+#include <hal/core.h>
+#include <thread.h>
+#include <timers.h>
+#include <waitq.h>
+
+/*
+ * wq_lock is always held with interrupts disabled so that a thread can't be
+ * switched out while holding it. The interrupt state is saved locally
+ * instead of using MTX_OPT_DINT because thread_release() takes other DINT
+ * locks while wq_lock is held.
+ */
+
+static istate_t waitq_lock(struct waitq * wq)
+{
+    istate_t s = get_interrupt_state();
+
+    disable_interrupt();
+    mtx_lock(&wq->wq_lock);
+
+    return s;
+}
+
+static void waitq_unlock(struct waitq * wq, istate_t s)
+{
+    mtx_unlock(&wq->wq_lock);
+    set_interrupt_state(s);
+}
+
+void waitq_init(struct waitq * wq)
+{
+    mtx_init(&wq->wq_lock, MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+    TAILQ_INIT(&wq->wq_head);
+}
+
+/**
+ * Timeout timer callback of a waiter.
+ */
+static void waitq_timeout(void * arg)
+{
+    struct waitq_entry * we = (struct waitq_entry *)arg;
+    struct waitq * wq = we->we_wq;
+    istate_t s;
+
+    s = waitq_lock(wq);
+    if (!we->we_woken) {
+        we->we_timedout = 1;
+        thread_release(we->we_thread->id);
+    }
+    waitq_unlock(wq, s);
+}
+
+int waitq_wait(struct waitq * wq, mtx_t * mtx, long timeout)
+{
+    struct waitq_entry we = {
+        .we_thread = current_thread,
+        .we_wq = wq,
+        .we_woken = 0,
+        .we_timedout = 0,
+    };
+    int timer_id = TMNOVAL;
+    istate_t s;
+    int blocked;
+    int retval;
+
+    s = waitq_lock(wq);
+    TAILQ_INSERT_TAIL(&wq->wq_head, &we, we_entry_);
+    waitq_unlock(wq, s);
+
+    /*
+     * A wakeup after this point is recorded in we_woken, so it's safe to
+     * release the condition mutex before blocking.
+     */
+    if (mtx)
+        mtx_unlock(mtx);
+
+    if (timeout > 0) {
+        timer_id = timers_add(waitq_timeout, &we, TIMERS_FLAG_ONESHOT,
+                              (uint64_t)timeout * 1000);
+        if (timer_id < 0)
+            timer_id = TMNOVAL;
+        else
+            timers_start(timer_id);
+    }
+
+    /*
+     * The state must be set while holding wq_lock, otherwise a wakeup or a
+     * timeout between the check and setting the state would be lost.
+     */
+    s = waitq_lock(wq);
+    blocked = !we.we_woken && !we.we_timedout;
+    if (blocked)
+        thread_state_set(current_thread, THREAD_STATE_BLOCKED);
+    waitq_unlock(wq, s);
+
+    if (blocked)
+        thread_wait_blocked();
+
+    if (timer_id != TMNOVAL)
+        timers_release(timer_id);
+
+    s = waitq_lock(wq);
+    if (we.we_woken) {
+        retval = 0;
+    } else {
+        TAILQ_REMOVE(&wq->wq_head, &we, we_entry_);
+        retval = (we.we_timedout) ? -ETIMEDOUT : -EINTR;
+    }
+    waitq_unlock(wq, s);
+
+    return retval;
+}
+
+static void wakeup(struct waitq * wq, int all)
+{
+    struct waitq_entry * we;
+    istate_t s;
+
+    /*
+     * A waiter is always in the queue before it releases the condition
+     * mutex, so if the caller changed the condition while holding the same
+     * mutex an empty queue means that there is nobody to wake up.
+     */
+    if (TAILQ_EMPTY(&wq->wq_head))
+        return;
+
+    s = waitq_lock(wq);
+    while ((we = TAILQ_FIRST(&wq->wq_head))) {
+        struct thread_info * thread = we->we_thread;
+
+        TAILQ_REMOVE(&wq->wq_head, we, we_entry_);
+        we->we_woken = 1;
+        thread_release(thread->id);
+
+        if (!all)
+            break;
+    }
+    waitq_unlock(wq, s);
+}
+
+void waitq_wakeup(struct waitq * wq)
+{
+    wakeup(wq, 0);
+}
+
+void waitq_wakeup_all(struct waitq * wq)
+{
+    wakeup(wq, 1);
+}
@@ -85,6 +85,24 @@ int __kinit__ shmem_init(void)
     return 0;
 }
 
+/**
+ * Get the page size that an anonymous mapping should be rounded to.
+ * A mapping made with a large page hint is rounded up so that it can be
+ * fully mapped with large pages or sections.
+ */
+static size_t mmap_anon_pgsize(size_t bsize, int flags)
+{
+#ifdef configMMU_LARGE_PAGES
+    if ((flags & MAP_HUGE) ||
+        (flags & MAP_ALIGNMENT_MASK) == MAP_ALIGNED_SUPER) {
+        return (bsize >= MMU_PGSIZE_SECTION) ? MMU_PGSIZE_SECTION
+                                             : MMU_PGSIZE_LARGE;
+    }
+#endif
+
+    return MMU_PGSIZE_COARSE;
+}
+
 /**
  * @param file is the file to be memory mapped.
  * @param bp_out is a pointer to a buf pointer than should be written if
@@ -148,13 +166,16 @@ int shmem_mmap(struct proc_info * proc, uintptr_t vaddr, size_t bsize, int prot,
      */
 
     if (flags & MAP_ANON) {
+        const size_t pgsize = mmap_anon_pgsize(bsize, flags);
+
         bsize = memalign_size(bsize, MMU_PGSIZE_COARSE);
-        bp = geteblk(bsize);
+        bp = geteblk(memalign_size(bsize, pgsize));
         if (!bp) {
             return -ENOMEM;
         }
 
         BUF_LOCK(bp);
+        bp->b_bcount = bsize; /* munmap() expects the requested size. */
         bp->b_flags |= B_NOSYNC;
         bp->b_mmu.control = MMU_CTRL_MEMTYPE_WB;
         BUF_UNLOCK(bp);
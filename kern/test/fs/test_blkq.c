@@ -0,0 +1,168 @@
+/**
+ * @file test_blkq.c
+ * @brief Test block request queue.
+ */
+
+#include <buf.h>
+#include <fs/blkq.h>
+#include <fs/devfs.h>
+#include <kstring.h>
+#include <kunit.h>
+#include <libkern.h>
+
+#define TST_BSIZE   16
+#define TST_NBLKS   16
+
+static uint8_t tst_disk[TST_BSIZE * TST_NBLKS];
+static int tst_nr_calls;
+static size_t tst_last_blkno;
+static size_t tst_last_bcount;
+
+static ssize_t tst_read(struct dev_info * devnfo, off_t blkno, uint8_t * buf,
+                        size_t bcount, int oflags)
+{
+    tst_nr_calls++;
+    tst_last_blkno = blkno;
+    tst_last_bcount = bcount;
+    memcpy(buf, tst_disk + blkno * TST_BSIZE, bcount);
+
+    return bcount;
+}
+
+static struct blkq tst_blkq;
+static struct dev_info tst_dev = {
+    .flags = DEV_FLAGS_MB_READ,
+    .block_size = TST_BSIZE,
+    .num_blocks = TST_NBLKS,
+    .read = tst_read,
+    .blkq = &tst_blkq,
+};
+
+static void setup(void)
+{
+    blkq_init(&tst_blkq, 8);
+    tst_nr_calls = 0;
+    for (size_t i = 0; i < sizeof(tst_disk); i++) {
+        tst_disk[i] = i / TST_BSIZE;
+    }
+}
+
+static void teardown(void)
+{
+    /* Intentionally unimplemented... */
+}
+
+static void init_req(struct buf * bp, uint8_t * data, size_t blkno)
+{
+    memset(bp, 0, sizeof(struct buf));
+    mtx_init(&bp->lock, MTX_TYPE_TICKET, MTX_OPT_DEFAULT);
+    bp->b_data = (uintptr_t)data;
+    bp->b_bcount = TST_BSIZE;
+    bp->b_bufsize = TST_BSIZE;
+    bp->b_blkno = blkno;
+    bp->b_flags = B_BUSY | B_READ;
+}
+
+static char * test_blkq_rw(void)
+{
+    uint8_t buf[2 * TST_BSIZE];
+    ssize_t ret;
+
+    ku_test_description("Test that blkq_rw() reads through the driver.");
+
+    ret = blkq_rw(&tst_dev, 0, 3, buf, sizeof(buf));
+    ku_assert_equal("All bytes were read", ret, sizeof(buf));
+    ku_assert_equal("Driver was called once", tst_nr_calls, 1);
+    ku_assert_equal("First block is correct", buf[0], 3);
+    ku_assert_equal("Second block is correct", buf[TST_BSIZE], 4);
+
+    return NULL;
+}
+
+/**
+ * Submit requests as if the queue was being dispatched, and finally submit
+ * the last request to an idle queue to dispatch them all.
+ */
+static void submit_reqs(struct buf req[], size_t n)
+{
+    tst_blkq.bq_active = 1;
+    for (size_t i = 0; i < n - 1; i++) {
+        blkq_strategy(&tst_dev, &req[i]);
+    }
+    tst_blkq.bq_active = 0;
+    blkq_strategy(&tst_dev, &req[n - 1]);
+}
+
+static int wait_reqs(struct buf req[], size_t n)
+{
+    int err = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int e = biowait(&req[i]);
+
+        if (e)
+            err = e;
+    }
+
+    return err;
+}
+
+static char * test_blkq_merge(void)
+{
+    static const size_t blknos[] = { 6, 4, 5, 7 };
+    struct buf req[num_elem(blknos)];
+    uint8_t data[num_elem(blknos)][TST_BSIZE];
+
+    ku_test_description("Test that adjacent requests are merged.");
+
+    for (size_t i = 0; i < num_elem(blknos); i++) {
+        init_req(&req[i], data[i], blknos[i]);
+    }
+    submit_reqs(req, num_elem(blknos));
+    ku_assert_equal("Requests completed", wait_reqs(req, num_elem(blknos)), 0);
+
+    ku_assert_equal("Driver was called once", tst_nr_calls, 1);
+    ku_assert_equal("Merged request starts from the lowest block",
+                    tst_last_blkno, 4);
+    ku_assert_equal("Merged request covers all blocks",
+                    tst_last_bcount, num_elem(blknos) * TST_BSIZE);
+    ku_assert_equal("Three requests were merged", tst_blkq.bq_nr_merged, 3);
+
+    for (size_t i = 0; i < num_elem(blknos); i++) {
+        ku_assert_equal("Request data is correct", data[i][0], blknos[i]);
+    }
+
+    return NULL;
+}
+
+static char * test_blkq_elevator(void)
+{
+    static const size_t blknos[] = { 9, 1, 12 };
+    struct buf req[num_elem(blknos)];
+    uint8_t data[num_elem(blknos)][TST_BSIZE];
+
+    ku_test_description("Test that requests are dispatched in C-LOOK order.");
+
+    tst_blkq.bq_pos = 10;
+    for (size_t i = 0; i < num_elem(blknos); i++) {
+        init_req(&req[i], data[i], blknos[i]);
+    }
+    submit_reqs(req, num_elem(blknos));
+    ku_assert_equal("Requests completed", wait_reqs(req, num_elem(blknos)), 0);
+
+    ku_assert_equal("Each request was dispatched separately",
+                    tst_nr_calls, num_elem(blknos));
+    ku_assert_equal("Sweep wrapped around to the lowest block",
+                    tst_last_blkno, 9);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_blkq_rw, KU_RUN);
+    ku_def_test(test_blkq_merge, KU_RUN);
+    ku_def_test(test_blkq_elevator, KU_RUN);
+}
+
+TEST_MODULE(fs, blkq);
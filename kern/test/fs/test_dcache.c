@@ -0,0 +1,143 @@
+/**
+ * @file test_dcache.c
+ * @brief Test name lookup cache.
+ */
+
+#include <errno.h>
+#include <fs/dcache.h>
+#include <fs/fs.h>
+#include <kstring.h>
+#include <kunit.h>
+#include <libkern.h>
+
+static int tst_lookup(vnode_t * dir, const char * name, vnode_t ** result);
+static int tst_delete_vnode(vnode_t * vnode)
+{
+    return 0;
+}
+
+static fs_t tst_fs = {
+    .fsname = "tstfs",
+    .fs_flags = FS_FLAG_DCACHE,
+};
+
+static struct fs_superblock tst_sb = {
+    .fs = &tst_fs,
+    .delete_vnode = tst_delete_vnode,
+};
+
+static vnode_ops_t tst_vnode_ops = {
+    .lookup = tst_lookup,
+};
+
+static vnode_t tst_dir;
+static vnode_t tst_file;
+static int tst_nr_lookups;
+
+static int tst_lookup(vnode_t * dir, const char * name, vnode_t ** result)
+{
+    tst_nr_lookups++;
+
+    if (!strcmp(name, "file")) {
+        vref(&tst_file);
+        *result = &tst_file;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+static void init_tst_vnode(vnode_t * vnode, ino_t num, mode_t mode)
+{
+    memset(vnode, 0, sizeof(vnode_t));
+    vnode->vn_num = num;
+    vnode->vn_mode = mode;
+    vnode->sb = &tst_sb;
+    vnode->vnode_ops = &tst_vnode_ops;
+    vrefset(vnode, 1);
+}
+
+static void setup(void)
+{
+    init_tst_vnode(&tst_dir, 1, S_IFDIR);
+    init_tst_vnode(&tst_file, 2, S_IFREG);
+    tst_nr_lookups = 0;
+}
+
+static void teardown(void)
+{
+    dcache_purge_sb(&tst_sb);
+}
+
+static char * test_dcache_hit(void)
+{
+    vnode_t * vnode;
+
+    ku_test_description("Test that a cached lookup doesn't call the fs.");
+
+    for (int i = 0; i < 2; i++) {
+        vnode = NULL;
+        ku_assert_equal("Lookup ok",
+                        dcache_lookup(&tst_dir, "file", &vnode), 0);
+        ku_assert_ptr_equal("Correct vnode returned", vnode, &tst_file);
+        vrele(vnode);
+    }
+    ku_assert_equal("fs lookup called once", tst_nr_lookups, 1);
+
+    return NULL;
+}
+
+static char * test_dcache_negative(void)
+{
+    vnode_t * vnode = NULL;
+
+    ku_test_description("Test that a failed lookup is cached.");
+
+    for (int i = 0; i < 2; i++) {
+        ku_assert_equal("Lookup fails",
+                        dcache_lookup(&tst_dir, "nofile", &vnode), -ENOENT);
+    }
+    ku_assert_equal("fs lookup called once", tst_nr_lookups, 1);
+
+    return NULL;
+}
+
+static char * test_dcache_invalidate(void)
+{
+    vnode_t * vnode = NULL;
+
+    ku_test_description("Test that an invalidated entry is looked up again.");
+
+    dcache_lookup(&tst_dir, "nofile", &vnode);
+    dcache_invalidate(&tst_dir, "nofile");
+    dcache_lookup(&tst_dir, "nofile", &vnode);
+    ku_assert_equal("fs lookup called twice", tst_nr_lookups, 2);
+
+    return NULL;
+}
+
+static char * test_dcache_purge(void)
+{
+    vnode_t * vnode = NULL;
+
+    ku_test_description("Test that purging releases the vnode references.");
+
+    ku_assert_equal("Lookup ok", dcache_lookup(&tst_dir, "file", &vnode), 0);
+    vrele(vnode);
+    ku_assert("Cache holds a reference", vrefcnt(&tst_file) > 1);
+
+    dcache_purge_sb(&tst_sb);
+    ku_assert_equal("Reference released", vrefcnt(&tst_file), 1);
+    ku_assert_equal("Dir reference released", vrefcnt(&tst_dir), 1);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_dcache_hit, KU_RUN);
+    ku_def_test(test_dcache_negative, KU_RUN);
+    ku_def_test(test_dcache_invalidate, KU_RUN);
+    ku_def_test(test_dcache_purge, KU_RUN);
+}
+
+TEST_MODULE(fs, dcache);
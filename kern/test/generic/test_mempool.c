@@ -0,0 +1,116 @@
+/**
+ * @file test_mempool.c
+ * @brief Test per CPU mempool magazines.
+ */
+
+#include <hal/core.h>
+#include <kunit.h>
+#include <ksched.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <mempool.h>
+
+#define NR_ELEM (3 * MEMPOOL_MAG_SIZE)
+
+static struct mempool * mp;
+static void * elem[NR_ELEM];
+
+static void setup(void)
+{
+    mp = mempool_init(MEMPOOL_TYPE_PERCPU, sizeof(int), NR_ELEM);
+    memset(elem, 0, sizeof(elem));
+}
+
+static void teardown(void)
+{
+    if (mp)
+        mempool_destroy(&mp);
+}
+
+static int elem_is_unique(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (elem[i] == elem[n])
+            return 0;
+    }
+
+    return 1;
+}
+
+static char * test_mempool_percpu_get_all(void)
+{
+    ku_test_description("Test getting all elements through a magazine.");
+
+    ku_assert("Pool created", mp);
+    for (size_t i = 0; i < NR_ELEM; i++) {
+        elem[i] = mempool_get(mp);
+        ku_assert("Got an element", elem[i]);
+        ku_assert("Element is unique", elem_is_unique(i));
+    }
+    ku_assert_null("Pool is empty", mempool_get(mp));
+
+    return NULL;
+}
+
+static char * test_mempool_percpu_return(void)
+{
+    ku_test_description("Test returns across magazine drains and refills.");
+
+    ku_assert("Pool created", mp);
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < NR_ELEM; i++) {
+            elem[i] = mempool_get(mp);
+            ku_assert("Got an element", elem[i]);
+            ku_assert("Element is unique", elem_is_unique(i));
+        }
+        ku_assert_null("Pool is empty", mempool_get(mp));
+
+        /* Fills and drains the magazine several times. */
+        for (size_t i = 0; i < NR_ELEM; i++) {
+            mempool_return(mp, elem[i]);
+        }
+    }
+
+    return NULL;
+}
+
+static char * test_mempool_percpu_steal(void)
+{
+#if KSCHED_CPU_COUNT > 1
+    struct mempool_magazine * mag;
+    istate_t s;
+    void * p;
+
+    ku_test_description("Test stealing elements cached by another CPU.");
+
+    ku_assert("Pool created", mp);
+    for (size_t i = 0; i < NR_ELEM; i++) {
+        elem[i] = mempool_get(mp);
+        ku_assert("Got an element", elem[i]);
+    }
+
+    /* Pretend that another CPU has the last element cached. */
+    s = get_interrupt_state();
+    disable_interrupt();
+    mag = &mp->mag[(get_cpu_index() + 1) % KSCHED_CPU_COUNT];
+    mtx_lock(&mag->lock);
+    mag->elem[mag->count++] = elem[NR_ELEM - 1];
+    mtx_unlock(&mag->lock);
+    set_interrupt_state(s);
+
+    p = mempool_get(mp);
+    ku_assert_ptr_equal("Element stolen", p, elem[NR_ELEM - 1]);
+    ku_assert_null("Pool is empty", mempool_get(mp));
+#endif
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_mempool_percpu_get_all, KU_RUN);
+    ku_def_test(test_mempool_percpu_return, KU_RUN);
+    ku_def_test(test_mempool_percpu_steal, KU_RUN);
+}
+
+TEST_MODULE(generic, mempool);
@@ -129,11 +129,57 @@ static char * test_rcu_callback(void)
     return NULL;
 }
 
+static char * test_rcu_nesting(void)
+{
+    struct rcu_lock_ctx ctx1, ctx2;
+
+    ctx1 = rcu_read_lock();
+    ctx2 = rcu_read_lock();
+    ku_assert_equal("Nested read lock", current_thread->rcu.nesting, 2);
+    rcu_read_unlock(&ctx2);
+    ku_assert_equal("Still locked", current_thread->rcu.nesting, 1);
+    rcu_read_unlock(&ctx1);
+    ku_assert_equal("Unlocked", current_thread->rcu.nesting, 0);
+
+    return NULL;
+}
+
+static int rcu_batch_called;
+
+static void rcu_batch_callback(struct rcu_cb * cb)
+{
+    rcu_batch_called++;
+    kfree(containerof(cb, struct data, rcu));
+}
+
+static char * test_rcu_callback_batch(void)
+{
+    struct data * const p1 = kmalloc(sizeof(struct data));
+    struct data * const p2 = kmalloc(sizeof(struct data));
+
+    if (!p1 || !p2) {
+        kfree(p1);
+        kfree(p2);
+        ku_assert_fail("ENOMEM");
+    }
+
+    rcu_batch_called = 0;
+    rcu_call(&p1->rcu, rcu_batch_callback);
+    rcu_call(&p2->rcu, rcu_batch_callback);
+    rcu_synchronize();
+    ku_assert_equal("Both callbacks were called after a grace period",
+                    rcu_batch_called, 2);
+
+    return NULL;
+}
+
 static void all_tests(void)
 {
     ku_def_test(test_rcu_assign_pointer_and_deference, KU_RUN);
     ku_def_test(test_rcu_synchronize, KU_RUN);
     ku_def_test(test_rcu_callback, KU_RUN);
+    ku_def_test(test_rcu_nesting, KU_RUN);
+    ku_def_test(test_rcu_callback_batch, KU_RUN);
 }
 
 TEST_MODULE(rcu, basic);
@@ -0,0 +1,138 @@
+/**
+ * @file test_mtx.c
+ * @brief Test adaptive mutexes.
+ */
+
+#include <kunit.h>
+#include <libkern.h>
+#include <thread.h>
+
+static mtx_t lock;
+static mtx_t lock2;
+static int locked_by_worker;
+
+static void setup(void)
+{
+    mtx_init(&lock, MTX_TYPE_ADAPTIVE, MTX_OPT_DEFAULT);
+    mtx_init(&lock2, MTX_TYPE_ADAPTIVE, MTX_OPT_DEFAULT);
+    locked_by_worker = 0;
+}
+
+static void teardown(void)
+{
+}
+
+static void * test_mtx_worker(void * arg)
+{
+    mtx_lock(&lock);
+    locked_by_worker = 1;
+    mtx_unlock(&lock);
+
+    return NULL;
+}
+
+static void * test_mtx_worker2(void * arg)
+{
+    mtx_lock(&lock2);
+    mtx_unlock(&lock2);
+
+    return NULL;
+}
+
+static char * test_mtx_trylock(void)
+{
+    ku_test_description("Test mtx_trylock() on an adaptive mutex.");
+
+    ku_assert_equal("Lock acquired", mtx_trylock(&lock), 0);
+    ku_assert_ptr_equal("Owner is set", lock.adaptive.owner, current_thread);
+    ku_assert("Second trylock fails", mtx_trylock(&lock) != 0);
+    mtx_unlock(&lock);
+    ku_assert_null("Owner is cleared", lock.adaptive.owner);
+
+    return NULL;
+}
+
+static char * test_mtx_block(void)
+{
+    struct sched_param param = {
+        .sched_policy = SCHED_RR,
+        .sched_priority = NICE_MIN,
+    };
+    const int prio = thread_get_priority(current_thread->id);
+    pthread_t tid;
+    struct thread_info * worker;
+
+    ku_test_description("Test that a waiter blocks and lends its priority.");
+
+    mtx_lock(&lock);
+    tid = kthread_create("mtx_test", &param, 0, test_mtx_worker, NULL);
+    ku_assert("Thread created", tid > 0);
+    thread_sleep(20);
+
+    worker = thread_lookup(tid);
+    ku_assert("Worker exists", worker);
+    ku_assert_equal("Worker is blocked", thread_state_get(worker),
+                    THREAD_STATE_BLOCKED);
+    ku_assert_equal("Worker is waiting", atomic_read(&lock.adaptive.nr_waiters),
+                    1);
+    ku_assert_equal("Priority inherited",
+                    thread_get_priority(current_thread->id), NICE_MIN);
+    ku_assert_equal("Worker didn't get the lock", locked_by_worker, 0);
+
+    mtx_unlock(&lock);
+    ku_assert_equal("Priority restored",
+                    thread_get_priority(current_thread->id), prio);
+    thread_sleep(20);
+    ku_assert_equal("Worker got the lock", locked_by_worker, 1);
+    ku_assert_equal("No waiters", atomic_read(&lock.adaptive.nr_waiters), 0);
+
+    return NULL;
+}
+
+static char * test_mtx_pi_recompute(void)
+{
+    struct sched_param param_high = {
+        .sched_policy = SCHED_RR,
+        .sched_priority = NICE_MIN,
+    };
+    struct sched_param param_mid = {
+        .sched_policy = SCHED_RR,
+        .sched_priority = NICE_MIN + 1,
+    };
+    const int prio = thread_get_priority(current_thread->id);
+    pthread_t tid;
+
+    ku_test_description("Test that PI is recomputed from the remaining waiters.");
+
+    mtx_lock(&lock);
+    mtx_lock(&lock2);
+    tid = kthread_create("mtx_test", &param_high, 0, test_mtx_worker, NULL);
+    ku_assert("Thread created", tid > 0);
+    tid = kthread_create("mtx_test2", &param_mid, 0, test_mtx_worker2, NULL);
+    ku_assert("Thread created", tid > 0);
+    thread_sleep(20);
+
+    ku_assert_equal("Priority inherited",
+                    thread_get_priority(current_thread->id), NICE_MIN);
+
+    mtx_unlock(&lock);
+    ku_assert_equal("Priority of the remaining waiter",
+                    thread_get_priority(current_thread->id), NICE_MIN + 1);
+
+    mtx_unlock(&lock2);
+    ku_assert_equal("Priority restored",
+                    thread_get_priority(current_thread->id), prio);
+    thread_sleep(20);
+    ku_assert_equal("Worker got the lock", locked_by_worker, 1);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_mtx_trylock, KU_RUN);
+    ku_def_test(test_mtx_block, KU_RUN);
+    ku_def_test(test_mtx_pi_recompute, KU_RUN);
+}
+
+TEST_MODULE(sched, mtx);
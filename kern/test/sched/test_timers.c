@@ -0,0 +1,98 @@
+/**
+ * @file test_timers.c
+ * @brief Test kernel timers.
+ */
+
+#include <hal/hw_timers.h>
+#include <kunit.h>
+#include <thread.h>
+#include <timers.h>
+
+#define TST_TICK_USEC (1000000 / configSCHED_HZ)
+
+static int tst_nr_calls;
+static int tst_tim;
+
+static void setup(void)
+{
+    tst_nr_calls = 0;
+    tst_tim = TMNOVAL;
+}
+
+static void teardown(void)
+{
+    if (tst_tim >= 0)
+        timers_release(tst_tim);
+}
+
+static void tst_event(void * arg)
+{
+    tst_nr_calls++;
+}
+
+/**
+ * Run timers until usec has elapsed.
+ */
+static void tst_run_for(uint64_t usec)
+{
+    const uint64_t end = get_utime() + usec;
+
+    do {
+        timers_run();
+        thread_yield(THREAD_YIELD_LAZY);
+    } while (get_utime() < end);
+}
+
+static char * test_timers_oneshot(void)
+{
+    ku_test_description("Test that a one-shot timer fires exactly once.");
+
+    tst_tim = timers_add(tst_event, NULL,
+                         TIMERS_FLAG_ONESHOT | TIMERS_FLAG_ENABLED, 0);
+    ku_assert("Timer allocated", tst_tim >= 0);
+
+    tst_run_for(3 * TST_TICK_USEC);
+    ku_assert_equal("Timer fired once", tst_nr_calls, 1);
+
+    return NULL;
+}
+
+static char * test_timers_periodic(void)
+{
+    ku_test_description("Test that a periodic timer is rearmed.");
+
+    tst_tim = timers_add(tst_event, NULL,
+                         TIMERS_FLAG_PERIODIC | TIMERS_FLAG_ENABLED,
+                         TST_TICK_USEC);
+    ku_assert("Timer allocated", tst_tim >= 0);
+
+    tst_run_for(10 * TST_TICK_USEC);
+    ku_assert("Timer fired several times", tst_nr_calls > 1);
+
+    return NULL;
+}
+
+static char * test_timers_stop(void)
+{
+    ku_test_description("Test that a stopped timer doesn't fire.");
+
+    tst_tim = timers_add(tst_event, NULL, TIMERS_FLAG_ONESHOT,
+                         TST_TICK_USEC);
+    ku_assert("Timer allocated", tst_tim >= 0);
+    timers_start(tst_tim);
+    timers_stop(tst_tim);
+
+    tst_run_for(3 * TST_TICK_USEC);
+    ku_assert_equal("Timer didn't fire", tst_nr_calls, 0);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_timers_oneshot, KU_RUN);
+    ku_def_test(test_timers_periodic, KU_RUN);
+    ku_def_test(test_timers_stop, KU_RUN);
+}
+
+TEST_MODULE(sched, timers);
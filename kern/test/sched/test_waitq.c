@@ -0,0 +1,115 @@
+/**
+ * @file test_waitq.c
+ * @brief Test wait queues.
+ */
+
+#include <errno.h>
+#include <kunit.h>
+#include <libkern.h>
+#include <thread.h>
+#include <waitq.h>
+
+static struct waitq wq;
+static mtx_t lock;
+static int cond;
+
+static void setup(void)
+{
+    waitq_init(&wq);
+    mtx_init(&lock, MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+    cond = 0;
+}
+
+static void teardown(void)
+{
+}
+
+static void * test_waitq_waker(void * arg)
+{
+    thread_sleep(10);
+
+    mtx_lock(&lock);
+    cond = 1;
+    waitq_wakeup(&wq);
+    mtx_unlock(&lock);
+
+    return NULL;
+}
+
+static void * test_waitq_releaser(void * arg)
+{
+    thread_sleep(10);
+    thread_release(*(pthread_t *)arg);
+
+    return NULL;
+}
+
+static char * test_waitq_timeout(void)
+{
+    int err;
+
+    ku_test_description("Test that waitq_wait() times out.");
+
+    err = waitq_wait(&wq, NULL, 10);
+    ku_assert_equal("Timed out", err, -ETIMEDOUT);
+
+    return NULL;
+}
+
+static char * test_waitq_wakeup(void)
+{
+    struct sched_param param = {
+        .sched_policy = SCHED_RR,
+        .sched_priority = 0,
+    };
+    pthread_t tid;
+
+    ku_test_description("Test that waitq_wakeup() wakes up a waiting thread.");
+
+    tid = kthread_create("waitq_test", &param, 0, test_waitq_waker, NULL);
+    ku_assert("Thread created", tid > 0);
+
+    mtx_lock(&lock);
+    while (!cond) {
+        int err = waitq_wait(&wq, &lock, 1000);
+
+        ku_assert("No timeout", err != -ETIMEDOUT);
+        mtx_lock(&lock);
+    }
+    mtx_unlock(&lock);
+
+    ku_assert_equal("Condition is set", cond, 1);
+
+    return NULL;
+}
+
+static char * test_waitq_intr(void)
+{
+    struct sched_param param = {
+        .sched_policy = SCHED_RR,
+        .sched_priority = 0,
+    };
+    pthread_t self = current_thread->id;
+    pthread_t tid;
+    int err;
+
+    ku_test_description("Test that a waiter released before the timeout "
+                        "expires isn't reported as timed out.");
+
+    tid = kthread_create("waitq_test", &param, 0, test_waitq_releaser, &self);
+    ku_assert("Thread created", tid > 0);
+
+    err = waitq_wait(&wq, NULL, 1000);
+    ku_assert_equal("Interrupted", err, -EINTR);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_waitq_timeout, KU_RUN);
+    ku_def_test(test_waitq_wakeup, KU_RUN);
+    ku_def_test(test_waitq_intr, KU_RUN);
+}
+
+TEST_MODULE(sched, waitq);
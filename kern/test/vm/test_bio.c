@@ -62,6 +62,38 @@ static char * test_getblk(void)
     return NULL;
 }
 
+static char * test_getblk_cached(void)
+{
+    vnode_t * vndev;
+    struct buf * bp1;
+    struct buf * bp2;
+    struct proc_info * proc;
+
+    ku_test_description("Test that getblk() returns a cached buffer.");
+
+    proc = proc_ref(0);
+    proc_unref(proc);
+
+    ku_assert("lookup failed",
+               !lookup_vnode(&vndev, proc->croot, "dev/zero",
+                             O_RDWR));
+    bp1 = getblk(vndev, 8192, 4096, 0);
+    ku_assert("got a buffer", bp1);
+    brelse(bp1);
+
+    ku_assert("buffer is in core", incore(vndev, 8192) == bp1);
+
+    bp2 = getblk(vndev, 8192, 4096, 0);
+    ku_assert("got the same buffer", bp2 == bp1);
+    ku_assert("bp is marked as busy", bp2->b_flags & B_BUSY);
+    brelse(bp2);
+
+    bio_vnode_purge(vndev);
+    ku_assert("buffer was purged", incore(vndev, 8192) == NULL);
+
+    return NULL;
+}
+
 static char * test_bread(void)
 {
     vnode_t * vndev;
@@ -89,11 +121,42 @@ static char * test_bread(void)
     return NULL;
 }
 
+static char * test_breadn(void)
+{
+    vnode_t * vndev;
+    struct buf * bp;
+    struct proc_info * proc;
+    size_t rablks[] = { 16384, 20480 };
+    int rasizes[] = { 4096, 4096 };
+    int err;
+
+    ku_test_description("Test that breadn() starts read-ahead.");
+
+    proc = proc_ref(0);
+    proc_unref(proc);
+
+    ku_assert("lookup failed",
+              !lookup_vnode(&vndev, proc->croot, "/dev/zero", O_RDWR));
+    err = breadn(vndev, 12288, 4096, rablks, rasizes, num_elem(rablks), &bp);
+    ku_assert_equal("no error", err, 0);
+    ku_assert("got a buffer", bp);
+    brelse(bp);
+
+    ku_assert("read-ahead block is in core", incore(vndev, 16384));
+    ku_assert("read-ahead block is in core", incore(vndev, 20480));
+
+    bio_vnode_purge(vndev);
+
+    return NULL;
+}
+
 static void all_tests(void)
 {
     ku_def_test(test_geteblk, KU_RUN);
     ku_def_test(test_getblk, KU_RUN);
+    ku_def_test(test_getblk_cached, KU_RUN);
     ku_def_test(test_bread, KU_SKIP);
+    ku_def_test(test_breadn, KU_SKIP);
 }
 
 TEST_MODULE(vm, bio);
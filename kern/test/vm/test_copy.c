@@ -0,0 +1,214 @@
+/**
+ * @file test_copy.c
+ * @brief Test and benchmark copyin() and copyout().
+ */
+
+#include <sys/sysctl.h>
+#include <hal/hw_timers.h>
+#include <buf.h>
+#include <kerror.h>
+#include <kmalloc.h>
+#include <kstring.h>
+#include <kunit.h>
+#include <libkern.h>
+#include <proc.h>
+#include <vm/vm.h>
+
+#define TST_SIZE        (16 * MMU_PGSIZE_COARSE)
+#define TST_BENCH_BYTES (1024 * 1024)
+
+static struct buf * tst_region;
+static uint8_t * tst_kbuf;
+
+static void setup(void)
+{
+    tst_region = vm_rndsect(curproc, TST_SIZE, VM_PROT_READ | VM_PROT_WRITE,
+                            NULL);
+    tst_kbuf = kmalloc(TST_SIZE);
+}
+
+static void teardown(void)
+{
+    struct buf * region;
+    int region_nr;
+
+    if (tst_region) {
+        region_nr = vm_find_reg(curproc, tst_region->b_mmu.vaddr, &region);
+        if (region_nr >= 0)
+            vm_replace_region(curproc, NULL, region_nr, 0);
+    }
+    tst_region = NULL;
+
+    kfree(tst_kbuf);
+    tst_kbuf = NULL;
+}
+
+static unsigned cow_stat(char * name)
+{
+    unsigned val = 0;
+    size_t len = sizeof(val);
+
+    (void)kernel_sysctlbyname(NULL, name, &val, &len, NULL, 0, NULL, 0);
+
+    return val;
+}
+
+static char * test_copy_pages(void)
+{
+    __user uint8_t * uaddr;
+    const size_t off = MMU_PGSIZE_COARSE - 7;
+    const size_t len = 3 * MMU_PGSIZE_COARSE;
+
+    ku_test_description("Test that a copy spanning several pages is intact.");
+
+    ku_assert("User region allocated", tst_region);
+    ku_assert("Kernel buffer allocated", tst_kbuf);
+    uaddr = (__user uint8_t *)tst_region->b_mmu.vaddr;
+
+    for (size_t i = 0; i < len; i++) {
+        tst_kbuf[i] = (uint8_t)(i % 251);
+    }
+    ku_assert_equal("copyout() ok", copyout(tst_kbuf, uaddr + off, len), 0);
+
+    memset(tst_kbuf, 0, len);
+    ku_assert_equal("copyin() ok", copyin(uaddr + off, tst_kbuf, len), 0);
+    for (size_t i = 0; i < len; i++) {
+        if (tst_kbuf[i] != (uint8_t)(i % 251))
+            ku_assert_fail("Data is intact");
+    }
+
+    ku_assert("copyout() past the region fails",
+              copyout(tst_kbuf, uaddr + TST_SIZE - 1, 2) != 0);
+
+    return NULL;
+}
+
+static char * test_copyout_cow(void)
+{
+    __user uint8_t * uaddr;
+    struct buf * region;
+    const uint8_t c = 0xa5;
+    uint8_t rd = 0;
+
+    ku_test_description(
+        "Test that copyout() to an unshared COW region takes it over.");
+
+    ku_assert("User region allocated", tst_region);
+    uaddr = (__user uint8_t *)tst_region->b_mmu.vaddr;
+
+    tst_region->b_uflags |= VM_PROT_COW;
+    vm_updateusr_ap(tst_region);
+
+    ku_assert_equal("copyout() ok", copyout(&c, uaddr, sizeof(c)), 0);
+    ku_assert("Region found",
+              vm_find_reg(curproc, (uintptr_t)uaddr, &region) >= 0);
+    ku_assert("Region was not copied", region == tst_region);
+    ku_assert("Region is not COW", !(region->b_uflags & VM_PROT_COW));
+    ku_assert_equal("copyin() ok", copyin(uaddr, &rd, sizeof(rd)), 0);
+    ku_assert_equal("Data was written", rd, c);
+
+    return NULL;
+}
+
+static char * test_copyout_cow_shared(void)
+{
+    __user uint8_t * uaddr;
+    struct buf * shared;
+    struct buf * region;
+    const uint8_t c = 0xa5;
+    uint8_t rd = 0;
+    unsigned faults, copied;
+
+    ku_test_description(
+        "Test that copyout() to a shared COW region copies a single page.");
+
+    ku_assert("User region allocated", tst_region);
+    uaddr = (__user uint8_t *)tst_region->b_mmu.vaddr;
+
+    /* Share the region like fork() would do. */
+    shared = tst_region;
+    shared->vm_ops->rref(shared);
+    shared->b_uflags |= VM_PROT_COW;
+    ku_assert_equal("Region remapped", vm_mapproc_region(curproc, shared), 0);
+
+    ku_assert_equal("copyout() ok",
+                    copyout(&c, uaddr + MMU_PGSIZE_COARSE, sizeof(c)), 0);
+    ku_assert("Region found",
+              vm_find_reg(curproc, (uintptr_t)uaddr, &region) >= 0);
+    tst_region = region;
+
+    ku_assert("Region was replaced", region != shared);
+    ku_assert("Shared region is intact",
+              ((uint8_t *)shared->b_data)[MMU_PGSIZE_COARSE] == 0);
+    ku_assert_equal("copyin() ok",
+                    copyin(uaddr + MMU_PGSIZE_COARSE, &rd, sizeof(rd)), 0);
+    ku_assert_equal("Data was written", rd, c);
+    ku_assert("Written page was copied",
+              vm_uaddr2kaddr(curproc, uaddr + MMU_PGSIZE_COARSE, 1) !=
+              (void *)(shared->b_data + MMU_PGSIZE_COARSE));
+    ku_assert("Other pages are still shared",
+              vm_uaddr2kaddr(curproc, uaddr, 1) == (void *)shared->b_data);
+
+    faults = cow_stat("vm.cow.faults");
+    copied = cow_stat("vm.cow.pages_copied");
+    ku_assert_equal("copyout() to the private page ok",
+                    copyout(&c, uaddr + MMU_PGSIZE_COARSE + 1, sizeof(c)), 0);
+    ku_assert_equal("No COW fault for a private page",
+                    cow_stat("vm.cow.faults"), faults);
+    ku_assert_equal("No page copied for a private page",
+                    cow_stat("vm.cow.pages_copied"), copied);
+
+    shared->vm_ops->rfree(shared);
+
+    return NULL;
+}
+
+static char * test_copy_bandwidth(void)
+{
+    static const size_t sizes[] = {
+        16, 64, 256, 1024, 4096, 16384, 65536
+    };
+    __user uint8_t * uaddr;
+
+    ku_test_description("Measure copyin() and copyout() bandwidth.");
+
+    ku_assert("User region allocated", tst_region);
+    ku_assert("Kernel buffer allocated", tst_kbuf);
+    uaddr = (__user uint8_t *)tst_region->b_mmu.vaddr;
+
+    for (size_t i = 0; i < num_elem(sizes); i++) {
+        const size_t n = TST_BENCH_BYTES / sizes[i];
+        uint64_t start, t_out, t_in;
+
+        start = get_utime();
+        for (size_t j = 0; j < n; j++) {
+            ku_assert_equal("copyout() ok",
+                            copyout(tst_kbuf, uaddr, sizes[i]), 0);
+        }
+        t_out = get_utime() - start;
+
+        start = get_utime();
+        for (size_t j = 0; j < n; j++) {
+            ku_assert_equal("copyin() ok",
+                            copyin(uaddr, tst_kbuf, sizes[i]), 0);
+        }
+        t_in = get_utime() - start;
+
+        KERROR(KERROR_INFO, "%u bytes: copyout %u kB/s, copyin %u kB/s\n",
+               (unsigned)sizes[i],
+               (unsigned)(t_out ? (TST_BENCH_BYTES * 1000ull) / t_out : 0),
+               (unsigned)(t_in ? (TST_BENCH_BYTES * 1000ull) / t_in : 0));
+    }
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_copy_pages, KU_RUN);
+    ku_def_test(test_copyout_cow, KU_RUN);
+    ku_def_test(test_copyout_cow_shared, KU_RUN);
+    ku_def_test(test_copy_bandwidth, KU_RUN);
+}
+
+TEST_MODULE(vm, copy);
@@ -0,0 +1,109 @@
+/**
+ * @file test_dynmem.c
+ * @brief Test dynmem allocator.
+ */
+
+#include <stdint.h>
+#include <dynmem.h>
+#include <kunit.h>
+#include <libkern.h>
+
+#define NR_REGIONS      4
+#define MAX_PAGES       3
+#define NR_ITERATIONS   200
+
+static void setup(void)
+{
+    /* Intentionally unimplemented... */
+}
+
+static void teardown(void)
+{
+    /* Intentionally unimplemented... */
+}
+
+static void * alloc_region(size_t size)
+{
+    return dynmem_alloc_region(size, MMU_AP_RWNA, MMU_CTRL_MEMTYPE_WB);
+}
+
+/**
+ * Find the largest region size that can be allocated.
+ */
+static size_t largest_allocatable(void)
+{
+    for (size_t size = 64; size > 0; size--) {
+        void * p = alloc_region(size);
+
+        if (p) {
+            dynmem_free_region(p);
+            return size;
+        }
+    }
+
+    return 0;
+}
+
+static int overlaps(uintptr_t a, size_t a_pages, uintptr_t b, size_t b_pages)
+{
+    const uintptr_t a_end = a + a_pages * DYNMEM_PAGE_SIZE;
+    const uintptr_t b_end = b + b_pages * DYNMEM_PAGE_SIZE;
+
+    return a < b_end && b < a_end;
+}
+
+static char * test_random_alloc_free(void)
+{
+    void * regions[NR_REGIONS] = { NULL };
+    size_t sizes[NR_REGIONS] = { 0 };
+    size_t largest_before;
+    size_t largest_after;
+
+    ku_test_description("Test that random allocations don't overlap and "
+                        "freed regions are coalesced.");
+
+    largest_before = largest_allocatable();
+    ku_assert("Some dynmem is free", largest_before > 0);
+
+    for (int i = 0; i < NR_ITERATIONS; i++) {
+        const size_t slot = krandom() % NR_REGIONS;
+
+        if (regions[slot]) {
+            dynmem_free_region(regions[slot]);
+            regions[slot] = NULL;
+            continue;
+        }
+
+        sizes[slot] = 1 + krandom() % MAX_PAGES;
+        regions[slot] = alloc_region(sizes[slot]);
+        if (!regions[slot])
+            continue;
+
+        for (size_t j = 0; j < NR_REGIONS; j++) {
+            if (j == slot || !regions[j])
+                continue;
+
+            ku_assert("Regions don't overlap",
+                      !overlaps((uintptr_t)regions[slot], sizes[slot],
+                                (uintptr_t)regions[j], sizes[j]));
+        }
+    }
+
+    for (size_t i = 0; i < NR_REGIONS; i++) {
+        if (regions[i])
+            dynmem_free_region(regions[i]);
+    }
+
+    largest_after = largest_allocatable();
+    ku_assert_equal("Free extents were coalesced",
+                    largest_after, largest_before);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_random_alloc_free, KU_RUN);
+}
+
+TEST_MODULE(vm, dynmem);
@@ -0,0 +1,95 @@
+/**
+ * @file test_kmalloc.c
+ * @brief Test kmalloc.
+ */
+
+#include <stdint.h>
+#include <kmalloc.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <libkern.h>
+
+static void setup(void)
+{
+    /* Intentionally unimplemented... */
+}
+
+static void teardown(void)
+{
+    /* Intentionally unimplemented... */
+}
+
+static char * test_small_allocs(void)
+{
+    uint8_t * p[64];
+
+    ku_test_description("Test that small allocations don't overlap.");
+
+    for (size_t i = 0; i < num_elem(p); i++) {
+        p[i] = kmalloc(i + 1);
+        ku_assert("Allocation succeeded", p[i]);
+        memset(p[i], (int)i, i + 1);
+    }
+
+    for (size_t i = 0; i < num_elem(p); i++) {
+        for (size_t j = 0; j < i + 1; j++) {
+            ku_assert_equal("Data is intact", p[i][j], (uint8_t)i);
+        }
+        kfree(p[i]);
+    }
+
+    return NULL;
+}
+
+static char * test_kpalloc(void)
+{
+    char * p;
+    char * q;
+
+    ku_test_description("Test that a referenced block is not reused.");
+
+    p = kmalloc(32);
+    ku_assert("Allocation succeeded", p);
+    kpalloc(p);
+
+    kfree(p);
+    q = kmalloc(32);
+    ku_assert("Referenced block was not returned", q != p);
+
+    kfree(p);
+    kfree(q);
+
+    return NULL;
+}
+
+static char * test_krealloc(void)
+{
+    char * p;
+
+    ku_test_description("Test that krealloc() preserves data between sizes.");
+
+    p = kmalloc(20);
+    ku_assert("Allocation succeeded", p);
+    strlcpy(p, "0123456789", 20);
+
+    p = krealloc(p, 100);
+    ku_assert("Realloc to a larger size class succeeded", p);
+    ku_assert_str_equal("Data is preserved", p, "0123456789");
+
+    p = krealloc(p, 8192);
+    ku_assert("Realloc to a large block succeeded", p);
+    ku_assert_str_equal("Data is preserved", p, "0123456789");
+
+    kfree(p);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_small_allocs, KU_RUN);
+    ku_def_test(test_kpalloc, KU_RUN);
+    ku_def_test(test_krealloc, KU_RUN);
+}
+
+TEST_MODULE(vm, kmalloc);
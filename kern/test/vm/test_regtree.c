@@ -0,0 +1,126 @@
+/**
+ * @file test_regtree.c
+ * @brief Test the interval tree of memory regions.
+ */
+
+#include <kstring.h>
+#include <kunit.h>
+#include <libkern.h>
+#include <vm/vm.h>
+
+#define TST_NR_NODES 64
+
+static struct vm_regtree tst_head;
+static struct vm_region_node tst_nodes[TST_NR_NODES];
+
+static void setup(void)
+{
+    RB_INIT(&tst_head);
+    memset(tst_nodes, 0, sizeof(tst_nodes));
+}
+
+static void teardown(void)
+{
+    /* Intentionally unimplemented... */
+}
+
+static void tst_insert(int i, uintptr_t start, uintptr_t end)
+{
+    tst_nodes[i].region_nr = i;
+    tst_nodes[i].start = start;
+    tst_nodes[i].end = end;
+    vm_regtree_insert(&tst_head, &tst_nodes[i]);
+}
+
+static int tst_find(uintptr_t start, uintptr_t end)
+{
+    struct vm_region_node * node;
+
+    node = vm_regtree_find(&tst_head, start, end);
+    return (node) ? node->region_nr : -1;
+}
+
+static char * test_regtree_find(void)
+{
+    ku_test_description("Test that a region is found by an address.");
+
+    /* Insert in a scrambled order to get some rotations. */
+    for (int i = 0; i < TST_NR_NODES; i++) {
+        int j = (i * 37) % TST_NR_NODES;
+
+        tst_insert(j, 0x10000 * (j + 1), 0x10000 * (j + 1) + 0x7fff);
+    }
+
+    for (int i = 0; i < TST_NR_NODES; i++) {
+        const uintptr_t start = 0x10000 * (i + 1);
+
+        ku_assert_equal("Start address found", tst_find(start, start), i);
+        ku_assert_equal("End address found",
+                        tst_find(start + 0x7fff, start + 0x7fff), i);
+        ku_assert_equal("Gap is not found",
+                        tst_find(start + 0x8000, start + 0xffff), -1);
+    }
+    ku_assert_equal("Range over several regions finds the lowest",
+                    tst_find(0x28000, 0x58000), 2);
+    ku_assert_equal("Address below all regions",
+                    tst_find(0x0, 0xffff), -1);
+
+    return NULL;
+}
+
+static char * test_regtree_overlap(void)
+{
+    ku_test_description("Test lookups with overlapping regions.");
+
+    tst_insert(0, 0x10000, 0x10fff);
+    tst_insert(1, 0x20000, 0x8ffff); /* Large region... */
+    tst_insert(2, 0x30000, 0x30fff); /* ...overlapping smaller ones. */
+    tst_insert(3, 0x40000, 0x40fff);
+    tst_insert(4, 0xa0000, 0xa0fff);
+
+    ku_assert_equal("Large region found past the small ones",
+                    tst_find(0x50000, 0x50000), 1);
+    ku_assert_equal("Lowest overlapping region found",
+                    tst_find(0x40000, 0x40000), 1);
+    ku_assert_equal("Range containing a whole region",
+                    tst_find(0x9f000, 0xa2000), 4);
+
+    vm_regtree_remove(&tst_head, &tst_nodes[1]);
+    ku_assert_equal("Removed region not found",
+                    tst_find(0x50000, 0x50000), -1);
+    ku_assert_equal("Overlapped region found after removal",
+                    tst_find(0x40000, 0x40000), 3);
+
+    return NULL;
+}
+
+static char * test_regtree_remove(void)
+{
+    ku_test_description("Test that removals keep the tree consistent.");
+
+    for (int i = 0; i < TST_NR_NODES; i++) {
+        tst_insert(i, 0x1000 * i, 0x1000 * i + 0xfff);
+    }
+    for (int i = 0; i < TST_NR_NODES; i += 2) {
+        vm_regtree_remove(&tst_head, &tst_nodes[i]);
+    }
+
+    for (int i = 0; i < TST_NR_NODES; i++) {
+        const uintptr_t addr = 0x1000 * i + 0x800;
+        const int expected = (i & 1) ? i : -1;
+
+        ku_assert_equal("Only remaining regions are found",
+                        tst_find(addr, addr), expected);
+    }
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_regtree_find, KU_RUN);
+    ku_def_test(test_regtree_overlap, KU_RUN);
+    ku_def_test(test_regtree_remove, KU_RUN);
+}
+
+TEST_MODULE(vm, regtree);
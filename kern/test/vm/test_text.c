@@ -0,0 +1,155 @@
+/**
+ * @file test_text.c
+ * @brief Test the shared text segment cache.
+ */
+
+#include <errno.h>
+#include <buf.h>
+#include <fs/fs.h>
+#include <kstring.h>
+#include <kunit.h>
+#include <libkern.h>
+#include <uio.h>
+#include <vm/vm.h>
+
+static int tst_delete_vnode(vnode_t * vnode)
+{
+    return 0;
+}
+
+static fs_t tst_fs = {
+    .fsname = "tstfs",
+};
+
+static struct fs_superblock tst_sb = {
+    .fs = &tst_fs,
+    .delete_vnode = tst_delete_vnode,
+};
+
+static int tst_nr_reads;
+
+static off_t tst_lseek(file_t * file, off_t offset, int whence)
+{
+    file->seek_pos = offset;
+    return offset;
+}
+
+static ssize_t tst_read(file_t * file, struct uio * uio, size_t count)
+{
+    static const char data[] = "text";
+    int err;
+
+    tst_nr_reads++;
+
+    err = uio_copyout(data, uio, 0, min(count, sizeof(data)));
+    if (err)
+        return err;
+    return count;
+}
+
+static vnode_ops_t tst_vnode_ops = {
+    .read = tst_read,
+    .lseek = tst_lseek,
+};
+
+static vnode_t tst_file;
+
+static void setup(void)
+{
+    memset(&tst_file, 0, sizeof(vnode_t));
+    tst_file.vn_num = 1;
+    tst_file.vn_mode = S_IFREG;
+    tst_file.sb = &tst_sb;
+    tst_file.vnode_ops = &tst_vnode_ops;
+    vrefset(&tst_file, 1);
+    tst_nr_reads = 0;
+}
+
+static void teardown(void)
+{
+    vm_text_purge_sb(&tst_sb);
+}
+
+static char * test_text_demand(void)
+{
+    struct buf * bp;
+    uintptr_t paddr;
+
+    ku_test_description("Test that text pages are read in on demand.");
+
+    bp = vm_text_newsect(&tst_file, 0x1000, 0x1800, 0x9000, 0x1800,
+                         VM_PROT_READ | VM_PROT_EXECUTE);
+    ku_assert("A text section was created", bp);
+    ku_assert_equal("Nothing is in core", bp->b_data, 0);
+    ku_assert_equal("Nothing was read", tst_nr_reads, 0);
+
+    ku_assert_equal("Page not in core",
+                    bp->vm_ops->rpage(bp, 1, 0, &paddr), -ENOENT);
+    ku_assert_equal("Page filled",
+                    bp->vm_ops->rpage(bp, 1, VM_RPAGE_FILL, &paddr), 0);
+    ku_assert_equal("One page was read", tst_nr_reads, 1);
+    ku_assert_equal("Text can't be written",
+                    bp->vm_ops->rpage(bp, 0, VM_RPAGE_WRITE, &paddr),
+                    -EACCES);
+
+    bp->vm_ops->rfree(bp);
+
+    return NULL;
+}
+
+static char * test_text_shared(void)
+{
+    struct buf * bp1;
+    struct buf * bp2;
+    uintptr_t paddr1, paddr2;
+
+    ku_test_description("Test that text pages are shared between mappings.");
+
+    bp1 = vm_text_newsect(&tst_file, 0x1000, 0x1000, 0x9000, 0x1000,
+                          VM_PROT_READ | VM_PROT_EXECUTE);
+    bp2 = vm_text_newsect(&tst_file, 0x1000, 0x1000, 0x9000, 0x1000,
+                          VM_PROT_READ | VM_PROT_EXECUTE);
+    ku_assert("Text sections were created", bp1 && bp2);
+
+    ku_assert_equal("Page filled",
+                    bp1->vm_ops->rpage(bp1, 0, VM_RPAGE_FILL, &paddr1), 0);
+    ku_assert_equal("Page is in core for the other mapping",
+                    bp2->vm_ops->rpage(bp2, 0, 0, &paddr2), 0);
+    ku_assert_equal("Same page is used", paddr1, paddr2);
+    ku_assert_equal("Page was read once", tst_nr_reads, 1);
+
+    bp1->vm_ops->rfree(bp1);
+    bp2->vm_ops->rfree(bp2);
+
+    return NULL;
+}
+
+static char * test_text_busy(void)
+{
+    struct buf * bp;
+
+    ku_test_description("Test that a mapped text file can't be purged.");
+
+    ku_assert("Writable sections are not cached",
+              !vm_text_newsect(&tst_file, 0x1000, 0x1000, 0x9000, 0x1000,
+                               VM_PROT_READ | VM_PROT_WRITE));
+
+    bp = vm_text_newsect(&tst_file, 0x1000, 0x1000, 0x9000, 0x1000,
+                         VM_PROT_READ | VM_PROT_EXECUTE);
+    ku_assert("A text section was created", bp);
+    ku_assert_equal("Text is busy", vm_text_purge(&tst_file), -ETXTBSY);
+
+    bp->vm_ops->rfree(bp);
+    ku_assert_equal("Text is no longer busy", vm_text_purge(&tst_file), 0);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    ku_def_test(test_text_demand, KU_RUN);
+    ku_def_test(test_text_shared, KU_RUN);
+    ku_def_test(test_text_busy, KU_RUN);
+}
+
+TEST_MODULE(vm, text);
@@ -0,0 +1,199 @@
+/**
+ * @file test_vralloc.c
+ * @brief Test vralloc and large page mappings.
+ */
+
+#include <buf.h>
+#include <hal/mmu.h>
+#include <kunit.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <ptmapper.h>
+
+#define TEST_VADDR 0x50000000
+
+static mmu_pagetable_t mpt;
+static mmu_pagetable_t pt;
+static struct buf * bp;
+static unsigned mapped_pages[MMU_PGSZ_COUNT];
+
+static void setup(void)
+{
+    mpt = (mmu_pagetable_t){
+        .nr_tables = 1,
+        .pt_type = MMU_PTT_MASTER,
+        .pt_dom = MMU_DOM_USER,
+    };
+    pt = (mmu_pagetable_t){
+        .vaddr = TEST_VADDR,
+        .nr_tables = 1,
+        .pt_type = MMU_PTT_COARSE,
+        .pt_dom = MMU_DOM_USER,
+    };
+    bp = NULL;
+    memcpy(mapped_pages, mmu_mapped_pages, sizeof(mapped_pages));
+}
+
+static void teardown(void)
+{
+    if (pt.pt_addr)
+        ptmapper_free(&pt);
+    if (mpt.pt_addr)
+        ptmapper_free(&mpt);
+    if (bp)
+        brelse(bp);
+}
+
+/**
+ * Get the change of a mapped pages gauge since setup().
+ */
+static int mapped(enum mmu_pgsize pgsz)
+{
+    return (int)(mmu_mapped_pages[pgsz] - mapped_pages[pgsz]);
+}
+
+static char * test_geteblk_align(void)
+{
+    ku_test_description("Test that big allocations are aligned physically.");
+
+    bp = geteblk(MMU_PGSIZE_LARGE);
+    ku_assert("A new buffer was returned", bp);
+    ku_assert_equal("64 kB allocation is aligned",
+                    (bp->b_mmu.paddr & (MMU_PGSIZE_LARGE - 1)), 0);
+    brelse(bp);
+
+    bp = geteblk(MMU_PGSIZE_SECTION);
+    ku_assert("A new buffer was returned", bp);
+    ku_assert_equal("1 MB allocation is aligned",
+                    (bp->b_mmu.paddr & (MMU_PGSIZE_SECTION - 1)), 0);
+
+    return NULL;
+}
+
+static char * test_map_large(void)
+{
+    mmu_region_t region;
+    uintptr_t paddr;
+
+    ku_test_description("Test that an aligned region is mapped with large "
+                        "pages and sections, a large page is split "
+                        "correctly and the page gauges follow the mappings.");
+
+    bp = geteblk(2 * MMU_PGSIZE_LARGE);
+    ku_assert("A new buffer was returned", bp);
+    ku_assert("Got a page table", !ptmapper_alloc(&pt));
+
+    region = bp->b_mmu;
+    region.vaddr = TEST_VADDR;
+    region.ap = MMU_AP_RWRW;
+    region.control = MMU_CTRL_MEMTYPE_WB | MMU_CTRL_XN;
+    region.pt = &pt;
+    ku_assert_equal("Region mapped", mmu_map_region(&region), 0);
+
+    paddr = (uintptr_t)mmu_translate_vaddr(&pt, TEST_VADDR + 0x1234);
+    ku_assert_equal("Large page translates",
+                    paddr, bp->b_mmu.paddr + 0x1234);
+    paddr = (uintptr_t)mmu_translate_vaddr(&pt, TEST_VADDR + 0x1f004);
+    ku_assert_equal("Second large page translates",
+                    paddr, bp->b_mmu.paddr + 0x1f004);
+#ifdef configMMU_LARGE_PAGES
+    ku_assert_equal("Two large pages mapped", mapped(MMU_PGSZ_LARGE), 2);
+    ku_assert_equal("No small pages mapped", mapped(MMU_PGSZ_SMALL), 0);
+#endif
+
+    /* Remap a single page in the middle of the first large page. */
+    region.vaddr = TEST_VADDR + 3 * MMU_PGSIZE_COARSE;
+    region.paddr = bp->b_mmu.paddr + MMU_PGSIZE_LARGE;
+    region.num_pages = 1;
+    ku_assert_equal("Page mapped", mmu_map_region(&region), 0);
+
+    paddr = (uintptr_t)mmu_translate_vaddr(&pt, TEST_VADDR + 0x3010);
+    ku_assert_equal("Remapped page translates",
+                    paddr, bp->b_mmu.paddr + MMU_PGSIZE_LARGE + 0x10);
+    paddr = (uintptr_t)mmu_translate_vaddr(&pt, TEST_VADDR + 0x4010);
+    ku_assert_equal("The rest of the split large page is intact",
+                    paddr, bp->b_mmu.paddr + 0x4010);
+    paddr = (uintptr_t)mmu_translate_vaddr(&pt, TEST_VADDR + 0x10010);
+    ku_assert_equal("The other large page is intact",
+                    paddr, bp->b_mmu.paddr + 0x10010);
+#ifdef configMMU_LARGE_PAGES
+    ku_assert_equal("Split large page removed", mapped(MMU_PGSZ_LARGE), 1);
+    ku_assert_equal("Split large page added small pages",
+                    mapped(MMU_PGSZ_SMALL), MMU_NR_LARGE_ENTR);
+#endif
+
+    region = bp->b_mmu;
+    region.vaddr = TEST_VADDR;
+    region.pt = &pt;
+    ku_assert_equal("Region unmapped", mmu_unmap_region(&region), 0);
+    ku_assert_equal("No large pages left", mapped(MMU_PGSZ_LARGE), 0);
+    ku_assert_equal("No small pages left", mapped(MMU_PGSZ_SMALL), 0);
+
+#ifdef configMMU_LARGE_PAGES
+    /* Map a whole coarse table attached to a master table. */
+    brelse(bp);
+    bp = geteblk(MMU_PGSIZE_SECTION);
+    ku_assert("A new buffer was returned", bp);
+    ku_assert("Got a master page table", !ptmapper_alloc(&mpt));
+    pt.master_pt_addr = mpt.pt_addr;
+    ku_assert_equal("Page table attached", mmu_attach_pagetable(&pt), 0);
+
+    region = bp->b_mmu;
+    region.vaddr = TEST_VADDR;
+    region.ap = MMU_AP_RWRW;
+    region.control = MMU_CTRL_MEMTYPE_WB | MMU_CTRL_XN;
+    region.pt = &pt;
+    ku_assert_equal("Region mapped", mmu_map_region(&region), 0);
+    ku_assert_equal("Table promoted to a section",
+                    mapped(MMU_PGSZ_SECTION), 1);
+    ku_assert_equal("Promoted large pages not counted",
+                    mapped(MMU_PGSZ_LARGE), 0);
+
+    /* Remapping the same region must not count it twice. */
+    ku_assert_equal("Region remapped", mmu_map_region(&region), 0);
+    ku_assert_equal("Still one section", mapped(MMU_PGSZ_SECTION), 1);
+    ku_assert_equal("Still no large pages", mapped(MMU_PGSZ_LARGE), 0);
+
+    /* Remap a single page to demote the section. */
+    region.vaddr = TEST_VADDR + 3 * MMU_PGSIZE_COARSE;
+    region.num_pages = 1;
+    ku_assert_equal("Page mapped", mmu_map_region(&region), 0);
+    ku_assert_equal("Section demoted", mapped(MMU_PGSZ_SECTION), 0);
+    ku_assert_equal("Large pages back",
+                    mapped(MMU_PGSZ_LARGE), MMU_NR_COARSE_ENTR /
+                    MMU_NR_LARGE_ENTR - 1);
+    ku_assert_equal("Split large page added small pages",
+                    mapped(MMU_PGSZ_SMALL), MMU_NR_LARGE_ENTR);
+
+    /* Promote again and detach the promoted table. */
+    region = bp->b_mmu;
+    region.vaddr = TEST_VADDR;
+    region.ap = MMU_AP_RWRW;
+    region.control = MMU_CTRL_MEMTYPE_WB | MMU_CTRL_XN;
+    region.pt = &pt;
+    ku_assert_equal("Region mapped", mmu_map_region(&region), 0);
+    ku_assert_equal("Table promoted again", mapped(MMU_PGSZ_SECTION), 1);
+    ku_assert_equal("Small pages replaced", mapped(MMU_PGSZ_SMALL), 0);
+    ku_assert_equal("Page table detached", mmu_detach_pagetable(&pt), 0);
+    ku_assert_equal("Detach removed the section",
+                    mapped(MMU_PGSZ_SECTION), 0);
+
+    ku_assert_equal("Region unmapped", mmu_unmap_region(&region), 0);
+    ku_assert_equal("No large pages left", mapped(MMU_PGSZ_LARGE), 0);
+    ku_assert_equal("No small pages left", mapped(MMU_PGSZ_SMALL), 0);
+#endif
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+#ifdef configMMU_LARGE_PAGES
+    ku_def_test(test_geteblk_align, KU_RUN);
+#else
+    ku_def_test(test_geteblk_align, KU_SKIP);
+#endif
+    ku_def_test(test_map_large, KU_RUN);
+}
+
+TEST_MODULE(vm, vralloc);
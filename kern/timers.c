@@ -32,19 +32,42 @@
  *******************************************************************************
  */
 
-/* TODO MP version, per CPU timers */
+/*
+ * Timers are kept in a hierarchical timing wheel of TW_LEVELS levels with
+ * TW_SIZE slots each. The expiry time of a timer is rounded up to the next
+ * scheduler tick. Timers expiring within TW_SIZE ticks are placed on the
+ * first level, timers expiring within TW_SIZE^2 ticks on the second level
+ * and so on. Every time the first level wraps around, the current slot of
+ * the next level is cascaded down to the lower levels. Arming and canceling
+ * a timer is O(1) and the work per tick is proportional to the number of
+ * expiring and cascaded timers.
+ *
+ * The wheel is run only on the boot CPU, so a single wheel protected by
+ * tw_lock is used. The lock is held with interrupts disabled and it's
+ * released for calling the event handlers, which can then modify timers.
+ */
 
 #include <sys/linker_set.h>
-#include <machine/atomic.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <hal/core.h>
 #include <hal/hw_timers.h>
 #include <kinit.h>
+#include <klocks.h>
 #include <ksched.h>
 #include <thread.h>
 #include <timers.h>
 
+#define TW_BITS     6
+#define TW_SIZE     (1 << TW_BITS)
+#define TW_MASK     (TW_SIZE - 1)
+#define TW_LEVELS   4
+#define TW_MAX_TICKS ((1ull << (TW_BITS * TW_LEVELS)) - 1)
+#define TICK_USEC   (1000000 / configSCHED_HZ)
+
 /** Timer allocation struct */
 struct timer_cb {
-    atomic_t flags;             /*!< Timer flags:
+    timers_flags_t flags;       /*!< Timer flags:
                                  * + 0 = Timer state
                                  *     + 0 = disabled
                                  *     + 1 = enabled
@@ -56,42 +79,225 @@ struct timer_cb {
     void * event_arg;           /*!< Argument for event handler. */
     uint64_t interval;          /*!< Timer interval. */
     uint64_t start;             /*!< Timer start value. */
+    uint64_t expires;           /*!< Expiry time in ticks. */
+    int armed;                  /*!< Set if the timer is in the wheel. */
+    LIST_ENTRY(timer_cb) entry_; /*!< Wheel slot or the free list. */
 };
 
-static struct timer_cb timers_array[configTIMERS_MAX] = {
-    [0 ... (configTIMERS_MAX - 1)] = {
-        .flags = ATOMIC_INIT(0),
-        .event_fn = NULL,
-        .interval = 0,
-        .start = 0,
-    }
-};
+LIST_HEAD(tw_slot, timer_cb);
+
+static struct timer_cb timers_array[configTIMERS_MAX];
 #define VALID_TIMER_ID(x) ((x) < configTIMERS_MAX && (x) >= 0)
 
+static struct {
+    mtx_t lock;
+    int initialized;
+    uint64_t tick;              /*!< Next tick to be processed. */
+    struct tw_slot free;
+    struct tw_slot slot[TW_LEVELS][TW_SIZE];
+} tw = {
+    .lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT),
+};
+
+SYSCTL_DECL(_kern_timers);
+SYSCTL_NODE(_kern, OID_AUTO, timers, CTLFLAG_RW, 0,
+            "Kernel timers");
+
+static unsigned timers_nr_expired;
+SYSCTL_UINT(_kern_timers, OID_AUTO, nr_expired, CTLFLAG_RD,
+            &timers_nr_expired, 0,
+            "Number of expired timers");
+
+static unsigned timers_nr_cascaded;
+SYSCTL_UINT(_kern_timers, OID_AUTO, nr_cascaded, CTLFLAG_RD,
+            &timers_nr_cascaded, 0,
+            "Number of timers moved to a lower wheel level");
+
+static unsigned timers_slack_max;
+SYSCTL_UINT(_kern_timers, OID_AUTO, slack_max, CTLFLAG_RD,
+            &timers_slack_max, 0,
+            "Maximum timer slack [us]");
+
+#define TIMERS_SLACK_AVG_N 4
+static unsigned timers_slack_avg;
+
+static int sysctl_timers_slack_avg(SYSCTL_HANDLER_ARGS)
+{
+    unsigned avg = timers_slack_avg >> TIMERS_SLACK_AVG_N;
+
+    return sysctl_handle_int(oidp, &avg, sizeof(avg), req);
+}
+
+SYSCTL_PROC(_kern_timers, OID_AUTO, slack_avg, CTLTYPE_UINT | CTLFLAG_RD,
+            NULL, 0, sysctl_timers_slack_avg, "IU",
+            "Average timer slack [us]");
+
+static istate_t tw_lock(void)
+{
+    istate_t s = get_interrupt_state();
+
+    disable_interrupt();
+    mtx_lock(&tw.lock);
+
+    if (unlikely(!tw.initialized)) {
+        tw.tick = get_utime() / TICK_USEC;
+        LIST_INIT(&tw.free);
+        for (int i = configTIMERS_MAX - 1; i >= 0; i--) {
+            LIST_INSERT_HEAD(&tw.free, &timers_array[i], entry_);
+        }
+        tw.initialized = 1;
+    }
+
+    return s;
+}
+
+static void tw_unlock(istate_t s)
+{
+    mtx_unlock(&tw.lock);
+    set_interrupt_state(s);
+}
+
+/**
+ * Insert a timer to the wheel.
+ * tw.lock must be held.
+ */
+static void tw_insert(struct timer_cb * timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    size_t level;
+
+    if (expires < tw.tick)
+        expires = tw.tick;
+    delta = expires - tw.tick;
+    if (delta > TW_MAX_TICKS) {
+        /* The timer will be reinserted when the slot is cascaded. */
+        delta = TW_MAX_TICKS;
+        expires = tw.tick + delta;
+    }
+
+    for (level = 0; level < TW_LEVELS - 1; level++) {
+        if (delta < (1ull << (TW_BITS * (level + 1))))
+            break;
+    }
+
+    LIST_INSERT_HEAD(&tw.slot[level][(expires >> (TW_BITS * level)) & TW_MASK],
+                     timer, entry_);
+    timer->armed = 1;
+}
+
+/**
+ * Remove a timer from the wheel.
+ * tw.lock must be held.
+ */
+static void tw_remove(struct timer_cb * timer)
+{
+    if (timer->armed) {
+        LIST_REMOVE(timer, entry_);
+        timer->armed = 0;
+    }
+}
+
+/**
+ * Arm a timer to expire interval usecs after its start time.
+ * tw.lock must be held.
+ */
+static void tw_arm(struct timer_cb * timer)
+{
+    tw_remove(timer);
+    timer->expires = (timer->start + timer->interval + TICK_USEC - 1) /
+                     TICK_USEC;
+    tw_insert(timer);
+}
+
+/**
+ * Move the timers of the current slot of a level to the lower levels.
+ * tw.lock must be held.
+ * @return Returns the index of the slot.
+ */
+static size_t tw_cascade(size_t level)
+{
+    const size_t idx = (tw.tick >> (TW_BITS * level)) & TW_MASK;
+    struct tw_slot list = LIST_HEAD_INITIALIZER(list);
+    struct timer_cb * timer;
+
+    LIST_SWAP(&list, &tw.slot[level][idx], timer_cb, entry_);
+    while ((timer = LIST_FIRST(&list))) {
+        LIST_REMOVE(timer, entry_);
+        tw_insert(timer);
+        timers_nr_cascaded++;
+    }
+
+    return idx;
+}
+
+static void update_slack(uint64_t now, struct timer_cb * timer)
+{
+    const uint64_t deadline = timer->start + timer->interval;
+    const unsigned slack = (now > deadline) ? now - deadline : 0;
+
+    if (slack > timers_slack_max)
+        timers_slack_max = slack;
+    timers_slack_avg = timers_slack_avg + slack -
+                       (timers_slack_avg >> TIMERS_SLACK_AVG_N);
+    timers_nr_expired++;
+}
+
 void timers_run(void)
 {
-    size_t i = 0;
-    uint64_t now = get_utime();
-    const int enflags = TIMERS_FLAG_INUSE | TIMERS_FLAG_ENABLED;
-
-    do {
-        struct timer_cb * const timer = &timers_array[i];
-        timers_flags_t flags = atomic_read(&timer->flags);
-
-        if ((flags & enflags) == enflags) {
-            if ((now - timer->start) >= timer->interval) {
-                timer->event_fn(timer->event_arg);
-
-                if (!(flags & TIMERS_FLAG_PERIODIC)) {
-                    /* Stop the timer */
-                    timer->flags &= ~TIMERS_FLAG_ENABLED;
-                } else {
-                    /* Repeating timer */
-                    timer->start = get_utime();
-                }
+    uint64_t now;
+    uint64_t now_tick;
+    istate_t s;
+
+    if (!sched_is_boot_cpu())
+        return;
+
+    now = get_utime();
+    now_tick = now / TICK_USEC;
+
+    s = tw_lock();
+    while (tw.tick <= now_tick) {
+        const size_t idx = tw.tick & TW_MASK;
+        struct tw_slot expired = LIST_HEAD_INITIALIZER(expired);
+        struct timer_cb * timer;
+
+        if (idx == 0) {
+            for (size_t level = 1; level < TW_LEVELS; level++) {
+                if (tw_cascade(level) != 0)
+                    break;
             }
         }
-    } while (++i < configTIMERS_MAX);
+
+        LIST_SWAP(&expired, &tw.slot[0][idx], timer_cb, entry_);
+        tw.tick++;
+
+        /*
+         * The handlers may stop or release any timer in the expired list,
+         * so always take the first one.
+         */
+        while ((timer = LIST_FIRST(&expired))) {
+            void (*event_fn)(void *) = timer->event_fn;
+            void * event_arg = timer->event_arg;
+
+            LIST_REMOVE(timer, entry_);
+            timer->armed = 0;
+            update_slack(now, timer);
+
+            if (timer->flags & TIMERS_FLAG_PERIODIC) {
+                /* Repeating timer */
+                timer->start = now;
+                tw_arm(timer);
+            } else {
+                /* Stop the timer */
+                timer->flags &= ~TIMERS_FLAG_ENABLED;
+            }
+
+            tw_unlock(s);
+            event_fn(event_arg);
+            s = tw_lock();
+        }
+    }
+    tw_unlock(s);
 }
 SCHED_PRE_SCHED_TASK(timers_run);
 
@@ -99,26 +305,48 @@ int timers_add(void (*event_fn)(void *), void * event_arg,
                timers_flags_t flags, uint64_t usec)
 {
     struct timer_cb * timer;
-    size_t i = 0;
+    istate_t s;
 
     flags &= TIMERS_EXT_FLAGS; /* Allow only external flags to be set */
 
-    do { /* Locate first free timer */
-        timer = &timers_array[i];
+    s = tw_lock();
+    timer = LIST_FIRST(&tw.free);
+    if (!timer) {
+        tw_unlock(s);
+        return TMNOVAL;
+    }
+    LIST_REMOVE(timer, entry_);
+
+    timer->event_fn = event_fn;
+    timer->event_arg = event_arg;
+    timer->interval = usec;
+    timer->start = get_utime();
+    timer->armed = 0;
+    timer->flags = flags | TIMERS_FLAG_INUSE;
+    if (flags & TIMERS_FLAG_ENABLED)
+        tw_arm(timer);
+    tw_unlock(s);
+
+    return timer - timers_array;
+}
 
-        if (atomic_cmpxchg(&timer->flags, 0, flags) == 0) {
-            timer->event_fn = event_fn;
-            timer->event_arg = event_arg;
-            timer->interval = usec;
-            timer->start = get_utime();
-            flags |= TIMERS_FLAG_INUSE;
-            atomic_set(&timer->flags, flags);
+uint64_t timers_next_expiry(void)
+{
+    uint64_t expires;
+    istate_t s;
 
-            return i;
+    s = tw_lock();
+    /* The wheel must be run at least when the first level wraps around. */
+    expires = (tw.tick | TW_MASK) + 1;
+    for (uint64_t tick = tw.tick; tick < expires; tick++) {
+        if (!LIST_EMPTY(&tw.slot[0][tick & TW_MASK])) {
+            expires = tick;
+            break;
         }
-    } while (++i < configTIMERS_MAX);
+    }
+    tw_unlock(s);
 
-    return TMNOVAL;
+    return expires * TICK_USEC;
 }
 
 int64_t timers_get_split(int tim)
@@ -137,24 +365,51 @@ int64_t timers_get_split(int tim)
 
 void timers_start(int tim)
 {
+    struct timer_cb * timer;
+    istate_t s;
+
     if (!VALID_TIMER_ID(tim))
         return;
 
-    atomic_add(&timers_array[tim].flags, TIMERS_FLAG_ENABLED);
+    timer = &timers_array[tim];
+    s = tw_lock();
+    if ((timer->flags & (TIMERS_FLAG_INUSE | TIMERS_FLAG_ENABLED)) ==
+        TIMERS_FLAG_INUSE) {
+        timer->flags |= TIMERS_FLAG_ENABLED;
+        tw_arm(timer);
+    }
+    tw_unlock(s);
 }
 
 void timers_stop(int tim)
 {
+    struct timer_cb * timer;
+    istate_t s;
+
     if (!VALID_TIMER_ID(tim))
         return;
 
-    atomic_sub(&timers_array[tim].flags, TIMERS_FLAG_ENABLED);
+    timer = &timers_array[tim];
+    s = tw_lock();
+    timer->flags &= ~TIMERS_FLAG_ENABLED;
+    tw_remove(timer);
+    tw_unlock(s);
 }
 
 void timers_release(int tim)
 {
+    struct timer_cb * timer;
+    istate_t s;
+
     if (!VALID_TIMER_ID(tim))
         return;
 
-    atomic_set(&timers_array[tim].flags, 0);
+    timer = &timers_array[tim];
+    s = tw_lock();
+    if (timer->flags & TIMERS_FLAG_INUSE) {
+        tw_remove(timer);
+        timer->flags = 0;
+        LIST_INSERT_HEAD(&tw.free, timer, entry_);
+    }
+    tw_unlock(s);
 }
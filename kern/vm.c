@@ -33,6 +33,7 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <sys/sysctl.h>
 #include <buf.h>
 #include <dynmem.h>
 #include <hal/mmu.h>
@@ -55,6 +56,18 @@
 
 extern mmu_region_t mmu_region_kernel;
 
+SYSCTL_DECL(_vm_cow);
+SYSCTL_NODE(_vm, OID_AUTO, cow, CTLFLAG_RW, 0,
+            "Copy-on-write stats");
+
+static unsigned vm_cow_faults;
+SYSCTL_UINT(_vm_cow, OID_AUTO, faults, CTLFLAG_RD, &vm_cow_faults, 0,
+            "Number of writes to COW regions");
+
+static unsigned vm_cow_reused;
+SYSCTL_UINT(_vm_cow, OID_AUTO, reused, CTLFLAG_RD, &vm_cow_reused, 0,
+            "Number of COW regions taken over without copying");
+
 __kernel void * vm_uaddr2kaddr(struct proc_info * proc,
                                __user const void * uaddr,
                                size_t acc_size)
@@ -67,57 +80,225 @@ __kernel void * vm_uaddr2kaddr(struct proc_info * proc,
         return NULL;
 
     phys_uaddr = mmu_translate_vaddr(&vpt->pt, (uintptr_t)uaddr);
+    if (!phys_uaddr) {
+        struct buf * region;
+        int region_nr;
+
+        /* Read in a page of a demand paged region. */
+        region_nr = vm_find_reg(proc, (uintptr_t)uaddr, &region);
+        if (region_nr >= 0 &&
+            vm_fill_page(proc, region_nr, (uintptr_t)uaddr) == 0)
+            phys_uaddr = mmu_translate_vaddr(&vpt->pt, (uintptr_t)uaddr);
+    }
 
     return phys_uaddr;
 }
 
-int copyin(__user const void * uaddr, __kernel void * kaddr, size_t len)
+/*
+ * copyin() and copyout() walk the user range one region and one page at a
+ * time. The region lookup is done once per region and each page is translated
+ * separately, so the user buffer doesn't need to be physically contiguous.
+ * Physically contiguous pages are still copied with a single memcpy(). A
+ * write to a COW region resolves the COW of each page first and pages of
+ * demand paged regions are read in when found unmapped, like the abort
+ * handler would do on a fault from user space.
+ */
+
+static int test_ap_user(uint32_t rw, struct buf * bp);
+
+static uintptr_t region_end(struct buf * region)
 {
-    return copyin_proc(curproc, uaddr, kaddr, len);
+    size_t size = region->b_bcount;
+
+    /* Unfortunately sometimes the b_count is invalid. */
+    if (unlikely(size == 0)) /* TODO and this is probably wrong too */
+        size = mmu_sizeof_region(&region->b_mmu);
+
+    return region->b_mmu.vaddr + size;
 }
 
-int copyin_proc(struct proc_info * proc, __user const void * uaddr,
-                __kernel void * kaddr, size_t len)
+/**
+ * Test if a page of a page granular COW region is already private to the
+ * region and mapped by the process.
+ * A page granular region keeps VM_PROT_COW as long as it exists, but a
+ * private page can be written by the kernel through its physical address
+ * without resolving the COW again. A user write still faults in the RW
+ * mapping if the page was made private by its other users.
+ * mm->regions_lock must be held.
+ */
+static int vm_cow_page_private(struct proc_info * proc, struct buf * region,
+                               uintptr_t uaddr)
 {
-    void * phys_uaddr;
+    struct vm_pt * vpt;
+    uintptr_t paddr;
+    size_t iblock;
 
-    if (!useracc_proc(uaddr, len, proc, VM_PROT_READ)) {
-        return -EFAULT;
-    }
+    if (!region->vm_ops->rpage)
+        return 0;
 
-    phys_uaddr = vm_uaddr2kaddr(proc, uaddr, len);
-    if (!phys_uaddr) {
-        return -EFAULT;
+    iblock = (uaddr - region->b_mmu.vaddr) / MMU_PGSIZE_COARSE;
+    if (region->vm_ops->rpage(region, iblock, 0, &paddr) != 1)
+        return 0;
+
+    vpt = ptlist_get_pt(&proc->mm, uaddr, MMU_PGSIZE_COARSE, 0);
+    if (!vpt)
+        return 0;
+
+    return (uintptr_t)mmu_translate_vaddr(&vpt->pt, uaddr) == paddr;
+}
+
+/**
+ * Resolve COW for all pages in a range of a region.
+ */
+static int vm_cow_pages(struct proc_info * proc, int region_nr,
+                        uintptr_t uaddr, size_t len)
+{
+    struct vm_mm_struct * const mm = &proc->mm;
+    const uintptr_t end = uaddr + len;
+
+    uaddr &= ~(MMU_PGSIZE_COARSE - 1);
+    for (; uaddr < end; uaddr += MMU_PGSIZE_COARSE) {
+        struct buf * region;
+        int private;
+        int err;
+
+        mtx_lock(&mm->regions_lock);
+        region = (*mm->regions)[region_nr];
+        private = region && vm_cow_page_private(proc, region, uaddr);
+        mtx_unlock(&mm->regions_lock);
+        if (private)
+            continue;
+
+        err = vm_cow_page(proc, region_nr, uaddr);
+        if (err)
+            return err;
     }
 
-    memcpy(kaddr, phys_uaddr, len);
     return 0;
 }
 
-int copyout(__kernel const void * kaddr, __user void * uaddr, size_t len)
+/**
+ * Copy between a kernel buffer and user pages within a single region.
+ */
+static int vm_copy_pages(struct proc_info * proc, int region_nr,
+                         uintptr_t uaddr, uint8_t * kaddr, size_t len, int out)
 {
-    return copyout_proc(curproc, kaddr, uaddr, len);
+    struct vm_pt * vpt = NULL;
+    uintptr_t vpt_end = 0;
+
+    while (len > 0) {
+        uint8_t * run = NULL;
+        size_t run_len = 0;
+
+        /* Collect a run of physically contiguous pages. */
+        while (run_len < len) {
+            const uintptr_t va = uaddr + run_len;
+            const size_t n = min(len - run_len, MMU_PGSIZE_COARSE -
+                                 (va & (MMU_PGSIZE_COARSE - 1)));
+            uint8_t * pa;
+
+            if (!vpt || va >= vpt_end) {
+                vpt = ptlist_get_pt(&proc->mm, va, MMU_PGSIZE_COARSE,
+                                    VM_PT_CREAT);
+                if (!vpt)
+                    return -EFAULT;
+                vpt_end = vpt->pt.vaddr + mmu_sizeof_pt_img(&vpt->pt);
+            }
+
+            pa = mmu_translate_vaddr(&vpt->pt, va);
+            if (!pa) {
+                /* The page might be just not read in yet. */
+                if (vm_fill_page(proc, region_nr, va))
+                    return -EFAULT;
+                pa = mmu_translate_vaddr(&vpt->pt, va);
+                if (!pa)
+                    return -EFAULT;
+            }
+            if (run && pa != run + run_len)
+                break;
+
+            if (!run)
+                run = pa;
+            run_len += n;
+        }
+
+        if (out)
+            memcpy(run, kaddr, run_len);
+        else
+            memcpy(kaddr, run, run_len);
+
+        uaddr += run_len;
+        kaddr += run_len;
+        len -= run_len;
+    }
+
+    return 0;
 }
 
-int copyout_proc(struct proc_info * proc, __kernel const void * kaddr,
-                 __user void * uaddr, size_t len)
+static int vm_copy_proc(struct proc_info * proc, uintptr_t uaddr,
+                        uint8_t * kaddr, size_t len, int out)
 {
-    /* TODO Handle possible cow flag? */
-    void * phys_uaddr;
+    const uint32_t rw = (out) ? VM_PROT_WRITE : VM_PROT_READ;
 
-    if (!useracc_proc(uaddr, len, proc, VM_PROT_WRITE)) {
+    if (uaddr == 0)
         return -EFAULT;
-    }
 
-    phys_uaddr = vm_uaddr2kaddr(proc, uaddr, len);
-    if (!phys_uaddr) {
-        return -EFAULT;
+    while (len > 0) {
+        struct buf * region;
+        size_t n;
+        int region_nr, err;
+
+        region_nr = vm_find_reg(proc, uaddr, &region);
+        if (region_nr < 0)
+            return -EFAULT;
+
+        if (uaddr >= region_end(region))
+            return -EFAULT;
+        n = min(len, region_end(region) - uaddr);
+
+        if (out && (region->b_uflags & (VM_PROT_COW | VM_PROT_WRITE)) ==
+                   (VM_PROT_COW | VM_PROT_WRITE)) {
+            err = vm_cow_pages(proc, region_nr, uaddr, n);
+            if (err)
+                return err;
+        } else if (!test_ap_user(rw, region)) {
+            return -EFAULT;
+        }
+
+        err = vm_copy_pages(proc, region_nr, uaddr, kaddr, n, out);
+        if (err)
+            return err;
+
+        uaddr += n;
+        kaddr += n;
+        len -= n;
     }
 
-    memcpy(phys_uaddr, kaddr, len);
     return 0;
 }
 
+int copyin(__user const void * uaddr, __kernel void * kaddr, size_t len)
+{
+    return copyin_proc(curproc, uaddr, kaddr, len);
+}
+
+int copyin_proc(struct proc_info * proc, __user const void * uaddr,
+                __kernel void * kaddr, size_t len)
+{
+    return vm_copy_proc(proc, (uintptr_t)uaddr, kaddr, len, 0);
+}
+
+int copyout(__kernel const void * kaddr, __user void * uaddr, size_t len)
+{
+    return copyout_proc(curproc, kaddr, uaddr, len);
+}
+
+int copyout_proc(struct proc_info * proc, __kernel const void * kaddr,
+                 __user void * uaddr, size_t len)
+{
+    return vm_copy_proc(proc, (uintptr_t)uaddr, (uint8_t *)kaddr, len, 1);
+}
+
 int copyinstr(__user const char * uaddr, __kernel char * kaddr, size_t len,
               size_t * done)
 {
@@ -206,32 +387,20 @@ int copyoutstr(__kernel char * kaddr, __user const char * uaddr, size_t len,
 
 int vm_find_reg(struct proc_info * proc, uintptr_t uaddr, struct buf ** bp)
 {
-    struct buf * region = NULL;
     struct vm_mm_struct * mm = &proc->mm;
-    uintptr_t reg_start, reg_end;
+    int region_nr;
 
+    /*
+     * TODO Would be good idea to use region size instead of mmu alloc size
+     *      but before that it has to be fixed everywhere in the codebase.
+     */
     mtx_lock(&mm->regions_lock);
-    for (int i = 0; i < mm->nr_regions; i++) {
-        region = (*mm->regions)[i];
-        if (!region)
-            continue;
-
-        /*
-         * TODO Would be good idea to use region size instead of mmu alloc size
-         *      but before that it has to be fixed everywhere in the codebase.
-         */
-        reg_start = region->b_mmu.vaddr;
-        reg_end = region->b_mmu.vaddr + region->b_bufsize - 1;
-
-        if (VM_ADDR_IS_IN_RANGE(uaddr, reg_start, reg_end)) {
-            mtx_unlock(&mm->regions_lock);
-            *bp = region;
-            return i;
-        }
-    }
+    region_nr = vm_mm_find_region(mm, uaddr, uaddr);
+    if (region_nr >= 0)
+        *bp = (*mm->regions)[region_nr];
     mtx_unlock(&mm->regions_lock);
 
-    return -1;
+    return region_nr;
 }
 
 struct buf * vm_newsect(uintptr_t vaddr, size_t size, int prot)
@@ -265,24 +434,9 @@ static bool is_overlaping_current_regions(
     uintptr_t vaddr,
     size_t size)
 {
-    const size_t nr_regions = mm->nr_regions;
     const uintptr_t newreg_end = vaddr + size - 1;
 
-    for (size_t i = 0; i < nr_regions; i++) {
-        struct buf * bp = (*mm->regions)[i];
-        if (!bp)
-            continue;
-
-        const uintptr_t reg_start = bp->b_mmu.vaddr;
-        const uintptr_t reg_end = bp->b_mmu.vaddr + bp->b_bufsize - 1;
-
-        if (VM_RANGE_IS_OVERLAPPING(reg_start, reg_end,
-                                    vaddr, newreg_end)) {
-            return true;
-        }
-    }
-
-    return false;
+    return vm_mm_find_region(mm, vaddr, newreg_end) >= 0;
 }
 
 /**
@@ -291,7 +445,6 @@ static bool is_overlaping_current_regions(
  */
 static uintptr_t rnd_addr(struct vm_mm_struct * mm, size_t size)
 {
-    size_t nr_regions;
     const size_t bits = NBITS(MMU_PGSIZE_SECTION);
     const uintptr_t addr_min = configEXEC_BASE_LIMIT;
     /*
@@ -301,7 +454,6 @@ static uintptr_t rnd_addr(struct vm_mm_struct * mm, size_t size)
 
     KASSERT(mtx_test(&mm->regions_lock), "mm should be locked\n");
 
-    nr_regions = mm->nr_regions;
     do {
         uintptr_t vaddr;
         vaddr = addr_min +
@@ -359,7 +511,7 @@ struct buf * vm_rndsect(struct proc_info * proc, size_t size, int prot,
     return bp;
 }
 
-struct buf * vm_new_userstack_curproc(size_t size)
+struct buf * vm_new_userstack(struct proc_info * proc, size_t size)
 {
     struct buf * vmstack;
     uintptr_t vaddr;
@@ -368,8 +520,8 @@ struct buf * vm_new_userstack_curproc(size_t size)
     if (!vmstack)
         return NULL;
 
-    mtx_lock(&curproc->mm.regions_lock);
-    vaddr = rnd_addr(&curproc->mm, vmstack->b_bufsize);
+    mtx_lock(&proc->mm.regions_lock);
+    vaddr = rnd_addr(&proc->mm, vmstack->b_bufsize);
 
     vmstack->b_uflags = VM_PROT_READ | VM_PROT_WRITE;
     vmstack->b_mmu.vaddr = vaddr;
@@ -381,9 +533,9 @@ struct buf * vm_new_userstack_curproc(size_t size)
      * with allocations, though it's unlikely because this function is
      * most likely only called by exec.
      */
-    mtx_unlock(&curproc->mm.regions_lock);
+    mtx_unlock(&proc->mm.regions_lock);
 
-    vm_replace_region(curproc, vmstack, MM_STACK_REGION, VM_INSOP_MAP_REG);
+    vm_replace_region(proc, vmstack, MM_STACK_REGION, VM_INSOP_MAP_REG);
 
     return vmstack;
 }
@@ -441,6 +593,17 @@ void vm_updateusr_ap(struct buf * region)
 
 int vm_mm_init(struct vm_mm_struct * mm, int nr_regions)
 {
+    /*
+     * The mm struct is often a copy of the parent's mm, so clear everything
+     * vm_mm_destroy() would free before anything can fail.
+     */
+    mm->regions = NULL;
+    mm->regnodes = NULL;
+    mm->nr_regions = 0;
+    RB_INIT(&mm->regtree_head);
+    RB_INIT(&mm->ptlist_head);
+    mm->mpt.pt_addr = 0;
+
     /* Allocate a master page table for the new process. */
     mm->mpt.vaddr = 0; /* mpt always starts from zero */
     mm->mpt.nr_tables = 1;
@@ -451,8 +614,6 @@ int vm_mm_init(struct vm_mm_struct * mm, int nr_regions)
         return -ENOMEM;
 
     /* Allocate an array for regions. */
-    mm->regions = NULL;
-    mm->nr_regions = 0;
     realloc_mm_regions(mm, nr_regions);
     if (!mm->regions)
         return -ENOMEM;
@@ -478,6 +639,14 @@ void vm_mm_destroy(struct vm_mm_struct * mm)
                 region->vm_ops->rfree(region);
             }
         }
+
+        /* Free the region index. */
+        for (int i = 0; i < mm->nr_regions; i++) {
+            kfree((*mm->regnodes)[i]);
+        }
+        kfree(mm->regnodes);
+        mm->regnodes = NULL;
+        RB_INIT(&mm->regtree_head);
         mm->nr_regions = 0;
 
         /* Free page table list. */
@@ -496,6 +665,7 @@ void vm_mm_destroy(struct vm_mm_struct * mm)
 static int realloc_mm_regions_locked(struct vm_mm_struct * mm, int new_count)
 {
     struct buf * (*new_regions)[];
+    struct vm_region_node * (*new_regnodes)[];
     int i = mm->nr_regions;
 
     KERROR_DBG("realloc_mm_regions(mm %p, new_count %d), old %d\n",
@@ -509,17 +679,34 @@ static int realloc_mm_regions_locked(struct vm_mm_struct * mm, int new_count)
         return 0;
     }
 
+    new_regnodes = krealloc(mm->regnodes,
+                            new_count * sizeof(struct vm_region_node *));
+    if (!new_regnodes)
+        return -ENOMEM;
+    mm->regnodes = new_regnodes;
+
     new_regions = krealloc(mm->regions, new_count * sizeof(struct buf *));
     if (!new_regions)
         return -ENOMEM;
+    mm->regions = new_regions;
 
+    /*
+     * The index nodes are allocated separately so the tree stays valid when
+     * the arrays are reallocated.
+     */
     for (; i < new_count; i++) {
+        struct vm_region_node * node;
+
+        node = kzalloc(sizeof(struct vm_region_node));
+        if (!node)
+            return -ENOMEM;
+        node->region_nr = i;
+
         (*new_regions)[i] = NULL;
+        (*new_regnodes)[i] = node;
+        mm->nr_regions = i + 1;
     }
 
-    mm->regions = new_regions;
-    mm->nr_regions = new_count;
-
     return 0;
 }
 
@@ -539,6 +726,40 @@ int realloc_mm_regions(struct vm_mm_struct * mm, int new_count)
     return retval;
 }
 
+void vm_mm_set_region(struct vm_mm_struct * mm, int region_nr,
+                      struct buf * region)
+{
+    struct vm_region_node * node = (*mm->regnodes)[region_nr];
+
+    if (node->region) {
+        vm_regtree_remove(&mm->regtree_head, node);
+        node->region = NULL;
+    }
+
+    (*mm->regions)[region_nr] = region;
+
+    /*
+     * Regions without size are never found by an address so there is no
+     * need to index them.
+     */
+    if (region && region->b_bufsize > 0) {
+        node->region = region;
+        node->start = region->b_mmu.vaddr;
+        node->end = region->b_mmu.vaddr + region->b_bufsize - 1;
+        vm_regtree_insert(&mm->regtree_head, node);
+    }
+}
+
+int vm_mm_find_region(struct vm_mm_struct * mm, uintptr_t start,
+                      uintptr_t end)
+{
+    struct vm_region_node * node;
+
+    node = vm_regtree_find(&mm->regtree_head, start, end);
+
+    return (node) ? node->region_nr : -1;
+}
+
 /* TODO Verify that the mapping will be valid */
 /**
  * Insert a reference to a region but don't map it.
@@ -566,11 +787,13 @@ static int vm_insert_region_ref(struct vm_mm_struct * mm, struct buf * region)
 
         slot = nr_regions;
         err = realloc_mm_regions_locked(mm, nr_regions + 1);
-        if (err)
+        if (err) {
+            mtx_unlock(&mm->regions_lock);
             return err;
+        }
     }
 
-    (*mm->regions)[slot] = region;
+    vm_mm_set_region(mm, slot, region);
     mtx_unlock(&mm->regions_lock);
 
     return slot;
@@ -612,7 +835,7 @@ int vm_replace_region(struct proc_info * proc, struct buf * region,
 
     mtx_lock(&mm->regions_lock);
     old_region = (*mm->regions)[region_nr];
-    (*mm->regions)[region_nr] = NULL;
+    vm_mm_set_region(mm, region_nr, NULL);
     mtx_unlock(&mm->regions_lock);
 
     if (old_region) {
@@ -654,7 +877,7 @@ int vm_replace_region(struct proc_info * proc, struct buf * region,
     }
 
     mtx_lock(&mm->regions_lock);
-    (*mm->regions)[region_nr] = region;
+    vm_mm_set_region(mm, region_nr, region);
     mtx_unlock(&mm->regions_lock);
 
     if (region) {
@@ -670,9 +893,47 @@ int vm_replace_region(struct proc_info * proc, struct buf * region,
     return 0;
 }
 
+/**
+ * Map the pages of a page granular region that differ from the base mapping.
+ * Pages not in core are left unmapped and will be read in on the first
+ * access.
+ */
+static int vm_map_rpages(struct buf * region, mmu_region_t * mmu_region)
+{
+    const uintptr_t vaddr = mmu_region->vaddr;
+    const uintptr_t paddr = mmu_region->paddr;
+    const size_t num_pages = mmu_region->num_pages;
+    const unsigned ap = mmu_region->ap;
+
+    mmu_region->num_pages = 1;
+    for (size_t i = 0; i < num_pages; i++) {
+        uintptr_t page;
+        int excl, err;
+
+        excl = region->vm_ops->rpage(region, i, 0, &page);
+        if (excl == -ENOENT)
+            continue;
+        if (excl < 0)
+            return excl;
+        if (!excl && paddr && page == paddr + i * MMU_PGSIZE_COARSE)
+            continue;
+
+        mmu_region->vaddr = vaddr + i * MMU_PGSIZE_COARSE;
+        mmu_region->paddr = page;
+        mmu_region->ap = (excl && (region->b_uflags & VM_PROT_WRITE)) ?
+                         MMU_AP_RWRW : ap;
+        err = mmu_map_region(mmu_region);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
 int vm_map_region(struct buf * region, struct vm_pt * pt)
 {
     mmu_region_t mmu_region;
+    int err;
 
     KASSERT(region, "region can't be null\n");
 
@@ -684,7 +945,17 @@ int vm_map_region(struct buf * region, struct vm_pt * pt)
 
     mtx_unlock(&region->lock);
 
-    return mmu_map_region(&mmu_region);
+    if (!region->vm_ops->rpage)
+        return mmu_map_region(&mmu_region);
+
+    /* A demand paged region that is not in core has no base mapping. */
+    if (region->b_data) {
+        err = mmu_map_region(&mmu_region);
+        if (err)
+            return err;
+    }
+
+    return vm_map_rpages(region, &mmu_region);
 }
 
 int vm_mapproc_region(struct proc_info * proc, struct buf * region)
@@ -699,6 +970,148 @@ int vm_mapproc_region(struct proc_info * proc, struct buf * region)
     return vm_map_region(region, vpt);
 }
 
+/**
+ * Map a single page of a region to a process.
+ * @param mmu_region is a copy of the mmu struct of the region.
+ */
+static int vm_mapproc_page(struct proc_info * proc, mmu_region_t * mmu_region,
+                           size_t iblock, uintptr_t paddr)
+{
+    struct vm_pt * vpt;
+
+    vpt = ptlist_get_pt(&proc->mm, mmu_region->vaddr,
+                        mmu_sizeof_region(mmu_region), VM_PT_CREAT);
+    if (!vpt)
+        return -ENOMEM;
+
+    mmu_region->vaddr += iblock * MMU_PGSIZE_COARSE;
+    mmu_region->paddr = paddr;
+    mmu_region->num_pages = 1;
+    mmu_region->pt = &vpt->pt;
+
+    return mmu_map_region(mmu_region);
+}
+
+int vm_cow_page(struct proc_info * proc, int region_nr, uintptr_t vaddr)
+{
+    struct vm_mm_struct * const mm = &proc->mm;
+    struct buf * region;
+    struct buf * new_region;
+    mmu_region_t mmu_page;
+    uintptr_t paddr;
+    size_t iblock;
+    int excl, err;
+
+    mtx_lock(&mm->regions_lock);
+    region = (*mm->regions)[region_nr];
+    if (!region) {
+        mtx_unlock(&mm->regions_lock);
+        return -EFAULT;
+    }
+    if (!(region->b_uflags & VM_PROT_COW)) {
+        /* Someone else already resolved it. */
+        mtx_unlock(&mm->regions_lock);
+        return 0;
+    }
+    vm_cow_faults++;
+
+    if (!region->vm_ops->rpage && kobj_refcnt(&region->b_obj) == 1) {
+        /*
+         * Nobody else maps this region anymore, e.g. the child called exec,
+         * so it can be just taken over.
+         */
+        region->b_uflags &= ~VM_PROT_COW;
+        mtx_unlock(&mm->regions_lock);
+        vm_cow_reused++;
+
+        return vm_mapproc_region(proc, region);
+    }
+
+    if (!region->vm_ops->rpage || kobj_refcnt(&region->b_obj) > 1) {
+        if (region->vm_ops->rshadow) {
+            new_region = region->vm_ops->rshadow(region);
+        } else if (region->vm_ops->rclone) {
+            new_region = region->vm_ops->rclone(region);
+        } else {
+            mtx_unlock(&mm->regions_lock);
+            return -ENOTSUP;
+        }
+        mtx_unlock(&mm->regions_lock);
+        if (!new_region)
+            return -ENOMEM;
+
+        err = vm_replace_region(proc, new_region, region_nr, VM_INSOP_MAP_REG);
+        if (err || !new_region->vm_ops->rpage)
+            return err;
+
+        mtx_lock(&mm->regions_lock);
+        region = (*mm->regions)[region_nr];
+        if (region != new_region) {
+            mtx_unlock(&mm->regions_lock);
+            return 0;
+        }
+    }
+
+    /*
+     * Now the region is a page granular COW region only mapped by this
+     * process and only the faulting page needs to be copied.
+     */
+    iblock = (vaddr - region->b_mmu.vaddr) / MMU_PGSIZE_COARSE;
+    excl = region->vm_ops->rpage(region, iblock, VM_RPAGE_WRITE, &paddr);
+    mtx_lock(&region->lock);
+    mmu_page = region->b_mmu;
+    mtx_unlock(&region->lock);
+    mtx_unlock(&mm->regions_lock);
+    if (excl < 0)
+        return excl;
+
+    mmu_page.ap = MMU_AP_RWRW;
+
+    return vm_mapproc_page(proc, &mmu_page, iblock, paddr);
+}
+
+int vm_fill_page(struct proc_info * proc, int region_nr, uintptr_t vaddr)
+{
+    struct vm_mm_struct * const mm = &proc->mm;
+    struct buf * region;
+    mmu_region_t mmu_page;
+    uintptr_t paddr;
+    size_t iblock;
+    int err;
+
+    mtx_lock(&mm->regions_lock);
+    region = (*mm->regions)[region_nr];
+    if (!region) {
+        mtx_unlock(&mm->regions_lock);
+        return -EFAULT;
+    }
+    if (region->b_data || !region->vm_ops->rpage) {
+        /* The region is in core, it just needs to be mapped again. */
+        mtx_unlock(&mm->regions_lock);
+        return vm_mapproc_region(proc, region);
+    }
+
+    /* Reading the page in may sleep so hold a ref instead of the lock. */
+    if (region->vm_ops->rref)
+        region->vm_ops->rref(region);
+    mtx_unlock(&mm->regions_lock);
+
+    iblock = (vaddr - region->b_mmu.vaddr) / MMU_PGSIZE_COARSE;
+    err = region->vm_ops->rpage(region, iblock, VM_RPAGE_FILL, &paddr);
+    if (err >= 0) {
+        mtx_lock(&region->lock);
+        mmu_page = region->b_mmu;
+        mtx_unlock(&region->lock);
+
+        err = vm_mapproc_page(proc, &mmu_page, iblock, paddr);
+    }
+
+    if (region->vm_ops->rfree)
+        region->vm_ops->rfree(region);
+
+    return err;
+}
+
 int vm_unmapproc_region(struct proc_info * proc, struct buf * region)
 {
     struct vm_pt * vpt;
@@ -904,26 +1317,16 @@ int useracc_proc(__user const void * addr, size_t len, struct proc_info * proc,
         return 0;
 
     start = region->b_mmu.vaddr;
+    end = region_end(region) - 1;
 
-    /*
-     * Unfortunately sometimes the b_count is invalid.
-     */
-    if (unlikely(region->b_bcount == 0)) {
-        /* TODO and this is probably wrong too */
-        end = mmu_sizeof_region(&region->b_mmu);
-    } else {
-        end = region->b_bcount;
-    }
-    end += region->b_mmu.vaddr - 1;
+    if (!VM_ADDR_IS_IN_RANGE(uaddr, start, end))
+        return 0;
 
-    if ((rw & VM_PROT_WRITE) && (region->b_uflags & VM_PROT_COW)) {
-        /* FIXME We should inform the called */
-        KERROR(KERROR_WARN, "VMPROT_WRITE tested for COW region\n");
-    }
+    /* A write to a COW region is resolved by copyout() or a page fault. */
+    if ((rw & VM_PROT_WRITE) && (region->b_uflags & VM_PROT_COW))
+        return (region->b_uflags & VM_PROT_WRITE) != 0;
 
-    if (VM_ADDR_IS_IN_RANGE(uaddr, start, end))
-        return test_ap_user(rw, region);
-    return 0;
+    return test_ap_user(rw, region);
 }
 
 void vm_get_uapstring(char str[5], struct buf * bp)
@@ -0,0 +1,137 @@
+/**
+ *******************************************************************************
+ * @file    vm_regtree.c
+ * @author  Olli Vanhoja
+ * @brief   Interval tree of process memory regions.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+/*
+ * The tree is an augmented RB tree, each node maintains the highest end
+ * address of its subtree in max_end. RB_AUGMENT() is only called for the
+ * nodes the tree implementation touches while rebalancing, so insert and
+ * remove fix the path from the node to the root before changing the tree;
+ * after that every rotation sees valid child values and stays exact.
+ */
+#define RB_AUGMENT(x) vm_regtree_augment(x)
+
+#include <kerror.h>
+#include <libkern.h>
+#include <vm/vm.h>
+
+static void vm_regtree_augment(struct vm_region_node * node);
+static int vm_regtree_compare(struct vm_region_node * a,
+                              struct vm_region_node * b);
+
+RB_GENERATE_STATIC(vm_regtree, vm_region_node, entry_, vm_regtree_compare);
+
+static int vm_regtree_compare(struct vm_region_node * a,
+                              struct vm_region_node * b)
+{
+    if (a->start != b->start)
+        return (a->start < b->start) ? -1 : 1;
+    return a->region_nr - b->region_nr;
+}
+
+/**
+ * Recompute max_end of a node from its own interval and its children.
+ */
+static void vm_regtree_augment(struct vm_region_node * node)
+{
+    struct vm_region_node * child;
+    uintptr_t max_end = node->end;
+
+    child = RB_LEFT(node, entry_);
+    if (child && child->max_end > max_end)
+        max_end = child->max_end;
+    child = RB_RIGHT(node, entry_);
+    if (child && child->max_end > max_end)
+        max_end = child->max_end;
+
+    node->max_end = max_end;
+}
+
+void vm_regtree_insert(struct vm_regtree * head, struct vm_region_node * node)
+{
+    struct vm_region_node * tmp = RB_ROOT(head);
+
+    /*
+     * Every node on the search path will be an ancestor of the new node.
+     */
+    while (tmp) {
+        if (node->end > tmp->max_end)
+            tmp->max_end = node->end;
+        tmp = (vm_regtree_compare(node, tmp) < 0) ?
+            RB_LEFT(tmp, entry_) : RB_RIGHT(tmp, entry_);
+    }
+
+    node->max_end = node->end;
+    if (RB_INSERT(vm_regtree, head, node))
+        panic("Region node already in the tree");
+}
+
+void vm_regtree_remove(struct vm_regtree * head, struct vm_region_node * node)
+{
+    struct vm_region_node * tmp;
+
+    /*
+     * Make the node an empty interval and drop it from max_end of the
+     * ancestors before the tree is modified.
+     */
+    node->end = 0;
+    for (tmp = node; tmp; tmp = RB_PARENT(tmp, entry_)) {
+        vm_regtree_augment(tmp);
+    }
+
+    RB_REMOVE(vm_regtree, head, node);
+}
+
+struct vm_region_node * vm_regtree_find(struct vm_regtree * head,
+                                        uintptr_t start, uintptr_t end)
+{
+    struct vm_region_node * node = RB_ROOT(head);
+
+    while (node) {
+        struct vm_region_node * left = RB_LEFT(node, entry_);
+
+        /*
+         * If the left subtree reaches the range but doesn't overlap it then
+         * nothing on the right of it can overlap the range either.
+         */
+        if (left && left->max_end >= start) {
+            node = left;
+        } else if (node->start <= end && start <= node->end) {
+            return node;
+        } else if (node->start > end) {
+            return NULL;
+        } else {
+            node = RB_RIGHT(node, entry_);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,465 @@
+/**
+ *******************************************************************************
+ * @file    vm_text.c
+ * @author  Olli Vanhoja
+ * @brief   Demand paged and shared executable text.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <buf.h>
+#include <fs/fs.h>
+#include <kerror.h>
+#include <kmalloc.h>
+#include <kobj.h>
+#include <kstring.h>
+#include <libkern.h>
+#include <uio.h>
+#include <vm/vm.h>
+
+/*
+ * Read-only segments of executable files are mapped as demand paged sections.
+ * A page is read in from the file on the first access to it and the pages
+ * are shared by all the processes executing the same segment of the same
+ * vnode. A text cache entry lives as long as there is at least one section
+ * using it and it holds a reference to the vnode; Opening the vnode for
+ * writing fails with ETXTBSY meanwhile. The most recently executed entries
+ * are kept in core after their last user is gone, so running the same short
+ * lived command repeatedly doesn't read it in every time.
+ */
+
+#define VM_TEXT_HASH_SIZE 32
+#define VM_TEXT_KEEP configEXEC_TEXT_KEEP
+
+/**
+ * A cached read-only segment of an executable file.
+ */
+struct vm_text {
+    LIST_ENTRY(vm_text) vt_entry;
+    vnode_t * vt_vnode;     /*!< The file, a reference is held. */
+    off_t vt_foff;          /*!< File offset of the first page. */
+    size_t vt_start;        /*!< Start of the file data in the segment. */
+    size_t vt_end;          /*!< End of the file data in the segment. */
+    size_t vt_npages;       /*!< Number of pages in the segment. */
+    struct kobj vt_obj;
+    mtx_t vt_lock;          /*!< Protects vt_pages. */
+    struct buf * vt_pages[0]; /*!< Pages read in or NULL. */
+};
+
+static LIST_HEAD(vm_text_list, vm_text) vm_text_hash[VM_TEXT_HASH_SIZE];
+/** Recently used entries, a reference is held to each. */
+static struct vm_text * vm_text_keep[VM_TEXT_KEEP];
+static size_t vm_text_keep_next;
+static mtx_t vm_text_lock = MTX_INITIALIZER(MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+
+SYSCTL_DECL(_vm_text);
+SYSCTL_NODE(_vm, OID_AUTO, text, CTLFLAG_RW, 0,
+            "Executable text cache stats");
+
+static unsigned vm_text_hits;
+SYSCTL_UINT(_vm_text, OID_AUTO, hits, CTLFLAG_RD, &vm_text_hits, 0,
+            "Number of text sections found from the cache");
+
+static unsigned vm_text_misses;
+SYSCTL_UINT(_vm_text, OID_AUTO, misses, CTLFLAG_RD, &vm_text_misses, 0,
+            "Number of text sections not found from the cache");
+
+static unsigned vm_text_pageins;
+SYSCTL_UINT(_vm_text, OID_AUTO, pageins, CTLFLAG_RD, &vm_text_pageins, 0,
+            "Number of text pages read in");
+
+static void vm_text_rref(struct buf * bp);
+static struct buf * vm_text_rclone(struct buf * old_region);
+static int vm_text_rpage(struct buf * bp, size_t iblock, int flags,
+                         uintptr_t * paddr);
+static void vm_text_rfree(struct buf * bp);
+
+static const vm_ops_t vm_text_ops = {
+    .rref = vm_text_rref,
+    .rclone = vm_text_rclone,
+    .rpage = vm_text_rpage,
+    .rfree = vm_text_rfree,
+};
+
+static struct vm_text_list * vm_text_bucket(vnode_t * vn)
+{
+    return &vm_text_hash[((uintptr_t)vn / sizeof(vnode_t)) %
+                         VM_TEXT_HASH_SIZE];
+}
+
+/**
+ * vm_text free callback.
+ * This function is called by kobj.
+ */
+static void vm_text_free(struct kobj * obj)
+{
+    struct vm_text * vt = containerof(obj, struct vm_text, vt_obj);
+
+    mtx_lock(&vm_text_lock);
+    LIST_REMOVE(vt, vt_entry);
+    mtx_unlock(&vm_text_lock);
+
+    for (size_t i = 0; i < vt->vt_npages; i++) {
+        if (vt->vt_pages[i])
+            vrfree(vt->vt_pages[i]);
+    }
+    vrele(vt->vt_vnode);
+    kfree(vt);
+}
+
+static struct vm_text * vm_text_find(vnode_t * vn, off_t foff, size_t start,
+                                     size_t end, size_t npages)
+{
+    struct vm_text * vt;
+
+    KASSERT(mtx_test(&vm_text_lock), "vm_text_lock should be locked");
+
+    LIST_FOREACH(vt, vm_text_bucket(vn), vt_entry) {
+        if (vt->vt_vnode == vn && vt->vt_foff == foff &&
+            vt->vt_start == start && vt->vt_end == end &&
+            vt->vt_npages == npages && kobj_ref(&vt->vt_obj) == 0)
+            return vt;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get a text cache entry for a segment, a new entry is created if the
+ * segment is not found from the cache.
+ */
+static struct vm_text * vm_text_get(vnode_t * vn, off_t foff, size_t start,
+                                    size_t end, size_t npages)
+{
+    struct vm_text * vt;
+    struct vm_text * found;
+
+    mtx_lock(&vm_text_lock);
+    vt = vm_text_find(vn, foff, start, end, npages);
+    mtx_unlock(&vm_text_lock);
+    if (vt) {
+        vm_text_hits++;
+        return vt;
+    }
+
+    vt = kzalloc(sizeof(struct vm_text) + npages * sizeof(struct buf *));
+    if (!vt)
+        return NULL;
+
+    if (vref(vn)) {
+        kfree(vt);
+        return NULL;
+    }
+    vt->vt_vnode = vn;
+    vt->vt_foff = foff;
+    vt->vt_start = start;
+    vt->vt_end = end;
+    vt->vt_npages = npages;
+    kobj_init(&vt->vt_obj, vm_text_free);
+    mtx_init(&vt->vt_lock, MTX_TYPE_SPIN, MTX_OPT_DEFAULT);
+
+    mtx_lock(&vm_text_lock);
+    found = vm_text_find(vn, foff, start, end, npages);
+    if (!found)
+        LIST_INSERT_HEAD(vm_text_bucket(vn), vt, vt_entry);
+    mtx_unlock(&vm_text_lock);
+
+    if (found) {
+        /* Someone else created the same entry meanwhile. */
+        vrele(vn);
+        kfree(vt);
+        vm_text_hits++;
+        return found;
+    }
+
+    vm_text_misses++;
+    return vt;
+}
+
+/**
+ * Keep a text cache entry in core after its last user is gone.
+ */
+static void vm_text_keep_add(struct vm_text * vt)
+{
+    struct vm_text * old;
+
+    mtx_lock(&vm_text_lock);
+    for (size_t i = 0; i < VM_TEXT_KEEP; i++) {
+        if (vm_text_keep[i] == vt) {
+            mtx_unlock(&vm_text_lock);
+            return;
+        }
+    }
+    if (kobj_ref(&vt->vt_obj)) {
+        mtx_unlock(&vm_text_lock);
+        return;
+    }
+    old = vm_text_keep[vm_text_keep_next];
+    vm_text_keep[vm_text_keep_next] = vt;
+    vm_text_keep_next = (vm_text_keep_next + 1) % VM_TEXT_KEEP;
+    mtx_unlock(&vm_text_lock);
+
+    if (old)
+        kobj_unref(&old->vt_obj);
+}
+
+/**
+ * Drop the kept entries of a vnode or of a superblock.
+ */
+static void vm_text_keep_drop(vnode_t * vn, struct fs_superblock * sb)
+{
+    struct vm_text * drop[VM_TEXT_KEEP];
+    size_t n = 0;
+
+    mtx_lock(&vm_text_lock);
+    for (size_t i = 0; i < VM_TEXT_KEEP; i++) {
+        struct vm_text * vt = vm_text_keep[i];
+
+        if (vt && ((vn && vt->vt_vnode == vn) ||
+                   (sb && vt->vt_vnode->sb == sb))) {
+            drop[n++] = vt;
+            vm_text_keep[i] = NULL;
+        }
+    }
+    mtx_unlock(&vm_text_lock);
+
+    for (size_t i = 0; i < n; i++) {
+        kobj_unref(&drop[i]->vt_obj);
+    }
+}
+
+/**
+ * Read in a page of a text segment.
+ * @note vt_lock must not be held as the read may block.
+ */
+static struct buf * vm_text_pagein(struct vm_text * vt, size_t iblock)
+{
+    const size_t pstart = iblock * MMU_PGSIZE_COARSE;
+    const size_t pend = pstart + MMU_PGSIZE_COARSE;
+    const size_t start = max(pstart, vt->vt_start);
+    const size_t end = min(pend, vt->vt_end);
+    vnode_t * vn = vt->vt_vnode;
+    struct buf * pg;
+
+    pg = geteblk(MMU_PGSIZE_COARSE); /* Zeroed by geteblk(). */
+    if (!pg)
+        return NULL;
+
+    if (start < end) {
+        file_t file;
+        struct uio uio;
+        ssize_t n;
+
+        fs_fildes_set(&file, vn, O_RDONLY);
+        n = vn->vnode_ops->lseek(&file, vt->vt_foff + start, SEEK_SET);
+        if (n >= 0) {
+            uio_init_kbuf(&uio, (void *)(pg->b_data + start - pstart),
+                          end - start);
+            n = vn->vnode_ops->read(&file, &uio, end - start);
+        }
+        if (n < 0) {
+            KERROR_DBG("%s: Failed to read a text page (%d)\n",
+                       __func__, (int)n);
+            vrfree(pg);
+            return NULL;
+        }
+    }
+
+    vm_text_pageins++;
+
+    return pg;
+}
+
+/**
+ * Text section free callback.
+ * This function is called by kobj.
+ */
+static void vm_text_buf_free(struct kobj * obj)
+{
+    struct buf * bp = containerof(obj, struct buf, b_obj);
+    struct vm_text * vt = bp->allocator_data;
+
+    kobj_unref(&vt->vt_obj);
+    kfree(bp);
+}
+
+struct buf * vm_text_newsect(struct vnode * vn, off_t offset, size_t filesz,
+                             uintptr_t vaddr, size_t size, int prot)
+{
+    const uintptr_t start_vaddr = vaddr & ~(MMU_PGSIZE_COARSE - 1);
+    const size_t start = vaddr - start_vaddr;
+    const size_t bufsize = memalign_size(start + size, MMU_PGSIZE_COARSE);
+    struct vm_text * vt;
+    struct buf * bp;
+
+    if ((prot & VM_PROT_WRITE) || filesz > size || offset < (off_t)start ||
+        !S_ISREG(vn->vn_mode))
+        return NULL;
+
+    bp = kzalloc(sizeof(struct buf));
+    if (!bp)
+        return NULL;
+
+    vt = vm_text_get(vn, offset - start, start, start + filesz,
+                     bufsize / MMU_PGSIZE_COARSE);
+    if (!vt) {
+        kfree(bp);
+        return NULL;
+    }
+
+    mtx_init(&bp->lock, MTX_TYPE_TICKET, 0);
+    bp->b_data = 0; /* Not in core. */
+    bp->b_bufsize = bufsize;
+    bp->b_bcount = start + size;
+    bp->b_flags = B_BUSY;
+    bp->b_uflags = prot & ~VM_PROT_COW;
+    bp->b_mmu.vaddr = start_vaddr;
+    bp->b_mmu.num_pages = vt->vt_npages;
+    bp->b_mmu.control = MMU_CTRL_MEMTYPE_WB;
+    kobj_init(&bp->b_obj, vm_text_buf_free);
+    bp->allocator_data = vt;
+    bp->vm_ops = &vm_text_ops;
+    vm_updateusr_ap(bp);
+    vm_text_keep_add(vt);
+
+    return bp;
+}
+
+int vm_text_purge(struct vnode * vn)
+{
+    struct vm_text * vt;
+    int retval = 0;
+
+    vm_text_keep_drop(vn, NULL);
+
+    mtx_lock(&vm_text_lock);
+    LIST_FOREACH(vt, vm_text_bucket(vn), vt_entry) {
+        if (vt->vt_vnode == vn && kobj_refcnt(&vt->vt_obj) > 0) {
+            retval = -ETXTBSY;
+            break;
+        }
+    }
+    mtx_unlock(&vm_text_lock);
+
+    return retval;
+}
+
+void vm_text_purge_sb(struct fs_superblock * sb)
+{
+    vm_text_keep_drop(NULL, sb);
+}
+
+static void vm_text_rref(struct buf * bp)
+{
+    if (kobj_ref(&bp->b_obj))
+        panic("vm_text_rref error");
+}
+
+static void vm_text_rfree(struct buf * bp)
+{
+    kobj_unref(&bp->b_obj);
+}
+
+static int vm_text_rpage(struct buf * bp, size_t iblock, int flags,
+                         uintptr_t * paddr)
+{
+    struct vm_text * vt = bp->allocator_data;
+    struct buf * pg;
+    int retval = 0; /* Text pages are always shared. */
+
+    if (iblock >= vt->vt_npages)
+        return -EINVAL;
+    if (flags & VM_RPAGE_WRITE)
+        return -EACCES;
+
+    mtx_lock(&vt->vt_lock);
+    pg = vt->vt_pages[iblock];
+    mtx_unlock(&vt->vt_lock);
+    if (!pg && (flags & VM_RPAGE_FILL)) {
+        struct buf * npg;
+
+        npg = vm_text_pagein(vt, iblock);
+        if (!npg)
+            return -EIO;
+
+        /* Another thread may have read in the same page meanwhile. */
+        mtx_lock(&vt->vt_lock);
+        pg = vt->vt_pages[iblock];
+        if (!pg) {
+            pg = npg;
+            vt->vt_pages[iblock] = pg;
+            npg = NULL;
+        }
+        mtx_unlock(&vt->vt_lock);
+        if (npg)
+            vrfree(npg);
+    } else if (!pg) {
+        return -ENOENT;
+    }
+    *paddr = pg->b_mmu.paddr;
+
+    return retval;
+}
+
+/**
+ * Clone a text section into a new private vregion.
+ */
+static struct buf * vm_text_rclone(struct buf * old_region)
+{
+    struct vm_text * vt = old_region->allocator_data;
+    struct buf * new_region;
+
+    new_region = geteblk(old_region->b_bufsize);
+    if (!new_region)
+        return NULL;
+
+    for (size_t i = 0; i < vt->vt_npages; i++) {
+        uintptr_t paddr;
+        int err;
+
+        err = vm_text_rpage(old_region, i, VM_RPAGE_FILL, &paddr);
+        if (err < 0) {
+            vrfree(new_region);
+            return NULL;
+        }
+        /* Kernel space is 1:1. */
+        memcpy((void *)(new_region->b_data + i * MMU_PGSIZE_COARSE),
+               (void *)paddr, MMU_PGSIZE_COARSE);
+    }
+
+    new_region->b_uflags = old_region->b_uflags & ~VM_PROT_COW;
+    new_region->b_mmu.vaddr = old_region->b_mmu.vaddr;
+    new_region->b_mmu.control = old_region->b_mmu.control;
+    vm_updateusr_ap(new_region);
+
+    return new_region;
+}
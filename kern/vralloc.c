@@ -62,9 +62,27 @@ struct vregion {
     unsigned magic;
 #endif
     size_t size;        /*!< Size of allocation bitmap in bytes. */
+    /**
+     * Per-page count of COW regions that have released their reference to
+     * the page by taking a private copy of it.
+     */
+    atomic_t * prel;
     bitmap_t map[0];    /*!< Bitmap of reserved pages. */
 };
 
+/**
+ * Page granular COW region.
+ * A COW region shares the pages of its backing region and a page is copied
+ * to a private single page buffer only when it's written to. The reference
+ * count of a shared page is the reference count of the backing region minus
+ * the number of COW regions that have released the page, this way taking a
+ * new reference to a whole region on fork() stays O(1).
+ */
+struct vr_cow {
+    struct buf * backing;   /*!< The region owning the shared pages. */
+    struct buf * pages[0];  /*!< Private copies or NULL if shared. */
+};
+
 #define DMEM_BLOCK_SIZE (DYNMEM_PAGE_SIZE / MMU_PGSIZE_COARSE)
 
 #define VREG_SIZE(count) \
@@ -87,11 +105,17 @@ struct vregion {
 static struct vregion * vreg_alloc_node(size_t count);
 static void vrref(struct buf * region);
 static struct buf * vr_rclone(struct buf * old_region);
+static struct buf * vr_rshadow(struct buf * cur_region);
+static struct buf * vr_cow_rclone(struct buf * old_region);
+static int vr_cow_rpage(struct buf * bp, size_t iblock, int flags,
+                        uintptr_t * paddr);
 
 /** List of all allocations done by vralloc. */
 static LIST_HEAD(vrlisthead, vregion) vrlist_head =
     LIST_HEAD_INITIALIZER(vrlisthead);
-static mtx_t vr_big_lock = MTX_INITIALIZER(MTX_TYPE_TICKET, MTX_OPT_DINT);
+MTX_LOCK_CLASS(vr_big, "vralloc big lock");
+static mtx_t vr_big_lock = MTX_INITIALIZER_CLASS(MTX_TYPE_TICKET, MTX_OPT_DINT,
+                                                 vr_big);
 
 SYSCTL_DECL(_vm_vralloc);
 SYSCTL_NODE(_vm, OID_AUTO, vralloc, CTLFLAG_RW, 0,
@@ -105,12 +129,30 @@ static size_t vralloc_used;
 SYSCTL_UINT(_vm_vralloc, OID_AUTO, used, CTLFLAG_RD, &vralloc_used, 0,
             "Amount of vralloc memory used");
 
+SYSCTL_DECL(_vm_cow);
+
+static unsigned vr_cow_copied;
+SYSCTL_UINT(_vm_cow, OID_AUTO, pages_copied, CTLFLAG_RD, &vr_cow_copied, 0,
+            "Number of pages copied by COW");
+
 /**
  * VRA specific operations for allocated vm regions.
  */
 static const vm_ops_t vra_ops = {
     .rref = vrref,
     .rclone = vr_rclone,
+    .rshadow = vr_rshadow,
+    .rfree = vrfree
+};
+
+/**
+ * VRA operations for page granular COW regions.
+ */
+static const vm_ops_t vra_cow_ops = {
+    .rref = vrref,
+    .rclone = vr_cow_rclone,
+    .rshadow = vr_rshadow,
+    .rpage = vr_cow_rpage,
     .rfree = vrfree
 };
 
@@ -152,10 +194,17 @@ static struct vregion * vreg_alloc_node(size_t count)
     if (!vreg)
         return NULL;
 
+    vreg->prel = kzalloc(count * sizeof(atomic_t));
+    if (!vreg->prel) {
+        kfree(vreg);
+        return NULL;
+    }
+
     vreg->kaddr = (uintptr_t)dynmem_alloc_region(count / DMEM_BLOCK_SIZE,
                                                  MMU_AP_RWNA,
                                                  MMU_CTRL_MEMTYPE_WB);
     if (vreg->kaddr == 0) {
+        kfree(vreg->prel);
         kfree(vreg);
         return NULL;
     }
@@ -173,6 +222,23 @@ static struct vregion * vreg_alloc_node(size_t count)
     return vreg;
 }
 
+/**
+ * Get the alignment of an allocation in pages.
+ * Big allocations are aligned physically so that they can be mapped with
+ * large pages or sections. vregion nodes are always aligned to a section.
+ * @param pcount is the number of pages requested.
+ */
+static size_t vreg_balign(size_t pcount)
+{
+#ifdef configMMU_LARGE_PAGES
+    if (pcount >= VREG_PCOUNT(MMU_PGSIZE_SECTION))
+        return VREG_PCOUNT(MMU_PGSIZE_SECTION);
+    if (pcount >= VREG_PCOUNT(MMU_PGSIZE_LARGE))
+        return VREG_PCOUNT(MMU_PGSIZE_LARGE);
+#endif
+    return 1;
+}
+
 /**
  * Get pcount number of unallocated pages.
  * @note needs to get vr_big_lock.
@@ -182,16 +248,16 @@ static struct vregion * vreg_alloc_node(size_t count)
  */
 static struct vregion * get_iblocks(size_t * iblock, size_t pcount)
 {
+    const size_t balign = vreg_balign(pcount);
     struct vregion * vreg_temp;
     struct vregion * vreg = NULL;
-    int err;
 
     mtx_lock(&vr_big_lock);
 
 retry:
     LIST_FOREACH(vreg_temp, &vrlist_head, _entry) {
-        if (bitmap_block_search(iblock, pcount, vreg_temp->map,
-                                vreg_temp->size) == 0) {
+        if (bitmap_block_align_alloc(iblock, pcount, vreg_temp->map,
+                                     vreg_temp->size, balign) == 0) {
             vreg = vreg_temp;
             break; /* Found a block */
         }
@@ -204,8 +270,6 @@ retry:
         goto retry;
     }
 
-    err = bitmap_block_update(vreg->map, 1, *iblock, pcount, vreg->size);
-    KASSERT(err == 0, "vreg map update OOB");
     vreg->count += pcount;
     vralloc_used += VREG_BYTESIZE(pcount);
 out:
@@ -237,6 +301,9 @@ static void vreg_free_callback(struct kobj * obj)
     err = bitmap_block_update(vreg->map, 0, iblock, bcount, vreg->size);
     KASSERT(err == 0, "vreg map update OOB");
     vreg->count -= bcount;
+    for (size_t i = iblock; i < iblock + bcount; i++) {
+        atomic_set(&vreg->prel[i], 0);
+    }
 
     vralloc_used -= bp->b_bufsize; /* Update stats */
 
@@ -247,6 +314,7 @@ static void vreg_free_callback(struct kobj * obj)
         mtx_unlock(&vr_big_lock);
 
         dynmem_free_region((void *)vreg->kaddr);
+        kfree(vreg->prel);
         kfree(vreg);
     } else {
         mtx_unlock(&vr_big_lock);
@@ -349,6 +417,208 @@ static struct buf * vr_rclone(struct buf * old_region)
     return new_region;
 }
 
+/**
+ * Get the reference count of a page of a vralloc region.
+ */
+static int vr_page_refcnt(struct buf * bp, size_t iblock)
+{
+    struct vregion * vreg = bp->allocator_data;
+    const size_t i = VREG_ADDR2I(vreg, bp->b_data) + iblock;
+
+    return kobj_refcnt(&bp->b_obj) - atomic_read(&vreg->prel[i]);
+}
+
+/**
+ * Release or reacquire a COW reference to a page of a vralloc region.
+ */
+static void vr_page_release(struct buf * bp, size_t iblock, int release)
+{
+    struct vregion * vreg = bp->allocator_data;
+    const size_t i = VREG_ADDR2I(vreg, bp->b_data) + iblock;
+
+    if (release)
+        atomic_inc(&vreg->prel[i]);
+    else
+        atomic_dec(&vreg->prel[i]);
+}
+
+/**
+ * Get a kernel address of a page of a COW region.
+ */
+static uintptr_t vr_cow_page_kaddr(struct vr_cow * cow, size_t iblock)
+{
+    struct buf * pg = cow->pages[iblock];
+
+    if (pg)
+        return pg->b_data;
+    return cow->backing->b_data + VREG_BYTESIZE(iblock);
+}
+
+/**
+ * COW region free callback.
+ * This function is called by kobj.
+ */
+static void vr_cow_free_callback(struct kobj * obj)
+{
+    struct buf * bp = containerof(obj, struct buf, b_obj);
+    struct vr_cow * cow = (struct vr_cow *)(bp->allocator_data);
+    const size_t pcount = VREG_PCOUNT(bp->b_bufsize);
+
+    for (size_t i = 0; i < pcount; i++) {
+        struct buf * pg = cow->pages[i];
+
+        if (pg) {
+            vr_page_release(cow->backing, i, 0);
+            vrfree(pg);
+        }
+    }
+    vrfree(cow->backing);
+
+    kfree(cow);
+    kfree(bp);
+}
+
+/**
+ * Create a page granular COW region sharing the pages of cur_region.
+ * If cur_region is a COW region itself the new region is created from the
+ * same backing region and its private pages are shared too, so a chain of
+ * COW regions is never formed.
+ * @param cur_region is the region to be shared.
+ * @return  Returns a pointer to the new region if operation was successful;
+ *          Otherwise zero.
+ */
+static struct buf * vr_rshadow(struct buf * cur_region)
+{
+    const size_t pcount = VREG_PCOUNT(cur_region->b_bufsize);
+    struct vr_cow * cur_cow = NULL;
+    struct vr_cow * cow;
+    struct buf * bp;
+
+    bp = kzalloc(sizeof(struct buf));
+    cow = kzalloc(sizeof(struct vr_cow) + pcount * sizeof(struct buf *));
+    if (!bp || !cow) {
+        kfree(bp);
+        kfree(cow);
+        return NULL;
+    }
+
+    mtx_lock(&cur_region->lock);
+    if (cur_region->vm_ops == &vra_cow_ops) {
+        cur_cow = cur_region->allocator_data;
+        cow->backing = cur_cow->backing;
+    } else {
+        cow->backing = cur_region;
+    }
+    vrref(cow->backing);
+
+    if (cur_cow) {
+        for (size_t i = 0; i < pcount; i++) {
+            struct buf * pg = cur_cow->pages[i];
+
+            if (pg) {
+                vrref(pg);
+                vr_page_release(cow->backing, i, 1);
+                cow->pages[i] = pg;
+            }
+        }
+    }
+
+    mtx_init(&bp->lock, MTX_TYPE_TICKET, 0);
+    bp->b_mmu = cur_region->b_mmu;
+    bp->b_data = cur_region->b_data; /* Shared pages only. */
+    bp->b_bufsize = cur_region->b_bufsize;
+    bp->b_bcount = cur_region->b_bcount;
+    bp->b_flags = B_BUSY;
+    bp->b_uflags = cur_region->b_uflags | VM_PROT_COW;
+    mtx_unlock(&cur_region->lock);
+
+    kobj_init(&bp->b_obj, vr_cow_free_callback);
+    bp->allocator_data = cow;
+    bp->vm_ops = &vra_cow_ops;
+    vm_updateusr_ap(bp);
+
+    return bp;
+}
+
+/**
+ * Clone a page granular COW region into a new contiguous vregion.
+ */
+static struct buf * vr_cow_rclone(struct buf * old_region)
+{
+    struct vr_cow * cow = old_region->allocator_data;
+    const size_t pcount = VREG_PCOUNT(old_region->b_bufsize);
+    struct buf * new_region;
+
+    new_region = geteblk(old_region->b_bufsize);
+    if (!new_region)
+        return NULL;
+
+    mtx_lock(&old_region->lock);
+    for (size_t i = 0; i < pcount; i++) {
+        memcpy((void *)(new_region->b_data + VREG_BYTESIZE(i)),
+               (void *)vr_cow_page_kaddr(cow, i), MMU_PGSIZE_COARSE);
+    }
+
+    new_region->b_uflags = ~VM_PROT_COW & old_region->b_uflags;
+    new_region->b_mmu.vaddr = old_region->b_mmu.vaddr;
+    new_region->b_mmu.ap = old_region->b_mmu.ap;
+    new_region->b_mmu.control = old_region->b_mmu.control;
+    new_region->b_mmu.pt = old_region->b_mmu.pt;
+    mtx_unlock(&old_region->lock);
+    vm_updateusr_ap(new_region);
+
+    return new_region;
+}
+
+static int vr_cow_rpage(struct buf * bp, size_t iblock, int flags,
+                        uintptr_t * paddr)
+{
+    struct vr_cow * cow = bp->allocator_data;
+    struct buf * pg;
+    int excl;
+
+    if (iblock >= VREG_PCOUNT(bp->b_bufsize))
+        return -EINVAL;
+
+    mtx_lock(&bp->lock);
+
+    pg = cow->pages[iblock];
+    excl = kobj_refcnt(&bp->b_obj) == 1;
+    if (pg)
+        excl = excl && kobj_refcnt(&pg->b_obj) == 1;
+    else
+        excl = excl && vr_page_refcnt(cow->backing, iblock) == 1;
+
+    if ((flags & VM_RPAGE_WRITE) && !excl) {
+        struct buf * new_pg;
+
+        KASSERT(kobj_refcnt(&bp->b_obj) == 1, "COW region can't be shared");
+
+        new_pg = geteblk(MMU_PGSIZE_COARSE);
+        if (!new_pg) {
+            mtx_unlock(&bp->lock);
+            return -ENOMEM;
+        }
+        memcpy((void *)new_pg->b_data, (void *)vr_cow_page_kaddr(cow, iblock),
+               MMU_PGSIZE_COARSE);
+
+        if (pg)
+            vrfree(pg);
+        else
+            vr_page_release(cow->backing, iblock, 1);
+        cow->pages[iblock] = pg = new_pg;
+        excl = 1;
+        vr_cow_copied++;
+    }
+
+    *paddr = (pg) ? pg->b_mmu.paddr :
+                    cow->backing->b_mmu.paddr + VREG_BYTESIZE(iblock);
+
+    mtx_unlock(&bp->lock);
+
+    return excl;
+}
+
 void allocbuf(struct buf * bp, size_t size)
 {
     const size_t orig_size = size;
@@ -441,7 +711,8 @@ int clone2vr(struct buf * src, struct buf ** out)
     KASSERT(src != NULL, "src arg must be set");
     KASSERT(out != NULL, "out arg must be set");
 
-    if (src->vm_ops == &vra_ops && src->vm_ops->rclone) {
+    if ((src->vm_ops == &vra_ops || src->vm_ops == &vra_cow_ops) &&
+        src->vm_ops->rclone) {
         /* If the buffer is vrallocated already we can just call rclone(). */
         new = src->vm_ops->rclone(src);
         if (!new) {
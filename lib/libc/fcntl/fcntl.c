@@ -54,8 +54,14 @@ int fcntl(int fildes, int cmd, ...)
     case F_SETFD:
     case F_SETFL:
     case F_SETOWN:
+    case F_SETPIPE_SZ:
         args.third.ival = va_arg(ap, int);
         break;
+    case F_GETFD:
+    case F_GETFL:
+    case F_GETOWN:
+    case F_GETPIPE_SZ:
+        break;
     case F_GETLK:
     case F_SETLK:
     case F_SETLKW:
@@ -0,0 +1,61 @@
+/**
+ *******************************************************************************
+ * @file    splice.c
+ * @author  Olli Vanhoja
+ * @brief   Move data between a pipe and a file.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+#define __SYSCALL_DEFS__
+#include <fcntl.h>
+#include <stddef.h>
+#include <syscall.h>
+
+ssize_t splice(int fd_in, off_t * off_in, int fd_out, off_t * off_out,
+               size_t len, unsigned int flags)
+{
+    struct _fs_splice_args args = {
+        .fd_in = fd_in,
+        .off_in = (off_in) ? *off_in : -1,
+        .fd_out = fd_out,
+        .off_out = (off_out) ? *off_out : -1,
+        .len = len,
+        .flags = flags,
+    };
+    ssize_t retval;
+
+    retval = (ssize_t)syscall(SYSCALL_FS_SPLICE, &args);
+    if (retval < 0)
+        return retval;
+
+    if (off_in)
+        *off_in = args.off_in;
+    if (off_out)
+        *off_out = args.off_out;
+
+    return retval;
+}
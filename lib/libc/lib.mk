@@ -27,6 +27,7 @@ $(wildcard libc/resource/*.c) \
 $(wildcard libc/sched/*.c) \
 $(wildcard libc/setjmp/*.c) \
 $(wildcard libc/signal/*.c) \
+$(wildcard libc/spawn/*.c) \
 $(wildcard libc/stat/*.c) \
 $(wildcard libc/statvfs/*.c) \
 $(wildcard libc/stdio/*.c) \
@@ -0,0 +1,188 @@
+/**
+ *******************************************************************************
+ * @file    posix_spawn.c
+ * @author  Olli Vanhoja
+ * @brief   Spawn a new process.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+#define __SYSCALL_DEFS__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <paths.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+
+static size_t vcount(char * const arr[])
+{
+    size_t i = 0;
+
+    if (!arr)
+        return 0;
+
+    while (arr[i++]);
+
+    return i;
+}
+
+static char * execat(char * s1, const char * s2, char * si)
+{
+    char * s = si;
+
+    while (*s1 && *s1 != ':') {
+        *s++ = *s1++;
+    }
+    if (si != s)
+        *s++ = '/';
+    while (*s2) {
+        *s++ = *s2++;
+    }
+    *s = '\0';
+
+    return *s1 ? ++s1 : NULL;
+}
+
+static int spawn(pid_t * restrict pid, const char * restrict path,
+                 const posix_spawn_file_actions_t * file_actions,
+                 const posix_spawnattr_t * restrict attrp,
+                 char * const argv[], char * const envp[])
+{
+    struct _exec_spawn_args args = {
+        .argv = argv,
+        .env = envp,
+    };
+    intptr_t retval;
+    int err = 0;
+
+    if (attrp)
+        args.attr = *attrp;
+    else
+        posix_spawnattr_init(&args.attr);
+
+    if (file_actions) {
+        if (file_actions->fa_count > _SPAWN_FA_MAX)
+            return ENOMEM;
+        args.fa = file_actions->fa_actions;
+        args.nfa = file_actions->fa_count;
+    }
+
+    args.fd = open(path, O_EXEC);
+    if (args.fd < 0)
+        return errno;
+
+    args.nargv = vcount(argv);
+    args.nenv = vcount(envp);
+    retval = syscall(SYSCALL_EXEC_SPAWN, &args);
+    if (retval < 0)
+        err = errno;
+    else if (pid)
+        *pid = (pid_t)retval;
+
+    close(args.fd);
+
+    return err;
+}
+
+/**
+ * Run a file that is not an executable image with the shell.
+ */
+static int spawn_script(pid_t * restrict pid, const char * restrict path,
+                        const posix_spawn_file_actions_t * file_actions,
+                        const posix_spawnattr_t * restrict attrp,
+                        char * const argv[], char * const envp[])
+{
+    const size_t argc = (argv && argv[0]) ? vcount(argv) - 1 : 1;
+    char ** newargv;
+    int err;
+
+    newargv = malloc((argc + 2) * sizeof(char *));
+    if (!newargv)
+        return ENOMEM;
+
+    newargv[0] = _PATH_BSHELL;
+    newargv[1] = (char *)path;
+    for (size_t i = 1; i < argc; i++) {
+        newargv[i + 1] = argv[i];
+    }
+    newargv[argc + 1] = NULL;
+
+    err = spawn(pid, _PATH_BSHELL, file_actions, attrp, newargv, envp);
+    free(newargv);
+
+    return err;
+}
+
+int posix_spawn(pid_t * restrict pid, const char * restrict path,
+                const posix_spawn_file_actions_t * file_actions,
+                const posix_spawnattr_t * restrict attrp,
+                char * const argv[restrict], char * const envp[restrict])
+{
+    return spawn(pid, path, file_actions, attrp, argv, envp);
+}
+
+int posix_spawnp(pid_t * restrict pid, const char * restrict file,
+                 const posix_spawn_file_actions_t * file_actions,
+                 const posix_spawnattr_t * restrict attrp,
+                 char * const argv[restrict], char * const envp[restrict])
+{
+    char * pathstr;
+    char * cp;
+    char fname[PATH_MAX];
+    int eacces = 0;
+    int err = ENOENT;
+
+    pathstr = getenv("PATH");
+    if (!pathstr)
+        pathstr = _PATH_STDPATH;
+    cp = strchr(file, '/') ? "" : pathstr;
+
+    do {
+        cp = execat(cp, file, fname);
+        err = spawn(pid, fname, file_actions, attrp, argv, envp);
+        switch (err) {
+        case 0:
+            return 0;
+        case ENOEXEC:
+            return spawn_script(pid, fname, file_actions, attrp, argv, envp);
+        case EACCES:
+            eacces = 1;
+            break;
+        case ENOENT:
+        case ENOTDIR:
+            break;
+        default:
+            return err;
+        }
+    } while (cp);
+
+    return (eacces) ? EACCES : err;
+}
@@ -0,0 +1,149 @@
+/**
+ *******************************************************************************
+ * @file    posix_spawn_file_actions.c
+ * @author  Olli Vanhoja
+ * @brief   Spawn file actions.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct _spawn_file_action *
+fa_new(posix_spawn_file_actions_t * file_actions)
+{
+    if (file_actions->fa_count == file_actions->fa_size) {
+        const size_t new_size = file_actions->fa_size + 4;
+        struct _spawn_file_action * actions;
+
+        actions = realloc(file_actions->fa_actions,
+                          new_size * sizeof(struct _spawn_file_action));
+        if (!actions)
+            return NULL;
+
+        file_actions->fa_actions = actions;
+        file_actions->fa_size = new_size;
+    }
+
+    return &file_actions->fa_actions[file_actions->fa_count++];
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t * file_actions)
+{
+    *file_actions = (posix_spawn_file_actions_t){
+        .fa_count = 0,
+        .fa_size = 0,
+        .fa_actions = NULL,
+    };
+
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t * file_actions)
+{
+    for (size_t i = 0; i < file_actions->fa_count; i++) {
+        free(file_actions->fa_actions[i].fa_path);
+    }
+    free(file_actions->fa_actions);
+
+    return posix_spawn_file_actions_init(file_actions);
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t * file_actions,
+                                      int fildes)
+{
+    struct _spawn_file_action * fa;
+
+    if (fildes < 0)
+        return EBADF;
+
+    fa = fa_new(file_actions);
+    if (!fa)
+        return ENOMEM;
+
+    *fa = (struct _spawn_file_action){
+        .fa_type = _SPAWN_FA_CLOSE,
+        .fa_fd = fildes,
+    };
+
+    return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t * file_actions,
+                                     int fildes, int newfildes)
+{
+    struct _spawn_file_action * fa;
+
+    if (fildes < 0 || newfildes < 0)
+        return EBADF;
+
+    fa = fa_new(file_actions);
+    if (!fa)
+        return ENOMEM;
+
+    *fa = (struct _spawn_file_action){
+        .fa_type = _SPAWN_FA_DUP2,
+        .fa_fd = fildes,
+        .fa_newfd = newfildes,
+    };
+
+    return 0;
+}
+
+int posix_spawn_file_actions_addopen(
+        posix_spawn_file_actions_t * restrict file_actions, int fildes,
+        const char * restrict path, int oflag, mode_t mode)
+{
+    struct _spawn_file_action * fa;
+    char * fa_path;
+
+    if (fildes < 0)
+        return EBADF;
+
+    fa_path = strdup(path);
+    if (!fa_path)
+        return ENOMEM;
+
+    fa = fa_new(file_actions);
+    if (!fa) {
+        free(fa_path);
+        return ENOMEM;
+    }
+
+    *fa = (struct _spawn_file_action){
+        .fa_type = _SPAWN_FA_OPEN,
+        .fa_fd = fildes,
+        .fa_oflag = oflag,
+        .fa_mode = mode,
+        .fa_path = fa_path,
+    };
+
+    return 0;
+}
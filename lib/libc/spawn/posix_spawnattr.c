@@ -0,0 +1,119 @@
+/**
+ *******************************************************************************
+ * @file    posix_spawnattr.c
+ * @author  Olli Vanhoja
+ * @brief   Spawn attributes.
+ * @section LICENSE
+ * Copyright (c) 2020 Olli Vanhoja <olli.vanhoja@alumni.helsinki.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************
+ */
+
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+
+int posix_spawnattr_init(posix_spawnattr_t * attr)
+{
+    *attr = (posix_spawnattr_t){
+        .sa_flags = 0,
+        .sa_pgroup = 0,
+    };
+    sigemptyset(&attr->sa_sigmask);
+    sigemptyset(&attr->sa_sigdefault);
+
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t * attr)
+{
+    return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t * restrict attr,
+                             short * restrict flags)
+{
+    *flags = attr->sa_flags;
+
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t * attr, short flags)
+{
+    if (flags & ~(POSIX_SPAWN_RESETIDS | POSIX_SPAWN_SETPGROUP |
+                  POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK))
+        return EINVAL;
+
+    attr->sa_flags = flags;
+
+    return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t * restrict attr,
+                              pid_t * restrict pgroup)
+{
+    *pgroup = attr->sa_pgroup;
+
+    return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t * attr, pid_t pgroup)
+{
+    attr->sa_pgroup = pgroup;
+
+    return 0;
+}
+
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t * restrict attr,
+                                  sigset_t * restrict sigdefault)
+{
+    *sigdefault = attr->sa_sigdefault;
+
+    return 0;
+}
+
+int posix_spawnattr_setsigdefault(posix_spawnattr_t * restrict attr,
+                                  const sigset_t * restrict sigdefault)
+{
+    attr->sa_sigdefault = *sigdefault;
+
+    return 0;
+}
+
+int posix_spawnattr_getsigmask(const posix_spawnattr_t * restrict attr,
+                               sigset_t * restrict sigmask)
+{
+    *sigmask = attr->sa_sigmask;
+
+    return 0;
+}
+
+int posix_spawnattr_setsigmask(posix_spawnattr_t * restrict attr,
+                               const sigset_t * restrict sigmask)
+{
+    attr->sa_sigmask = *sigmask;
+
+    return 0;
+}
@@ -8,17 +8,23 @@
 #include <errno.h>
 #include <paths.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+extern char ** environ;
+
 int system(const char * cmd)
 {
     int stat;
     pid_t pid;
     struct sigaction sa, savintr, savequit;
     sigset_t saveblock;
+    posix_spawnattr_t attr;
+    char * argv[] = { "sh", "-c", (char *)cmd, NULL };
+    int err;
 
     if (!cmd)
         return 1;
@@ -33,16 +39,26 @@ int system(const char * cmd)
     sigaddset(&sa.sa_mask, SIGCHLD);
     sigprocmask(SIG_BLOCK, &sa.sa_mask, &saveblock);
 
-    if ((pid = fork()) == 0) {
-        sigaction(SIGINT, &savintr, (struct sigaction *)0);
-        sigaction(SIGQUIT, &savequit, (struct sigaction *)0);
-        sigprocmask(SIG_SETMASK, &saveblock, (sigset_t *)0);
-        execl(_PATH_BSHELL, "sh", "-c", cmd, (char *)0);
+    /*
+     * The child gets the original signal mask and default actions for the
+     * signals ignored here without forking the address space of the caller.
+     */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sa.sa_mask);
+    if (savintr.sa_handler != SIG_IGN)
+        sigaddset(&sa.sa_mask, SIGINT);
+    if (savequit.sa_handler != SIG_IGN)
+        sigaddset(&sa.sa_mask, SIGQUIT);
+    posix_spawnattr_setsigdefault(&attr, &sa.sa_mask);
+    posix_spawnattr_setsigmask(&attr, &saveblock);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
 
-        _exit(127);
-    }
-    if (pid == -1) {
-        stat = -1; /* errno comes from fork() */
+    err = posix_spawn(&pid, _PATH_BSHELL, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (err) {
+        errno = err;
+        stat = -1;
     } else {
         while (waitpid(pid, &stat, 0) == -1) {
             if (errno != EINTR) {
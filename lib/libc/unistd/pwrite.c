@@ -32,23 +32,19 @@
  *******************************************************************************
 */
 
-#include <fcntl.h>
+#define __SYSCALL_DEFS__
 #include <sys/types.h>
 #include <unistd.h>
+#include <syscall.h>
 
 ssize_t pwrite(int fildes, const void * buf, size_t nbytes, off_t offset)
 {
-    off_t old;
-    ssize_t retval;
+    struct _fs_preadwrite_args args = {
+        .fildes = fildes,
+        .buf = (void *)buf,
+        .nbytes = nbytes,
+        .offset = offset,
+    };
 
-    if ((old = lseek(fildes, offset, SEEK_SET)) == -1)
-        return -1;
-
-    if ((retval = write(fildes, buf, nbytes)) == -1)
-        return -1;
-
-    if (lseek(fildes, old, SEEK_SET) == -1)
-        return -1;
-
-    return retval;
+    return (ssize_t)syscall(SYSCALL_FS_PWRITE, &args);
 }
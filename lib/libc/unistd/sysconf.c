@@ -218,7 +218,7 @@ long sysconf(int name)
         value = _POSIX_SHELL;
         break;
     case _SC_SPAWN:
-        /* RFE Probably won't be supported */
+        value = _POSIX_SPAWN;
         break;
     case _SC_SPIN_LOCKS:
         /* TODO _SC_SPIN_LOCKS */
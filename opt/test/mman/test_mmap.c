@@ -99,12 +99,32 @@ static char * test_mmap_anon_huge(void)
     return NULL;
 }
 
+static char * test_mmap_anon_hint_huge(void)
+{
+    const size_t size = 3 * 65536 + 4096;
+    errno = 0;
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_HUGE,
+                -1, 0);
+
+    pu_assert("a new memory region returned", data != MAP_FAILED);
+    pu_assert_equal("No errno was set", errno, 0);
+
+    memset(data, 0xff, size);
+    pu_assert("memory is accessible", data[size - 1] == 0xff);
+
+    pu_assert_equal("unmapped with the requested size", munmap(data, size), 0);
+    data = NULL;
+
+    return NULL;
+}
+
 static void all_tests()
 {
     pu_def_test(test_mmap_anon, PU_RUN);
     pu_def_test(test_mmap_anon_fixed, PU_RUN);
     pu_def_test(test_mmap_file, PU_RUN);
     pu_def_test(test_mmap_anon_huge, PU_RUN);
+    pu_def_test(test_mmap_anon_hint_huge, PU_RUN);
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include "punit.h"
+
+static void setup(void)
+{
+}
+
+static void teardown(void)
+{
+}
+
+static int64_t ts2usec(const struct timespec * ts)
+{
+    return (int64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static int64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2usec(&ts);
+}
+
+static char * test_nanosleep_short(void)
+{
+    const struct timespec rqtp = { .tv_sec = 0, .tv_nsec = 500000 };
+    int64_t start, elapsed;
+
+    start = now_usec();
+    pu_assert_equal("nanosleep() ok", nanosleep(&rqtp, NULL), 0);
+    elapsed = now_usec() - start;
+
+    pu_assert("Slept at least the requested time", elapsed >= 500);
+    pu_assert("Sleep wasn't rounded up to the tick", elapsed < 10000);
+
+    return NULL;
+}
+
+static char * test_clock_nanosleep_abstime(void)
+{
+    struct timespec deadline;
+    int64_t end;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pu_assert_equal("clock_nanosleep() ok",
+                    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                    &deadline, NULL), 0);
+    end = now_usec();
+    pu_assert("Deadline reached", end >= ts2usec(&deadline));
+
+    pu_assert_equal("Passed deadline returns immediately",
+                    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                    &deadline, NULL), 0);
+
+    return NULL;
+}
+
+static char * test_clock_nanosleep_einval(void)
+{
+    const struct timespec inval = { .tv_sec = 0, .tv_nsec = 1000000000 };
+    const struct timespec rqtp = { .tv_sec = 0, .tv_nsec = 1000 };
+
+    pu_assert_equal("Invalid nsec",
+                    clock_nanosleep(CLOCK_MONOTONIC, 0, &inval, NULL), EINVAL);
+    pu_assert_equal("Invalid clock",
+                    clock_nanosleep(CLOCK_THREAD_CPUTIME_ID, 0, &rqtp, NULL),
+                    EINVAL);
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    pu_def_test(test_nanosleep_short, PU_RUN);
+    pu_def_test(test_clock_nanosleep_abstime, PU_RUN);
+    pu_def_test(test_clock_nanosleep_einval, PU_RUN);
+}
+
+int main(int argc, char **argv)
+{
+    return pu_run_tests(&all_tests);
+}
@@ -0,0 +1 @@
+TEST-SRC += test_nanosleep.c
@@ -1,3 +1,6 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,6 +10,7 @@
 #include "punit.h"
 
 static int fd[2];
+static int fd2[2];
 
 static void setup(void)
 {
@@ -22,6 +26,12 @@ static void teardown(void)
     if (fd[1] > 0)
         close(fd[1]);
     fd[1] = 0;
+
+    for (int i = 0; i < 2; i++) {
+        if (fd2[i] > 0)
+            close(fd2[i]);
+        fd2[i] = 0;
+    }
 }
 
 static char * test_simple(void)
@@ -115,12 +125,162 @@ static char * test_pipe_after_fork(void)
     return NULL;
 }
 
+static char * test_nonblock(void)
+{
+    char str[] = "testing";
+
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+    pu_assert_equal("O_NONBLOCK set", fcntl(fd[0], F_SETFL, O_NONBLOCK), 0);
+
+    errno = 0;
+    pu_assert_equal("Read from an empty pipe fails",
+                    read(fd[0], str, sizeof(str)), -1);
+    pu_assert_equal("errno is EAGAIN", errno, EAGAIN);
+
+    return NULL;
+}
+
+static char * test_setpipe_sz(void)
+{
+    static char buf[2 * 4096];
+    int size;
+
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+    pu_assert("Pipe has a capacity", fcntl(fd[0], F_GETPIPE_SZ) > 0);
+
+    size = fcntl(fd[1], F_SETPIPE_SZ, (int)sizeof(buf));
+    pu_assert("Capacity was changed", size >= (int)sizeof(buf));
+    pu_assert_equal("F_GETPIPE_SZ returns the new capacity",
+                    fcntl(fd[0], F_GETPIPE_SZ), size);
+
+    memset(buf, 'a', sizeof(buf));
+    pu_assert_equal("Whole buffer is written without blocking",
+                    write(fd[1], buf, sizeof(buf)), sizeof(buf));
+    pu_assert_equal("Whole buffer is read",
+                    read(fd[0], buf, sizeof(buf)), sizeof(buf));
+
+    return NULL;
+}
+
+static char * test_atomic_write(void)
+{
+    static char buf[PIPE_BUF];
+    int size;
+
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+    pu_assert_equal("O_NONBLOCK set", fcntl(fd[1], F_SETFL, O_NONBLOCK), 0);
+    size = fcntl(fd[1], F_GETPIPE_SZ);
+
+    /* Fill the pipe so that less than PIPE_BUF bytes are left. */
+    memset(buf, 'a', sizeof(buf));
+    for (int left = size - sizeof(buf) / 2; left > 0;) {
+        const int chunk = sizeof(buf) / 2;
+        ssize_t n = write(fd[1], buf, (left < chunk) ? left : chunk);
+
+        pu_assert("write() ok", n > 0);
+        left -= n;
+    }
+
+    errno = 0;
+    pu_assert_equal("PIPE_BUF write is not split",
+                    write(fd[1], buf, sizeof(buf)), -1);
+    pu_assert_equal("errno is EAGAIN", errno, EAGAIN);
+
+    return NULL;
+}
+
+static char * test_splice_file(void)
+{
+    char expected[16];
+    char str[16];
+    off_t off = 4;
+    int file;
+
+    file = open("/root/README.markdown", O_RDONLY);
+    pu_assert("file opened", file >= 0);
+    pu_assert_equal("pread() ok", pread(file, expected, sizeof(expected), 4),
+                    sizeof(expected));
+
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+    pu_assert_equal("splice() from file to pipe",
+                    splice(file, &off, fd[1], NULL, sizeof(str), 0),
+                    sizeof(str));
+    pu_assert_equal("offset was updated", off, 4 + sizeof(str));
+    pu_assert_equal("file offset was not changed",
+                    lseek(file, 0, SEEK_CUR), 0);
+    close(file);
+
+    pu_assert_equal("read() ok", read(fd[0], str, sizeof(str)), sizeof(str));
+    pu_assert("spliced data is correct",
+              memcmp(str, expected, sizeof(str)) == 0);
+
+    return NULL;
+}
+
+static char * test_splice_pipe(void)
+{
+    char str[] = "testing";
+
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+    pu_assert_equal("pipe creation ok", pipe(fd2), 0);
+
+    write(fd[1], str, sizeof(str));
+    pu_assert_equal("splice() from pipe to pipe",
+                    splice(fd[0], NULL, fd2[1], NULL, 100, 0), sizeof(str));
+
+    errno = 0;
+    pu_assert_equal("source pipe is empty",
+                    splice(fd[0], NULL, fd2[1], NULL, 100, SPLICE_F_NONBLOCK),
+                    -1);
+    pu_assert_equal("errno is EAGAIN", errno, EAGAIN);
+
+    memset(str, '\0', sizeof(str));
+    pu_assert_equal("read() ok", read(fd2[0], str, sizeof(str)), sizeof(str));
+    pu_assert_str_equal("read string equals written", str, "testing");
+
+    errno = 0;
+    pu_assert_equal("splice() between two files fails",
+                    splice(fd[0], NULL, fd[0], NULL, 100, 0), -1);
+    pu_assert_equal("errno is EBADF", errno, EBADF);
+
+    return NULL;
+}
+
+static char * test_tee(void)
+{
+    char str[] = "testing";
+
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+    pu_assert_equal("pipe creation ok", pipe(fd2), 0);
+
+    write(fd[1], str, sizeof(str));
+    pu_assert_equal("tee() ok", tee(fd[0], fd2[1], 100, 0), sizeof(str));
+
+    memset(str, '\0', sizeof(str));
+    pu_assert_equal("read() from source ok", read(fd[0], str, sizeof(str)),
+                    sizeof(str));
+    pu_assert_str_equal("source still has the data", str, "testing");
+
+    memset(str, '\0', sizeof(str));
+    pu_assert_equal("read() from destination ok",
+                    read(fd2[0], str, sizeof(str)), sizeof(str));
+    pu_assert_str_equal("destination has a copy", str, "testing");
+
+    return NULL;
+}
+
 static void all_tests(void)
 {
     pu_def_test(test_simple, PU_RUN);
     pu_def_test(test_eof, PU_RUN);
     pu_def_test(test_eof_remaining, PU_RUN);
     pu_def_test(test_pipe_after_fork, PU_RUN);
+    pu_def_test(test_nonblock, PU_RUN);
+    pu_def_test(test_setpipe_sz, PU_RUN);
+    pu_def_test(test_atomic_write, PU_RUN);
+    pu_def_test(test_splice_file, PU_RUN);
+    pu_def_test(test_splice_pipe, PU_RUN);
+    pu_def_test(test_tee, PU_RUN);
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "punit.h"
+
+#define TESTFILE "/tmp/test_rw.tmp"
+
+static int fd;
+static int pfd[2];
+
+static void setup(void)
+{
+    fd = open(TESTFILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+}
+
+static void teardown(void)
+{
+    if (fd >= 0) {
+        close(fd);
+        unlink(TESTFILE);
+    }
+
+    if (pfd[0] > 0)
+        close(pfd[0]);
+    if (pfd[1] > 0)
+        close(pfd[1]);
+    pfd[0] = 0;
+    pfd[1] = 0;
+}
+
+static char * test_pread_pwrite(void)
+{
+    char str[8];
+
+    pu_assert("file opened", fd >= 0);
+
+    pu_assert_equal("write() ok", write(fd, "0123456789", 10), 10);
+    pu_assert_equal("pwrite() ok", pwrite(fd, "ab", 2, 4), 2);
+    pu_assert_equal("file offset not changed", lseek(fd, 0, SEEK_CUR), 10);
+
+    memset(str, '\0', sizeof(str));
+    pu_assert_equal("pread() ok", pread(fd, str, 4, 3), 4);
+    pu_assert_str_equal("pread() sees pwrite()", str, "3ab6");
+    pu_assert_equal("file offset not changed", lseek(fd, 0, SEEK_CUR), 10);
+
+    pu_assert_equal("pipe creation ok", pipe(pfd), 0);
+    errno = 0;
+    pu_assert_equal("pread() from a pipe fails", pread(pfd[0], str, 1, 0), -1);
+    pu_assert_equal("errno is ESPIPE", errno, ESPIPE);
+
+    return NULL;
+}
+
+static char * test_readv_writev(void)
+{
+    static char big[2 * PIPE_BUF];
+    char a[4], b[7];
+    struct iovec wiov[] = {
+        { .iov_base = "abc", .iov_len = 3 },
+        { .iov_base = "defghij", .iov_len = 7 },
+        { .iov_base = big, .iov_len = sizeof(big) },
+    };
+    struct iovec riov[] = {
+        { .iov_base = a, .iov_len = sizeof(a) },
+        { .iov_base = b, .iov_len = sizeof(b) },
+    };
+
+    pu_assert("file opened", fd >= 0);
+
+    memset(big, 'x', sizeof(big));
+    pu_assert_equal("writev() ok", writev(fd, wiov, 3),
+                    10 + sizeof(big));
+    pu_assert_equal("offset was updated", lseek(fd, 0, SEEK_CUR),
+                    10 + sizeof(big));
+
+    lseek(fd, 0, SEEK_SET);
+    pu_assert_equal("readv() ok", readv(fd, riov, 2), sizeof(a) + sizeof(b));
+    pu_assert("first buffer is correct", memcmp(a, "abcd", 4) == 0);
+    pu_assert("second buffer is correct", memcmp(b, "efghijx", 7) == 0);
+
+    errno = 0;
+    pu_assert_equal("Too many iovecs", writev(fd, wiov, IOV_MAX + 1), -1);
+    pu_assert_equal("errno is EINVAL", errno, EINVAL);
+
+    return NULL;
+}
+
+static char * test_writev_pipe(void)
+{
+    char str[11];
+    struct iovec iov[] = {
+        { .iov_base = "hello ", .iov_len = 6 },
+        { .iov_base = "pipe", .iov_len = 5 },
+    };
+
+    pu_assert_equal("pipe creation ok", pipe(pfd), 0);
+    pu_assert_equal("writev() ok", writev(pfd[1], iov, 2), 11);
+    pu_assert_equal("Data is read with a single read()",
+                    read(pfd[0], str, sizeof(str)), sizeof(str));
+    pu_assert_str_equal("Data is correct", str, "hello pipe");
+
+    return NULL;
+}
+
+static void all_tests(void)
+{
+    pu_def_test(test_pread_pwrite, PU_RUN);
+    pu_def_test(test_readv_writev, PU_RUN);
+    pu_def_test(test_writev_pipe, PU_RUN);
+}
+
+int main(int argc, char **argv)
+{
+    return pu_run_tests(&all_tests);
+}
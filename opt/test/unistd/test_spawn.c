@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "punit.h"
+
+extern char ** environ;
+
+static int fd[2];
+static volatile int vfork_shared;
+
+static void setup(void)
+{
+    fd[0] = -1;
+    fd[1] = -1;
+}
+
+static void teardown(void)
+{
+    for (int i = 0; i < 2; i++) {
+        if (fd[i] >= 0)
+            close(fd[i]);
+        fd[i] = -1;
+    }
+}
+
+static char * test_vfork_exit(void)
+{
+    pid_t pid;
+    int status;
+
+    pid = vfork();
+    pu_assert("vfork created", pid != -1);
+    if (pid == 0)
+        _exit(3);
+
+    pu_assert_equal("waited the child", waitpid(pid, &status, 0), pid);
+    pu_assert("Child exited", WIFEXITED(status));
+    pu_assert_equal("Exit status", WEXITSTATUS(status), 3);
+
+    return NULL;
+}
+
+static char * test_vfork_exec(void)
+{
+    char * argv[] = { "sh", "-c", "exit 4", NULL };
+    pid_t pid;
+    int status;
+
+    pid = vfork();
+    pu_assert("vfork created", pid != -1);
+    if (pid == 0) {
+        execve("/bin/sh", argv, environ);
+        _exit(127);
+    }
+
+    pu_assert_equal("waited the child", waitpid(pid, &status, 0), pid);
+    pu_assert("Child exited", WIFEXITED(status));
+    pu_assert_equal("Exit status of the new image", WEXITSTATUS(status), 4);
+
+    return NULL;
+}
+
+static char * test_vfork_shared(void)
+{
+    pid_t pid;
+    int status;
+
+    vfork_shared = 0;
+    pid = vfork();
+    pu_assert("vfork created", pid != -1);
+    if (pid == 0) {
+        vfork_shared = 42;
+        _exit(0);
+    }
+
+    pu_assert_equal("Parent sees the write of the child", vfork_shared, 42);
+    pu_assert_equal("waited the child", waitpid(pid, &status, 0), pid);
+    pu_assert("Child exited", WIFEXITED(status));
+
+    return NULL;
+}
+
+static char * test_spawn_exit(void)
+{
+    char * argv[] = { "sh", "-c", "exit 2", NULL };
+    pid_t pid = -1;
+    int status;
+
+    pu_assert_equal("spawned", posix_spawn(&pid, "/bin/sh", NULL, NULL,
+                                           argv, environ), 0);
+    pu_assert("pid set", pid > 0);
+    pu_assert_equal("waited the child", waitpid(pid, &status, 0), pid);
+    pu_assert("Child exited", WIFEXITED(status));
+    pu_assert_equal("Exit status", WEXITSTATUS(status), 2);
+
+    return NULL;
+}
+
+static char * test_spawn_noent(void)
+{
+    char * argv[] = { "nonexistent", NULL };
+    pid_t pid;
+
+    pu_assert_equal("ENOENT", posix_spawn(&pid, "/nonexistent", NULL, NULL,
+                                          argv, environ), ENOENT);
+
+    return NULL;
+}
+
+static char * test_spawn_dup2(void)
+{
+    char * argv[] = { "echo", "spawned", NULL };
+    posix_spawn_file_actions_t fa;
+    char str[20];
+    pid_t pid;
+    int status;
+
+    memset(str, '\0', sizeof(str));
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&fa, fd[0]);
+    posix_spawn_file_actions_addclose(&fa, fd[1]);
+    pu_assert_equal("spawned", posix_spawnp(&pid, "echo", &fa, NULL,
+                                            argv, environ), 0);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fd[1]);
+    fd[1] = -1;
+
+    pu_assert_equal("waited the child", waitpid(pid, &status, 0), pid);
+    pu_assert("read() ok", read(fd[0], str, sizeof(str) - 1) > 0);
+    pu_assert_str_equal("Output of the child", str, "spawned\n");
+
+    return NULL;
+}
+
+static char * test_spawn_open_order(void)
+{
+    char * argv[] = { "echo", "spawned", NULL };
+    posix_spawn_file_actions_t fa;
+    char str[20];
+    pid_t pid;
+    int status;
+    int tmpfd;
+
+    memset(str, '\0', sizeof(str));
+    pu_assert_equal("pipe creation ok", pipe(fd), 0);
+
+    /* The lowest free descriptor of the parent. */
+    tmpfd = dup(fd[0]);
+    pu_assert("dup() ok", tmpfd >= 0);
+    close(tmpfd);
+
+    /*
+     * The open action must be executed between the dup2 actions, so it can't
+     * use tmpfd of the parent even though it's free there.
+     */
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fd[1], tmpfd);
+    posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, tmpfd, STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&fa, tmpfd);
+    posix_spawn_file_actions_addclose(&fa, fd[0]);
+    posix_spawn_file_actions_addclose(&fa, fd[1]);
+    pu_assert_equal("spawned", posix_spawnp(&pid, "echo", &fa, NULL,
+                                            argv, environ), 0);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fd[1]);
+    fd[1] = -1;
+
+    pu_assert_equal("waited the child", waitpid(pid, &status, 0), pid);
+    pu_assert("read() ok", read(fd[0], str, sizeof(str) - 1) > 0);
+    pu_assert_str_equal("Output of the child", str, "spawned\n");
+
+    return NULL;
+}
+
+static void all_tests()
+{
+    pu_def_test(test_vfork_exit, PU_RUN);
+    pu_def_test(test_vfork_exec, PU_RUN);
+    pu_def_test(test_vfork_shared, PU_RUN);
+    pu_def_test(test_spawn_exit, PU_RUN);
+    pu_def_test(test_spawn_noent, PU_RUN);
+    pu_def_test(test_spawn_dup2, PU_RUN);
+    pu_def_test(test_spawn_open_order, PU_RUN);
+}
+
+int main(int argc, char **argv)
+{
+    return pu_run_tests(&all_tests);
+}